@@ -111,6 +111,7 @@ cd $TRAVIS_BUILD_DIR/python-package && python setup.py install --precompile || e
 pytest $TRAVIS_BUILD_DIR || exit -1
 
 if [[ $TASK == "regular" ]]; then
+    cd $TRAVIS_BUILD_DIR/build && cmake -DBUILD_CPP_TEST=ON .. && make test_predict && ctest --output-on-failure || exit -1
     cd $TRAVIS_BUILD_DIR/examples/python-guide
     sed -i'.bak' '/import lightgbm as lgb/a\
 import matplotlib\
@@ -93,6 +93,7 @@ cd ${BUILD_REPOSITORY_LOCALPATH}/python-package && python setup.py install --pre
 pytest ${BUILD_REPOSITORY_LOCALPATH} || exit -1
 
 if [[ $TASK == "regular" ]]; then
+    cd ${BUILD_REPOSITORY_LOCALPATH}/build && cmake -DBUILD_CPP_TEST=ON .. && make test_predict && ctest --output-on-failure || exit -1
     if [[ $AGENT_OS == "Darwin" ]]; then
         cp ${BUILD_REPOSITORY_LOCALPATH}/lib_lightgbm.so ${BUILD_ARTIFACTSTAGINGDIRECTORY}/lib_lightgbm.dylib
     else
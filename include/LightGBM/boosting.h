@@ -17,6 +17,18 @@ class ObjectiveFunction;
 class Metric;
 struct PredictionEarlyStopInstance;
 
+/*!
+* \brief How Boosting::PredictContrib attributes the prediction to the features
+*/
+enum ContribMethod {
+  /*! \brief SHAP values from the path-dependent TreeSHAP */
+  kContribTreeSHAP,
+  /*! \brief Saabas, the change of the node value at every split of the decision path goes to the split feature */
+  kContribSaabas,
+  /*! \brief SHAP values from the interventional TreeSHAP against the background, see GBDTBase::SetContribBackground */
+  kContribInterventional
+};
+
 /*!
 * \brief The interface for Boosting
 */
@@ -71,6 +83,50 @@ public:
   virtual void PredictLeafIndexByMap(
     const std::unordered_map<int, double>& features, double* output) const = 0;
 
+  /*!
+  * \brief Same as PredictLeafIndex with integer leaf indices
+  */
+  virtual void PredictLeafIndex(const double* features, int32_t* output) const = 0;
+
+  /*!
+  * \brief Prediction for one record, only the trees of some classes are evaluated.
+  *        Early stopping is not applied.
+  * \param features Feature value on this record
+  * \param classes Classes to predict
+  * \param normalize True to apply softmax over the classes, false for their raw scores
+  * \param output Prediction result for this record, one value per class in the order of classes
+  */
+  virtual void PredictClasses(const double* features, const std::vector<int>& classes, bool normalize,
+                              double* output) const = 0;
+
+  /*!
+  * \brief Predictions for one record at several numbers of iterations, every tree is evaluated once.
+  *        Early stopping is not applied.
+  * \param features Feature value on this record
+  * \param checkpoints Numbers of iterations in increasing order, the last one at most the iterations of InitPredict
+  * \param is_raw_score True for the raw scores, false to transform them as Predict does
+  * \param output For every checkpoint the prediction of the record with its number of iterations
+  */
+  virtual void PredictStaged(const double* features, const std::vector<int>& checkpoints, bool is_raw_score,
+                             double* output) const = 0;
+
+  /*!
+  * \brief Feature contributions for one record with the method given to InitPredict
+  * \param features Feature value on this record
+  * \param output Contributions, for every class one value per feature and the expected value last
+  */
+  virtual void PredictContrib(const double* features, double* output) const = 0;
+
+  /*!
+  * \brief Feature contributions for one record as PredictContrib computes them, without the zeros
+  * \param features Feature value on this record
+  * \param top_k Only keep the top_k features with the largest absolute contributions, 0 keeps all of them
+  * \param output For every class the features and their contributions by feature index,
+  *               the expected value is always last with index MaxFeatureIdx() + 1
+  */
+  virtual void PredictContribSparse(const double* features, int top_k,
+                                    std::vector<std::vector<std::pair<int, double>>>* output) const = 0;
+
   /*!
   * \brief Restore from a serialized string
   * \param buffer The content of model
@@ -79,12 +135,41 @@ public:
   */
   virtual bool LoadModelFromString(const char* buffer, size_t len) = 0;
 
+  /*!
+  * \brief Restore from a serialized packed model
+  * \param buffer The packed model
+  * \param len The length of buffer
+  * \param copy True to copy the buffer, otherwise the buffer should outlive this object
+  * \return true if succeeded
+  */
+  virtual bool LoadModelFromPacked(const char* buffer, size_t len, bool copy) = 0;
+
+  /*!
+  * \brief Get the serialized packed model
+  * \param out_len The length of packed model
+  * \return The packed model, nullptr if the model is not packed
+  */
+  virtual const char* PackedModel(size_t* out_len) const = 0;
+
   /*!
   * \brief Get max feature index of this model
   * \return Max feature index of this model
   */
   virtual int MaxFeatureIdx() const = 0;
 
+  /*!
+  * \brief Get the features the trees split on
+  * \return Feature indices in increasing order
+  */
+  virtual const std::vector<int>& UsedFeatures() const = 0;
+
+  /*!
+  * \brief Get the number of feature values Predict and PredictRaw take.
+  *        When it is less than MaxFeatureIdx() + 1, the values are those of UsedFeatures() in that order
+  * \return Number of feature values of one record
+  */
+  virtual int NumPredictFeatures() const = 0;
+
   /*!
   * \brief Get feature names of this model
   * \return Feature names of this model
@@ -115,6 +200,12 @@ public:
   */
   virtual int NumberOfClasses() const = 0;
 
+  /*!
+  * \brief Get the name of the objective of the model
+  * \return Name of the objective, empty if the model has none
+  */
+  virtual const char* ObjectiveName() const = 0;
+
   /*! \brief The prediction should be accurate or not. True will disable early stopping for prediction. */
   virtual bool NeedAccuratePrediction() const = 0;
 
@@ -122,8 +213,9 @@ public:
   * \brief Initial work for the prediction
   * \param num_iteration number of used iteration
   * \param is_pred_contrib
+  * \param contrib_method How PredictContrib attributes the prediction, used with is_pred_contrib
   */
-  virtual void InitPredict(int num_iteration, bool is_pred_contrib) = 0;
+  virtual void InitPredict(int num_iteration, bool is_pred_contrib, ContribMethod contrib_method = kContribTreeSHAP) = 0;
 
   /*!
   * \brief Name of submodel
@@ -154,6 +246,138 @@ class GBDTBase : public Boosting {
 public:
   virtual double GetLeafValue(int tree_idx, int leaf_idx) const = 0;
   virtual void SetLeafValue(int tree_idx, int leaf_idx, double val) = 0;
+
+  /*!
+  * \brief Offsets of the leaves of the trees used for prediction when the leaves of all trees are numbered
+  *        one after the other, e.g. the columns of a one-hot encoding of the leaf indices, see InitPredict
+  * \return Offset of every tree and the total number of leaves last
+  */
+  virtual std::vector<int32_t> LeafOffsets() const = 0;
+
+  /*!
+  * \brief Hash of the first trees of the model, the same for a model and the models it grows into
+  * \param num_trees Number of trees to hash, at most NumberOfTotalModel()
+  */
+  virtual uint64_t LineageHash(int num_trees) const = 0;
+
+  /*!
+  * \brief False if LineageHash cannot hash the trees,
+  *        i.e. the trees are only in a packed model that was packed without their hashes
+  */
+  virtual bool HasLineageHash() const = 0;
+
+  /*!
+  * \brief Delta that turns a model made of the first trees of this model into this model, see ApplyModelDelta.
+  *        The delta has the header of this model and the trees after the first ones.
+  * \param buffer The content of this model, as it was loaded
+  * \param len The length of buffer
+  * \param base_num_trees Number of first trees the model the delta applies to shares with this model
+  * \return The delta, as text
+  */
+  virtual std::string ModelDelta(const char* buffer, size_t len, int base_num_trees) const = 0;
+
+  /*!
+  * \brief Keep the first trees of this model, drop the others and append the trees of a delta made by ModelDelta.
+  *        Fatal if the kept trees are not those the delta was made for, see LineageHash.
+  * \param buffer The delta
+  * \param len The length of buffer
+  */
+  virtual void ApplyModelDelta(const char* buffer, size_t len) = 0;
+
+  /*!
+  * \brief Add the outputs of some trees to raw scores, in the order of summation of PredictRaw.
+  *        Going on from the raw scores of the trees before first_tree gives the same raw scores as PredictRaw.
+  * \param features Feature values, as Predict takes them
+  * \param first_tree First tree to add
+  * \param end_tree End of the trees to add, at most NumberOfTotalModel()
+  * \param raw_score Raw score of every class, updated in place
+  */
+  virtual void AddTreesToRawScore(const double* features, int first_tree, int end_tree, double* raw_score) const = 0;
+
+  /*!
+  * \brief Transform raw scores as Predict does
+  * \param raw_score Raw score of every class
+  * \param num_iteration Iterations the raw scores add up
+  * \param output Prediction, can be raw_score
+  */
+  virtual void ConvertRawScore(const double* raw_score, int num_iteration, double* output) const = 0;
+
+  /*!
+  * \brief Transform in place consecutive rows of raw scores from PredictRaw, as Predict does
+  * \param scores Raw scores of every row and class
+  * \param num_rows Number of rows
+  * \param fast_exp True to allow PredictKernels::fast_exp, see ObjectiveFunction::ConvertOutputBatch
+  */
+  virtual void ConvertRawScores(double* scores, int num_rows, bool fast_exp) const = 0;
+
+  /*!
+  * \brief Build a quantized packed model, kept aside until accepted
+  * \param leaf_type Encoding of leaf values, PackedForest::LeafType
+  * \param threshold_type Encoding of thresholds, PackedForest::ThresholdType
+  * \param sample Rows to measure the quantized model on, every row as Predict takes it, see NumPredictFeatures
+  * \param out_max_deviation Max absolute deviation of raw scores on sample
+  * \param out_mean_deviation Mean absolute deviation of raw scores on sample
+  */
+  virtual void QuantizeModel(int leaf_type, int threshold_type, const std::vector<std::vector<double>>& sample,
+                             double* out_max_deviation, double* out_mean_deviation) = 0;
+
+  /*!
+  * \brief Predict with the quantized model from now on, or drop it
+  */
+  virtual void AcceptQuantizedModel(bool accept) = 0;
+
+  /*!
+  * \brief Time the prediction engines, block sizes and thread counts and keep the fastest for every batch size
+  * \param sample Rows to time on, every row as Predict takes it, empty for synthetic rows
+  */
+  virtual void Autotune(const std::vector<std::vector<double>>& sample) = 0;
+
+  /*!
+  * \brief Summarize the reference population of interventional SHAP values, see kContribInterventional
+  * \param background Rows of the population, every row as Predict takes it
+  */
+  virtual void SetContribBackground(const std::vector<std::vector<double>>& background) = 0;
+
+  /*!
+  * \brief Plan of every batch size, e.g. "1:packed_groups:64:8,16:packed:0:1,256:trees:0:8,max:trees:0:8"
+  *        with the bucket, the engine, the trees given to a thread at once and the threads
+  */
+  virtual std::string GetPredictPlan() const = 0;
+
+  /*!
+  * \brief Pin the plan of some batch sizes, as returned by GetPredictPlan
+  */
+  virtual void SetPredictPlan(const std::string& plan) = 0;
+
+  /*!
+  * \brief Use the plan of a batch size for the next predictions
+  * \param num_rows Rows of the batch
+  * \param out_row_parallel True if the rows should be split across the threads
+  * \return Number of threads to use
+  */
+  virtual int SelectPredictPlan(int num_rows, bool* out_row_parallel) = 0;
+
+  /*!
+  * \brief Output of every tree used for prediction on one record, see InitPredict
+  * \param features Feature values, as Predict takes them
+  * \param tree_outputs Output of every tree, resized to the number of trees
+  */
+  virtual void PredictTreeOutputs(const double* features, std::vector<double>* tree_outputs) const = 0;
+
+  /*!
+  * \brief Update the outputs of the trees that split on some features, after the values of these features changed
+  * \param features Feature values with the changes, as Predict takes them
+  * \param changed_features Changed features, as positions in features
+  * \param tree_outputs Outputs of PredictTreeOutputs, updated in place
+  * \return Number of trees evaluated
+  */
+  virtual int RepredictTreeOutputs(const double* features, const std::vector<int>& changed_features,
+                                   double* tree_outputs) const = 0;
+
+  /*!
+  * \brief Prediction of one record from the outputs of its trees, the same as Predict without early stopping
+  */
+  virtual void PredictFromTreeOutputs(const double* tree_outputs, double* output) const = 0;
 };
 
 }  // namespace LightGBM
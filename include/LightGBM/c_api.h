@@ -22,17 +22,28 @@
 
 typedef void* DatasetHandle;
 typedef void* BoosterHandle;
+typedef void* RescoreHandle;
+typedef void* ScoreCacheHandle;
+typedef void* EnsembleHandle;
 
 #define C_API_DTYPE_FLOAT32 (0)
 #define C_API_DTYPE_FLOAT64 (1)
 #define C_API_DTYPE_INT32   (2)
 #define C_API_DTYPE_INT64   (3)
+#define C_API_DTYPE_INT16   (4)
 
 #define C_API_PREDICT_NORMAL     (0)
 #define C_API_PREDICT_RAW_SCORE  (1)
 #define C_API_PREDICT_LEAF_INDEX (2)
 #define C_API_PREDICT_CONTRIB    (3)
 
+#define C_API_LEAF_FLOAT64 (0)
+#define C_API_LEAF_FLOAT16 (1)
+#define C_API_LEAF_INT8    (2)
+
+#define C_API_THRESHOLD_FLOAT64 (0)
+#define C_API_THRESHOLD_FLOAT32 (1)
+
 /*!
 * \brief get string message of the last error
 *  all function in this file will return 0 when succeed
@@ -55,6 +66,213 @@ LIGHTGBM_C_EXPORT int LGBM_BoosterLoadModelFromString(
   int* out_num_iterations,
   BoosterHandle* out);
 
+/*!
+* \brief load an existing boosting from string, with parameters that control how the model is stored
+* \param model_str model string
+* \param parameters load-time parameters, e.g. model_huge_pages
+* \param out_num_iterations number of iterations of this booster
+* \param out handle of created Booster
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterLoadModelFromStringWithParams(
+  const char* model_str,
+  const char* parameters,
+  int* out_num_iterations,
+  BoosterHandle* out);
+
+/*!
+* \brief load a booster from a packed model, only prediction is available on it
+* \param buffer packed model, as saved by LGBM_BoosterSavePackedModel
+* \param len length of buffer
+* \param out_num_iterations number of iterations of this booster
+* \param out handle of created Booster
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterLoadPackedModel(
+  const void* buffer,
+  int64_t len,
+  int* out_num_iterations,
+  BoosterHandle* out);
+
+/*!
+* \brief save the packed model of a booster loaded with pack_model=true
+* \param handle handle
+* \param buffer_len the length of out_buf
+* \param out_len actual length of packed model, out_buf is only filled when buffer_len >= out_len
+* \param out_buf buffer to receive the packed model
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterSavePackedModel(BoosterHandle handle,
+                                                  int64_t buffer_len,
+                                                  int64_t* out_len,
+                                                  void* out_buf);
+
+/*!
+* \brief make a model delta, the header of a model and its trees after its first base_num_trees trees.
+*        The delta turns a booster whose first trees are the same, e.g. the model before some more iterations
+*        of training or the model after some more, into this model, see LGBM_BoosterApplyModelDelta.
+*        A delta with base_num_trees equal to the number of trees of the model truncates the trees after them.
+* \param model_str model string
+* \param base_num_trees number of first trees the booster shares with the model, a multiple of the number of classes
+* \param buffer_len the length of out_str
+* \param out_len actual length of the delta, with the terminating zero, out_str is only filled when buffer_len >= out_len
+* \param out_str buffer to receive the delta
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ModelDeltaCreate(const char* model_str,
+                                            int base_num_trees,
+                                            int64_t buffer_len,
+                                            int64_t* out_len,
+                                            char* out_str);
+
+/*!
+* \brief apply a model delta made by LGBM_ModelDeltaCreate: keep the first trees of the booster,
+*        drop the others, append the trees of the delta and take the header of the delta.
+*        Fails without changing the booster when its first trees are not those the delta was made for.
+*        The storage of dropped trees is only released when a whole model is loaded again.
+*        Boosters that hold only a packed model, i.e. loaded by LGBM_BoosterLoadPackedModel, with model_cache_dir
+*        or attached to a shared model, have no trees to keep and cannot apply deltas: load the new model instead.
+* \param handle handle
+* \param delta_str model delta
+* \param out_num_iterations number of iterations of this booster after the delta
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterApplyModelDelta(BoosterHandle handle,
+                                                  const char* delta_str,
+                                                  int* out_num_iterations);
+
+/*!
+* \brief get the hash of the first trees of a booster, two boosters with the same hash share these trees.
+*        Packed models store the hashes of their trees, so a booster loaded from one hashes them as well.
+* \param handle handle
+* \param num_trees number of first trees
+* \param out_hash hash of the trees
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterGetLineageHash(BoosterHandle handle,
+                                                 int num_trees,
+                                                 uint64_t* out_hash);
+
+/*!
+* \brief copy the packed model of a booster loaded with pack_model=true into a new named shared memory segment,
+*        other processes can then attach to it with LGBM_BoosterAttachSharedModel.
+*        The booster predicts from the segment afterwards and only prediction is available on it.
+*        The segment is unlinked when the last booster using it is freed. POSIX only
+* \param handle handle
+* \param name name of the segment, e.g. "/my_model", it must not exist yet
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterShareModel(BoosterHandle handle, const char* name);
+
+/*!
+* \brief create a booster on a shared memory segment made by LGBM_BoosterShareModel,
+*        the trees are mapped read-only and neither parsed nor copied. Only prediction is available on it
+* \param name name of the segment
+* \param out_num_iterations number of iterations of this booster
+* \param out handle of created Booster
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterAttachSharedModel(
+  const char* name,
+  int* out_num_iterations,
+  BoosterHandle* out);
+
+/*!
+* \brief build a quantized packed model and measure it on a sample,
+*        the booster keeps predicting with its current model until LGBM_BoosterAcceptQuantizedModel is called
+* \param handle handle
+* \param leaf_type encoding of leaf values, C_API_LEAF_FLOAT64, C_API_LEAF_FLOAT16 or C_API_LEAF_INT8,
+*                  quantized leaf values are scaled per tree
+* \param threshold_type encoding of thresholds, C_API_THRESHOLD_FLOAT64 or C_API_THRESHOLD_FLOAT32
+* \param data pointer to the sample
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param out_max_abs_deviation max absolute difference of raw scores between the model and the quantized model
+* \param out_mean_abs_deviation mean absolute difference of raw scores between the model and the quantized model
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterQuantizeModel(BoosterHandle handle,
+                                                int leaf_type,
+                                                int threshold_type,
+                                                const void* data,
+                                                int data_type,
+                                                int32_t nrow,
+                                                int32_t ncol,
+                                                int is_row_major,
+                                                double* out_max_abs_deviation,
+                                                double* out_mean_abs_deviation);
+
+/*!
+* \brief accept or reject the model built by LGBM_BoosterQuantizeModel
+* \param handle handle
+* \param accept 1 to predict with the quantized model from now on, 0 to drop it
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterAcceptQuantizedModel(BoosterHandle handle, int accept);
+
+/*!
+* \brief time the prediction engines, block sizes and thread counts of a booster on a sample
+*        and predict every batch size with the fastest from now on, see LGBM_BoosterGetPredictPlan.
+*        Loading with autotune=true does the same on synthetic rows, as does an empty sample
+* \param handle handle
+* \param data pointer to the sample, rows like the ones to predict
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterAutotune(BoosterHandle handle,
+                                           const void* data,
+                                           int data_type,
+                                           int32_t nrow,
+                                           int32_t ncol,
+                                           int is_row_major);
+
+/*!
+* \brief set the reference population of interventional SHAP values (contrib_method=interventional).
+*        The rows are summarized into every tree once, they are not kept
+* \param handle handle
+* \param data pointer to the rows of the population
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterSetContribBackground(BoosterHandle handle,
+                                                       const void* data,
+                                                       int data_type,
+                                                       int32_t nrow,
+                                                       int32_t ncol,
+                                                       int is_row_major);
+
+/*!
+* \brief get how a booster predicts every batch size, e.g. "1:packed_groups:64:8,16:packed:0:8,256:trees:0:8,max:trees:0:8".
+*        Every batch size bucket (1, 16, 256 or max rows) has an engine (trees, packed, packed_groups or compiled),
+*        the trees given to a thread at once when the rows cannot keep the threads busy (0 to never split the trees)
+*        and the number of threads
+* \param handle handle
+* \param buffer_len the length of out_str
+* \param out_len actual length of the plan, with the terminating zero, out_str is only filled when buffer_len >= out_len
+* \param out_str buffer to receive the plan
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterGetPredictPlan(BoosterHandle handle,
+                                                 int64_t buffer_len,
+                                                 int64_t* out_len,
+                                                 char* out_str);
+
+/*!
+* \brief pin how a booster predicts some batch sizes, the same as loading with predict_plan
+* \param handle handle
+* \param plan plan of one or more batch sizes, in the format of LGBM_BoosterGetPredictPlan
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterSetPredictPlan(BoosterHandle handle, const char* plan);
+
 /*!
 * \brief free obj in handle
 * \param handle handle to be freed
@@ -77,11 +295,26 @@ LIGHTGBM_C_EXPORT int LGBM_BoosterGetNumClasses(BoosterHandle handle, int* out_l
 */
 LIGHTGBM_C_EXPORT int LGBM_BoosterGetNumFeature(BoosterHandle handle, int* out_len);
 
+/*!
+* \brief Get the features the trees split on, the other features do not change predictions
+*        and PredictForMat does not read their columns
+* \param handle handle
+* \param buffer_len number of features out_features can hold
+* \param out_len number of used features, out_features is only filled when buffer_len >= out_len
+* \param out_features used feature indices, in increasing order
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterGetUsedFeatures(BoosterHandle handle,
+                                                  int buffer_len,
+                                                  int* out_len,
+                                                  int* out_features);
+
 /*!
 * \brief make prediction for an new data set
 *        Note:  should pre-allocate memory for out_result,
 *               for noraml and raw score: its length is equal to num_class * num_data
 *               for leaf index, its length is equal to num_class * num_data * num_iteration
+*               for feature contributions, its length is equal to num_class * num_data * (num_feature + 1)
 * \param handle handle
 * \param data pointer to the data space
 * \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
@@ -92,6 +325,7 @@ LIGHTGBM_C_EXPORT int LGBM_BoosterGetNumFeature(BoosterHandle handle, int* out_l
 *          C_API_PREDICT_NORMAL: normal prediction, with transform (if needed)
 *          C_API_PREDICT_RAW_SCORE: raw score
 *          C_API_PREDICT_LEAF_INDEX: leaf index
+*          C_API_PREDICT_CONTRIB: feature contributions (SHAP values), the expected value last
 * \param num_iteration number of iteration for prediction, <= 0 means no limit
 * \param parameter Other parameters for the parameters, e.g. early stopping for prediction.
 * \param out_len len of output result
@@ -110,6 +344,358 @@ LIGHTGBM_C_EXPORT int LGBM_BoosterPredictForMat(BoosterHandle handle,
                                                 int64_t* out_len,
                                                 double* out_result);
 
+/*!
+* \brief make prediction for an new data set at several numbers of iterations, walking the trees once.
+*        The predictions of a row are those of every checkpoint one after the other,
+*        the same as LGBM_BoosterPredictForMat with num_iteration set to the checkpoint.
+*        Note: should pre-allocate memory for out_result, its length is nrow * num_checkpoints * num_class
+* \param handle handle
+* \param data pointer to the data space
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param predict_type
+*          C_API_PREDICT_NORMAL: normal prediction, with transform (if needed)
+*          C_API_PREDICT_RAW_SCORE: raw score
+* \param checkpoints numbers of iterations to predict at, positive and increasing
+* \param num_checkpoints number of checkpoints
+* \param parameter Other parameters for the prediction
+* \param out_len len of output result
+* \param out_result used to set a pointer to array, should allocate memory before call this function
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterPredictStagedForMat(BoosterHandle handle,
+                                                      const void* data,
+                                                      int data_type,
+                                                      int32_t nrow,
+                                                      int32_t ncol,
+                                                      int is_row_major,
+                                                      int predict_type,
+                                                      const int32_t* checkpoints,
+                                                      int num_checkpoints,
+                                                      const char* parameter,
+                                                      int64_t* out_len,
+                                                      double* out_result);
+
+/*!
+* \brief LGBM_BoosterPredictStagedForMat at every iteration from start_iteration to end_iteration, both included
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterPredictStagedRangeForMat(BoosterHandle handle,
+                                                           const void* data,
+                                                           int data_type,
+                                                           int32_t nrow,
+                                                           int32_t ncol,
+                                                           int is_row_major,
+                                                           int predict_type,
+                                                           int start_iteration,
+                                                           int end_iteration,
+                                                           const char* parameter,
+                                                           int64_t* out_len,
+                                                           double* out_result);
+
+/*!
+* \brief create a score cache of a data set, the raw scores of its rows kept between models.
+*        The cache covers no tree until LGBM_BoosterUpdateScoreCache.
+* \param data pointer to the data space, only hashed, the same data has to be given to every update
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param out handle of the score cache
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ScoreCacheCreate(const void* data,
+                                            int data_type,
+                                            int32_t nrow,
+                                            int32_t ncol,
+                                            int is_row_major,
+                                            ScoreCacheHandle* out);
+
+/*!
+* \brief load a score cache saved by LGBM_ScoreCacheSaveToFile
+* \param filename name of the file
+* \param out handle of the score cache
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ScoreCacheCreateFromFile(const char* filename,
+                                                    ScoreCacheHandle* out);
+
+/*!
+* \brief save a score cache, an existing file is replaced
+* \param handle handle of the score cache
+* \param filename name of the file
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ScoreCacheSaveToFile(ScoreCacheHandle handle,
+                                                const char* filename);
+
+/*!
+* \brief get the number of trees the scores of a score cache add up
+* \param handle handle of the score cache
+* \param out_num_trees number of trees
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ScoreCacheGetNumTrees(ScoreCacheHandle handle,
+                                                 int* out_num_trees);
+
+/*!
+* \brief free a score cache
+* \param handle handle to be freed
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_ScoreCacheFree(ScoreCacheHandle handle);
+
+/*!
+* \brief bring a score cache up to date with the model of a booster and get the predictions of its rows.
+*        When the model grew from the model the cache was last updated with, e.g. by continued training,
+*        only the trees it gained are evaluated. Otherwise all trees are evaluated again.
+*        The predictions are the same as LGBM_BoosterPredictForMat with all iterations.
+* \param handle handle
+* \param cache_handle handle of the score cache
+* \param data pointer to the data space, the data the score cache was created with
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param predict_type
+*          C_API_PREDICT_NORMAL: normal prediction, with transform (if needed)
+*          C_API_PREDICT_RAW_SCORE: raw score
+* \param parameter Other parameters for the prediction
+* \param out_num_new_trees number of trees evaluated
+* \param out_len len of output result
+* \param out_result predictions, nrow * num_class values, can be NULL to only update the cache
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterUpdateScoreCache(BoosterHandle handle,
+                                                   ScoreCacheHandle cache_handle,
+                                                   const void* data,
+                                                   int data_type,
+                                                   int32_t nrow,
+                                                   int32_t ncol,
+                                                   int is_row_major,
+                                                   int predict_type,
+                                                   const char* parameter,
+                                                   int* out_num_new_trees,
+                                                   int64_t* out_len,
+                                                   double* out_result);
+
+/*!
+* \brief create an ensemble of boosters, predicted together on the same rows and blended.
+*        The boosters must have the same number of classes and outlive the ensemble.
+* \param boosters handles of the boosters, each at most once
+* \param num_boosters number of boosters
+* \param weights weight of every booster in the blend, NULL for the same weight 1 / num_boosters
+* \param predict_types C_API_PREDICT_NORMAL or C_API_PREDICT_RAW_SCORE for every booster, NULL for normal
+* \param num_iterations number of iteration of every booster, <= 0 means no limit, NULL for no limit
+* \param out handle of the ensemble
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_EnsembleCreate(const BoosterHandle* boosters,
+                                          int num_boosters,
+                                          const double* weights,
+                                          const int* predict_types,
+                                          const int* num_iterations,
+                                          EnsembleHandle* out);
+
+/*!
+* \brief make prediction for an new data set with every booster of an ensemble.
+*        The rows are converted once for all boosters and every booster scores a block of rows at a time.
+*        Note: should pre-allocate memory for out_result, its length is nrow * (num_boosters + 1) * num_class
+* \param handle handle of the ensemble
+* \param data pointer to the data space
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param parameter Other parameters for the prediction
+* \param out_len len of output result
+* \param out_result for every row the prediction of every booster, then their weighted sum
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_EnsemblePredictForMat(EnsembleHandle handle,
+                                                 const void* data,
+                                                 int data_type,
+                                                 int32_t nrow,
+                                                 int32_t ncol,
+                                                 int is_row_major,
+                                                 const char* parameter,
+                                                 int64_t* out_len,
+                                                 double* out_result);
+
+/*!
+* \brief free an ensemble, its boosters are not freed
+* \param handle handle to be freed
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_EnsembleFree(EnsembleHandle handle);
+
+/*!
+* \brief get number of predictions of LGBM_BoosterPredictForMat, also the length of the leaf indices
+*        of LGBM_BoosterPredictLeafIndexForMat and LGBM_BoosterPredictLeafOneHotForMat with C_API_PREDICT_LEAF_INDEX
+* \param handle handle
+* \param num_row number of rows
+* \param predict_type C_API_PREDICT_NORMAL, C_API_PREDICT_RAW_SCORE, C_API_PREDICT_LEAF_INDEX or C_API_PREDICT_CONTRIB
+* \param num_iteration number of iteration for prediction, <= 0 means no limit
+* \param out_len length of the prediction
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterCalcNumPredict(BoosterHandle handle,
+                                                 int num_row,
+                                                 int predict_type,
+                                                 int num_iteration,
+                                                 int64_t* out_len);
+
+/*!
+* \brief leaf index of every tree for an new data set as integers, num_class * num_iteration per row.
+*        Note: should pre-allocate memory for out_result, see LGBM_BoosterCalcNumPredict
+* \param handle handle
+* \param data pointer to the data space
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param num_iteration number of iteration for prediction, <= 0 means no limit
+* \param parameter Other parameters for the prediction
+* \param out_type type of out_result, C_API_DTYPE_INT32 or C_API_DTYPE_INT16 when no tree has more than 32768 leaves
+* \param out_len len of output result
+* \param out_result leaf indices
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterPredictLeafIndexForMat(BoosterHandle handle,
+                                                         const void* data,
+                                                         int data_type,
+                                                         int32_t nrow,
+                                                         int32_t ncol,
+                                                         int is_row_major,
+                                                         int num_iteration,
+                                                         const char* parameter,
+                                                         int out_type,
+                                                         int64_t* out_len,
+                                                         void* out_result);
+
+/*!
+* \brief one-hot encoding of the leaf indices for an new data set, as a CSR matrix whose values are all 1.
+*        The leaves of all trees are the columns one after the other, so that a row has one column per tree.
+*        Note: should pre-allocate memory for out_indptr (nrow + 1) and out_indices (see LGBM_BoosterCalcNumPredict)
+* \param handle handle
+* \param data pointer to the data space
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param num_iteration number of iteration for prediction, <= 0 means no limit
+* \param parameter Other parameters for the prediction
+* \param out_num_col number of columns, the leaves of all the trees
+* \param out_indptr start of every row
+* \param out_indices column of every value
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterPredictLeafOneHotForMat(BoosterHandle handle,
+                                                          const void* data,
+                                                          int data_type,
+                                                          int32_t nrow,
+                                                          int32_t ncol,
+                                                          int is_row_major,
+                                                          int num_iteration,
+                                                          const char* parameter,
+                                                          int64_t* out_num_col,
+                                                          int64_t* out_indptr,
+                                                          int32_t* out_indices);
+
+/*!
+* \brief feature contributions for an new data set without the zeros, in CSR format with one row per record and class
+*        (num_class * nrow rows, the classes of a record next to each other) and num_feature + 1 columns.
+*        Only the features with a non-zero contribution are returned, or the contrib_top_k largest in absolute value,
+*        by feature index, and the expected value last in column num_feature.
+*        The arrays are allocated here, free them with LGBM_BoosterFreeSparseContrib
+* \param handle handle
+* \param data pointer to the data space
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param nrow number of rows
+* \param ncol number columns
+* \param is_row_major 1 for row major, 0 for column major
+* \param num_iteration number of iteration for prediction, <= 0 means no limit
+* \param parameter Other parameters for the prediction, e.g. contrib_method and contrib_top_k
+* \param out_len number of values
+* \param out_indptr set to the start of every row, num_class * nrow + 1 entries
+* \param out_indices set to the column of every value
+* \param out_data set to the values
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterPredictSparseContribForMat(BoosterHandle handle,
+                                                             const void* data,
+                                                             int data_type,
+                                                             int32_t nrow,
+                                                             int32_t ncol,
+                                                             int is_row_major,
+                                                             int num_iteration,
+                                                             const char* parameter,
+                                                             int64_t* out_len,
+                                                             int64_t** out_indptr,
+                                                             int32_t** out_indices,
+                                                             double** out_data);
+
+/*!
+* \brief free the arrays of LGBM_BoosterPredictSparseContribForMat
+* \param indptr out_indptr
+* \param indices out_indices
+* \param data out_data
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterFreeSparseContrib(int64_t* indptr, int32_t* indices, double* data);
+
+/*!
+* \brief Score one record and keep the output of every tree, so that the record can be rescored
+*        after a few of its features change. Only normal prediction is supported.
+*        Once the trees of the booster change, e.g. by LGBM_BoosterApplyModelDelta, rescoring the record fails.
+* \param handle handle
+* \param data values of the record
+* \param data_type type of data pointer, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param ncol number of values
+* \param num_iteration number of iteration for prediction, <= 0 means no limit
+* \param out handle of the scored record
+* \param out_len len of output result
+* \param out_result prediction of the record, num_class values
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterRescoreInit(BoosterHandle handle,
+                                              const void* data,
+                                              int data_type,
+                                              int32_t ncol,
+                                              int num_iteration,
+                                              RescoreHandle* out,
+                                              int64_t* out_len,
+                                              double* out_result);
+
+/*!
+* \brief Change features of a record scored by LGBM_BoosterRescoreInit and score it again.
+*        Only the trees that split on a changed feature are evaluated, the result is the same as a full prediction.
+*        Fails if the trees of the booster are not those the record was scored by.
+* \param handle handle of the scored record
+* \param feature_indices indices of the changed features
+* \param values new values of the changed features
+* \param data_type type of values, can be C_API_DTYPE_FLOAT32 or C_API_DTYPE_FLOAT64
+* \param num_changed number of changed features
+* \param out_len len of output result
+* \param out_result prediction of the record, num_class values
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_BoosterRescore(RescoreHandle handle,
+                                          const int32_t* feature_indices,
+                                          const void* values,
+                                          int data_type,
+                                          int32_t num_changed,
+                                          int64_t* out_len,
+                                          double* out_result);
+
+/*!
+* \brief free a scored record
+* \param handle handle to be freed
+* \return 0 when succeed, -1 when failure happens
+*/
+LIGHTGBM_C_EXPORT int LGBM_RescoreFree(RescoreHandle handle);
+
 // exception handle and error msg
 static char* LastErrorMsg() { static THREAD_LOCAL char err_msg[512] = "Everything is fine"; return err_msg; }
 
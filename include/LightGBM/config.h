@@ -98,10 +98,22 @@ public:
     predict_raw_score(false),
     predict_leaf_index(false),
     predict_contrib(false),
+    contrib_method("tree_shap"),
+    contrib_top_k(0),
     num_iteration_predict(-1),
     pred_early_stop(false),
     pred_early_stop_freq(10),
     pred_early_stop_margin(10.0),
+    pred_normalize_classes(false),
+    pred_fast_transform(false),
+    model_huge_pages(false),
+    pack_model(false),
+    model_cache_dir(""),
+    compile_model(false),
+    model_compiler("cc -O2"),
+    autotune(false),
+    autotune_rows(256),
+    predict_plan(""),
     convert_model_language(""),
     convert_model("gbdt_prediction.cpp"),
     num_class(1),
@@ -656,6 +668,22 @@ public:
   // desc = produces ``#features + 1`` values where the last value is the expected value of the model output over the training data
   bool predict_contrib;
 
+  // [doc-only]
+  // type = enum
+  // options = tree_shap, saabas, interventional
+  // desc = used only in ``prediction`` task, with ``predict_contrib``
+  // desc = how the prediction is attributed to the features
+  // desc = ``tree_shap``, exact SHAP values
+  // desc = ``saabas``, walks the decision path once per tree and attributes the change of the node value at every split to its feature, as fast as a normal prediction. The values add up to the prediction but are only an approximation of SHAP values
+  // desc = ``interventional``, SHAP values against a reference population instead of the training data, the expected value is the mean prediction of the population. The population is summarized once by ``LGBM_BoosterSetContribBackground``, the cost of a record then depends on the variety of the population rather than on its size
+  std::string contrib_method;
+
+  // check = >=0
+  // desc = used only by ``LGBM_BoosterPredictSparseContribForMat``
+  // desc = number of features with the largest absolute contributions to return for every record and class, ``0`` returns every feature with a non-zero contribution
+  // desc = the expected value is always returned
+  int contrib_top_k;
+
   // desc = used only in ``prediction`` task
   // desc = used to specify how many trained iterations will be used in prediction
   // desc = ``<= 0`` means no limit
@@ -673,6 +701,70 @@ public:
   // desc = the threshold of margin in early-stopping prediction
   double pred_early_stop_margin;
 
+  // type = multi-int
+  // default = None
+  // desc = used only in ``prediction`` task
+  // desc = classes to predict, separated by ``,``, only the trees of these classes are evaluated
+  // desc = the prediction has one value per listed class, in the listed order
+  // desc = cannot be used with ``pred_early_stop``
+  std::vector<int> pred_classes;
+
+  // desc = used only in ``prediction`` task, with ``pred_classes``
+  // desc = set this to ``true`` to apply softmax over the listed classes, by default their raw scores are returned
+  // desc = only for models with ``multiclass`` objective, an error is raised for other objectives, e.g. a custom one, whose raw scores are not meant for softmax
+  bool pred_normalize_classes;
+
+  // desc = used only in ``prediction`` task, with normal predictions
+  // desc = set this to ``true`` to compute the exp of the sigmoid or softmax of the predictions with vectorized code, a block of rows at a time
+  // desc = exp is then within 1 ulp of the exp of the C library, so the predictions differ from the default ones by a few ulp
+  bool pred_fast_transform;
+
+  // desc = used only when loading a model
+  // desc = set this to ``true`` to align the model storage to 2 MB pages and advise the kernel to back it with transparent huge pages
+  // desc = only takes effect when the model storage is larger than 2 MB
+  bool model_huge_pages;
+
+  // desc = used only when loading a model
+  // desc = set this to ``true`` to pack the trees for prediction: thresholds are interned per feature, categorical bitsets are deduplicated and identical subtrees are merged
+  // desc = predictions are bit-identical, the packed model can be saved with ``LGBM_BoosterSavePackedModel`` and loaded back with ``LGBM_BoosterLoadPackedModel``
+  // desc = the traversals of packed models larger than twice the L2 cache are interleaved, the environment variable ``LIGHTGBM_INTERLEAVE`` set to ``always`` or ``never`` overrides this when a packed model is loaded
+  bool pack_model;
+
+  // desc = used only when loading a model
+  // desc = directory to cache the packed model in, files are keyed by a hash of the model string
+  // desc = later loads of the same model map the cached file read-only and skip parsing and packing
+  // desc = the booster keeps only the packed trees, also on the load that writes the file, so it cannot predict contributions or leaf indices, compile the model or apply model deltas
+  // desc = cached files written by another version or on another platform are ignored and replaced
+  std::string model_cache_dir;
+
+  // desc = used only when loading a model
+  // desc = set this to ``true`` to generate C code for the trees, compile it with ``model_compiler`` into a shared library and predict with the compiled trees
+  // desc = predictions are bit-identical, if the compilation fails a warning is printed and the trees are interpreted as usual
+  // desc = prediction on sparse rows and leaf index prediction still use the interpreted trees
+  // desc = **Note**: compiling large models takes a long time
+  bool compile_model;
+
+  // desc = used only when ``compile_model=true``
+  // desc = command used to compile the generated code, it is called with ``-shared -fPIC -o <library> <source>``
+  // desc = the command is split on white space and run without a shell, so quotes, pipes and variables are not interpreted
+  // desc = **Warning**: whoever sets this parameter runs any program they like with the rights of the process, never take it from an untrusted source, e.g. the parameters of a request
+  std::string model_compiler;
+
+  // desc = used only when loading a model
+  // desc = set this to ``true`` to time the prediction engines of the model at load and keep the fastest one for every batch size, see ``predict_plan``
+  // desc = the engines are the trees, the packed forest (built for the occasion when ``pack_model=false``, and dropped again if it is slower) and the compiled model when ``compile_model=true``
+  // desc = the timing runs on synthetic rows made from the split thresholds, ``LGBM_BoosterAutotune`` runs it on rows of the caller
+  bool autotune;
+
+  // check = >0
+  // desc = number of synthetic rows the autotuning runs on
+  int autotune_rows;
+
+  // desc = used only when loading a model
+  // desc = plan to predict with, as returned by ``LGBM_BoosterGetPredictPlan``, to pin the decision of an earlier autotuning
+  // desc = takes precedence over ``autotune``
+  std::string predict_plan;
+
   // desc = used only in ``convert_model`` task
   // desc = only ``cpp`` is supported yet
   // desc = if ``convert_model_language`` is set and ``task=train``, the model will be also converted
@@ -44,6 +44,15 @@ const score_t kEpsilon = 1e-15f;
 
 const double kZeroThreshold = 1e-35f;
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH_T0(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define PREFETCH_T0(addr) __builtin_prefetch(reinterpret_cast<const char*>(addr), 0, 3)
+#else
+#define PREFETCH_T0(addr) do {} while (0)
+#endif
+
 
 typedef int32_t comm_size_t;
 
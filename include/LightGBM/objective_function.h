@@ -56,6 +56,18 @@ public:
     output[0] = input[0];
   }
 
+  /*!
+  * \brief ConvertOutput of consecutive rows of NumPredictOneRow() values, input and output may be the same
+  * \param num_rows Number of rows
+  * \param fast_exp True to allow PredictKernels::fast_exp, the outputs are then within a few ulp of ConvertOutput
+  */
+  virtual void ConvertOutputBatch(const double* input, double* output, int num_rows, bool) const {
+    const int num_pred_one_row = NumPredictOneRow();
+    for (int i = 0; i < num_rows; ++i) {
+      ConvertOutput(input + static_cast<size_t>(i) * num_pred_one_row, output + static_cast<size_t>(i) * num_pred_one_row);
+    }
+  }
+
   virtual std::string ToString() const = 0;
 
   ObjectiveFunction() = default;
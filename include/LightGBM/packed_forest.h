@@ -0,0 +1,403 @@
+#ifndef LIGHTGBM_PACKED_FOREST_H_
+#define LIGHTGBM_PACKED_FOREST_H_
+
+#include <LightGBM/meta.h>
+#include <LightGBM/predict_kernels.h>
+#include <LightGBM/tree.h>
+#include <LightGBM/utils/arena.h>
+#include <LightGBM/utils/common.h>
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <unordered_map>
+
+namespace LightGBM {
+
+/*!
+* \brief One split node of a packed forest, 16 bytes
+*/
+struct PackedNode {
+  /*! \brief Left child, >= 0 for a node, ~leaf for a leaf */
+  int32_t left_child;
+  /*! \brief Right child, >= 0 for a node, ~leaf for a leaf */
+  int32_t right_child;
+  /*! \brief Split feature, index into the feature values given to prediction */
+  int32_t split_feature;
+  /*! \brief Index into the threshold table of split_feature, or the bitset index for categorical splits */
+  uint16_t threshold;
+  /*! \brief Same as Tree::decision_type_ */
+  int8_t decision_type;
+  int8_t reserved;
+};
+
+/*!
+* \brief Header of a serialized packed forest. All offsets are in bytes from the start of the buffer.
+*/
+struct PackedForestHeader {
+  char magic[8];
+  int32_t version;
+  int32_t num_trees;
+  int32_t num_features;
+  int32_t num_nodes;
+  int32_t num_leaves;
+  int32_t num_thresholds;
+  int32_t num_bitsets;
+  int32_t num_bitset_words;
+  /*! \brief Encoding of leaf values, PackedForest::LeafType */
+  int32_t leaf_type;
+  /*! \brief Encoding of thresholds, PackedForest::ThresholdType */
+  int32_t threshold_type;
+  int32_t num_implicit_nodes;
+  int32_t num_implicit_leaves;
+  int64_t total_size;
+  int64_t root_offset;
+  int64_t node_offset;
+  int64_t leaf_value_offset;
+  /*! \brief Scale of the leaf values of every tree, only for quantized leaf values */
+  int64_t tree_scale_offset;
+  int64_t threshold_boundaries_offset;
+  int64_t threshold_offset;
+  int64_t bitset_boundaries_offset;
+  int64_t bitset_offset;
+  /*! \brief PackedImplicitTree of every tree */
+  int64_t implicit_tree_offset;
+  int64_t implicit_node_offset;
+  /*! \brief Leaf of every leaf slot of implicit trees */
+  int64_t implicit_leaf_offset;
+  /*! \brief Text header of the model (everything but the trees), used to restore a booster from the buffer alone */
+  int64_t model_header_offset;
+  int64_t model_header_len;
+};
+
+/*!
+* \brief Compaction of the trees of a model for prediction.
+*        Thresholds are interned per feature, categorical bitsets and leaf values are deduplicated,
+*        and identical subtrees are merged across the whole forest, so the nodes form a DAG.
+*        Shallow numerical trees are also stored as complete binary trees, which are walked
+*        with a fixed number of steps and without branching on the direction.
+*        This is lossless by default, leaf values and thresholds can optionally be quantized.
+*        Everything lives in one position independent buffer that can be written out and mapped back.
+*/
+class PackedForest {
+public:
+  /*! \brief Version of the serialized layout */
+  static const int32_t kVersion = 3;
+
+  /*! \brief Max depth of trees stored as complete binary trees */
+  static const int kMaxImplicitDepth = 8;
+
+  /*! \brief Number of traversals advanced together by PredictTrees */
+  static const int kInterleave = 8;
+
+  /*! \brief Encoding of leaf values */
+  enum LeafType {
+    /*! \brief Exact double */
+    kLeafFloat64 = 0,
+    /*! \brief Half precision times the scale of the tree */
+    kLeafFloat16 = 1,
+    /*! \brief 8 bits integer times the scale of the tree */
+    kLeafInt8 = 2
+  };
+
+  /*! \brief Encoding of thresholds */
+  enum ThresholdType {
+    /*! \brief Exact double */
+    kThresholdFloat64 = 0,
+    /*! \brief Rounded to the nearest float */
+    kThresholdFloat32 = 1
+  };
+
+  PackedForest();
+
+  /*!
+  * \brief Pack trees
+  * \param trees Trees to pack
+  * \param num_features Number of features of the model
+  * \param model_header Text header of the model, stored along with the trees
+  * \param huge_page True to put the buffer on huge pages
+  * \param leaf_type Encoding of leaf values, anything but kLeafFloat64 is lossy
+  * \param threshold_type Encoding of thresholds, anything but kThresholdFloat64 is lossy
+  * \return False if the trees cannot be packed, e.g. a feature has more than 65536 distinct thresholds
+  */
+  bool Build(const std::vector<Tree*>& trees, int num_features, const std::string& model_header, bool huge_page,
+             LeafType leaf_type = kLeafFloat64, ThresholdType threshold_type = kThresholdFloat64);
+
+  /*!
+  * \brief Use a serialized packed forest
+  * \param buffer Serialized buffer, aligned to 8 bytes
+  * \param len Length of buffer
+  * \param copy True to copy the buffer, otherwise the buffer should outlive this object
+  */
+  void LoadFromBuffer(const char* buffer, size_t len, bool copy);
+
+  /*!
+  * \brief Check whether a buffer holds a serialized packed forest
+  */
+  static bool IsPackedForest(const char* buffer, size_t len);
+
+  /*! \brief Serialized buffer */
+  inline const char* data() const { return data_; }
+  /*! \brief Size of serialized buffer */
+  inline size_t size() const { return size_; }
+
+  inline int num_trees() const { return header_->num_trees; }
+  inline int num_features() const { return header_->num_features; }
+  /*!
+  * \brief Whether PredictTrees beats PredictTree tree by tree,
+  *        i.e. the buffer is too large to stay in cache or most trees are implicit trees for the kernels
+  */
+  inline bool predict_in_groups() const { return predict_in_groups_; }
+  inline int num_nodes() const { return header_->num_nodes; }
+  inline int num_leaves() const { return header_->num_leaves; }
+  inline LeafType leaf_type() const { return leaf_type_; }
+  inline ThresholdType threshold_type() const { return threshold_type_; }
+
+  /*! \brief Features the trees split on, in increasing order */
+  std::vector<int> SplitFeatures() const;
+
+  /*!
+  * \brief Features one tree splits on
+  * \param tree Index of tree
+  * \param out_features Features in increasing order
+  */
+  void TreeSplitFeatures(int tree, std::vector<int>* out_features) const;
+
+  /*! \brief Text header of the model */
+  inline std::string model_header() const {
+    return std::string(data_ + header_->model_header_offset, header_->model_header_len);
+  }
+
+  /*!
+  * \brief Prediction of one tree on one record
+  * \param tree Index of tree
+  * \param feature_values Feature value of this record
+  */
+  inline double PredictTree(int tree, const double* feature_values) const {
+    const PackedImplicitTree& implicit = implicit_trees_[tree];
+    switch (implicit.depth) {
+    case 1: return LeafValue(tree, ImplicitLeaf<1>(implicit, feature_values));
+    case 2: return LeafValue(tree, ImplicitLeaf<2>(implicit, feature_values));
+    case 3: return LeafValue(tree, ImplicitLeaf<3>(implicit, feature_values));
+    case 4: return LeafValue(tree, ImplicitLeaf<4>(implicit, feature_values));
+    case 5: return LeafValue(tree, ImplicitLeaf<5>(implicit, feature_values));
+    case 6: return LeafValue(tree, ImplicitLeaf<6>(implicit, feature_values));
+    case 7: return LeafValue(tree, ImplicitLeaf<7>(implicit, feature_values));
+    case 8: return LeafValue(tree, ImplicitLeaf<8>(implicit, feature_values));
+    default: break;
+    }
+    int node = roots_[tree];
+    if (threshold_type_ == kThresholdFloat64) {
+      while (node >= 0) {
+        node = Decision(feature_values[nodes_[node].split_feature], nodes_[node], thresholds_);
+      }
+    } else {
+      while (node >= 0) {
+        node = Decision(feature_values[nodes_[node].split_feature], nodes_[node], thresholds_float_);
+      }
+    }
+    return LeafValue(tree, ~node);
+  }
+
+  /*!
+  * \brief Prediction of consecutive trees on one record. The implicit trees are walked together by the kernels.
+  *        When the buffer does not fit in cache, the other traversals are advanced in turns
+  *        and the next node of each is prefetched, so that their cache misses overlap.
+  *        The environment variable LIGHTGBM_INTERLEAVE (always or never) overrides the size check at load.
+  * \param first_tree Index of the first tree
+  * \param num_trees Number of trees, at most kInterleave
+  * \param feature_values Feature value of this record
+  * \param output Output, prediction of every tree
+  */
+  inline void PredictTrees(int first_tree, int num_trees, const double* feature_values, double* output) const {
+    int nodes[kInterleave];
+    for (int i = 0; i < num_trees; ++i) {
+      nodes[i] = implicit_trees_[first_tree + i].depth > 0 ? -1 : roots_[first_tree + i];
+      if (interleave_ && nodes[i] >= 0) {
+        PREFETCH_T0(nodes_ + nodes[i]);
+      }
+    }
+    if (interleave_) {
+      if (threshold_type_ == kThresholdFloat64) {
+        InterleavedTraversal(nodes, num_trees, feature_values, thresholds_);
+      } else {
+        InterleavedTraversal(nodes, num_trees, feature_values, thresholds_float_);
+      }
+    } else {
+      for (int i = 0; i < num_trees; ++i) {
+        int node = nodes[i];
+        if (threshold_type_ == kThresholdFloat64) {
+          while (node >= 0) {
+            node = Decision(feature_values[nodes_[node].split_feature], nodes_[node], thresholds_);
+          }
+        } else {
+          while (node >= 0) {
+            node = Decision(feature_values[nodes_[node].split_feature], nodes_[node], thresholds_float_);
+          }
+        }
+        nodes[i] = node;
+      }
+    }
+    // the implicit trees are walked together, with the vector instructions of this CPU
+    int32_t slots[kInterleave];
+    kernels_->implicit_leaves(implicit_trees_ + first_tree, num_trees, implicit_nodes_, feature_values, slots);
+    for (int i = 0; i < num_trees; ++i) {
+      if (implicit_trees_[first_tree + i].depth > 0) {
+        output[i] = LeafValue(first_tree + i, implicit_leaves_[slots[i]]);
+      } else {
+        output[i] = LeafValue(first_tree + i, ~nodes[i]);
+      }
+    }
+  }
+
+  inline double PredictTreeByMap(int tree, const std::unordered_map<int, double>& feature_values) const {
+    int node = roots_[tree];
+    while (node >= 0) {
+      const int fidx = nodes_[node].split_feature;
+      const double fval = feature_values.count(fidx) > 0 ? feature_values.at(fidx) : 0.0f;
+      if (threshold_type_ == kThresholdFloat64) {
+        node = Decision(fval, nodes_[node], thresholds_);
+      } else {
+        node = Decision(fval, nodes_[node], thresholds_float_);
+      }
+    }
+    return LeafValue(tree, ~node);
+  }
+
+  /*! \brief Decoded value of a leaf reached in a tree */
+  inline double LeafValue(int tree, int leaf) const {
+    if (leaf_type_ == kLeafFloat64) {
+      return leaf_value_[leaf];
+    } else if (leaf_type_ == kLeafFloat16) {
+      return static_cast<double>(Common::HalfToFloat(leaf_value_half_[leaf])) * tree_scale_[tree];
+    } else {
+      return static_cast<double>(leaf_value_int8_[leaf]) * tree_scale_[tree];
+    }
+  }
+
+private:
+  /*! \brief Point the section pointers into data_ */
+  void Attach();
+
+  /*! \brief Whether a split of an implicit tree goes right, same as Tree::NumericalDecision but with selects only */
+  inline static int ImplicitGoRight(double fval, const PackedImplicitNode& node) {
+    int go_right = fval <= node.threshold ? 0 : 1;
+    go_right = node.zero_right >= 0 && Tree::IsZero(fval) ? node.zero_right : go_right;
+    return std::isnan(fval) ? node.nan_right : go_right;
+  }
+
+  /*! \brief Advance every traversal that is not at a leaf by one node, until all are at leaves */
+  template<typename T>
+  inline void InterleavedTraversal(int* nodes, int num_trees, const double* feature_values, const T* thresholds) const {
+    bool active = true;
+    while (active) {
+      active = false;
+      for (int i = 0; i < num_trees; ++i) {
+        if (nodes[i] >= 0) {
+          const PackedNode& node = nodes_[nodes[i]];
+          nodes[i] = Decision(feature_values[node.split_feature], node, thresholds);
+          if (nodes[i] >= 0) {
+            PREFETCH_T0(nodes_ + nodes[i]);
+            active = true;
+          }
+        }
+      }
+    }
+  }
+
+  template<int kDepth>
+  inline int ImplicitLeaf(const PackedImplicitTree& implicit, const double* feature_values) const {
+    const PackedImplicitNode* nodes = implicit_nodes_ + implicit.node_offset;
+    int node = 0;
+    for (int i = 0; i < kDepth; ++i) {
+      node = 2 * node + 1 + ImplicitGoRight(feature_values[nodes[node].split_feature], nodes[node]);
+    }
+    return implicit_leaves_[implicit.leaf_offset + node - ((1 << kDepth) - 1)];
+  }
+
+  template<typename T>
+  inline int NumericalDecision(double fval, const PackedNode& node, const T* thresholds) const {
+    uint8_t missing_type = Tree::GetMissingType(node.decision_type);
+    if (std::isnan(fval)) {
+      if (missing_type != 2) {
+        fval = 0.0f;
+      }
+    }
+    if ((missing_type == 1 && Tree::IsZero(fval))
+        || (missing_type == 2 && std::isnan(fval))) {
+      if (Tree::GetDecisionType(node.decision_type, kDefaultLeftMask)) {
+        return node.left_child;
+      } else {
+        return node.right_child;
+      }
+    }
+    if (fval <= thresholds[threshold_boundaries_[node.split_feature] + node.threshold]) {
+      return node.left_child;
+    } else {
+      return node.right_child;
+    }
+  }
+
+  inline int CategoricalDecision(double fval, const PackedNode& node) const {
+    uint8_t missing_type = Tree::GetMissingType(node.decision_type);
+    int int_fval = static_cast<int>(fval);
+    if (int_fval < 0) {
+      return node.right_child;
+    } else if (std::isnan(fval)) {
+      // NaN is always in the right
+      if (missing_type == 2) {
+        return node.right_child;
+      }
+      int_fval = 0;
+    }
+    const int cat_idx = node.threshold;
+    if (Common::FindInBitset(bitsets_ + bitset_boundaries_[cat_idx],
+                             bitset_boundaries_[cat_idx + 1] - bitset_boundaries_[cat_idx], int_fval)) {
+      return node.left_child;
+    }
+    return node.right_child;
+  }
+
+  template<typename T>
+  inline int Decision(double fval, const PackedNode& node, const T* thresholds) const {
+    if (Tree::GetDecisionType(node.decision_type, kCategoricalMask)) {
+      return CategoricalDecision(fval, node);
+    } else {
+      return NumericalDecision(fval, node, thresholds);
+    }
+  }
+
+  /*! \brief Owned storage, empty when the buffer is borrowed */
+  Arena arena_;
+  /*! \brief Serialized buffer */
+  const char* data_;
+  size_t size_;
+  const PackedForestHeader* header_;
+  LeafType leaf_type_;
+  ThresholdType threshold_type_;
+  bool interleave_;
+  bool predict_in_groups_;
+  /*! \brief Root of every tree, ~leaf for single leaf trees */
+  const int32_t* roots_;
+  const PackedNode* nodes_;
+  /*! \brief Leaf values, only the one matching leaf_type_ is set */
+  const double* leaf_value_;
+  const uint16_t* leaf_value_half_;
+  const int8_t* leaf_value_int8_;
+  const double* tree_scale_;
+  /*! \brief Start of the threshold table of every feature in thresholds_ */
+  const int32_t* threshold_boundaries_;
+  /*! \brief Threshold tables, only the one matching threshold_type_ is set */
+  const double* thresholds_;
+  const float* thresholds_float_;
+  const int32_t* bitset_boundaries_;
+  const uint32_t* bitsets_;
+  const PackedImplicitTree* implicit_trees_;
+  const PackedImplicitNode* implicit_nodes_;
+  const int32_t* implicit_leaves_;
+  const PredictKernels* kernels_;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_PACKED_FOREST_H_
@@ -0,0 +1,88 @@
+#ifndef LIGHTGBM_PREDICT_KERNELS_H_
+#define LIGHTGBM_PREDICT_KERNELS_H_
+
+#include <cstdint>
+
+namespace LightGBM {
+
+// the implicit trees of PackedForest are defined here, the kernels cannot include packed_forest.h
+
+/*!
+* \brief Shallow tree stored as a complete binary tree in breadth-first order, children are implicit
+*/
+struct PackedImplicitTree {
+  /*! \brief Depth of the complete tree, 0 if the tree is only in the node DAG */
+  int32_t depth;
+  /*! \brief First of the (1 << depth) - 1 nodes of this tree */
+  int32_t node_offset;
+  /*! \brief First of the 1 << depth leaf slots of this tree */
+  int32_t leaf_offset;
+  int32_t reserved;
+};
+
+/*!
+* \brief One split of an implicit tree, 16 bytes
+*/
+struct PackedImplicitNode {
+  /*! \brief Threshold, already rounded when thresholds are float */
+  double threshold;
+  int32_t split_feature;
+  /*! \brief 1 if NaN goes right, the missing value handling of Tree::NumericalDecision is resolved at build */
+  int8_t nan_right;
+  /*! \brief 1 if zero goes right and 0 if it goes left when zero is missing, -1 otherwise */
+  int8_t zero_right;
+  int8_t reserved[2];
+};
+
+/*! \brief Largest distance in ulp between PredictKernels::fast_exp and exp */
+const int kFastExpMaxUlp = 1;
+
+/*!
+* \brief Hot loops of prediction, built once per instruction set in the same library.
+*        The widest variant the CPU and the OS support is picked on first use,
+*        the environment variable LIGHTGBM_ISA (generic, sse4.2, avx2 or avx512) can lower the choice.
+*        Every variant returns bit-identical results.
+*/
+struct PredictKernels {
+  /*! \brief Name of the instruction set */
+  const char* isa;
+
+  /*!
+  * \brief Walk consecutive implicit trees together
+  * \param trees PackedImplicitTree of the trees, at most 8
+  * \param num_trees Number of trees
+  * \param nodes Implicit nodes of the forest
+  * \param feature_values Feature value of this record
+  * \param out_slots Leaf slot reached in each tree with a depth, the others are left untouched
+  */
+  void (*implicit_leaves)(const PackedImplicitTree* trees, int num_trees, const PackedImplicitNode* nodes,
+                          const double* feature_values, int32_t* out_slots);
+
+  /*!
+  * \brief Indices of the values of a dense row that are not zero, NaN included
+  * \param row Values of the row
+  * \param len Number of values
+  * \param out_indices Indices, room for len of them is needed
+  * \return Number of indices written to out_indices
+  */
+  int (*nonzero_float)(const float* row, int len, int32_t* out_indices);
+
+  /*! \brief Same as nonzero_float for a row of doubles */
+  int (*nonzero_double)(const double* row, int len, int32_t* out_indices);
+
+  /*!
+  * \brief exp of every value, input and output may be the same.
+  *        It is within kFastExpMaxUlp ulp of exp, and it is exp itself for NaN and for the values
+  *        whose exp is infinite or subnormal.
+  */
+  void (*fast_exp)(const double* input, double* output, int len);
+};
+
+/*!
+* \brief Kernels for the instruction set of this CPU
+*/
+const PredictKernels& GetPredictKernels();
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_PREDICT_KERNELS_H_
@@ -3,6 +3,7 @@
 
 #include <LightGBM/meta.h>
 #include <LightGBM/utils/common.h>
+#include <LightGBM/utils/arena.h>
 
 #include <string>
 #include <vector>
@@ -34,6 +35,23 @@ public:
   */
   Tree(const char* str, size_t* used_len);
 
+  /*!
+  * \brief Construtor, from a string, all arrays of the model are carved from arena.
+  *        The tables built on demand for contributions (shap_*, background_*, saabas_values_) grow after loading
+  *        and stay on the heap, so ~Tree must still run before the arena is released.
+  * \param str Model string
+  * \param used_len used count of str
+  * \param arena Storage for the arrays, should have at least ArenaSize(str) bytes left
+  */
+  Tree(const char* str, size_t* used_len, Arena* arena);
+
+  /*!
+  * \brief Bytes of arena storage needed to load a tree from string
+  * \param str Model string
+  * \param used_len used count of str
+  */
+  static size_t ArenaSize(const char* str, size_t* used_len);
+
   ~Tree();
 
   /*! \brief Get the output of one leaf */
@@ -41,6 +59,7 @@ public:
 
   /*! \brief Set the output of one leaf */
   inline void SetLeafOutput(int leaf, double output) {
+    saabas_built_ = false;
     leaf_value_[leaf] = output;
   }
 
@@ -56,7 +75,83 @@ public:
   inline int PredictLeafIndexByMap(const std::unordered_map<int, double>& feature_values) const;
 
 
-  inline void PredictContrib(const double* feature_values, int num_features, double* output);
+  /*!
+  * \brief Used by TreeSHAP for data we keep about our decision path
+  */
+  struct PathElement {
+    int feature_index;
+    double zero_fraction;
+    double one_fraction;
+
+    // note that pweight is included for convenience and is not tied with the other attributes,
+    // the pweight of the i'th path element is the permuation weight of paths with i-1 ones in them
+    double pweight;
+
+    PathElement() {}
+    PathElement(int i, double z, double o, double w) : feature_index(i), zero_fraction(z), one_fraction(o), pweight(w) {}
+  };
+
+  /*!
+  * \brief Scratch space of PredictContrib, reused between records
+  */
+  struct SHAPBuffer {
+    /*! \brief 1 if the record goes left at a split */
+    std::vector<int8_t> goes_left;
+    /*! \brief 1 if the record follows the splits of a feature of a path */
+    std::vector<int8_t> is_followed;
+    /*! \brief Polynomials of the leaves that have no table */
+    std::vector<double> poly;
+    /*! \brief Unique paths of the recursive TreeSHAP */
+    std::vector<PathElement> unique_path;
+  };
+
+  /*!
+  * \brief Precompute the paths and tables PredictContrib uses, does nothing if they are already built
+  */
+  void BuildSHAPTables();
+
+  /*!
+  * \brief Add the SHAP values of this tree on one record to output, BuildSHAPTables has to be called first
+  * \param feature_values Feature value of this record
+  * \param num_features Number of features, the expected value of the tree goes to output[num_features]
+  * \param output SHAP values, num_features + 1 of them
+  * \param buffer Scratch space
+  */
+  void PredictContrib(const double* feature_values, int num_features, double* output, SHAPBuffer* buffer) const;
+
+  /*!
+  * \brief Precompute the node values PredictContribSaabas uses, does nothing if they are already built
+  */
+  void BuildSaabasValues();
+
+  /*!
+  * \brief Add the Saabas contributions of this tree on one record to output, BuildSaabasValues has to be called first.
+  *        Every split of the decision path gives the change of the node value to its feature.
+  * \param feature_values Feature value of this record
+  * \param num_features Number of features, the value of the root goes to output[num_features]
+  * \param output Contributions, num_features + 1 of them
+  */
+  void PredictContribSaabas(const double* feature_values, int num_features, double* output) const;
+
+  /*!
+  * \brief Summarize background rows for PredictContribInterventional: for every leaf, the distinct sets of
+  *        path features whose splits the rows follow and the fraction of the rows behind each set
+  * \param rows Feature values of the background rows, num_features per row
+  * \param num_rows Number of background rows
+  * \param num_features Number of features of a row
+  */
+  void SetBackground(const double* rows, int num_rows, int num_features);
+
+  /*!
+  * \brief Add the interventional SHAP values of this tree on one record against the background to output,
+  *        SetBackground has to be called first
+  * \param feature_values Feature value of this record
+  * \param num_features Number of features, the mean output of the background goes to output[num_features]
+  * \param output SHAP values, num_features + 1 of them
+  * \param buffer Scratch space
+  */
+  void PredictContribInterventional(const double* feature_values, int num_features, double* output,
+                                    SHAPBuffer* buffer) const;
 
   /*! \brief Get Number of leaves*/
   inline int num_leaves() const { return num_leaves_; }
@@ -64,11 +159,45 @@ public:
   /*! \brief Get depth of specific leaf*/
   inline int leaf_depth(int leaf_idx) const { return leaf_depth_[leaf_idx]; }
 
+  /*! \brief Get max depth of leaves, -1 until RecomputeMaxDepth is called on a loaded tree*/
+  inline int max_depth() const { return max_depth_; }
+
   /*! \brief Get feature of specific split*/
   inline int split_feature(int split_idx) const { return split_feature_[split_idx]; }
 
   inline double split_gain(int split_idx) const { return split_gain_[split_idx]; }
 
+  /*! \brief Get threshold of specific split, the index of its bitset for categorical splits*/
+  inline double threshold(int split_idx) const { return threshold_[split_idx]; }
+
+  /*! \brief Get decision type of specific split*/
+  inline int8_t decision_type(int split_idx) const { return decision_type_[split_idx]; }
+
+  /*! \brief Get left child of specific split, ~leaf for a leaf*/
+  inline int left_child(int split_idx) const { return left_child_[split_idx]; }
+
+  /*! \brief Get right child of specific split, ~leaf for a leaf*/
+  inline int right_child(int split_idx) const { return right_child_[split_idx]; }
+
+  /*! \brief Get number of categorical splits*/
+  inline int num_cat() const { return num_cat_; }
+
+  /*!
+  * \brief Get the bitset of a categorical split
+  * \param split_idx Index of split
+  * \param num_words Output, number of 32 bits words in the bitset
+  */
+  inline const uint32_t* cat_threshold(int split_idx, int* num_words) const {
+    const int cat_idx = static_cast<int>(threshold_[split_idx]);
+    *num_words = cat_boundaries_[cat_idx + 1] - cat_boundaries_[cat_idx];
+    return cat_threshold_.data() + cat_boundaries_[cat_idx];
+  }
+
+  /*! \brief Whether specific split is categorical, as decided by prediction*/
+  inline bool IsCategoricalSplit(int split_idx) const {
+    return num_cat_ > 0 && GetDecisionType(decision_type_[split_idx], kCategoricalMask);
+  }
+
   /*! \brief Get the number of data points that fall at or below this node*/
   inline int data_count(int node) const { return node >= 0 ? internal_count_[node] : leaf_count_[~node]; }
 
@@ -83,6 +212,7 @@ public:
       leaf_value_[i] *= rate;
     }
     shrinkage_ *= rate;
+    saabas_built_ = false;
   }
 
   inline double shrinkage() const {
@@ -96,12 +226,14 @@ public:
     }
     // force to 1.0
     shrinkage_ = 1.0f;
+    saabas_built_ = false;
   }
 
   inline void AsConstantTree(double val) {
     num_leaves_ = 1;
     shrinkage_ = 1.0f;
     leaf_value_[0] = val;
+    saabas_built_ = false;
   }
 
   /*! \brief Serialize this object to string*/
@@ -144,6 +276,13 @@ public:
 
   void RecomputeMaxDepth();
 
+  /*!
+  * \brief Make the split features index a subset of the features, so that prediction only needs the values of the subset.
+  *        The serialized tree has the new indices afterwards
+  * \param feature_slots Position of every feature in the subset, -1 for the features that are not in it
+  */
+  void RemapSplitFeatures(const std::vector<int>& feature_slots);
+
 private:
 
   std::string NumericalDecisionIfElse(int node) const;
@@ -254,25 +393,12 @@ private:
 
   double ExpectedValue() const;
 
+  /*! \brief Parse arrays from string into arena, shared by the string constructors */
+  void LoadFromString(const char* str, size_t* used_len, Arena* arena);
+
   /*! \brief This is used fill in leaf_depth_ after reloading a model*/
   inline void RecomputeLeafDepths(int node = 0, int depth = 0);
 
-  /*!
-  * \brief Used by TreeSHAP for data we keep about our decision path
-  */
-  struct PathElement {
-    int feature_index;
-    double zero_fraction;
-    double one_fraction;
-
-    // note that pweight is included for convenience and is not tied with the other attributes,
-    // the pweight of the i'th path element is the permuation weight of paths with i-1 ones in them
-    double pweight;
-
-    PathElement() {}
-    PathElement(int i, double z, double o, double w) : feature_index(i), zero_fraction(z), one_fraction(o), pweight(w) {}
-  };
-
   /*! \brief Polynomial time algorithm for SHAP values (https://arxiv.org/abs/1706.06060) */
   void TreeSHAP(const double *feature_values, double *phi,
                 int node, int unique_depth,
@@ -289,51 +415,109 @@ private:
   /*! determine what the total permuation weight would be if we unwound a previous extension in the decision path*/
   static double UnwoundPathSum(const PathElement *unique_path, int unique_depth, int path_index);
 
+  /*! \brief Paths and Shapley weights shared by BuildSHAPTables and SetBackground */
+  void BuildSHAPPaths();
+
+  /*! \brief Count weighted mean of the leaves under a node, the plain mean of both children without counts, see BuildSaabasValues */
+  double SaabasValue(int node, int* count);
+
+  /*! \brief A split on the path from the root to a leaf, for the tables of PredictContrib */
+  struct SHAPSplit {
+    int node;
+    /*! \brief 1 if the path goes left */
+    int8_t left;
+    /*! \brief Position of the split feature among the distinct features of the path */
+    int8_t feature_pos;
+  };
+
+  /*! \brief Storage of the arrays when the tree is not loaded into a shared arena */
+  std::unique_ptr<Arena> own_arena_;
   /*! \brief Number of max leaves*/
   int max_leaves_;
   /*! \brief Number of current levas*/
   int num_leaves_;
   // following values used for non-leaf node
   /*! \brief A non-leaf node's left child */
-  std::vector<int> left_child_;
+  ArenaArray<int> left_child_;
   /*! \brief A non-leaf node's right child */
-  std::vector<int> right_child_;
+  ArenaArray<int> right_child_;
   /*! \brief A non-leaf node's split feature */
-  std::vector<int> split_feature_inner_;
+  ArenaArray<int> split_feature_inner_;
   /*! \brief A non-leaf node's split feature, the original index */
-  std::vector<int> split_feature_;
+  ArenaArray<int> split_feature_;
   /*! \brief A non-leaf node's split threshold in bin */
-  std::vector<uint32_t> threshold_in_bin_;
+  ArenaArray<uint32_t> threshold_in_bin_;
   /*! \brief A non-leaf node's split threshold in feature value */
-  std::vector<double> threshold_;
+  ArenaArray<double> threshold_;
   int num_cat_;
-  std::vector<int> cat_boundaries_inner_;
-  std::vector<uint32_t> cat_threshold_inner_;
-  std::vector<int> cat_boundaries_;
-  std::vector<uint32_t> cat_threshold_;
+  ArenaArray<int> cat_boundaries_inner_;
+  ArenaArray<uint32_t> cat_threshold_inner_;
+  ArenaArray<int> cat_boundaries_;
+  ArenaArray<uint32_t> cat_threshold_;
   /*! \brief Store the information for categorical feature handle and mising value handle. */
-  std::vector<int8_t> decision_type_;
+  ArenaArray<int8_t> decision_type_;
   /*! \brief A non-leaf node's split gain */
-  std::vector<float> split_gain_;
+  ArenaArray<float> split_gain_;
   // used for leaf node
   /*! \brief The parent of leaf */
-  std::vector<int> leaf_parent_;
+  ArenaArray<int> leaf_parent_;
   /*! \brief Output of leaves */
-  std::vector<double> leaf_value_;
+  ArenaArray<double> leaf_value_;
   /*! \brief DataCount of leaves */
-  std::vector<int> leaf_count_;
+  ArenaArray<int> leaf_count_;
   /*! \brief Output of non-leaf nodes */
-  std::vector<double> internal_value_;
+  ArenaArray<double> internal_value_;
   /*! \brief DataCount of non-leaf nodes */
-  std::vector<int> internal_count_;
+  ArenaArray<int> internal_count_;
   /*! \brief Depth for leaves */
-  std::vector<int> leaf_depth_;
+  ArenaArray<int> leaf_depth_;
   double shrinkage_;
   int max_depth_;
+  // tables of PredictContrib, they do not depend on the leaf values.
+  // Built on demand and of unknown size at load, so they are heap vectors even for a tree in an arena
+  /*! \brief True once BuildSHAPPaths is called */
+  bool shap_paths_built_;
+  /*! \brief Max number of distinct features on the path of a leaf */
+  int shap_max_path_features_;
+  /*! \brief True once BuildSHAPTables is called */
+  bool shap_built_;
+  /*! \brief False if some split has no data, PredictContrib runs the recursive TreeSHAP then */
+  bool shap_tabled_;
+  /*! \brief Start of the path of every leaf in shap_splits_, num_leaves_ + 1 entries */
+  std::vector<int> shap_split_begin_;
+  std::vector<SHAPSplit> shap_splits_;
+  /*! \brief Start of the distinct features of the path of every leaf, num_leaves_ + 1 entries */
+  std::vector<int> shap_feature_begin_;
+  std::vector<int> shap_features_;
+  /*! \brief Fraction z of the data that follows the path at the splits of every distinct feature of a path */
+  std::vector<double> shap_zero_fractions_;
+  /*! \brief (1 - z) / z for every distinct feature of a path */
+  std::vector<double> shap_feature_ratios_;
+  /*! \brief Product of z over the path of every leaf */
+  std::vector<double> shap_zero_products_;
+  /*! \brief Shapley weights of the subsets of every size among D features, from D * (D - 1) / 2 */
+  std::vector<double> shap_weights_;
+  /*! \brief Start of the table of every leaf, 1 << (number of distinct features of its path) entries, -1 without table */
+  std::vector<int> shap_table_begin_;
+  /*! \brief G(A) of every subset A of the distinct features of a path, see BuildSHAPTables */
+  std::vector<double> shap_tables_;
+  /*! \brief Start of the background sets of every leaf, num_leaves_ + 1 entries, empty without background */
+  std::vector<int> background_begin_;
+  /*! \brief Distinct features of the path followed by some background rows, as bits */
+  std::vector<uint64_t> background_masks_;
+  /*! \brief Fraction of the background rows behind every set */
+  std::vector<double> background_fractions_;
+  /*! \brief True once BuildSaabasValues is called, reset when the leaf values change */
+  bool saabas_built_;
+  /*! \brief Value of every non-leaf node for PredictContribSaabas */
+  std::vector<double> saabas_values_;
 };
 
 inline void Tree::Split(int leaf, int feature, int real_feature,
                         double left_value, double right_value, int left_cnt, int right_cnt, float gain) {
+  shap_paths_built_ = false;
+  shap_built_ = false;
+  saabas_built_ = false;
   int new_node_idx = num_leaves_ - 1;
   // update parent info
   int parent = leaf_parent_[leaf];
@@ -404,19 +588,7 @@ inline int Tree::PredictLeafIndexByMap(const std::unordered_map<int, double>& fe
   }
 }
 
-inline void Tree::PredictContrib(const double* feature_values, int num_features, double* output) {
-  output[num_features] += ExpectedValue();
-  // Run the recursion with preallocated space for the unique path data
-  if (num_leaves_ > 1) {
-    CHECK(max_depth_ >= 0);
-    const int max_path_len = max_depth_ + 1;
-    std::vector<PathElement> unique_path_data(max_path_len*(max_path_len + 1) / 2);
-    TreeSHAP(feature_values, output, 0, 0, unique_path_data.data(), 1, 1, -1);
-  }
-}
-
 inline void Tree::RecomputeLeafDepths(int node, int depth) {
-  if (node == 0) leaf_depth_.resize(num_leaves());
   if (node < 0) {
     leaf_depth_[~node] = depth;
   } else {
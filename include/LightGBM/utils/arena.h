@@ -0,0 +1,180 @@
+#ifndef LIGHTGBM_UTILS_ARENA_H_
+#define LIGHTGBM_UTILS_ARENA_H_
+
+#include <LightGBM/utils/log.h>
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace LightGBM {
+
+/*!
+* \brief Bump allocator over one contiguous block.
+*        Everything carved from an arena is released together when the arena is destroyed,
+*        nothing is freed individually.
+*/
+class Arena {
+public:
+  /*! \brief Alignment of every allocation inside the block */
+  static const size_t kAlignment = 8;
+  /*! \brief Alignment of the block itself */
+  static const size_t kBlockAlignment = 64;
+  /*! \brief Size of a transparent huge page */
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  Arena() : data_(0), size_(0), used_(0), owned_(false) {}
+
+  /*!
+  * \brief Non-owning arena over an existing range, used to hand out disjoint slices of one block
+  * \param data Start of the range, should be aligned to kAlignment
+  * \param size Size of the range in bytes
+  */
+  Arena(char* data, size_t size) : data_(data), size_(size), used_(0), owned_(false) {}
+
+  ~Arena() { Release(); }
+
+  /*!
+  * \brief Allocate the backing block, drops the previous one
+  * \param size Size in bytes
+  * \param huge_page True to align the block to huge pages and advise the kernel to back it with them
+  */
+  void Reserve(size_t size, bool huge_page) {
+    Release();
+    if (size == 0) { return; }
+    size_t alignment = kBlockAlignment;
+    if (huge_page && size >= kHugePageSize) {
+      alignment = kHugePageSize;
+      size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+    void* ptr = 0;
+    #if defined(_MSC_VER)
+    ptr = _aligned_malloc(size, alignment);
+    #else
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+      ptr = 0;
+    }
+    #endif
+    if (ptr == 0) {
+      Log::Fatal("Cannot allocate %zu bytes for model storage", size);
+    }
+    #if defined(MADV_HUGEPAGE)
+    if (alignment == kHugePageSize) {
+      madvise(ptr, size, MADV_HUGEPAGE);
+    }
+    #endif
+    data_ = reinterpret_cast<char*>(ptr);
+    size_ = size;
+    used_ = 0;
+    owned_ = true;
+  }
+
+  /*!
+  * \brief Carve n objects of type T, the memory is not initialized
+  * \param n Number of objects
+  * \return Pointer to the first object, 0 when n is 0
+  */
+  template<typename T>
+  inline T* Allocate(size_t n) {
+    if (n == 0) { return 0; }
+    const size_t bytes = AlignedSize<T>(n);
+    if (used_ + bytes > size_) {
+      Log::Fatal("Model storage overflow, need %zu bytes but only %zu left", bytes, size_ - used_);
+    }
+    T* ret = reinterpret_cast<T*>(data_ + used_);
+    used_ += bytes;
+    return ret;
+  }
+
+  /*! \brief Bytes taken by n objects of type T inside an arena */
+  template<typename T>
+  inline static size_t AlignedSize(size_t n) {
+    return (n * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  inline char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline size_t used() const { return used_; }
+
+  /*! \brief Disable copy */
+  Arena& operator=(const Arena&) = delete;
+  /*! \brief Disable copy */
+  Arena(const Arena&) = delete;
+
+private:
+  void Release() {
+    if (owned_ && data_ != 0) {
+      #if defined(_MSC_VER)
+      _aligned_free(data_);
+      #else
+      free(data_);
+      #endif
+    }
+    data_ = 0;
+    size_ = 0;
+    used_ = 0;
+    owned_ = false;
+  }
+
+  /*! \brief Start of the block */
+  char* data_;
+  /*! \brief Size of the block */
+  size_t size_;
+  /*! \brief Bytes handed out so far */
+  size_t used_;
+  /*! \brief True if the block should be freed by this arena */
+  bool owned_;
+};
+
+/*!
+* \brief Fixed-size array living in an Arena, it never frees its storage
+*/
+template<typename T>
+class ArenaArray {
+public:
+  ArenaArray() : data_(0), size_(0) {}
+
+  /*!
+  * \brief Take n uninitialized objects from the arena
+  */
+  inline void Allocate(Arena* arena, size_t n) {
+    data_ = arena->Allocate<T>(n);
+    size_ = n;
+  }
+
+  /*!
+  * \brief Take n objects from the arena and fill them with val
+  */
+  inline void Allocate(Arena* arena, size_t n, const T& val) {
+    Allocate(arena, n);
+    for (size_t i = 0; i < n; ++i) {
+      data_[i] = val;
+    }
+  }
+
+  inline T& operator[](size_t i) { return data_[i]; }
+  inline const T& operator[](size_t i) const { return data_[i]; }
+  inline T* data() { return data_; }
+  inline const T* data() const { return data_; }
+  inline T* begin() { return data_; }
+  inline const T* begin() const { return data_; }
+  inline T* end() { return data_ + size_; }
+  inline const T* end() const { return data_ + size_; }
+  inline const T& back() const { return data_[size_ - 1]; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+private:
+  T* data_;
+  size_t size_;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_UTILS_ARENA_H_
@@ -5,6 +5,8 @@
 #include <LightGBM/utils/openmp_wrapper.h>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -423,8 +425,8 @@ struct __TToStringHelperFast<T, false, true> {
 };
 
 template<typename T>
-inline static std::string ArrayToStringFast(const std::vector<T>& arr, size_t n) {
-  if (arr.empty() || n == 0) {
+inline static std::string ArrayToStringFast(const T* arr, size_t n) {
+  if (arr == nullptr || n == 0) {
     return std::string("");
   }
   __TToStringHelperFast<T, std::is_floating_point<T>::value, std::is_unsigned<T>::value> helper;
@@ -433,15 +435,23 @@ inline static std::string ArrayToStringFast(const std::vector<T>& arr, size_t n)
   std::stringstream str_buf;
   helper(arr[0], buffer.data(), buf_len);
   str_buf << buffer.data();
-  for (size_t i = 1; i < std::min(n, arr.size()); ++i) {
+  for (size_t i = 1; i < n; ++i) {
     helper(arr[i], buffer.data(), buf_len);
     str_buf << ' ' << buffer.data();
   }
   return str_buf.str();
 }
 
-inline static std::string ArrayToString(const std::vector<double>& arr, size_t n) {
-  if (arr.empty() || n == 0) {
+template<typename T>
+inline static std::string ArrayToStringFast(const std::vector<T>& arr, size_t n) {
+  if (arr.empty()) {
+    return std::string("");
+  }
+  return ArrayToStringFast(arr.data(), std::min(n, arr.size()));
+}
+
+inline static std::string ArrayToString(const double* arr, size_t n) {
+  if (arr == nullptr || n == 0) {
     return std::string("");
   }
   const size_t buf_len = 32;
@@ -449,13 +459,20 @@ inline static std::string ArrayToString(const std::vector<double>& arr, size_t n
   std::stringstream str_buf;
   DoubleToStr(arr[0], buffer.data(), buf_len);
   str_buf << buffer.data();
-  for (size_t i = 1; i < std::min(n, arr.size()); ++i) {
+  for (size_t i = 1; i < n; ++i) {
     DoubleToStr(arr[i], buffer.data(), buf_len);
     str_buf << ' ' << buffer.data();
   }
   return str_buf.str();
 }
 
+inline static std::string ArrayToString(const std::vector<double>& arr, size_t n) {
+  if (arr.empty()) {
+    return std::string("");
+  }
+  return ArrayToString(arr.data(), std::min(n, arr.size()));
+}
+
 template<typename T, bool is_float>
 struct __StringToTHelper {
   T operator()(const std::string& str) const {
@@ -533,6 +550,35 @@ inline static std::vector<T> StringToArrayFast(const std::string& str, int n) {
   return ret;
 }
 
+/*!
+* \brief Parse n numbers separated by spaces into out, without temporary strings
+* \return Pointer after the last parsed number
+*/
+template<typename T>
+inline static const char* StringToArrayFast(const char* p_str, int n, T* out) {
+  __StringToTHelperFast<T, std::is_floating_point<T>::value> helper;
+  for (int i = 0; i < n; ++i) {
+    p_str = helper(p_str, &out[i]);
+  }
+  return p_str;
+}
+
+/*!
+* \brief Parse n doubles separated by spaces into out, same precision as StringToArray
+* \return Pointer after the last parsed number
+*/
+inline static const char* StringToArray(const char* p_str, int n, double* out) {
+  for (int i = 0; i < n; ++i) {
+    char* next = 0;
+    out[i] = std::strtod(p_str, &next);
+    if (next == p_str) {
+      Log::Fatal("Expect %d numbers but only %d found", n, i);
+    }
+    p_str = next;
+  }
+  return p_str;
+}
+
 template<typename T>
 inline static std::string Join(const std::vector<T>& strs, const char* delimiter) {
   if (strs.empty()) {
@@ -688,6 +734,77 @@ inline static float AvoidInf(float x) {
   }
 }
 
+/*!
+* \brief Convert float to IEEE 754 half precision, rounding to nearest even
+*/
+inline static uint16_t FloatToHalf(float val) {
+  uint32_t x;
+  std::memcpy(&x, &val, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const int exp = static_cast<int>((x >> 23) & 0xff);
+  uint32_t mant = x & 0x7fffff;
+  if (exp == 0xff) {
+    // inf or nan
+    return static_cast<uint16_t>(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+  }
+  const int half_exp = exp - 127 + 15;
+  if (half_exp >= 0x1f) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  if (half_exp <= 0) {
+    // subnormal half
+    if (half_exp < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mant |= 0x800000;
+    const int shift = 14 - half_exp;
+    uint32_t half_mant = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (half_mant & 1))) {
+      ++half_mant;
+    }
+    return static_cast<uint16_t>(sign | half_mant);
+  }
+  uint32_t half = sign | (static_cast<uint32_t>(half_exp) << 10) | (mant >> 13);
+  const uint32_t rem = mant & 0x1fff;
+  // a carry into the exponent is still the correctly rounded result
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return static_cast<uint16_t>(half);
+}
+
+/*!
+* \brief Convert IEEE 754 half precision to float, exact
+*/
+inline static float HalfToFloat(uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exp = (half >> 10) & 0x1f;
+  uint32_t mant = half & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else {
+      // normalize the subnormal half
+      exp = 127 - 15 + 1;
+      while ((mant & 0x400) == 0) {
+        mant <<= 1;
+        --exp;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float ret;
+  std::memcpy(&ret, &x, sizeof(ret));
+  return ret;
+}
+
 template<typename _Iter> inline
 static typename std::iterator_traits<_Iter>::value_type* IteratorValType(_Iter) {
   return (0);
@@ -0,0 +1,98 @@
+#ifndef LIGHTGBM_UTILS_MAPPED_FILE_H_
+#define LIGHTGBM_UTILS_MAPPED_FILE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LightGBM {
+
+/*!
+* \brief Read-only view of a whole file, mapped where the platform allows it
+*/
+class MappedFile {
+public:
+  MappedFile() : data_(0), size_(0) {}
+
+  ~MappedFile() { Close(); }
+
+  /*!
+  * \brief Map a file
+  * \param filename Name of the file
+  * \return False if the file cannot be opened or is empty
+  */
+  bool Open(const std::string& filename) {
+    Close();
+    #if defined(_WIN32)
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) { return false; }
+    const std::streamoff size = file.tellg();
+    if (size <= 0) { return false; }
+    // no mmap, keep a copy aligned to 8 bytes
+    buffer_.resize((static_cast<size_t>(size) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(buffer_.data()), size)) {
+      buffer_.clear();
+      return false;
+    }
+    data_ = reinterpret_cast<const char*>(buffer_.data());
+    size_ = static_cast<size_t>(size);
+    #else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      close(fd);
+      return false;
+    }
+    void* ptr = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if (ptr == MAP_FAILED) { return false; }
+    data_ = reinterpret_cast<const char*>(ptr);
+    size_ = static_cast<size_t>(st.st_size);
+    #endif
+    return true;
+  }
+
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+  /*! \brief Disable copy */
+  MappedFile& operator=(const MappedFile&) = delete;
+  /*! \brief Disable copy */
+  MappedFile(const MappedFile&) = delete;
+
+private:
+  void Close() {
+    #if defined(_WIN32)
+    buffer_.clear();
+    #else
+    if (data_ != 0) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    #endif
+    data_ = 0;
+    size_ = 0;
+  }
+
+  const char* data_;
+  size_t size_;
+  #if defined(_WIN32)
+  std::vector<uint64_t> buffer_;
+  #endif
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_UTILS_MAPPED_FILE_H_
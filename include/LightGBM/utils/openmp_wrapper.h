@@ -27,7 +27,10 @@ public:
   }
   void ReThrow() {
     if (ex_ptr_ != empty_ptr_) {
-      boost::rethrow_exception(ex_ptr_);
+      // thrown once, the destructor must not throw it again while the stack unwinds
+      boost::exception_ptr ex_ptr = ex_ptr_;
+      ex_ptr_ = empty_ptr_;
+      boost::rethrow_exception(ex_ptr);
     }
   }
   void CaptureException() {
@@ -67,6 +70,8 @@ catch(...) { omp_except_helper.CaptureException();  }
   inline void omp_set_nested(int) {}
   inline int omp_get_num_threads() {return 1;}
   inline int omp_get_thread_num() {return 0;}
+  inline int omp_get_max_threads() {return 1;}
+  inline int omp_in_parallel() {return 0;}
 #ifdef __cplusplus
 }; // extern "C"
 #endif
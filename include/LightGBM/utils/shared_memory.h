@@ -0,0 +1,194 @@
+#ifndef LIGHTGBM_UTILS_SHARED_MEMORY_H_
+#define LIGHTGBM_UTILS_SHARED_MEMORY_H_
+
+#include <LightGBM/utils/log.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LightGBM {
+
+const char kSharedMemoryMagic[8] = "LGBMSHM";
+
+/*!
+* \brief Control block at the start of a shared memory segment, the payload starts on the next page
+*/
+struct SharedMemoryControl {
+  char magic[8];
+  /*! \brief Set to 1 once the payload is complete */
+  volatile int32_t ready;
+  /*! \brief Number of attached users, the segment is unlinked when it drops to 0 */
+  volatile int32_t refcount;
+  uint64_t payload_offset;
+  uint64_t payload_size;
+};
+
+/*!
+* \brief Named POSIX shared memory segment holding a read-only payload.
+*        Every SharedMemory object holds one reference on the segment, the last one to go away unlinks it.
+*        A process that dies without releasing its reference leaves the segment behind,
+*        it can then be removed with shm_unlink (or from /dev/shm on Linux).
+*/
+class SharedMemory {
+public:
+  SharedMemory() : control_(0), control_size_(0), payload_(0), payload_size_(0) {}
+
+  ~SharedMemory() { Release(); }
+
+  /*!
+  * \brief Create a new segment holding a copy of data, fails if the name is taken
+  * \param name Name of the segment, e.g. "/my_model"
+  * \param data Payload
+  * \param size Size of payload
+  */
+  void Create(const std::string& name, const char* data, size_t size) {
+    #if defined(_WIN32)
+    Log::Fatal("Shared memory models are not supported on Windows");
+    #else
+    Release();
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t control_size = (sizeof(SharedMemoryControl) + page_size - 1) / page_size * page_size;
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      Log::Fatal("Cannot create shared memory segment %s: %s", name.c_str(), std::strerror(errno));
+    }
+    void* control = MAP_FAILED;
+    void* payload = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(control_size + size)) == 0) {
+      control = mmap(0, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      payload = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(control_size));
+    }
+    close(fd);
+    if (control == MAP_FAILED || payload == MAP_FAILED) {
+      const int err = errno;
+      if (control != MAP_FAILED) { munmap(control, control_size); }
+      if (payload != MAP_FAILED) { munmap(payload, size); }
+      shm_unlink(name.c_str());
+      Log::Fatal("Cannot map shared memory segment %s: %s", name.c_str(), std::strerror(err));
+    }
+    std::memcpy(payload, data, size);
+    // the payload is never written again, not even by its creator
+    mprotect(payload, size, PROT_READ);
+    SharedMemoryControl* ctrl = reinterpret_cast<SharedMemoryControl*>(control);
+    std::memcpy(ctrl->magic, kSharedMemoryMagic, sizeof(ctrl->magic));
+    ctrl->refcount = 1;
+    ctrl->payload_offset = control_size;
+    ctrl->payload_size = size;
+    __sync_synchronize();
+    ctrl->ready = 1;
+    name_ = name;
+    control_ = ctrl;
+    control_size_ = control_size;
+    payload_ = reinterpret_cast<const char*>(payload);
+    payload_size_ = size;
+    #endif
+  }
+
+  /*!
+  * \brief Attach to an existing segment, the payload is mapped read-only
+  * \param name Name of the segment
+  */
+  void Attach(const std::string& name) {
+    #if defined(_WIN32)
+    Log::Fatal("Shared memory models are not supported on Windows");
+    #else
+    Release();
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t control_size = (sizeof(SharedMemoryControl) + page_size - 1) / page_size * page_size;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      Log::Fatal("Cannot open shared memory segment %s: %s", name.c_str(), std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < control_size) {
+      close(fd);
+      Log::Fatal("Shared memory segment %s is not a LightGBM segment", name.c_str());
+    }
+    void* control = mmap(0, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (control == MAP_FAILED) {
+      close(fd);
+      Log::Fatal("Cannot map shared memory segment %s: %s", name.c_str(), std::strerror(errno));
+    }
+    SharedMemoryControl* ctrl = reinterpret_cast<SharedMemoryControl*>(control);
+    if (std::memcmp(ctrl->magic, kSharedMemoryMagic, sizeof(ctrl->magic)) != 0 || ctrl->ready != 1
+        || ctrl->payload_offset != control_size
+        || ctrl->payload_offset + ctrl->payload_size != static_cast<uint64_t>(st.st_size)) {
+      munmap(control, control_size);
+      close(fd);
+      Log::Fatal("Shared memory segment %s is not a complete LightGBM segment", name.c_str());
+    }
+    // never revive a segment whose last user is already unlinking it
+    int32_t count = ctrl->refcount;
+    while (count > 0) {
+      const int32_t prev = __sync_val_compare_and_swap(&ctrl->refcount, count, count + 1);
+      if (prev == count) { break; }
+      count = prev;
+    }
+    if (count <= 0) {
+      munmap(control, control_size);
+      close(fd);
+      Log::Fatal("Shared memory segment %s is being removed", name.c_str());
+    }
+    const size_t size = static_cast<size_t>(ctrl->payload_size);
+    void* payload = mmap(0, size, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(control_size));
+    close(fd);
+    name_ = name;
+    control_ = ctrl;
+    control_size_ = control_size;
+    if (payload == MAP_FAILED) {
+      const int err = errno;
+      Release();
+      Log::Fatal("Cannot map shared memory segment %s: %s", name.c_str(), std::strerror(err));
+    }
+    payload_ = reinterpret_cast<const char*>(payload);
+    payload_size_ = size;
+    #endif
+  }
+
+  inline const char* data() const { return payload_; }
+  inline size_t size() const { return payload_size_; }
+
+  /*! \brief Disable copy */
+  SharedMemory& operator=(const SharedMemory&) = delete;
+  /*! \brief Disable copy */
+  SharedMemory(const SharedMemory&) = delete;
+
+private:
+  /*! \brief Drop the reference of this object, unlink the segment if it was the last one */
+  void Release() {
+    #if !defined(_WIN32)
+    if (control_ == 0) { return; }
+    if (payload_ != 0) {
+      munmap(const_cast<char*>(payload_), payload_size_);
+    }
+    if (__sync_sub_and_fetch(&control_->refcount, 1) == 0) {
+      shm_unlink(name_.c_str());
+    }
+    munmap(control_, control_size_);
+    #endif
+    control_ = 0;
+    control_size_ = 0;
+    payload_ = 0;
+    payload_size_ = 0;
+    name_.clear();
+  }
+
+  std::string name_;
+  SharedMemoryControl* control_;
+  size_t control_size_;
+  const char* payload_;
+  size_t payload_size_;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_UTILS_SHARED_MEMORY_H_
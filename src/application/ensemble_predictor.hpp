@@ -0,0 +1,208 @@
+#ifndef LIGHTGBM_ENSEMBLE_PREDICTOR_HPP_
+#define LIGHTGBM_ENSEMBLE_PREDICTOR_HPP_
+
+#include <LightGBM/meta.h>
+#include <LightGBM/boosting.h>
+#include <LightGBM/prediction_early_stop.h>
+
+#include <LightGBM/utils/log.h>
+#include <LightGBM/utils/openmp_wrapper.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <functional>
+
+namespace LightGBM {
+
+/*! \brief Size of the shared rows of a block of EnsemblePredictor, small enough to stay in cache with the trees */
+const size_t kEnsembleBlockBytes = 64 * 1024;
+/*! \brief Rows of a block of EnsemblePredictor when the rows are narrow */
+const size_t kEnsembleMaxBlockRows = 64;
+
+/*!
+* \brief Used to predict data with several models at once, e.g. a blend of models on the same rows.
+*        A row is converted once into the features of all models, and the rows are scored in blocks,
+*        every model over a whole block before the next one so that its trees stay in cache.
+*/
+class EnsemblePredictor {
+public:
+  /*!
+  * \brief Constructor, the models must not change while it is used
+  * \param boostings Models of the members
+  * \param num_iterations Number of iterations of every member, <= 0 for all of them
+  * \param is_raw_score True for the raw scores of a member, false to transform them as Predict does
+  * \param weights Weight of every member in the blend
+  * \param num_rows Rows of the batch, every member uses its predict plan of this batch size
+  */
+  EnsemblePredictor(const std::vector<Boosting*>& boostings, const std::vector<int>& num_iterations,
+                    const std::vector<bool>& is_raw_score, const std::vector<double>& weights, int num_rows)
+    : boostings_(boostings.begin(), boostings.end()), is_raw_score_(is_raw_score), weights_(weights) {
+    early_stop_ = CreatePredictionEarlyStopInstance("none", PredictionEarlyStopConfig());
+    const int num_members = static_cast<int>(boostings.size());
+    num_class_ = boostings[0]->NumModelPerIteration();
+    int num_feature = 0;
+    for (int m = 0; m < num_members; ++m) {
+      if (boostings[m]->NumModelPerIteration() != num_class_) {
+        Log::Fatal("Models of an ensemble need the same number of classes, model %d has %d instead of %d",
+                   m, boostings[m]->NumModelPerIteration(), num_class_);
+      }
+      num_feature = std::max(num_feature, boostings[m]->MaxFeatureIdx() + 1);
+    }
+    // the shared row holds the features any member uses, every member gathers its own from it
+    std::vector<std::vector<int>> member_features(num_members);
+    union_slots_.assign(num_feature, -1);
+    for (int m = 0; m < num_members; ++m) {
+      const int num_member_feature = boostings[m]->MaxFeatureIdx() + 1;
+      if (boostings[m]->NumPredictFeatures() < num_member_feature) {
+        member_features[m] = boostings[m]->UsedFeatures();
+      } else {
+        for (int i = 0; i < num_member_feature; ++i) {
+          member_features[m].push_back(i);
+        }
+      }
+      for (size_t i = 0; i < member_features[m].size(); ++i) {
+        union_slots_[member_features[m][i]] = 0;
+      }
+    }
+    for (int i = 0; i < num_feature; ++i) {
+      if (union_slots_[i] >= 0) {
+        union_slots_[i] = static_cast<int>(used_features_.size());
+        used_features_.push_back(i);
+      }
+    }
+    const int num_union_feature = static_cast<int>(used_features_.size());
+    member_slots_.resize(num_members);
+    is_identity_.resize(num_members);
+    size_t max_member_feature = 1;
+    num_iteration_for_pred_.resize(num_members);
+    for (int m = 0; m < num_members; ++m) {
+      for (size_t i = 0; i < member_features[m].size(); ++i) {
+        member_slots_[m].push_back(union_slots_[member_features[m][i]]);
+      }
+      // a member that uses every feature of the shared row reads it in place
+      is_identity_[m] = static_cast<int>(member_features[m].size()) == num_union_feature;
+      max_member_feature = std::max(max_member_feature, member_features[m].size());
+      boostings[m]->InitPredict(num_iterations[m], false);
+      const int num_total_iteration = boostings[m]->GetCurrentIteration();
+      num_iteration_for_pred_[m] = num_iterations[m] > 0 ? std::min(num_iterations[m], num_total_iteration)
+                                                         : num_total_iteration;
+      GBDTBase* gbdt = dynamic_cast<GBDTBase*>(boostings[m]);
+      if (gbdt != nullptr) {
+        bool row_parallel = false;
+        gbdt->SelectPredictPlan(num_rows, &row_parallel);
+      }
+    }
+    block_rows_ = static_cast<int>(std::min<size_t>(kEnsembleMaxBlockRows,
+        std::max<size_t>(1, kEnsembleBlockBytes / (sizeof(double) * std::max(num_union_feature, 1)))));
+    const int num_threads = omp_get_max_threads();
+    row_bufs_.assign(num_threads, std::vector<double>(static_cast<size_t>(block_rows_) * num_union_feature, 0.0f));
+    member_bufs_.assign(num_threads, std::vector<double>(max_member_feature, 0.0f));
+  }
+
+  /*! \brief Number of predictions of a row, the classes of every member and of the blend */
+  int NumPredictOneRow() const {
+    return (static_cast<int>(boostings_.size()) + 1) * num_class_;
+  }
+
+  /*! \brief Features any member uses, in increasing order */
+  const std::vector<int>& UsedFeatures() const {
+    return used_features_;
+  }
+
+  /*!
+  * \brief Predict rows with every member and blend them
+  * \param num_rows Number of rows
+  * \param get_row_fun Features of a row
+  * \param output For every row the prediction of every member, then their weighted sum
+  */
+  void Predict(int num_rows, const std::function<std::vector<std::pair<int, double>>(int row_idx)>& get_row_fun,
+               double* output) {
+    const int num_members = static_cast<int>(boostings_.size());
+    const int num_union_feature = static_cast<int>(used_features_.size());
+    const int num_pred_one_row = NumPredictOneRow();
+    const int num_blocks = (num_rows + block_rows_ - 1) / block_rows_;
+    // small batches leave the threads to the members, which may split their trees
+    const bool row_parallel = num_rows >= omp_get_max_threads();
+    OMP_INIT_EX();
+    #pragma omp parallel for schedule(static) if (row_parallel && num_blocks > 1)
+    for (int block = 0; block < num_blocks; ++block) {
+      OMP_LOOP_EX_BEGIN();
+      const int tid = omp_get_thread_num();
+      double* rows = row_bufs_[tid].data();
+      double* member_buf = member_bufs_[tid].data();
+      const int row_begin = block * block_rows_;
+      const int block_size = std::min(block_rows_, num_rows - row_begin);
+      // convert every row once
+      for (int r = 0; r < block_size; ++r) {
+        const std::vector<std::pair<int, double>> one_row = get_row_fun(row_begin + r);
+        double* row = rows + static_cast<size_t>(r) * num_union_feature;
+        for (size_t i = 0; i < one_row.size(); ++i) {
+          if (one_row[i].first < static_cast<int>(union_slots_.size()) && union_slots_[one_row[i].first] >= 0) {
+            row[union_slots_[one_row[i].first]] = one_row[i].second;
+          }
+        }
+      }
+      for (int m = 0; m < num_members; ++m) {
+        const std::vector<int>& slots = member_slots_[m];
+        for (int r = 0; r < block_size; ++r) {
+          const double* row = rows + static_cast<size_t>(r) * num_union_feature;
+          const double* features = row;
+          if (!is_identity_[m]) {
+            for (size_t j = 0; j < slots.size(); ++j) {
+              member_buf[j] = row[slots[j]];
+            }
+            features = member_buf;
+          }
+          double* member_output = output + static_cast<size_t>(row_begin + r) * num_pred_one_row + m * num_class_;
+          boostings_[m]->PredictRaw(features, member_output, &early_stop_);
+          if (!is_raw_score_[m]) {
+            dynamic_cast<const GBDTBase*>(boostings_[m])->ConvertRawScore(member_output, num_iteration_for_pred_[m],
+                                                                          member_output);
+          }
+        }
+      }
+      for (int r = 0; r < block_size; ++r) {
+        double* row_output = output + static_cast<size_t>(row_begin + r) * num_pred_one_row;
+        double* blend = row_output + num_members * num_class_;
+        for (int k = 0; k < num_class_; ++k) {
+          blend[k] = 0.0f;
+        }
+        for (int m = 0; m < num_members; ++m) {
+          for (int k = 0; k < num_class_; ++k) {
+            blend[k] += weights_[m] * row_output[m * num_class_ + k];
+          }
+        }
+      }
+      std::memset(rows, 0, sizeof(double) * block_size * num_union_feature);
+      OMP_LOOP_EX_END();
+    }
+    OMP_THROW_EX();
+  }
+
+private:
+  std::vector<const Boosting*> boostings_;
+  std::vector<bool> is_raw_score_;
+  std::vector<double> weights_;
+  /*! \brief Iterations every member predicts with, to average or transform its raw scores */
+  std::vector<int> num_iteration_for_pred_;
+  int num_class_;
+  PredictionEarlyStopInstance early_stop_;
+  /*! \brief Position of every feature in the shared row, -1 if no member uses it */
+  std::vector<int> union_slots_;
+  std::vector<int> used_features_;
+  /*! \brief Position in the shared row of every feature of the prediction buffer of a member */
+  std::vector<std::vector<int>> member_slots_;
+  /*! \brief True if the prediction buffer of a member is the shared row */
+  std::vector<bool> is_identity_;
+  int block_rows_;
+  /*! \brief Shared rows of a block for every thread */
+  std::vector<std::vector<double>> row_bufs_;
+  /*! \brief Prediction buffer of a member for every thread */
+  std::vector<std::vector<double>> member_bufs_;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_ENSEMBLE_PREDICTOR_HPP_
@@ -5,6 +5,7 @@
 #include <LightGBM/boosting.h>
 //#include <LightGBM/dataset.h>
 
+#include <LightGBM/utils/log.h>
 #include <LightGBM/utils/openmp_wrapper.h>
 
 #include <map>
@@ -49,9 +50,10 @@ public:
   * \param is_raw_score True if need to predict result with raw score
   * \param predict_leaf_index True to output leaf index instead of prediction score
   * \param predict_contrib True to output feature contributions instead of prediction score
+  * \param contrib_method How the contributions are computed
   */
   Predictor(Boosting* boosting, int num_iteration,
-            bool is_raw_score, bool predict_leaf_index, bool predict_contrib,
+            bool is_raw_score, bool predict_leaf_index, bool predict_contrib, ContribMethod contrib_method,
             bool early_stop, int early_stop_freq, double early_stop_margin) {
 
     early_stop_ = CreatePredictionEarlyStopInstance("none", LightGBM::PredictionEarlyStopConfig());
@@ -73,14 +75,27 @@ public:
     {
       num_threads_ = omp_get_num_threads();
     }
-    boosting->InitPredict(num_iteration, predict_contrib);
+    boosting->InitPredict(num_iteration, predict_contrib, contrib_method);
     boosting_ = boosting;
+    predict_leaf_index_ = predict_leaf_index;
+    predict_contrib_ = predict_contrib;
+    normalize_classes_ = false;
+    defer_transform_ = false;
     num_pred_one_row_ = boosting_->NumPredictOneRow(num_iteration, predict_leaf_index, predict_contrib);
     num_feature_ = boosting_->MaxFeatureIdx() + 1;
-    predict_buf_ = std::vector<std::vector<double>>(num_threads_, std::vector<double>(num_feature_, 0.0f));
+    num_predict_feature_ = boosting_->NumPredictFeatures();
+    // the buffer only holds the features the trees use
+    if (num_predict_feature_ < num_feature_) {
+      const std::vector<int>& used_features = boosting_->UsedFeatures();
+      feature_slots_ = std::vector<int>(num_feature_, -1);
+      for (int i = 0; i < num_predict_feature_; ++i) {
+        feature_slots_[used_features[i]] = i;
+      }
+    }
+    predict_buf_ = std::vector<std::vector<double>>(num_threads_, std::vector<double>(num_predict_feature_, 0.0f));
     const int kFeatureThreshold = 100000;
     const size_t KSparseThreshold = static_cast<size_t>(0.01 * num_feature_);
-    if (predict_leaf_index || is_raw_score) {
+    if (is_raw_score) {
     	throw std::runtime_error("This prediction type is not implmented");
     }
     predict_fun_ = predict_ftor(this, kFeatureThreshold, KSparseThreshold);
@@ -92,17 +107,114 @@ public:
   ~Predictor() {
   }
 
+  /*!
+  * \brief Predict only some classes from now on, see Boosting::PredictClasses
+  * \param classes Classes to predict
+  * \param normalize True to apply softmax over the classes, false for their raw scores.
+  *        Only for the multiclass objective, whose outputs are a softmax as well
+  */
+  void SetClasses(const std::vector<int>& classes, bool normalize) {
+    if (normalize && std::strcmp(boosting_->ObjectiveName(), "multiclass") != 0) {
+      Log::Fatal("pred_normalize_classes needs the multiclass objective, the objective of the model is \"%s\"",
+                 boosting_->ObjectiveName());
+    }
+    for (size_t i = 0; i < classes.size(); ++i) {
+      if (classes[i] < 0 || classes[i] >= boosting_->NumberOfClasses()) {
+        Log::Fatal("Class %d is out of range, the model has %d classes", classes[i], boosting_->NumberOfClasses());
+      }
+    }
+    classes_ = classes;
+    normalize_classes_ = normalize;
+    num_pred_one_row_ = static_cast<int>(classes_.size());
+  }
+
+  /*!
+  * \brief Leave the predictions as raw scores from now on, for the caller to transform a block of rows
+  *        at a time with GBDTBase::ConvertRawScores
+  */
+  void DeferTransform() {
+    defer_transform_ = true;
+  }
+
   inline const PredictFunction& GetPredictFunction() const {
     return predict_fun_;
   }
 
+  /*!
+  * \brief Leaf index of one record in every tree used for prediction
+  * \param features Features of the record
+  * \param output Leaf indices
+  */
+  void PredictLeafIndex(const std::vector<std::pair<int, double>>& features, int32_t* output) {
+    CHECK(predict_leaf_index_);
+    const int tid = omp_get_thread_num();
+    CopyToPredictBuffer(predict_buf_[tid].data(), features);
+    boosting_->PredictLeafIndex(predict_buf_[tid].data(), output);
+    ClearPredictBuffer(predict_buf_[tid].data(), predict_buf_[tid].size(), features);
+  }
+
+  /*!
+  * \brief Predictions of one record at several numbers of iterations, see Boosting::PredictStaged
+  * \param features Features of the record
+  * \param checkpoints Numbers of iterations in increasing order
+  * \param is_raw_score True for the raw scores
+  * \param output Predictions of every checkpoint
+  */
+  void PredictStaged(const std::vector<std::pair<int, double>>& features, const std::vector<int>& checkpoints,
+                     bool is_raw_score, double* output) {
+    const int tid = omp_get_thread_num();
+    CopyToPredictBuffer(predict_buf_[tid].data(), features);
+    boosting_->PredictStaged(predict_buf_[tid].data(), checkpoints, is_raw_score, output);
+    ClearPredictBuffer(predict_buf_[tid].data(), predict_buf_[tid].size(), features);
+  }
+
+  /*!
+  * \brief Add the outputs of some trees to the raw scores of one record, see GBDTBase::AddTreesToRawScore
+  * \param features Features of the record
+  * \param first_tree First tree to add
+  * \param end_tree End of the trees to add
+  * \param raw_score Raw scores of the record, updated in place
+  */
+  void AddTreesToRawScore(const std::vector<std::pair<int, double>>& features, int first_tree, int end_tree,
+                          double* raw_score) {
+    const int tid = omp_get_thread_num();
+    CopyToPredictBuffer(predict_buf_[tid].data(), features);
+    dynamic_cast<const GBDTBase*>(boosting_)->AddTreesToRawScore(predict_buf_[tid].data(), first_tree, end_tree,
+                                                                  raw_score);
+    ClearPredictBuffer(predict_buf_[tid].data(), predict_buf_[tid].size(), features);
+  }
+
+  /*!
+  * \brief Feature contributions of one record without the zeros, see Boosting::PredictContribSparse
+  * \param features Features of the record
+  * \param top_k Number of features to keep for every class, 0 for all of them
+  * \param output Features and contributions of every class
+  */
+  void PredictContribSparse(const std::vector<std::pair<int, double>>& features, int top_k,
+                            std::vector<std::vector<std::pair<int, double>>>* output) {
+    CHECK(predict_contrib_);
+    const int tid = omp_get_thread_num();
+    CopyToPredictBuffer(predict_buf_[tid].data(), features);
+    boosting_->PredictContribSparse(predict_buf_[tid].data(), top_k, output);
+    ClearPredictBuffer(predict_buf_[tid].data(), predict_buf_[tid].size(), features);
+  }
+
 private:
 
+  /*! \brief Position of a feature in the prediction buffer, -1 if no tree uses it */
+  inline int FeatureSlot(int feature) const {
+    if (feature >= num_feature_) {
+      return -1;
+    }
+    return feature_slots_.empty() ? feature : feature_slots_[feature];
+  }
+
   void CopyToPredictBuffer(double* pred_buf, const std::vector<std::pair<int, double>>& features) {
     int loop_size = static_cast<int>(features.size());
     for (int i = 0; i < loop_size; ++i) {
-      if (features[i].first < num_feature_) {
-        pred_buf[features[i].first] = features[i].second;
+      const int slot = FeatureSlot(features[i].first);
+      if (slot >= 0) {
+        pred_buf[slot] = features[i].second;
       }
     }
   }
@@ -113,8 +225,9 @@ private:
     } else {
       int loop_size = static_cast<int>(features.size());
       for (int i = 0; i < loop_size; ++i) {
-        if (features[i].first < num_feature_) {
-          pred_buf[features[i].first] = 0.0f;
+        const int slot = FeatureSlot(features[i].first);
+        if (slot >= 0) {
+          pred_buf[slot] = 0.0f;
         }
       }
     }
@@ -124,8 +237,9 @@ private:
     std::unordered_map<int, double> buf;
     int loop_size = static_cast<int>(features.size());
     for (int i = 0; i < loop_size; ++i) {
-      if (features[i].first < num_feature_) {
-        buf[features[i].first] = features[i].second;
+      const int slot = FeatureSlot(features[i].first);
+      if (slot >= 0) {
+        buf[slot] = features[i].second;
       }
     }
     return std::move(buf);
@@ -137,7 +251,18 @@ private:
   PredictFunction predict_fun_;
   PredictionEarlyStopInstance early_stop_;
   int num_feature_;
+  /*! \brief Size of the prediction buffer, see Boosting::NumPredictFeatures */
+  int num_predict_feature_;
+  /*! \brief Position of every feature in the prediction buffer, empty when the buffer holds every feature */
+  std::vector<int> feature_slots_;
   int num_pred_one_row_;
+  bool predict_leaf_index_;
+  bool predict_contrib_;
+  /*! \brief Classes to predict, empty for all of them */
+  std::vector<int> classes_;
+  bool normalize_classes_;
+  /*! \brief True to predict raw scores, see DeferTransform */
+  bool defer_transform_;
   int num_threads_;
   std::vector<std::vector<double>> predict_buf_;
 };
@@ -151,12 +276,38 @@ namespace {
 
 	void predict_ftor::operator() (const std::vector<std::pair<int, double>>& features, double* output) {
 		int tid = omp_get_thread_num();
-		if (predictor_->num_feature_ > kFeatureThreshold_ && features.size() < KSparseThreshold_) {
+		if (predictor_->predict_leaf_index_) {
+			if (predictor_->num_predict_feature_ > kFeatureThreshold_ && features.size() < KSparseThreshold_) {
+				auto buf = predictor_->CopyToPredictMap(features);
+				predictor_->boosting_->PredictLeafIndexByMap(buf, output);
+			} else {
+				predictor_->CopyToPredictBuffer(predictor_->predict_buf_[tid].data(), features);
+				predictor_->boosting_->PredictLeafIndex(predictor_->predict_buf_[tid].data(), output);
+				predictor_->ClearPredictBuffer(predictor_->predict_buf_[tid].data(), predictor_->predict_buf_[tid].size(), features);
+			}
+		} else if (predictor_->predict_contrib_) {
+			predictor_->CopyToPredictBuffer(predictor_->predict_buf_[tid].data(), features);
+			predictor_->boosting_->PredictContrib(predictor_->predict_buf_[tid].data(), output);
+			predictor_->ClearPredictBuffer(predictor_->predict_buf_[tid].data(), predictor_->predict_buf_[tid].size(), features);
+		} else if (!predictor_->classes_.empty()) {
+			predictor_->CopyToPredictBuffer(predictor_->predict_buf_[tid].data(), features);
+			predictor_->boosting_->PredictClasses(predictor_->predict_buf_[tid].data(), predictor_->classes_,
+			                                      predictor_->normalize_classes_, output);
+			predictor_->ClearPredictBuffer(predictor_->predict_buf_[tid].data(), predictor_->predict_buf_[tid].size(), features);
+		} else if (predictor_->num_predict_feature_ > kFeatureThreshold_ && features.size() < KSparseThreshold_) {
 			auto buf = predictor_->CopyToPredictMap(features);
-			predictor_->boosting_->PredictByMap(buf, output, &predictor_->early_stop_);
+			if (predictor_->defer_transform_) {
+				predictor_->boosting_->PredictRawByMap(buf, output, &predictor_->early_stop_);
+			} else {
+				predictor_->boosting_->PredictByMap(buf, output, &predictor_->early_stop_);
+			}
 		} else {
 			predictor_->CopyToPredictBuffer(predictor_->predict_buf_[tid].data(), features);
-			predictor_->boosting_->Predict (predictor_->predict_buf_[tid].data(), output, &predictor_->early_stop_);
+			if (predictor_->defer_transform_) {
+				predictor_->boosting_->PredictRaw(predictor_->predict_buf_[tid].data(), output, &predictor_->early_stop_);
+			} else {
+				predictor_->boosting_->Predict (predictor_->predict_buf_[tid].data(), output, &predictor_->early_stop_);
+			}
 			predictor_->ClearPredictBuffer (predictor_->predict_buf_[tid].data(), predictor_->predict_buf_[tid].size(), features);
 		}
 	}
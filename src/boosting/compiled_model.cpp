@@ -0,0 +1,314 @@
+#include "compiled_model.h"
+
+#include <LightGBM/meta.h>
+#include <LightGBM/utils/common.h>
+#include <LightGBM/utils/log.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace LightGBM {
+
+namespace {
+
+/*! \brief Exact C literal of a double */
+std::string DoubleLiteral(double val) {
+  if (std::isnan(val)) {
+    return "(0.0 / 0.0)";
+  } else if (std::isinf(val)) {
+    return val > 0 ? "(1.0 / 0.0)" : "(-1.0 / 0.0)";
+  }
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%a", val);
+  return buf;
+}
+
+/*! \brief Label of a node or of a leaf (~leaf) in the function of a tree */
+std::string Label(int node) {
+  std::stringstream str_buf;
+  if (node >= 0) {
+    str_buf << "n" << node;
+  } else {
+    str_buf << "l" << ~node;
+  }
+  return str_buf.str();
+}
+
+/*!
+* \brief Condition for going left at a numerical split, same as Tree::NumericalDecision.
+*        The missing value handling is resolved here, so only the comparisons that can matter are emitted.
+*/
+std::string NumericalCondition(const Tree& tree, int node) {
+  std::stringstream str_buf;
+  const int8_t decision_type = tree.decision_type(node);
+  const uint8_t missing_type = Tree::GetMissingType(decision_type);
+  const bool default_left = Tree::GetDecisionType(decision_type, kDefaultLeftMask);
+  const double threshold = tree.threshold(node);
+  const std::string t = DoubleLiteral(threshold);
+  if (missing_type == 0) {
+    // NaN is compared as 0
+    if (0.0 <= threshold) {
+      str_buf << "!(v > " << t << ")";
+    } else {
+      str_buf << "v <= " << t;
+    }
+  } else if (missing_type == 1) {
+    // NaN is converted to 0 and then missing
+    const std::string z = DoubleLiteral(kZeroThreshold);
+    const std::string missing = "(v != v || (v > -" + z + " && v <= " + z + "))";
+    if (default_left) {
+      str_buf << "v <= " << t << " || " << missing;
+    } else {
+      str_buf << "v <= " << t << " && !" << missing;
+    }
+  } else {
+    if (default_left) {
+      str_buf << "v <= " << t << " || v != v";
+    } else {
+      str_buf << "v <= " << t;
+    }
+  }
+  return str_buf.str();
+}
+
+/*! \brief Condition for going left at a categorical split, same as Tree::CategoricalDecision */
+std::string CategoricalCondition(const Tree& tree, int node, int index, int offset, int num_words,
+                                 const uint32_t* words) {
+  std::stringstream str_buf;
+  const uint8_t missing_type = Tree::GetMissingType(tree.decision_type(node));
+  // NaN that is not missing falls into category 0
+  const bool nan_left = missing_type != 2 && num_words > 0 && (words[0] & 1) != 0;
+  str_buf << "iv >= 0 && (v != v ? " << (nan_left ? 1 : 0) << " : ";
+  if (num_words > 0) {
+    str_buf << "(iv < " << 32 * num_words << " && ((lgbm_cat_" << index << "[" << offset
+            << " + iv / 32] >> (iv & 31)) & 1))";
+  } else {
+    str_buf << "0";
+  }
+  str_buf << ")";
+  return str_buf.str();
+}
+
+/*!
+* \brief One tree as a static function. Nodes are flat labels, the child that saw more training data
+*        directly follows its parent so that the common path is straight-line code.
+*/
+std::string TreeToC(const Tree& tree, int index) {
+  std::stringstream str_buf;
+  if (tree.num_leaves() <= 1) {
+    str_buf << "static double lgbm_tree_" << index << "(const double* x) { (void)x; return "
+            << DoubleLiteral(tree.LeafOutput(0)) << "; }\n";
+    return str_buf.str();
+  }
+  const int num_nodes = tree.num_leaves() - 1;
+  // bitsets of categorical splits, by node
+  std::vector<int> cat_offset(num_nodes, 0);
+  std::vector<uint32_t> cat_words;
+  for (int i = 0; i < num_nodes; ++i) {
+    if (tree.IsCategoricalSplit(i)) {
+      int num_words = 0;
+      const uint32_t* words = tree.cat_threshold(i, &num_words);
+      cat_offset[i] = static_cast<int>(cat_words.size());
+      cat_words.insert(cat_words.end(), words, words + num_words);
+    }
+  }
+  if (!cat_words.empty()) {
+    str_buf << "static const uint32_t lgbm_cat_" << index << "[] = {";
+    for (size_t i = 0; i < cat_words.size(); ++i) {
+      if (i != 0) {
+        str_buf << ",";
+      }
+      str_buf << cat_words[i] << "u";
+    }
+    str_buf << "};\n";
+  }
+  str_buf << "static double lgbm_tree_" << index << "(const double* x) {\n";
+  str_buf << "  double v;\n";
+  if (tree.num_cat() > 0) {
+    str_buf << "  int iv;\n";
+  }
+  std::vector<int> stack(1, 0);
+  bool is_root = true;
+  while (!stack.empty()) {
+    int node = stack.back();
+    stack.pop_back();
+    if (!is_root) {
+      str_buf << Label(node) << ":\n";
+    }
+    is_root = false;
+    // follow the hot path until a leaf
+    while (node >= 0) {
+      const int left = tree.left_child(node);
+      const int right = tree.right_child(node);
+      str_buf << "  v = x[" << tree.split_feature(node) << "];\n";
+      std::string cond;
+      if (tree.IsCategoricalSplit(node)) {
+        int num_words = 0;
+        const uint32_t* words = tree.cat_threshold(node, &num_words);
+        str_buf << "  iv = (int)v;\n";
+        cond = CategoricalCondition(tree, node, index, cat_offset[node], num_words, words);
+      } else {
+        cond = NumericalCondition(tree, node);
+      }
+      if (tree.data_count(left) >= tree.data_count(right)) {
+        str_buf << "  if (!(" << cond << ")) goto " << Label(right) << ";\n";
+        stack.push_back(right);
+        node = left;
+      } else {
+        str_buf << "  if (" << cond << ") goto " << Label(left) << ";\n";
+        stack.push_back(left);
+        node = right;
+      }
+    }
+    str_buf << "  return " << DoubleLiteral(tree.LeafOutput(~node)) << ";\n";
+  }
+  str_buf << "}\n";
+  return str_buf.str();
+}
+
+#if !defined(_WIN32)
+/*! \brief Removes the generated files once the library is loaded or the build failed */
+struct BuildDirectory {
+  std::string dir;
+  std::string source;
+  std::string library;
+  ~BuildDirectory() {
+    std::remove(source.c_str());
+    std::remove(library.c_str());
+    rmdir(dir.c_str());
+  }
+};
+
+/*!
+* \brief Run a program without a shell, so that the arguments are never interpreted by one
+* \param args Program, looked up in PATH, and its arguments
+* \return True if the program ran and exited with 0
+*/
+bool RunProgram(const std::vector<std::string>& args) {
+  std::vector<char*> argv;
+  for (size_t i = 0; i < args.size(); ++i) {
+    argv.push_back(const_cast<char*>(args[i].c_str()));
+  }
+  argv.push_back(0);
+  pid_t pid;
+  if (posix_spawnp(&pid, argv[0], 0, 0, argv.data(), environ) != 0) {
+    return false;
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
+
+}  // namespace
+
+CompiledModel::CompiledModel() : library_(0), num_trees_(0), trees_(0) {
+}
+
+CompiledModel::~CompiledModel() {
+  #if !defined(_WIN32)
+  if (library_ != 0) {
+    dlclose(library_);
+  }
+  #endif
+}
+
+std::string CompiledModel::GenerateCode(const std::vector<Tree*>& trees) {
+  std::stringstream str_buf;
+  str_buf << "/* generated by LightGBM */\n";
+  str_buf << "#include <stdint.h>\n\n";
+  for (size_t i = 0; i < trees.size(); ++i) {
+    str_buf << TreeToC(*trees[i], static_cast<int>(i));
+  }
+  str_buf << "\nconst int lgbm_compiled_num_trees = " << trees.size() << ";\n";
+  str_buf << "double (*const lgbm_compiled_trees[])(const double*) = {\n";
+  for (size_t i = 0; i < trees.size(); ++i) {
+    str_buf << "  lgbm_tree_" << i << ",\n";
+  }
+  str_buf << "};\n";
+  return str_buf.str();
+}
+
+bool CompiledModel::Build(const std::vector<Tree*>& trees, const std::string& compiler) {
+  #if defined(_WIN32)
+  Log::Warning("Compiling the model is not supported on Windows, the trees are interpreted");
+  return false;
+  #else
+  const char* tmp_dir = std::getenv("TMPDIR");
+  std::string dir_template = std::string(tmp_dir != 0 && tmp_dir[0] != '\0' ? tmp_dir : "/tmp") + "/lightgbm-XXXXXX";
+  std::vector<char> dir_buf(dir_template.begin(), dir_template.end());
+  dir_buf.push_back('\0');
+  if (mkdtemp(dir_buf.data()) == 0) {
+    Log::Warning("Cannot create a directory to compile the model in, the trees are interpreted");
+    return false;
+  }
+  BuildDirectory build;
+  build.dir = dir_buf.data();
+  build.source = build.dir + "/model.c";
+  build.library = build.dir + "/model.so";
+  {
+    std::ofstream source(build.source.c_str());
+    source << GenerateCode(trees);
+    if (!source) {
+      Log::Warning("Cannot write the code of the model to %s, the trees are interpreted", build.source.c_str());
+      return false;
+    }
+  }
+  // split on white space and run without a shell, quotes and other shell syntax are not interpreted
+  std::vector<std::string> args = Common::Split(compiler.c_str(), " \t");
+  if (args.empty()) {
+    Log::Warning("model_compiler is empty, the trees are interpreted");
+    return false;
+  }
+  args.push_back("-shared");
+  args.push_back("-fPIC");
+  args.push_back("-o");
+  args.push_back(build.library);
+  args.push_back(build.source);
+  if (!RunProgram(args)) {
+    Log::Warning("Failed to compile the model with \"%s\", the trees are interpreted", compiler.c_str());
+    return false;
+  }
+  void* library = dlopen(build.library.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (library == 0) {
+    Log::Warning("Cannot load the compiled model: %s, the trees are interpreted", dlerror());
+    return false;
+  }
+  const int* num_trees = reinterpret_cast<const int*>(dlsym(library, "lgbm_compiled_num_trees"));
+  const TreeFunction* tree_functions = reinterpret_cast<const TreeFunction*>(dlsym(library, "lgbm_compiled_trees"));
+  if (num_trees == 0 || tree_functions == 0 || *num_trees != static_cast<int>(trees.size())) {
+    dlclose(library);
+    Log::Warning("The compiled model does not match the trees, the trees are interpreted");
+    return false;
+  }
+  if (library_ != 0) {
+    dlclose(library_);
+  }
+  library_ = library;
+  num_trees_ = *num_trees;
+  trees_ = tree_functions;
+  Log::Debug("Compiled %d trees", num_trees_);
+  return true;
+  #endif
+}
+
+}  // namespace LightGBM
@@ -0,0 +1,65 @@
+#ifndef LIGHTGBM_BOOSTING_COMPILED_MODEL_H_
+#define LIGHTGBM_BOOSTING_COMPILED_MODEL_H_
+
+#include <LightGBM/tree.h>
+
+#include <string>
+#include <vector>
+
+namespace LightGBM {
+
+/*!
+* \brief Trees generated into C code, compiled with the system compiler and loaded as a shared object.
+*        Every tree becomes one function with a flat goto per node, constants are spelled exactly,
+*        so predictions are bit-identical to the interpreted trees.
+*/
+class CompiledModel {
+public:
+  /*! \brief Signature of one compiled tree */
+  typedef double (*TreeFunction)(const double* feature_values);
+
+  CompiledModel();
+
+  ~CompiledModel();
+
+  /*!
+  * \brief Generate the C source of trees
+  * \param trees Trees to generate
+  * \return C source, exporting lgbm_compiled_num_trees and lgbm_compiled_trees
+  */
+  static std::string GenerateCode(const std::vector<Tree*>& trees);
+
+  /*!
+  * \brief Generate, compile and load trees
+  * \param trees Trees to compile
+  * \param compiler Compiler command, called with -shared -fPIC -o <output> <source>
+  * \return False if any step fails, a warning tells which one
+  */
+  bool Build(const std::vector<Tree*>& trees, const std::string& compiler);
+
+  inline int num_trees() const { return num_trees_; }
+
+  /*!
+  * \brief Prediction of one tree on one record
+  * \param tree Index of tree
+  * \param feature_values Feature value of this record
+  */
+  inline double PredictTree(int tree, const double* feature_values) const {
+    return trees_[tree](feature_values);
+  }
+
+  /*! \brief Disable copy */
+  CompiledModel& operator=(const CompiledModel&) = delete;
+  /*! \brief Disable copy */
+  CompiledModel(const CompiledModel&) = delete;
+
+private:
+  /*! \brief Handle of the loaded shared object */
+  void* library_;
+  int num_trees_;
+  const TreeFunction* trees_;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_BOOSTING_COMPILED_MODEL_H_
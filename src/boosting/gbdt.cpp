@@ -7,7 +7,9 @@
 #include <LightGBM/prediction_early_stop.h>
 
 #include <ctime>
+#include <cmath>
 
+#include <algorithm>
 #include <sstream>
 #include <chrono>
 #include <string>
@@ -29,7 +31,10 @@ std::chrono::duration<double, std::milli> tree_time;
 GBDT::GBDT() : iter_(0),
 objective_function_(0),
 early_stopping_round_(0),
+contrib_method_(kContribTreeSHAP),
+has_contrib_background_(false),
 max_feature_idx_(0),
+features_compacted_(false),
 num_tree_per_iteration_(1),
 num_class_(1),
 num_iteration_for_pred_(0),
@@ -44,9 +49,11 @@ need_re_bagging_(false)
     num_threads_ = omp_get_num_threads();
   }
   average_output_ = false;
+  ResetPredictPlans();
 }
 
 GBDT::~GBDT() {
+  ClearModels();
   #ifdef TIMETAG
   Log::Info("GBDT::boosting costs %f", boosting_time * 1e-3);
   Log::Info("GBDT::train_score costs %f", train_score_time * 1e-3);
@@ -85,4 +92,68 @@ void GBDT::ResetConfig(const Config* config) {
   config_.reset(new_config.release());
 }
 
+void GBDT::QuantizeModel(int leaf_type, int threshold_type, const std::vector<std::vector<double>>& sample,
+                         double* out_max_deviation, double* out_mean_deviation) {
+  if (models_.empty()) {
+    Log::Fatal("Cannot quantize a model without its trees, load the model from text");
+  }
+  if (leaf_type < PackedForest::kLeafFloat64 || leaf_type > PackedForest::kLeafInt8) {
+    Log::Fatal("Unknown leaf type %d", leaf_type);
+  }
+  if (threshold_type < PackedForest::kThresholdFloat64 || threshold_type > PackedForest::kThresholdFloat32) {
+    Log::Fatal("Unknown threshold type %d", threshold_type);
+  }
+  std::unique_ptr<PackedForest> quantized(new PackedForest());
+  if (!quantized->Build(models_, NumPredictFeatures(), PackedModelHeader(),
+                        config_.get() != nullptr && config_->model_huge_pages,
+                        static_cast<PackedForest::LeafType>(leaf_type),
+                        static_cast<PackedForest::ThresholdType>(threshold_type))) {
+    Log::Fatal("Cannot quantize the model");
+  }
+  // compare raw scores of all the trees, deviations are summed per row so that the mean is deterministic
+  const int num_data = static_cast<int>(sample.size());
+  const int num_trees = static_cast<int>(models_.size());
+  std::vector<double> row_max_deviation(num_data, 0.0);
+  std::vector<double> row_sum_deviation(num_data, 0.0);
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < num_data; ++i) {
+    const double* features = sample[i].data();
+    std::vector<double> score(num_tree_per_iteration_, 0.0);
+    std::vector<double> quantized_score(num_tree_per_iteration_, 0.0);
+    for (int j = 0; j < num_trees; ++j) {
+      score[j % num_tree_per_iteration_] += models_[j]->Predict(features);
+      quantized_score[j % num_tree_per_iteration_] += quantized->PredictTree(j, features);
+    }
+    for (int k = 0; k < num_tree_per_iteration_; ++k) {
+      const double deviation = std::fabs(score[k] - quantized_score[k]);
+      row_max_deviation[i] = std::max(row_max_deviation[i], deviation);
+      row_sum_deviation[i] += deviation;
+    }
+  }
+  double max_deviation = 0.0;
+  double sum_deviation = 0.0;
+  for (int i = 0; i < num_data; ++i) {
+    max_deviation = std::max(max_deviation, row_max_deviation[i]);
+    sum_deviation += row_sum_deviation[i];
+  }
+  *out_max_deviation = max_deviation;
+  *out_mean_deviation = num_data > 0 ? sum_deviation / (static_cast<double>(num_data) * num_tree_per_iteration_) : 0.0;
+  Log::Info("Quantized model takes %zu bytes, max abs deviation %g, mean abs deviation %g on %d rows",
+            quantized->size(), *out_max_deviation, *out_mean_deviation, num_data);
+  quantized_forest_.reset(quantized.release());
+}
+
+void GBDT::AcceptQuantizedModel(bool accept) {
+  if (!quantized_forest_) {
+    Log::Fatal("There is no quantized model, call LGBM_BoosterQuantizeModel first");
+  }
+  if (accept) {
+    packed_forest_.reset(quantized_forest_.release());
+    // the compiled trees are exact, they would hide the quantized ones
+    compiled_model_.reset();
+  } else {
+    quantized_forest_.reset();
+  }
+}
+
 }  // namespace LightGBM
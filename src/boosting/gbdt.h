@@ -4,6 +4,11 @@
 #include <LightGBM/boosting.h>
 #include <LightGBM/prediction_early_stop.h>
 #include <LightGBM/tree.h>
+#include <LightGBM/packed_forest.h>
+#include <LightGBM/utils/arena.h>
+#include <LightGBM/utils/mapped_file.h>
+
+#include "compiled_model.h"
 
 #include <cstdio>
 #include <vector>
@@ -41,7 +46,7 @@ public:
     /*!
   * \brief Get current iteration
   */
-    int GetCurrentIteration() const override { return static_cast<int>(models_.size()) / num_tree_per_iteration_; }
+    int GetCurrentIteration() const override { return NumberOfTotalModel() / num_tree_per_iteration_; }
 
   /*!
   * \brief Can use early stopping for prediction or not
@@ -62,10 +67,18 @@ public:
   * \param is_pred_contrib True if predicting feature contribution
   * \return number of prediction
   */
-  inline int NumPredictOneRow(int , bool is_pred_leaf, bool is_pred_contrib) const override {
+  inline int NumPredictOneRow(int num_iteration, bool is_pred_leaf, bool is_pred_contrib) const override {
     int num_preb_in_one_row = num_class_;
-    if (is_pred_contrib || is_pred_leaf) {
-      throw std::runtime_error("Invalid mode!");
+    if (is_pred_leaf) {
+      // one leaf per tree
+      int num_used_iteration = NumberOfTotalModel() / num_tree_per_iteration_;
+      if (num_iteration > 0) {
+        num_used_iteration = std::min(num_iteration, num_used_iteration);
+      }
+      num_preb_in_one_row = num_tree_per_iteration_ * num_used_iteration;
+    } else if (is_pred_contrib) {
+      // one value per feature and the expected value, for every class
+      num_preb_in_one_row = num_tree_per_iteration_ * (max_feature_idx_ + 2);
     }
     return num_preb_in_one_row;
   }
@@ -86,22 +99,66 @@ public:
 
   void PredictLeafIndexByMap(const std::unordered_map<int, double>& features, double* output) const override;
 
+  void PredictLeafIndex(const double* features, int32_t* output) const override;
+
+  void PredictClasses(const double* features, const std::vector<int>& classes, bool normalize,
+                      double* output) const override;
+
+  void PredictStaged(const double* features, const std::vector<int>& checkpoints, bool is_raw_score,
+                     double* output) const override;
+
+  void PredictContrib(const double* features, double* output) const override;
+
+  void PredictContribSparse(const double* features, int top_k,
+                            std::vector<std::vector<std::pair<int, double>>>* output) const override;
+
   /*!
   * \brief Restore from a serialized buffer
   */
   bool LoadModelFromString(const char* buffer, size_t len) override;
 
+  /*!
+  * \brief Restore from a serialized packed model, only prediction is available afterwards
+  */
+  bool LoadModelFromPacked(const char* buffer, size_t len, bool copy) override;
+
+  /*!
+  * \brief Get the serialized packed model
+  */
+  const char* PackedModel(size_t* out_len) const override {
+    if (!packed_forest_) {
+      *out_len = 0;
+      return 0;
+    }
+    *out_len = packed_forest_->size();
+    return packed_forest_->data();
+  }
+
+  /*!
+  * \brief Destroy the trees, the arrays of their models are released with the arena,
+  *        their contribution tables with the trees
+  */
+  void ClearModels();
+
   /*!
   * \brief Get max feature index of this model
   * \return Max feature index of this model
   */
   inline int MaxFeatureIdx() const override { return max_feature_idx_; }
 
+  inline const std::vector<int>& UsedFeatures() const override { return used_features_; }
+
+  inline int NumPredictFeatures() const override {
+    return features_compacted_ ? static_cast<int>(used_features_.size()) : max_feature_idx_ + 1;
+  }
+
   /*!
   * \brief Get feature names of this model
   * \return Feature names of this model
   */
-  inline std::vector<std::string> FeatureNames() const override { return feature_names_; }
+  inline std::vector<std::string> FeatureNames() const override {
+    return std::vector<std::string>(feature_names_.begin(), feature_names_.end());
+  }
 
   /*!
   * \brief Get index of label column
@@ -113,7 +170,12 @@ public:
   * \brief Get number of weak sub-models
   * \return Number of weak sub-models
   */
-  inline int NumberOfTotalModel() const override { return static_cast<int>(models_.size()); }
+  inline int NumberOfTotalModel() const override {
+    if (models_.empty() && packed_forest_) {
+      return packed_forest_->num_trees();
+    }
+    return static_cast<int>(models_.size());
+  }
 
   /*!
   * \brief Get number of tree per iteration
@@ -127,16 +189,31 @@ public:
   */
   inline int NumberOfClasses() const override { return num_class_; }
 
-  inline void InitPredict(int num_iteration, bool is_pred_contrib) override {
-    num_iteration_for_pred_ = static_cast<int>(models_.size()) / num_tree_per_iteration_;
+  inline const char* ObjectiveName() const override {
+    return objective_function_ != nullptr ? objective_function_->GetName() : "";
+  }
+
+  inline void InitPredict(int num_iteration, bool is_pred_contrib,
+                          ContribMethod contrib_method = kContribTreeSHAP) override {
+    num_iteration_for_pred_ = NumberOfTotalModel() / num_tree_per_iteration_;
     if (num_iteration > 0) {
       num_iteration_for_pred_ = std::min(num_iteration, num_iteration_for_pred_);
     }
     if (is_pred_contrib) {
+      if (contrib_method == kContribInterventional && !has_contrib_background_) {
+        Log::Fatal("Interventional SHAP values need a background, see LGBM_BoosterSetContribBackground");
+      }
+      contrib_method_ = contrib_method;
       #pragma omp parallel for schedule(static)
       for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
-        models_[i]->RecomputeMaxDepth();
+        if (contrib_method == kContribSaabas) {
+          models_[i]->BuildSaabasValues();
+        } else if (contrib_method == kContribTreeSHAP) {
+          models_[i]->BuildSHAPTables();
+        }
       }
+      shap_buffers_.resize(omp_get_max_threads());
+      shap_outputs_.resize(omp_get_max_threads());
     }
   }
 
@@ -150,14 +227,175 @@ public:
     CHECK(tree_idx >= 0 && static_cast<size_t>(tree_idx) < models_.size());
     CHECK(leaf_idx >= 0 && leaf_idx < models_[tree_idx]->num_leaves());
     models_[tree_idx]->SetLeafOutput(leaf_idx, val);
+    // the packed and compiled trees are stale now
+    packed_forest_.reset();
+    compiled_model_.reset();
+  }
+
+  std::vector<int32_t> LeafOffsets() const override;
+
+  uint64_t LineageHash(int num_trees) const override;
+
+  bool HasLineageHash() const override {
+    return !(models_.empty() && packed_forest_) || !packed_tree_hashes_.empty();
   }
 
+  std::string ModelDelta(const char* buffer, size_t len, int base_num_trees) const override;
+
+  void ApplyModelDelta(const char* buffer, size_t len) override;
+
+  void AddTreesToRawScore(const double* features, int first_tree, int end_tree, double* raw_score) const override;
+
+  void ConvertRawScore(const double* raw_score, int num_iteration, double* output) const override;
+
+  void ConvertRawScores(double* scores, int num_rows, bool fast_exp) const override;
+
+  void QuantizeModel(int leaf_type, int threshold_type, const std::vector<std::vector<double>>& sample,
+                     double* out_max_deviation, double* out_mean_deviation) override;
+
+  void AcceptQuantizedModel(bool accept) override;
+
+  void Autotune(const std::vector<std::vector<double>>& sample) override;
+
+  void SetContribBackground(const std::vector<std::vector<double>>& background) override;
+
+  std::string GetPredictPlan() const override;
+
+  void SetPredictPlan(const std::string& plan) override;
+
+  int SelectPredictPlan(int num_rows, bool* out_row_parallel) override;
+
+  void PredictTreeOutputs(const double* features, std::vector<double>* tree_outputs) const override;
+
+  int RepredictTreeOutputs(const double* features, const std::vector<int>& changed_features,
+                           double* tree_outputs) const override;
+
+  void PredictFromTreeOutputs(const double* tree_outputs, double* output) const override;
+
   /*!
   * \brief Get Type name of this boosting object
   */
   virtual const char* SubModelName() const override { return "tree"; }
 
 protected:
+  /*!
+  * \brief Ways to predict one record, kEngineAuto picks the compiled model, then the packed forest, then the trees
+  */
+  enum PredictEngine {
+    kEngineAuto = -1,
+    kEngineTrees = 0,
+    kEnginePacked = 1,
+    kEnginePackedGroups = 2,
+    kEngineCompiled = 3
+  };
+
+  /*!
+  * \brief How to predict a batch of one size bucket, see SelectPredictPlan
+  */
+  struct PredictPlan {
+    /*! \brief PredictEngine */
+    int engine;
+    /*! \brief Trees given to a thread at once when the rows cannot keep the threads busy, 0 to never split trees, -1 for the default */
+    int tree_block;
+    /*! \brief Threads to use, 0 for all */
+    int num_threads;
+  };
+
+  /*! \brief Number of batch size buckets, a batch goes to the first bucket with at least as many rows */
+  static const int kNumPlanBuckets = 4;
+
+  /*! \brief Let every batch size predict the default way */
+  void ResetPredictPlans();
+
+  /*! \brief Engine to predict with, engine when it is available and the default one otherwise */
+  int ResolveEngine(int engine) const;
+
+  /*! \brief Trees given to a thread at once, the default depends on the number of trees */
+  int ResolveTreeBlock(int tree_block) const;
+
+  /*! \brief Threads of a plan, never more than OpenMP allows */
+  int ResolveThreads(int num_threads) const;
+
+  /*!
+  * \brief Pack the trees if no packed forest exists yet
+  * \return False if there is no packed forest afterwards
+  */
+  bool EnsurePackedForest();
+
+  /*!
+  * \brief Rows that go down both sides of the splits, from the thresholds of the trees
+  */
+  std::vector<std::vector<double>> SyntheticRows(int num_rows) const;
+
+  /*!
+  * \brief Raw prediction with a packed forest that is faster on groups of trees, see PackedForest::predict_in_groups
+  */
+  void PredictRawInGroups(const double* features, double* output,
+                          const PredictionEarlyStopInstance* early_stop) const;
+
+  /*!
+  * \brief Raw prediction of one record outside of a parallel region, the trees are split across threads.
+  *        Tree outputs are summed in the original order afterwards, so the result does not depend on the threads
+  */
+  void PredictRawTreeParallel(int engine, int tree_block, int num_threads, const double* features, double* output,
+                              const PredictionEarlyStopInstance* early_stop) const;
+
+  /*!
+  * \brief Outputs of consecutive trees on one record
+  * \param engine Resolved PredictEngine
+  * \param first_tree Index of the first tree
+  * \param num_trees Number of trees
+  * \param features Feature values of this record
+  * \param output Output of each tree
+  */
+  void PredictTreeRange(int engine, int first_tree, int num_trees, const double* features, double* output) const;
+
+  /*!
+  * \brief Add the contributions of the trees of a class on one record to output
+  * \param features Feature values of this record
+  * \param class_id Class of the trees
+  * \param output Contributions by position in the prediction buffer, NumPredictFeatures() + 1 of them
+  */
+  void PredictClassContrib(const double* features, int class_id, double* output) const;
+
+  /*!
+  * \brief Restore from a serialized buffer without going through the model cache
+  * \param keep_trees Number of first trees of the current model to keep, the trees of buffer come after them
+  */
+  bool LoadModelFromText(const char* buffer, size_t len, int keep_trees = 0);
+
+  /*!
+  * \brief Use the predict plan or the autotuning of the config, after the model changed
+  */
+  void InitConfiguredPlan();
+
+  /*!
+  * \brief Find the used features and, when some features are not used, make the trees split on positions in them
+  * \param used_features Used features from the model header, null to find them from the trees
+  */
+  void CompactFeatures(const std::vector<int>* used_features);
+
+  /*!
+  * \brief Index the trees by the features they split on
+  */
+  void BuildFeatureTreeIndex();
+
+  /*!
+  * \brief Restore from the packed model in the model cache, or from the buffer and add it to the cache
+  */
+  bool LoadModelFromCache(const char* buffer, size_t len);
+
+  /*!
+  * \brief Hash of every one of the first trees, as LineageHash hashes them
+  * \param num_trees Number of trees to hash
+  * \param out_hashes Output, hash of every tree
+  */
+  void TreeHashes(int num_trees, uint64_t* out_hashes) const;
+
+  /*!
+  * \brief Text header stored along with the packed trees, the model header and the hashes of the trees
+  */
+  std::string PackedModelHeader() const;
 
   /*! \brief current iteration */
   int iter_;
@@ -179,10 +417,46 @@ protected:
   std::vector<std::vector<double>> best_score_;
   /*! \brief output message of best iteration */
   std::vector<std::vector<std::string>> best_msg_;
-  /*! \brief Trained models(trees) */
-  std::vector<std::unique_ptr<Tree>> models_;
+  /*! \brief Storage of the loaded model, trees and feature names live in it */
+  Arena arena_;
+  /*! \brief Storage of the trees appended by model deltas, released by the next full load */
+  std::vector<std::unique_ptr<Arena>> delta_arenas_;
+  /*! \brief Trained models(trees), placed in arena_ or delta_arenas_ */
+  std::vector<Tree*> models_;
+  /*! \brief Packed trees used for prediction, the only trees when loaded from a packed model */
+  std::unique_ptr<PackedForest> packed_forest_;
+  /*! \brief Compiled trees used for prediction before any other trees */
+  std::unique_ptr<CompiledModel> compiled_model_;
+  /*! \brief Method of PredictContrib, set by InitPredict */
+  ContribMethod contrib_method_;
+  /*! \brief True once SetContribBackground summarized a background into the trees */
+  bool has_contrib_background_;
+  /*! \brief Scratch space of PredictContrib for every thread */
+  mutable std::vector<Tree::SHAPBuffer> shap_buffers_;
+  /*! \brief SHAP values in the features of the prediction buffer for every thread, when they are compacted */
+  mutable std::vector<std::vector<double>> shap_outputs_;
+  /*! \brief Cached packed model file that packed_forest_ points into */
+  std::unique_ptr<MappedFile> model_cache_file_;
+  /*! \brief Quantized packed trees waiting to be accepted */
+  std::unique_ptr<PackedForest> quantized_forest_;
+  /*! \brief Plan of every batch size bucket */
+  PredictPlan predict_plans_[kNumPlanBuckets];
+  /*! \brief Bucket of the batch being predicted */
+  int active_plan_;
+  /*! \brief Text header of the model, without the trees */
+  std::string model_header_;
+  /*! \brief Hash of every tree from the header of a packed model, the trees themselves are not loaded */
+  std::vector<uint64_t> packed_tree_hashes_;
   /*! \brief Max feature index of training data*/
   int max_feature_idx_;
+  /*! \brief Features the trees split on */
+  std::vector<int> used_features_;
+  /*! \brief True if the split features of the trees are positions in used_features_ */
+  bool features_compacted_;
+  /*! \brief Trees that split on every feature of the prediction buffer, in increasing order */
+  std::vector<int> feature_trees_;
+  /*! \brief Start of the trees of every feature in feature_trees_ */
+  std::vector<int> feature_tree_boundaries_;
   /*! \brief First order derivative of training data */
   std::vector<score_t> gradients_;
   /*! \brief Secend order derivative of training data */
@@ -207,9 +481,12 @@ protected:
   double shrinkage_rate_;
   /*! \brief Number of loaded initial models */
   int num_init_iteration_;
-  /*! \brief Feature names */
-  std::vector<std::string> feature_names_;
-  std::vector<std::string> feature_infos_;
+  /*! \brief Feature names, point into feature_names_blob_ */
+  ArenaArray<const char*> feature_names_;
+  ArenaArray<char> feature_names_blob_;
+  /*! \brief Feature infos, point into feature_infos_blob_ */
+  ArenaArray<const char*> feature_infos_;
+  ArenaArray<char> feature_infos_blob_;
   /*! \brief number of threads */
   int num_threads_;
   /*! \brief Buffer for multi-threading bagging */
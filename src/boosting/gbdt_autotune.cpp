@@ -0,0 +1,293 @@
+#include "gbdt.h"
+
+#include <LightGBM/utils/openmp_wrapper.h>
+#include <LightGBM/utils/common.h>
+#include <LightGBM/utils/random.h>
+#include <LightGBM/prediction_early_stop.h>
+
+#include <climits>
+#include <cmath>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace LightGBM {
+
+namespace {
+
+/*! \brief Largest batch of every bucket */
+const int kPlanBucketRows[] = { 1, 16, 256, INT_MAX };
+const char* const kPlanBucketNames[] = { "1", "16", "256", "max" };
+
+/*! \brief Names of GBDT::PredictEngine, starting at kEngineTrees */
+const char* const kEngineNames[] = { "trees", "packed", "packed_groups", "compiled" };
+const int kNumEngines = 4;
+
+/*! \brief Tree blocks tried when the rows of a batch cannot keep the threads busy */
+const int kTreeBlockCandidates[] = { 16, 64, 256 };
+
+/*! \brief Timed passes over the rows for every candidate, the fastest one counts */
+const int kAutotunePasses = 3;
+
+/*! \brief Share of synthetic values that are NaN, and of those that are zero */
+const double kSyntheticNaNRate = 0.05;
+const double kSyntheticZeroRate = 0.05;
+
+}  // namespace
+
+void GBDT::ResetPredictPlans() {
+  for (int i = 0; i < kNumPlanBuckets; ++i) {
+    predict_plans_[i].engine = kEngineAuto;
+    predict_plans_[i].tree_block = -1;
+    predict_plans_[i].num_threads = 0;
+  }
+  active_plan_ = 0;
+}
+
+int GBDT::SelectPredictPlan(int num_rows, bool* out_row_parallel) {
+  int bucket = 0;
+  while (bucket + 1 < kNumPlanBuckets && num_rows > kPlanBucketRows[bucket]) {
+    ++bucket;
+  }
+  active_plan_ = bucket;
+  const int num_threads = ResolveThreads(predict_plans_[bucket].num_threads);
+  // with fewer rows than threads the rows go one by one, unless the plan never splits the trees
+  *out_row_parallel = num_rows >= num_threads || ResolveTreeBlock(predict_plans_[bucket].tree_block) == 0;
+  return num_threads;
+}
+
+std::string GBDT::GetPredictPlan() const {
+  std::stringstream str_buf;
+  for (int i = 0; i < kNumPlanBuckets; ++i) {
+    if (i > 0) {
+      str_buf << ",";
+    }
+    const PredictPlan& plan = predict_plans_[i];
+    str_buf << kPlanBucketNames[i] << ":" << kEngineNames[ResolveEngine(plan.engine)] << ":"
+            << ResolveTreeBlock(plan.tree_block) << ":" << ResolveThreads(plan.num_threads);
+  }
+  return str_buf.str();
+}
+
+void GBDT::SetPredictPlan(const std::string& plan_str) {
+  PredictPlan plans[kNumPlanBuckets];
+  for (int i = 0; i < kNumPlanBuckets; ++i) {
+    plans[i] = predict_plans_[i];
+  }
+  std::vector<std::string> buckets = Common::Split(plan_str.c_str(), ',');
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    std::vector<std::string> fields = Common::Split(Common::Trim(buckets[i]).c_str(), ':');
+    if (fields.size() != 4) {
+      Log::Fatal("Predict plan %s should be bucket:engine:tree_block:num_threads", buckets[i].c_str());
+    }
+    int bucket = -1;
+    for (int j = 0; j < kNumPlanBuckets; ++j) {
+      if (fields[0] == kPlanBucketNames[j]) {
+        bucket = j;
+      }
+    }
+    int engine = -1;
+    for (int j = 0; j < kNumEngines; ++j) {
+      if (fields[1] == kEngineNames[j]) {
+        engine = j;
+      }
+    }
+    PredictPlan plan;
+    plan.engine = engine;
+    if (bucket < 0) {
+      Log::Fatal("Unknown batch size %s in predict plan, expected 1, 16, 256 or max", fields[0].c_str());
+    }
+    if (engine < 0) {
+      Log::Fatal("Unknown engine %s in predict plan, expected trees, packed, packed_groups or compiled",
+                 fields[1].c_str());
+    }
+    if (!Common::AtoiAndCheck(fields[2].c_str(), &plan.tree_block) || plan.tree_block < 0
+        || !Common::AtoiAndCheck(fields[3].c_str(), &plan.num_threads) || plan.num_threads < 0) {
+      Log::Fatal("Predict plan %s should have non negative tree_block and num_threads", buckets[i].c_str());
+    }
+    plans[bucket] = plan;
+  }
+  for (int i = 0; i < kNumPlanBuckets; ++i) {
+    const int engine = plans[i].engine;
+    if ((engine == kEnginePacked || engine == kEnginePackedGroups) && !EnsurePackedForest()) {
+      Log::Warning("Predict plan of batch size %s uses the packed forest, but the model cannot be packed",
+                   kPlanBucketNames[i]);
+    } else if (engine == kEngineCompiled && !compiled_model_) {
+      Log::Warning("Predict plan of batch size %s uses the compiled model, load the model with compile_model=true",
+                   kPlanBucketNames[i]);
+    } else if (engine == kEngineTrees && models_.empty()) {
+      Log::Warning("Predict plan of batch size %s uses the trees, but only the packed forest is loaded",
+                   kPlanBucketNames[i]);
+    }
+    predict_plans_[i] = plans[i];
+  }
+}
+
+bool GBDT::EnsurePackedForest() {
+  if (packed_forest_) {
+    return true;
+  }
+  if (models_.empty()) {
+    return false;
+  }
+  std::unique_ptr<PackedForest> packed_forest(new PackedForest());
+  if (!packed_forest->Build(models_, NumPredictFeatures(), PackedModelHeader(),
+                            config_.get() != nullptr && config_->model_huge_pages)) {
+    return false;
+  }
+  packed_forest_.reset(packed_forest.release());
+  return true;
+}
+
+std::vector<std::vector<double>> GBDT::SyntheticRows(int num_rows) const {
+  const int num_features = NumPredictFeatures();
+  // split points of every feature, the values are drawn right next to them to go down both sides
+  std::vector<std::vector<double>> thresholds(num_features);
+  std::vector<int> num_categories(num_features, 0);
+  for (size_t i = 0; i < models_.size(); ++i) {
+    const Tree* tree = models_[i];
+    for (int node = 0; node < tree->num_leaves() - 1; ++node) {
+      const int feature = tree->split_feature(node);
+      if (feature < 0 || feature >= num_features) {
+        continue;
+      }
+      if (tree->IsCategoricalSplit(node)) {
+        int num_words = 0;
+        tree->cat_threshold(node, &num_words);
+        num_categories[feature] = std::max(num_categories[feature], 32 * num_words);
+      } else {
+        thresholds[feature].push_back(tree->threshold(node));
+      }
+    }
+  }
+  Random random(num_rows);
+  std::vector<std::vector<double>> rows(num_rows, std::vector<double>(num_features, 0.0));
+  for (int i = 0; i < num_rows; ++i) {
+    for (int j = 0; j < num_features; ++j) {
+      const double draw = random.NextFloat();
+      if (draw < kSyntheticNaNRate) {
+        rows[i][j] = std::numeric_limits<double>::quiet_NaN();
+      } else if (draw < kSyntheticNaNRate + kSyntheticZeroRate) {
+        rows[i][j] = 0.0;
+      } else if (num_categories[j] > 0) {
+        rows[i][j] = random.NextInt(0, num_categories[j]);
+      } else if (!thresholds[j].empty()) {
+        const double threshold = thresholds[j][random.NextInt(0, static_cast<int>(thresholds[j].size()))];
+        const double direction = random.NextFloat() < 0.5f ? -std::numeric_limits<double>::infinity()
+                                                           : std::numeric_limits<double>::infinity();
+        rows[i][j] = random.NextFloat() < 0.5f ? threshold : std::nextafter(threshold, direction);
+      } else if (models_.empty()) {
+        // only the packed forest is loaded, its thresholds are not read back
+        rows[i][j] = random.NextFloat() * 2.0 - 1.0;
+      }
+    }
+  }
+  return rows;
+}
+
+void GBDT::Autotune(const std::vector<std::vector<double>>& sample) {
+  if (models_.empty() && !packed_forest_) {
+    Log::Fatal("Cannot autotune a model without trees");
+  }
+  const int num_features = NumPredictFeatures();
+  for (size_t i = 0; i < sample.size(); ++i) {
+    if (static_cast<int>(sample[i].size()) != num_features) {
+      Log::Fatal("Autotuning rows should have %d features", num_features);
+    }
+  }
+  const std::vector<std::vector<double>> rows = sample.empty()
+    ? SyntheticRows(config_.get() != nullptr ? config_->autotune_rows : 256) : sample;
+  const int num_rows = static_cast<int>(rows.size());
+  if (num_rows == 0) {
+    Log::Fatal("Cannot autotune on zero rows");
+  }
+  // the packed forest is a candidate even when it was not asked for, it is dropped again if it loses
+  const bool had_packed_forest = packed_forest_.get() != nullptr;
+  EnsurePackedForest();
+  std::vector<int> engines;
+  if (!models_.empty()) {
+    engines.push_back(kEngineTrees);
+  }
+  if (packed_forest_) {
+    engines.push_back(kEnginePacked);
+    engines.push_back(kEnginePackedGroups);
+  }
+  if (compiled_model_) {
+    engines.push_back(kEngineCompiled);
+  }
+  std::vector<int> thread_counts;
+  const int max_threads = omp_get_max_threads();
+  for (int num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_threads);
+  const PredictionEarlyStopInstance early_stop = CreatePredictionEarlyStopInstance("none", PredictionEarlyStopConfig());
+  std::vector<double> output(static_cast<size_t>(num_rows) * num_tree_per_iteration_);
+  bool use_packed_forest = false;
+  for (int bucket = 0; bucket < kNumPlanBuckets; ++bucket) {
+    const int batch_rows = std::min(kPlanBucketRows[bucket], num_rows);
+    std::vector<PredictPlan> candidates;
+    for (size_t i = 0; i < engines.size(); ++i) {
+      for (size_t j = 0; j < thread_counts.size(); ++j) {
+        PredictPlan plan;
+        plan.engine = engines[i];
+        plan.tree_block = 0;
+        plan.num_threads = thread_counts[j];
+        candidates.push_back(plan);
+        // splitting the trees only matters when the rows cannot keep the threads busy
+        if (thread_counts[j] > 1 && batch_rows < thread_counts[j]) {
+          for (size_t k = 0; k < sizeof(kTreeBlockCandidates) / sizeof(kTreeBlockCandidates[0]); ++k) {
+            plan.tree_block = kTreeBlockCandidates[k];
+            candidates.push_back(plan);
+          }
+        }
+      }
+    }
+    double best_time = std::numeric_limits<double>::infinity();
+    PredictPlan best_plan = candidates[0];
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      predict_plans_[bucket] = candidates[c];
+      active_plan_ = bucket;
+      const int num_threads = ResolveThreads(candidates[c].num_threads);
+      const bool split_trees = ResolveTreeBlock(candidates[c].tree_block) > 0;
+      double candidate_time = std::numeric_limits<double>::infinity();
+      // the first pass warms up the caches and the threads
+      for (int pass = 0; pass <= kAutotunePasses; ++pass) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // batches of the bucket size, split the same way as Booster::Predict does
+        for (int first_row = 0; first_row < num_rows; first_row += batch_rows) {
+          const int end_row = std::min(num_rows, first_row + batch_rows);
+          const bool row_parallel = end_row - first_row >= num_threads || !split_trees;
+          #pragma omp parallel for schedule(static) num_threads(num_threads) if (row_parallel)
+          for (int i = first_row; i < end_row; ++i) {
+            PredictRaw(rows[i].data(), output.data() + static_cast<size_t>(i) * num_tree_per_iteration_, &early_stop);
+          }
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (pass > 0) {
+          candidate_time = std::min(candidate_time, elapsed.count());
+        }
+      }
+      Log::Debug("Autotune batch size %s: %s, tree block %d, %d threads, %f ms", kPlanBucketNames[bucket],
+                 kEngineNames[candidates[c].engine], candidates[c].tree_block, candidates[c].num_threads,
+                 candidate_time);
+      if (candidate_time < best_time) {
+        best_time = candidate_time;
+        best_plan = candidates[c];
+      }
+    }
+    predict_plans_[bucket] = best_plan;
+    use_packed_forest = use_packed_forest || best_plan.engine == kEnginePacked || best_plan.engine == kEnginePackedGroups;
+  }
+  active_plan_ = 0;
+  if (!had_packed_forest && !use_packed_forest) {
+    packed_forest_.reset();
+  }
+  Log::Info("Predict plan after autotuning on %d rows: %s", num_rows, GetPredictPlan().c_str());
+}
+
+}  // namespace LightGBM
@@ -1,29 +1,341 @@
 #include "gbdt.h"
+#include "model_cache.h"
 
 #include <LightGBM/utils/common.h>
+#include <LightGBM/utils/openmp_wrapper.h>
 #include <LightGBM/objective_function.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <memory>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 namespace LightGBM {
 
 const std::string kModelVersion = "v2";
+const std::string kModelDeltaVersion = "v1";
+
+namespace {
+
+/*! \brief Number of space separated tokens in a range */
+int CountTokens(const char* str, size_t len) {
+  int num_tokens = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (str[i] != ' ' && (i == 0 || str[i - 1] == ' ')) {
+      ++num_tokens;
+    }
+  }
+  return num_tokens;
+}
+
+/*!
+* \brief Copy a space separated list of names into the arena, names are NUL terminated in place
+* \param num_names Number of names, as returned by CountTokens
+*/
+void CopyNamesToArena(const char* str, size_t len, int num_names, Arena* arena,
+                      ArenaArray<char>* blob, ArenaArray<const char*>* names) {
+  blob->Allocate(arena, len + 1);
+  names->Allocate(arena, num_names);
+  std::memcpy(blob->data(), str, len);
+  (*blob)[len] = '\0';
+  int cur = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (str[i] == ' ') {
+      (*blob)[i] = '\0';
+    } else if (i == 0 || str[i - 1] == ' ') {
+      (*names)[cur++] = blob->data() + i;
+    }
+  }
+}
+
+template<typename T>
+void AppendBytes(const T& value, std::vector<char>* bytes) {
+  const char* begin = reinterpret_cast<const char*>(&value);
+  bytes->insert(bytes->end(), begin, begin + sizeof(T));
+}
+
+/*!
+* \brief Hash of the splits and leaf values of a tree
+* \param used_features Original index of every feature of the splits, empty if the features are not compacted
+*/
+uint64_t TreeHash(const Tree& tree, const std::vector<int>& used_features) {
+  std::vector<char> bytes;
+  AppendBytes(tree.num_leaves(), &bytes);
+  for (int node = 0; node < tree.num_leaves() - 1; ++node) {
+    // the compact index of a feature changes with the features of the other trees
+    const int feature = used_features.empty() ? tree.split_feature(node) : used_features[tree.split_feature(node)];
+    AppendBytes(feature, &bytes);
+    AppendBytes(tree.threshold(node), &bytes);
+    AppendBytes(tree.decision_type(node), &bytes);
+    AppendBytes(tree.left_child(node), &bytes);
+    AppendBytes(tree.right_child(node), &bytes);
+    if (tree.IsCategoricalSplit(node)) {
+      int num_words = 0;
+      const uint32_t* words = tree.cat_threshold(node, &num_words);
+      bytes.insert(bytes.end(), reinterpret_cast<const char*>(words),
+                   reinterpret_cast<const char*>(words + num_words));
+    }
+  }
+  for (int leaf = 0; leaf < tree.num_leaves(); ++leaf) {
+    AppendBytes(tree.LeafOutput(leaf), &bytes);
+  }
+  return ModelCache::Hash(bytes.data(), bytes.size());
+}
+
+}  // namespace
+
+void GBDT::TreeHashes(int num_trees, uint64_t* out_hashes) const {
+  if (models_.empty() && packed_forest_) {
+    if (!HasLineageHash()) {
+      Log::Fatal("Cannot hash the trees of a packed model packed without their hashes, pack the model again");
+    }
+    std::copy(packed_tree_hashes_.begin(), packed_tree_hashes_.begin() + num_trees, out_hashes);
+    return;
+  }
+  const std::vector<int> no_features;
+  const std::vector<int>& used_features = features_compacted_ ? used_features_ : no_features;
+  #pragma omp parallel for schedule(static) if (num_trees > 64)
+  for (int i = 0; i < num_trees; ++i) {
+    out_hashes[i] = TreeHash(*models_[i], used_features);
+  }
+}
+
+uint64_t GBDT::LineageHash(int num_trees) const {
+  CHECK(num_trees >= 0 && num_trees <= NumberOfTotalModel());
+  // the classes of the trees are part of the lineage
+  std::vector<uint64_t> hashes(num_trees + 1);
+  hashes[num_trees] = static_cast<uint64_t>(num_tree_per_iteration_);
+  TreeHashes(num_trees, hashes.data());
+  return ModelCache::Hash(reinterpret_cast<const char*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+}
+
+std::string GBDT::PackedModelHeader() const {
+  const int num_trees = static_cast<int>(models_.size());
+  std::vector<uint64_t> hashes(num_trees);
+  TreeHashes(num_trees, hashes.data());
+  std::string tree_hashes = "tree_hashes=";
+  for (int i = 0; i < num_trees; ++i) {
+    char hash[32];
+    std::snprintf(hash, sizeof(hash), "%s%016llx", i > 0 ? " " : "", static_cast<unsigned long long>(hashes[i]));
+    tree_hashes += hash;
+  }
+  tree_hashes += "\n";
+  std::string header = model_header_;
+  header.insert(header.find("end of trees\n"), tree_hashes);
+  return header;
+}
+
+void GBDT::ClearModels() {
+  for (size_t i = 0; i < models_.size(); ++i) {
+    if (models_[i] != nullptr) {
+      models_[i]->~Tree();
+    }
+  }
+  models_.clear();
+}
 
 bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
+  if (config_.get() == nullptr || config_->model_cache_dir.empty()) {
+    if (!LoadModelFromText(buffer, len)) {
+      return false;
+    }
+  } else if (!LoadModelFromCache(buffer, len)) {
+    return false;
+  }
+  InitConfiguredPlan();
+  return true;
+}
+
+void GBDT::InitConfiguredPlan() {
+  if (config_.get() != nullptr && !config_->predict_plan.empty()) {
+    SetPredictPlan(config_->predict_plan);
+  } else if (config_.get() != nullptr && config_->autotune) {
+    Autotune(std::vector<std::vector<double>>());
+  }
+}
+
+std::string GBDT::ModelDelta(const char* buffer, size_t len, int base_num_trees) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot make a model delta of a packed model");
+  }
+  const int num_trees = static_cast<int>(models_.size());
+  if (base_num_trees < 0 || base_num_trees > num_trees || base_num_trees % num_tree_per_iteration_ != 0) {
+    Log::Fatal("Cannot make a model delta from %d trees, the model has %d trees and %d trees per iteration",
+               base_num_trees, num_trees, num_tree_per_iteration_);
+  }
+  // split the text in the header, the trees and the rest
+  std::string header;
+  std::vector<const char*> tree_starts;
+  const char* trees_end = buffer + len;
+  const char* p = buffer;
+  const char* end = buffer + len;
+  while (p < end) {
+    const size_t line_len = Common::GetLine(p);
+    const char* next = Common::SkipNewLine(p + line_len);
+    if (line_len >= 5 && std::strncmp(p, "Tree=", 5) == 0) {
+      tree_starts.push_back(p);
+    } else if (line_len == 12 && std::strncmp(p, "end of trees", 12) == 0) {
+      trees_end = p;
+      break;
+    } else if (tree_starts.empty() && !(line_len >= 11 && std::strncmp(p, "tree_sizes=", 11) == 0)) {
+      header.append(p, next);
+    }
+    p = next;
+  }
+  if (static_cast<int>(tree_starts.size()) != num_trees) {
+    Log::Fatal("The model string has %zu trees, the model has %d trees", tree_starts.size(), num_trees);
+  }
+  tree_starts.push_back(trees_end);
+  std::stringstream str_buf;
+  str_buf << "model_delta=" << kModelDeltaVersion << '\n';
+  str_buf << "base_num_trees=" << base_num_trees << '\n';
+  char lineage[32];
+  std::snprintf(lineage, sizeof(lineage), "%016llx", static_cast<unsigned long long>(LineageHash(base_num_trees)));
+  str_buf << "base_lineage=" << lineage << '\n';
+  str_buf << header;
+  if (base_num_trees < num_trees) {
+    str_buf << "tree_sizes=";
+    for (int i = base_num_trees; i < num_trees; ++i) {
+      str_buf << (i > base_num_trees ? " " : "") << (tree_starts[i + 1] - tree_starts[i]);
+    }
+    str_buf << '\n';
+    str_buf << '\n';
+    str_buf.write(tree_starts[base_num_trees], tree_starts[num_trees] - tree_starts[base_num_trees]);
+  }
+  str_buf.write(trees_end, end - trees_end);
+  return str_buf.str();
+}
+
+void GBDT::ApplyModelDelta(const char* buffer, size_t len) {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot apply a model delta to a packed model");
+  }
+  // the first lines tell which trees the delta goes on from
+  const char* p = buffer;
+  const char* end = buffer + len;
+  std::string key_vals[3];
+  const char* const keys[3] = { "model_delta=", "base_num_trees=", "base_lineage=" };
+  for (int i = 0; i < 3; ++i) {
+    const size_t line_len = p < end ? Common::GetLine(p) : 0;
+    const size_t key_len = std::strlen(keys[i]);
+    if (line_len < key_len || std::strncmp(p, keys[i], key_len) != 0) {
+      Log::Fatal("Model delta doesn't start with %s", keys[i]);
+    }
+    key_vals[i].assign(p + key_len, line_len - key_len);
+    p = Common::SkipNewLine(p + line_len);
+  }
+  if (key_vals[0] != kModelDeltaVersion) {
+    Log::Fatal("Unknown model delta version %s", key_vals[0].c_str());
+  }
+  int base_num_trees = 0;
+  Common::Atoi(key_vals[1].c_str(), &base_num_trees);
+  const uint64_t base_lineage = std::strtoull(key_vals[2].c_str(), 0, 16);
+  if (base_num_trees < 0 || base_num_trees > static_cast<int>(models_.size())
+      || base_num_trees % num_tree_per_iteration_ != 0) {
+    Log::Fatal("The model delta goes on from %d trees, the model has %zu trees and %d trees per iteration",
+               base_num_trees, models_.size(), num_tree_per_iteration_);
+  }
+  if (LineageHash(base_num_trees) != base_lineage) {
+    Log::Fatal("The model delta was not made for the first %d trees of this model", base_num_trees);
+  }
+  // the delta is loaded aside first, so that a malformed delta leaves the model as it was
+  GBDT delta_model;
+  if (!delta_model.LoadModelFromText(p, end - p)) {
+    Log::Fatal("Cannot load the model delta");
+  }
+  if (base_num_trees > 0 && (delta_model.num_tree_per_iteration_ != num_tree_per_iteration_
+                             || delta_model.max_feature_idx_ != max_feature_idx_)) {
+    Log::Fatal("The model delta changes the classes or the features of the model");
+  }
+  if (delta_model.num_tree_per_iteration_ <= 0
+      || delta_model.models_.size() % delta_model.num_tree_per_iteration_ != 0) {
+    Log::Fatal("The model delta has %zu trees, not whole iterations of %d trees",
+               delta_model.models_.size(), delta_model.num_tree_per_iteration_);
+  }
+  if (!LoadModelFromText(p, end - p, base_num_trees)) {
+    Log::Fatal("Cannot apply the model delta");
+  }
+  InitConfiguredPlan();
+}
+
+bool GBDT::LoadModelFromCache(const char* buffer, size_t len) {
+  const uint64_t model_hash = ModelCache::Hash(buffer, len);
+  const char* packed = 0;
+  size_t packed_len = 0;
+  std::unique_ptr<MappedFile> cache_file = ModelCache::Open(config_->model_cache_dir, model_hash, len,
+                                                            &packed, &packed_len);
+  if (!cache_file) {
+    if (!LoadModelFromText(buffer, len)) {
+      return false;
+    }
+    if (!packed_forest_) {
+      // trees that cannot be packed are not cached, the booster keeps them
+      return true;
+    }
+    ModelCache::Save(config_->model_cache_dir, model_hash, len, *packed_forest_);
+    // the booster then holds only the packed forest, as the boosters that load the cached file do
+    cache_file = ModelCache::Open(config_->model_cache_dir, model_hash, len, &packed, &packed_len);
+    if (!cache_file) {
+      std::unique_ptr<PackedForest> packed_forest(packed_forest_.release());
+      return LoadModelFromPacked(packed_forest->data(), packed_forest->size(), true);
+    }
+  }
+  // the mapping has to outlive the borrowed packed forest
+  if (!LoadModelFromPacked(packed, packed_len, false)) {
+    return false;
+  }
+  model_cache_file_.reset(cache_file.release());
+  return true;
+}
+
+bool GBDT::LoadModelFromText(const char* buffer, size_t len, int keep_trees) {
   // use serialized string to restore this object
-  models_.clear();
+  if (keep_trees == 0) {
+    ClearModels();
+    delta_arenas_.clear();
+  }
+  has_contrib_background_ = false;
+  packed_forest_.reset();
+  quantized_forest_.reset();
+  compiled_model_.reset();
+  model_cache_file_.reset();
+  ResetPredictPlans();
   auto c_str = buffer;
   auto p = c_str;
   auto end = p + len;
   std::unordered_map<std::string, std::string> key_vals;
+  // feature names and infos are copied to the arena directly
+  const char* feature_names_str = 0;
+  size_t feature_names_len = 0;
+  const char* feature_infos_str = 0;
+  size_t feature_infos_len = 0;
+  const size_t kFeatureNamesLen = std::strlen("feature_names=");
+  const size_t kFeatureInfosLen = std::strlen("feature_infos=");
+  // the header is kept, without tree_sizes, when the trees are packed
+  const char* tree_sizes_str = 0;
+  size_t tree_sizes_len = 0;
   while (p < end) {
     auto line_len = Common::GetLine(p);
-    std::string cur_line(p, line_len);
-    if (line_len > 0) {
-      if (!Common::StartsWith(cur_line, "Tree=")) {
+    if (line_len >= kFeatureNamesLen && std::strncmp(p, "feature_names=", kFeatureNamesLen) == 0) {
+      feature_names_str = p + kFeatureNamesLen;
+      feature_names_len = line_len - kFeatureNamesLen;
+    } else if (line_len >= kFeatureInfosLen && std::strncmp(p, "feature_infos=", kFeatureInfosLen) == 0) {
+      feature_infos_str = p + kFeatureInfosLen;
+      feature_infos_len = line_len - kFeatureInfosLen;
+    } else if (line_len > 0) {
+      std::string cur_line(p, line_len);
+      if (cur_line == std::string("end of trees")) {
+        break;
+      } else if (!Common::StartsWith(cur_line, "Tree=")) {
+        if (Common::StartsWith(cur_line, "tree_sizes=")) {
+          tree_sizes_str = p;
+          tree_sizes_len = Common::SkipNewLine(p + line_len) - p;
+        }
         auto strs = Common::Split(cur_line.c_str(), '=');
         if (strs.size() == 1) {
           key_vals[strs[0]] = "";
@@ -32,12 +344,8 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
           key_vals[strs[0]] = strs[1];
         }
         else if (strs.size() > 2) {
-          if (strs[0] == "feature_names") {
-            key_vals[strs[0]] = cur_line.substr(std::strlen("feature_names="));
-          } else {
-            // Use first 128 chars to avoid exceed the message buffer.
-            Log::Fatal("Wrong line at model file: %s", cur_line.substr(0, std::min<size_t>(128, cur_line.size())).c_str());
-          }
+          // Use first 128 chars to avoid exceed the message buffer.
+          Log::Fatal("Wrong line at model file: %s", cur_line.substr(0, std::min<size_t>(128, cur_line.size())).c_str());
         }
       }
       else {
@@ -48,6 +356,8 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
     p = Common::SkipNewLine(p);
   }
 
+  const char* header_end = p;
+
   // get number of classes
   if (key_vals.count("num_class")) {
     Common::Atoi(key_vals["num_class"].c_str(), &num_class_);
@@ -83,25 +393,12 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
     average_output_ = true;
   }
 
-  // get feature names
-  if (key_vals.count("feature_names")) {
-    feature_names_ = Common::Split(key_vals["feature_names"].c_str(), ' ');
-    if (feature_names_.size() != static_cast<size_t>(max_feature_idx_ + 1)) {
-      Log::Fatal("Wrong size of feature_names");
-      return false;
-    }
-  } else {
+  if (feature_names_str == nullptr) {
     Log::Fatal("Model file doesn't contain feature_names");
     return false;
   }
 
-  if (key_vals.count("feature_infos")) {
-    feature_infos_ = Common::Split(key_vals["feature_infos"].c_str(), ' ');
-    if (feature_infos_.size() != static_cast<size_t>(max_feature_idx_ + 1)) {
-      Log::Fatal("Wrong size of feature_infos");
-      return false;
-    }
-  } else {
+  if (feature_infos_str == nullptr) {
     Log::Fatal("Model file doesn't contain feature_infos");
     return false;
   }
@@ -111,6 +408,10 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
     loaded_objective_.reset(ObjectiveFunction::CreateObjectiveFunction(str));
     objective_function_ = loaded_objective_.get();
   }
+
+  // locate the trees, and measure the arena storage each of them needs
+  std::vector<const char*> tree_strs;
+  std::vector<size_t> tree_arena_sizes;
   if (!key_vals.count("tree_sizes")) {
     while (p < end) {
       auto line_len = Common::GetLine(p);
@@ -120,7 +421,8 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
           p += line_len;
           p = Common::SkipNewLine(p);
           size_t used_len = 0;
-          models_.emplace_back(new Tree(p, &used_len));
+          tree_strs.push_back(p);
+          tree_arena_sizes.push_back(Tree::ArenaSize(p, &used_len));
           p += used_len;
         }
         else {
@@ -135,8 +437,14 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
     int num_trees = static_cast<int>(tree_sizes.size());
     for (int i = 0; i < num_trees; ++i) {
       tree_boundries[i + 1] = tree_boundries[i] + tree_sizes[i];
-      models_.emplace_back(std::unique_ptr<LightGBM::Tree>());
     }
+    // a truncated model would have the trees read past its end
+    if (tree_boundries[num_trees] > static_cast<size_t>(end - p)) {
+      Log::Fatal("Model format error, the trees are %zu bytes long but the model has only %zu bytes left",
+                 tree_boundries[num_trees], static_cast<size_t>(end - p));
+    }
+    tree_strs.resize(num_trees);
+    tree_arena_sizes.resize(num_trees);
     OMP_INIT_EX();
     #pragma omp parallel for schedule(static)
     for (int i = 0; i < num_trees; ++i) {
@@ -148,14 +456,83 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
         cur_p += line_len;
         cur_p = Common::SkipNewLine(cur_p);
         size_t used_len = 0;
-        models_[i].reset(new Tree(cur_p, &used_len));
+        tree_strs[i] = cur_p;
+        tree_arena_sizes[i] = Tree::ArenaSize(cur_p, &used_len);
       } else {
         Log::Fatal("Model format error, expect a tree here. met %s", cur_line.c_str());
       }
       OMP_LOOP_EX_END();
     }
     OMP_THROW_EX();
+    if (num_trees > 0) {
+      p += tree_boundries[num_trees];
+    }
+  }
+
+  if (CountTokens(feature_names_str, feature_names_len) != max_feature_idx_ + 1) {
+    Log::Fatal("Wrong size of feature_names");
+    return false;
+  }
+  if (CountTokens(feature_infos_str, feature_infos_len) != max_feature_idx_ + 1) {
+    Log::Fatal("Wrong size of feature_infos");
+    return false;
+  }
+
+  if (keep_trees > 0) {
+    // the kept trees split on the original features again, the used features are found with the new trees
+    if (features_compacted_) {
+      for (int i = 0; i < keep_trees; ++i) {
+        models_[i]->RemapSplitFeatures(used_features_);
+      }
+    }
+    for (size_t i = keep_trees; i < models_.size(); ++i) {
+      models_[i]->~Tree();
+    }
+    models_.resize(keep_trees);
+  }
+
+  // everything of the model is carved from one block, the kept trees stay where they are
+  Arena* arena = &arena_;
+  if (keep_trees > 0) {
+    delta_arenas_.push_back(std::unique_ptr<Arena>(new Arena()));
+    arena = delta_arenas_.back().get();
+  }
+  int num_trees = static_cast<int>(tree_strs.size());
+  std::vector<size_t> tree_offsets(num_trees + 1, 0);
+  for (int i = 0; i < num_trees; ++i) {
+    tree_offsets[i + 1] = tree_offsets[i] + Arena::AlignedSize<Tree>(1) + tree_arena_sizes[i];
+  }
+  const int num_feature = max_feature_idx_ + 1;
+  size_t arena_size = tree_offsets[num_trees];
+  arena_size += Arena::AlignedSize<char>(feature_names_len + 1) + Arena::AlignedSize<const char*>(num_feature);
+  arena_size += Arena::AlignedSize<char>(feature_infos_len + 1) + Arena::AlignedSize<const char*>(num_feature);
+  arena->Reserve(arena_size, config_.get() != nullptr && config_->model_huge_pages);
+  CopyNamesToArena(feature_names_str, feature_names_len, num_feature, arena, &feature_names_blob_, &feature_names_);
+  CopyNamesToArena(feature_infos_str, feature_infos_len, num_feature, arena, &feature_infos_blob_, &feature_infos_);
+
+  char* trees_block = arena->Allocate<char>(tree_offsets[num_trees]);
+  // the trees join the model once all of them are parsed
+  std::vector<Tree*> new_trees(num_trees, static_cast<Tree*>(0));
+  try {
+    OMP_INIT_EX();
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_trees; ++i) {
+      OMP_LOOP_EX_BEGIN();
+      Arena tree_arena(trees_block + tree_offsets[i], tree_offsets[i + 1] - tree_offsets[i]);
+      size_t used_len = 0;
+      new_trees[i] = new (tree_arena.Allocate<Tree>(1)) Tree(tree_strs[i], &used_len, &tree_arena);
+      OMP_LOOP_EX_END();
+    }
+    OMP_THROW_EX();
+  } catch (...) {
+    for (int i = 0; i < num_trees; ++i) {
+      if (new_trees[i] != 0) {
+        new_trees[i]->~Tree();
+      }
+    }
+    throw;
   }
+  models_.insert(models_.end(), new_trees.begin(), new_trees.end());
   num_iteration_for_pred_ = static_cast<int>(models_.size()) / num_tree_per_iteration_;
   num_init_iteration_ = num_iteration_for_pred_;
   iter_ = 0;
@@ -179,6 +556,156 @@ bool GBDT::LoadModelFromString(const char* buffer, size_t len) {
   if (!ss.str().empty()) {
     loaded_parameter_ = ss.str();
   }
+  // and the hashes of its trees, for LineageHash
+  packed_tree_hashes_.clear();
+  if (key_vals.count("tree_hashes")) {
+    if (!models_.empty()) {
+      Log::Fatal("tree_hashes is only valid in the header of a packed model");
+    }
+    const std::vector<std::string> hashes = Common::Split(key_vals["tree_hashes"].c_str(), ' ');
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      packed_tree_hashes_.push_back(std::strtoull(hashes[i].c_str(), 0, 16));
+    }
+  }
+  // a packed model header lists the used features, its trees already split on positions in them
+  if (key_vals.count("used_features")) {
+    if (!models_.empty()) {
+      Log::Fatal("used_features is only valid in the header of a packed model");
+    }
+    const std::vector<int> used_features = Common::StringToArray<int>(key_vals["used_features"], ' ');
+    CompactFeatures(&used_features);
+  } else {
+    CompactFeatures(0);
+  }
+  BuildFeatureTreeIndex();
+  model_header_.clear();
+  if (tree_sizes_str != nullptr) {
+    model_header_.append(buffer, tree_sizes_str);
+    model_header_.append(tree_sizes_str + tree_sizes_len, header_end);
+  } else {
+    model_header_.append(buffer, header_end);
+  }
+  if (features_compacted_ && !key_vals.count("used_features")) {
+    model_header_ += "used_features=" + Common::Join(used_features_, " ") + "\n";
+  }
+  model_header_ += "end of trees\n\nparameters:\n" + loaded_parameter_ + "end of parameters\n";
+  // a model cache holds the packed trees, so the model is always packed when it is used
+  if (config_.get() != nullptr && (config_->pack_model || !config_->model_cache_dir.empty()) && !models_.empty()) {
+    packed_forest_.reset(new PackedForest());
+    if (!packed_forest_->Build(models_, NumPredictFeatures(), PackedModelHeader(), config_->model_huge_pages)) {
+      packed_forest_.reset();
+    }
+  }
+  if (config_.get() != nullptr && config_->compile_model && !models_.empty()) {
+    compiled_model_.reset(new CompiledModel());
+    if (!compiled_model_->Build(models_, config_->model_compiler)) {
+      compiled_model_.reset();
+    }
+  }
+  return true;
+}
+
+void GBDT::CompactFeatures(const std::vector<int>* used_features) {
+  const int num_features = max_feature_idx_ + 1;
+  used_features_.clear();
+  features_compacted_ = false;
+  if (used_features != nullptr) {
+    for (size_t i = 0; i < used_features->size(); ++i) {
+      if ((*used_features)[i] < 0 || (*used_features)[i] >= num_features
+          || (i > 0 && (*used_features)[i] <= (*used_features)[i - 1])) {
+        Log::Fatal("Wrong used_features in the packed model header");
+      }
+    }
+    used_features_ = *used_features;
+    features_compacted_ = true;
+    return;
+  }
+  std::vector<int> feature_slots(num_features, -1);
+  for (size_t i = 0; i < models_.size(); ++i) {
+    for (int node = 0; node < models_[i]->num_leaves() - 1; ++node) {
+      const int feature = models_[i]->split_feature(node);
+      if (feature < 0 || feature >= num_features) {
+        Log::Fatal("Tree %zu splits on feature %d, but the model has %d features", i, feature, num_features);
+      }
+      feature_slots[feature] = 0;
+    }
+  }
+  for (int i = 0; i < num_features; ++i) {
+    if (feature_slots[i] >= 0) {
+      feature_slots[i] = static_cast<int>(used_features_.size());
+      used_features_.push_back(i);
+    }
+  }
+  if (models_.empty() || static_cast<int>(used_features_.size()) == num_features) {
+    return;
+  }
+  // the prediction buffer only holds the used features from now on
+  for (size_t i = 0; i < models_.size(); ++i) {
+    models_[i]->RemapSplitFeatures(feature_slots);
+  }
+  features_compacted_ = true;
+  Log::Debug("The trees split on %zu of %d features", used_features_.size(), num_features);
+}
+
+void GBDT::BuildFeatureTreeIndex() {
+  const bool is_packed = models_.empty() && packed_forest_;
+  const int num_trees = is_packed ? packed_forest_->num_trees() : static_cast<int>(models_.size());
+  std::vector<std::vector<int>> tree_features(num_trees);
+  for (int i = 0; i < num_trees; ++i) {
+    if (is_packed) {
+      packed_forest_->TreeSplitFeatures(i, &tree_features[i]);
+    } else {
+      for (int node = 0; node < models_[i]->num_leaves() - 1; ++node) {
+        tree_features[i].push_back(models_[i]->split_feature(node));
+      }
+      std::sort(tree_features[i].begin(), tree_features[i].end());
+      tree_features[i].erase(std::unique(tree_features[i].begin(), tree_features[i].end()), tree_features[i].end());
+    }
+  }
+  // trees of a feature are stored contiguously, in increasing order
+  feature_tree_boundaries_.assign(NumPredictFeatures() + 1, 0);
+  for (int i = 0; i < num_trees; ++i) {
+    for (size_t j = 0; j < tree_features[i].size(); ++j) {
+      ++feature_tree_boundaries_[tree_features[i][j] + 1];
+    }
+  }
+  for (size_t i = 1; i < feature_tree_boundaries_.size(); ++i) {
+    feature_tree_boundaries_[i] += feature_tree_boundaries_[i - 1];
+  }
+  feature_trees_.resize(feature_tree_boundaries_.back());
+  std::vector<int> next(feature_tree_boundaries_.begin(), feature_tree_boundaries_.end() - 1);
+  for (int i = 0; i < num_trees; ++i) {
+    for (size_t j = 0; j < tree_features[i].size(); ++j) {
+      feature_trees_[next[tree_features[i][j]]++] = i;
+    }
+  }
+}
+
+bool GBDT::LoadModelFromPacked(const char* buffer, size_t len, bool copy) {
+  std::unique_ptr<PackedForest> packed_forest(new PackedForest());
+  packed_forest->LoadFromBuffer(buffer, len, copy);
+  const std::string model_header = packed_forest->model_header();
+  if (!LoadModelFromText(model_header.c_str(), model_header.size())) {
+    return false;
+  }
+  if (packed_forest->num_trees() % num_tree_per_iteration_ != 0) {
+    Log::Fatal("Packed model has %d trees, not a multiple of %d trees per iteration",
+               packed_forest->num_trees(), num_tree_per_iteration_);
+  }
+  if (packed_forest->num_features() != NumPredictFeatures()) {
+    Log::Fatal("Packed model has %d features, expected %d", packed_forest->num_features(), NumPredictFeatures());
+  }
+  if (!packed_tree_hashes_.empty() && static_cast<int>(packed_tree_hashes_.size()) != packed_forest->num_trees()) {
+    Log::Fatal("Packed model has %d trees but %zu tree hashes", packed_forest->num_trees(), packed_tree_hashes_.size());
+  }
+  if (!features_compacted_) {
+    used_features_ = packed_forest->SplitFeatures();
+  }
+  // only the header is parsed from text, every tree is in the packed forest
+  packed_forest_.reset(packed_forest.release());
+  BuildFeatureTreeIndex();
+  num_iteration_for_pred_ = NumberOfTotalModel() / num_tree_per_iteration_;
+  num_init_iteration_ = num_iteration_for_pred_;
   return true;
 }
 
@@ -4,16 +4,82 @@
 #include <LightGBM/objective_function.h>
 #include <LightGBM/prediction_early_stop.h>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 namespace LightGBM {
 
+namespace {
+
+/*! \brief Trees given to a thread at once when one record is scored by several threads */
+const int kTreeParallelBlock = 64;
+/*! \brief Fewer trees are not worth waking up the other threads for */
+const int kTreeParallelMinTrees = 1024;
+/*! \brief Trees evaluated at once by PredictStaged */
+const int kStagedBlock = 64;
+
+}  // namespace
+
+int GBDT::ResolveEngine(int engine) const {
+  if (engine == kEngineCompiled && compiled_model_) {
+    return engine;
+  } else if ((engine == kEnginePacked || engine == kEnginePackedGroups) && packed_forest_) {
+    return engine;
+  } else if (engine == kEngineTrees && !models_.empty()) {
+    return engine;
+  }
+  if (compiled_model_) {
+    return kEngineCompiled;
+  } else if (packed_forest_) {
+    return packed_forest_->predict_in_groups() ? kEnginePackedGroups : kEnginePacked;
+  }
+  return kEngineTrees;
+}
+
+int GBDT::ResolveTreeBlock(int tree_block) const {
+  if (tree_block >= 0) {
+    return tree_block;
+  }
+  return num_iteration_for_pred_ * num_tree_per_iteration_ >= kTreeParallelMinTrees ? kTreeParallelBlock : 0;
+}
+
+int GBDT::ResolveThreads(int num_threads) const {
+  const int max_threads = omp_get_max_threads();
+  return num_threads > 0 && num_threads < max_threads ? num_threads : max_threads;
+}
+
 void GBDT::PredictRaw(const double* features, double* output, const PredictionEarlyStopInstance* early_stop) const {
   int early_stop_round_counter = 0;
+  const PredictPlan& plan = predict_plans_[active_plan_];
+  const int engine = ResolveEngine(plan.engine);
+  // a batch smaller than the threads is scored one record at a time, the trees are shared out instead
+  const int tree_block = ResolveTreeBlock(plan.tree_block);
+  if (tree_block > 0 && !omp_in_parallel()) {
+    const int num_threads = ResolveThreads(plan.num_threads);
+    if (num_threads > 1) {
+      PredictRawTreeParallel(engine, tree_block, num_threads, features, output, early_stop);
+      return;
+    }
+  }
+  if (engine == kEnginePackedGroups) {
+    PredictRawInGroups(features, output, early_stop);
+    return;
+  }
+  const CompiledModel* compiled = compiled_model_.get();
+  const PackedForest* packed = packed_forest_.get();
   // set zero
   std::memset(output, 0, sizeof(double) * num_tree_per_iteration_);
   for (int i = 0; i < num_iteration_for_pred_; ++i) {
     // predict all the trees for one iteration
     for (int k = 0; k < num_tree_per_iteration_; ++k) {
-      output[k] += models_[i * num_tree_per_iteration_ + k]->Predict(features);
+      if (engine == kEngineCompiled) {
+        output[k] += compiled->PredictTree(i * num_tree_per_iteration_ + k, features);
+      } else if (engine == kEnginePacked) {
+        output[k] += packed->PredictTree(i * num_tree_per_iteration_ + k, features);
+      } else {
+        output[k] += models_[i * num_tree_per_iteration_ + k]->Predict(features);
+      }
     }
     // check early stopping
     ++early_stop_round_counter;
@@ -26,14 +92,109 @@ void GBDT::PredictRaw(const double* features, double* output, const PredictionEa
   }
 }
 
+void GBDT::PredictRawInGroups(const double* features, double* output,
+                                 const PredictionEarlyStopInstance* early_stop) const {
+  const PackedForest* packed = packed_forest_.get();
+  double tree_outputs[PackedForest::kInterleave];
+  int early_stop_round_counter = 0;
+  // set zero
+  std::memset(output, 0, sizeof(double) * num_tree_per_iteration_);
+  int iter = 0;
+  while (iter < num_iteration_for_pred_) {
+    // all trees up to the next early stopping check are independent, every class included
+    const int num_iter = std::min(num_iteration_for_pred_ - iter, early_stop->round_period - early_stop_round_counter);
+    const int end_tree = (iter + num_iter) * num_tree_per_iteration_;
+    for (int tree = iter * num_tree_per_iteration_; tree < end_tree; tree += PackedForest::kInterleave) {
+      const int num_trees = std::min(PackedForest::kInterleave, end_tree - tree);
+      packed->PredictTrees(tree, num_trees, features, tree_outputs);
+      // same order of summation as one tree at a time
+      for (int j = 0; j < num_trees; ++j) {
+        output[(tree + j) % num_tree_per_iteration_] += tree_outputs[j];
+      }
+    }
+    iter += num_iter;
+    // check early stopping
+    early_stop_round_counter += num_iter;
+    if (early_stop->round_period == early_stop_round_counter) {
+      if (early_stop->callback_function(output, num_tree_per_iteration_)) {
+        return;
+      }
+      early_stop_round_counter = 0;
+    }
+  }
+}
+
+void GBDT::PredictRawTreeParallel(int engine, int tree_block, int num_threads, const double* features, double* output,
+                                  const PredictionEarlyStopInstance* early_stop) const {
+  std::vector<double> tree_outputs;
+  int early_stop_round_counter = 0;
+  // set zero
+  std::memset(output, 0, sizeof(double) * num_tree_per_iteration_);
+  int iter = 0;
+  while (iter < num_iteration_for_pred_) {
+    // all trees up to the next early stopping check are independent, every class included
+    const int num_iter = std::min(num_iteration_for_pred_ - iter, early_stop->round_period - early_stop_round_counter);
+    const int first_tree = iter * num_tree_per_iteration_;
+    const int num_trees = num_iter * num_tree_per_iteration_;
+    tree_outputs.resize(num_trees);
+    const int num_blocks = (num_trees + tree_block - 1) / tree_block;
+    #pragma omp parallel for schedule(static) num_threads(num_threads) if (num_blocks > 1)
+    for (int block = 0; block < num_blocks; ++block) {
+      const int start = block * tree_block;
+      PredictTreeRange(engine, first_tree + start, std::min(tree_block, num_trees - start), features,
+                       tree_outputs.data() + start);
+    }
+    // same order of summation as one tree at a time
+    for (int j = 0; j < num_trees; ++j) {
+      output[j % num_tree_per_iteration_] += tree_outputs[j];
+    }
+    iter += num_iter;
+    // check early stopping
+    early_stop_round_counter += num_iter;
+    if (early_stop->round_period == early_stop_round_counter) {
+      if (early_stop->callback_function(output, num_tree_per_iteration_)) {
+        return;
+      }
+      early_stop_round_counter = 0;
+    }
+  }
+}
+
+void GBDT::PredictTreeRange(int engine, int first_tree, int num_trees, const double* features, double* output) const {
+  const CompiledModel* compiled = compiled_model_.get();
+  const PackedForest* packed = packed_forest_.get();
+  if (engine == kEngineCompiled) {
+    for (int j = 0; j < num_trees; ++j) {
+      output[j] = compiled->PredictTree(first_tree + j, features);
+    }
+  } else if (engine == kEnginePackedGroups) {
+    for (int j = 0; j < num_trees; j += PackedForest::kInterleave) {
+      packed->PredictTrees(first_tree + j, std::min(PackedForest::kInterleave, num_trees - j), features, output + j);
+    }
+  } else if (engine == kEnginePacked) {
+    for (int j = 0; j < num_trees; ++j) {
+      output[j] = packed->PredictTree(first_tree + j, features);
+    }
+  } else {
+    for (int j = 0; j < num_trees; ++j) {
+      output[j] = models_[first_tree + j]->Predict(features);
+    }
+  }
+}
+
 void GBDT::PredictRawByMap(const std::unordered_map<int, double>& features, double* output, const PredictionEarlyStopInstance* early_stop) const {
   int early_stop_round_counter = 0;
+  const PackedForest* packed = packed_forest_.get();
   // set zero
   std::memset(output, 0, sizeof(double) * num_tree_per_iteration_);
   for (int i = 0; i < num_iteration_for_pred_; ++i) {
     // predict all the trees for one iteration
     for (int k = 0; k < num_tree_per_iteration_; ++k) {
-      output[k] += models_[i * num_tree_per_iteration_ + k]->PredictByMap(features);
+      if (packed != nullptr) {
+        output[k] += packed->PredictTreeByMap(i * num_tree_per_iteration_ + k, features);
+      } else {
+        output[k] += models_[i * num_tree_per_iteration_ + k]->PredictByMap(features);
+      }
     }
     // check early stopping
     ++early_stop_round_counter;
@@ -68,14 +229,301 @@ void GBDT::PredictByMap(const std::unordered_map<int, double>& features, double*
   }
 }
 
+void GBDT::PredictClasses(const double* features, const std::vector<int>& classes, bool normalize,
+                          double* output) const {
+  int engine = ResolveEngine(predict_plans_[active_plan_].engine);
+  // the trees of a class are not consecutive, the groups of the packed forest would mix classes
+  if (engine == kEnginePackedGroups) {
+    engine = kEnginePacked;
+  }
+  const CompiledModel* compiled = compiled_model_.get();
+  const PackedForest* packed = packed_forest_.get();
+  const int num_classes = static_cast<int>(classes.size());
+  // set zero
+  std::memset(output, 0, sizeof(double) * num_classes);
+  // same order of summation as PredictRaw, the raw scores are the same
+  for (int i = 0; i < num_iteration_for_pred_; ++i) {
+    for (int k = 0; k < num_classes; ++k) {
+      const int tree = i * num_tree_per_iteration_ + classes[k];
+      if (engine == kEngineCompiled) {
+        output[k] += compiled->PredictTree(tree, features);
+      } else if (engine == kEnginePacked) {
+        output[k] += packed->PredictTree(tree, features);
+      } else {
+        output[k] += models_[tree]->Predict(features);
+      }
+    }
+  }
+  if (normalize) {
+    Common::Softmax(output, output, num_classes);
+  }
+}
+
+void GBDT::PredictStaged(const double* features, const std::vector<int>& checkpoints, bool is_raw_score,
+                         double* output) const {
+  const int engine = ResolveEngine(predict_plans_[active_plan_].engine);
+  double tree_outputs[kStagedBlock];
+  // the raw scores go on from one checkpoint to the next
+  std::vector<double> raw_score(num_tree_per_iteration_, 0.0f);
+  int tree = 0;
+  for (size_t i = 0; i < checkpoints.size(); ++i) {
+    const int end_tree = checkpoints[i] * num_tree_per_iteration_;
+    while (tree < end_tree) {
+      const int num_trees = std::min(kStagedBlock, end_tree - tree);
+      PredictTreeRange(engine, tree, num_trees, features, tree_outputs);
+      // same order of summation as PredictRaw
+      for (int j = 0; j < num_trees; ++j) {
+        raw_score[(tree + j) % num_tree_per_iteration_] += tree_outputs[j];
+      }
+      tree += num_trees;
+    }
+    double* stage_output = output + i * num_tree_per_iteration_;
+    if (is_raw_score) {
+      std::memcpy(stage_output, raw_score.data(), sizeof(double) * num_tree_per_iteration_);
+    } else {
+      ConvertRawScore(raw_score.data(), checkpoints[i], stage_output);
+    }
+  }
+}
+
+void GBDT::AddTreesToRawScore(const double* features, int first_tree, int end_tree, double* raw_score) const {
+  const int engine = ResolveEngine(predict_plans_[active_plan_].engine);
+  double tree_outputs[kStagedBlock];
+  for (int tree = first_tree; tree < end_tree; tree += kStagedBlock) {
+    const int num_trees = std::min(kStagedBlock, end_tree - tree);
+    PredictTreeRange(engine, tree, num_trees, features, tree_outputs);
+    for (int j = 0; j < num_trees; ++j) {
+      raw_score[(tree + j) % num_tree_per_iteration_] += tree_outputs[j];
+    }
+  }
+}
+
+void GBDT::ConvertRawScore(const double* raw_score, int num_iteration, double* output) const {
+  if (output != raw_score) {
+    std::memcpy(output, raw_score, sizeof(double) * num_tree_per_iteration_);
+  }
+  if (average_output_) {
+    for (int k = 0; k < num_tree_per_iteration_; ++k) {
+      output[k] /= num_iteration;
+    }
+  } else if (objective_function_ != nullptr) {
+    objective_function_->ConvertOutput(output, output);
+  }
+}
+
+void GBDT::ConvertRawScores(double* scores, int num_rows, bool fast_exp) const {
+  if (average_output_) {
+    const int64_t len = static_cast<int64_t>(num_rows) * num_tree_per_iteration_;
+    for (int64_t i = 0; i < len; ++i) {
+      scores[i] /= num_iteration_for_pred_;
+    }
+  } else if (objective_function_ != nullptr) {
+    objective_function_->ConvertOutputBatch(scores, scores, num_rows, fast_exp);
+  }
+}
+
+void GBDT::PredictContrib(const double* features, double* output) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict contributions with a packed model");
+  }
+  const int num_features = max_feature_idx_ + 1;
+  const int num_predict_features = NumPredictFeatures();
+  const int tid = omp_get_thread_num();
+  std::memset(output, 0, sizeof(double) * num_tree_per_iteration_ * (num_features + 1));
+  for (int k = 0; k < num_tree_per_iteration_; ++k) {
+    double* class_output = output + k * (num_features + 1);
+    // the trees split on positions in the prediction buffer when the features are compacted
+    if (features_compacted_) {
+      shap_outputs_[tid].assign(num_predict_features + 1, 0.0);
+      double* tree_output = shap_outputs_[tid].data();
+      PredictClassContrib(features, k, tree_output);
+      for (int j = 0; j < num_predict_features; ++j) {
+        class_output[used_features_[j]] = tree_output[j];
+      }
+      class_output[num_features] = tree_output[num_predict_features];
+    } else {
+      PredictClassContrib(features, k, class_output);
+    }
+  }
+}
+
+namespace {
+
+/*! \brief Larger absolute contribution first, then smaller feature index */
+struct LargerContrib {
+  bool operator()(const std::pair<int, double>& a, const std::pair<int, double>& b) const {
+    const double abs_a = std::fabs(a.second);
+    const double abs_b = std::fabs(b.second);
+    return abs_a > abs_b || (abs_a == abs_b && a.first < b.first);
+  }
+};
+
+}  // namespace
+
+void GBDT::PredictContribSparse(const double* features, int top_k,
+                                std::vector<std::vector<std::pair<int, double>>>* output) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict contributions with a packed model");
+  }
+  const int num_features = max_feature_idx_ + 1;
+  const int num_predict_features = NumPredictFeatures();
+  const int tid = omp_get_thread_num();
+  // only the features in the prediction buffer can have contributions, the dense row of every feature is never built
+  std::vector<double>& tree_output = shap_outputs_[tid];
+  output->resize(num_tree_per_iteration_);
+  for (int k = 0; k < num_tree_per_iteration_; ++k) {
+    tree_output.assign(num_predict_features + 1, 0.0);
+    PredictClassContrib(features, k, tree_output.data());
+    std::vector<std::pair<int, double>>& class_output = (*output)[k];
+    class_output.clear();
+    for (int j = 0; j < num_predict_features; ++j) {
+      if (tree_output[j] != 0.0) {
+        class_output.push_back(std::make_pair(features_compacted_ ? used_features_[j] : j, tree_output[j]));
+      }
+    }
+    if (top_k > 0 && static_cast<int>(class_output.size()) > top_k) {
+      std::nth_element(class_output.begin(), class_output.begin() + top_k, class_output.end(), LargerContrib());
+      class_output.resize(top_k);
+      std::sort(class_output.begin(), class_output.end());
+    }
+    class_output.push_back(std::make_pair(num_features, tree_output[num_predict_features]));
+  }
+}
+
+void GBDT::PredictClassContrib(const double* features, int class_id, double* output) const {
+  const int num_predict_features = NumPredictFeatures();
+  if (contrib_method_ == kContribSaabas) {
+    for (int i = 0; i < num_iteration_for_pred_; ++i) {
+      models_[i * num_tree_per_iteration_ + class_id]->PredictContribSaabas(features, num_predict_features, output);
+    }
+    return;
+  }
+  Tree::SHAPBuffer* buffer = &shap_buffers_[omp_get_thread_num()];
+  if (contrib_method_ == kContribInterventional) {
+    for (int i = 0; i < num_iteration_for_pred_; ++i) {
+      models_[i * num_tree_per_iteration_ + class_id]->PredictContribInterventional(features, num_predict_features,
+                                                                                   output, buffer);
+    }
+  } else {
+    for (int i = 0; i < num_iteration_for_pred_; ++i) {
+      models_[i * num_tree_per_iteration_ + class_id]->PredictContrib(features, num_predict_features, output, buffer);
+    }
+  }
+}
+
+void GBDT::SetContribBackground(const std::vector<std::vector<double>>& background) {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict contributions with a packed model");
+  }
+  const int num_predict_features = NumPredictFeatures();
+  std::vector<double> rows(background.size() * num_predict_features);
+  for (size_t i = 0; i < background.size(); ++i) {
+    std::copy(background[i].begin(), background[i].end(), rows.begin() + i * num_predict_features);
+  }
+  OMP_INIT_EX();
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
+    OMP_LOOP_EX_BEGIN();
+    models_[i]->SetBackground(rows.data(), static_cast<int>(background.size()), num_predict_features);
+    OMP_LOOP_EX_END();
+  }
+  OMP_THROW_EX();
+  has_contrib_background_ = !background.empty();
+}
+
+void GBDT::PredictTreeOutputs(const double* features, std::vector<double>* tree_outputs) const {
+  tree_outputs->resize(num_iteration_for_pred_ * num_tree_per_iteration_);
+  PredictTreeRange(ResolveEngine(predict_plans_[0].engine), 0, static_cast<int>(tree_outputs->size()),
+                   features, tree_outputs->data());
+}
+
+int GBDT::RepredictTreeOutputs(const double* features, const std::vector<int>& changed_features,
+                               double* tree_outputs) const {
+  const int num_trees = num_iteration_for_pred_ * num_tree_per_iteration_;
+  // a tree can split on several of the changed features, marking is cheaper than sorting the trees
+  std::vector<char> is_changed(num_trees, 0);
+  int num_changed_trees = 0;
+  for (size_t i = 0; i < changed_features.size(); ++i) {
+    const int feature = changed_features[i];
+    for (int j = feature_tree_boundaries_[feature]; j < feature_tree_boundaries_[feature + 1]; ++j) {
+      const int tree = feature_trees_[j];
+      if (tree >= num_trees) {
+        break;
+      }
+      num_changed_trees += is_changed[tree] == 0;
+      is_changed[tree] = 1;
+    }
+  }
+  const int engine = ResolveEngine(predict_plans_[0].engine);
+  // consecutive trees are evaluated together
+  int start = 0;
+  while (start < num_trees) {
+    if (!is_changed[start]) {
+      ++start;
+      continue;
+    }
+    int end = start + 1;
+    while (end < num_trees && is_changed[end]) {
+      ++end;
+    }
+    PredictTreeRange(engine, start, end - start, features, tree_outputs + start);
+    start = end;
+  }
+  return num_changed_trees;
+}
+
+void GBDT::PredictFromTreeOutputs(const double* tree_outputs, double* output) const {
+  std::memset(output, 0, sizeof(double) * num_tree_per_iteration_);
+  // same order of summation as PredictRaw
+  const int num_trees = num_iteration_for_pred_ * num_tree_per_iteration_;
+  for (int j = 0; j < num_trees; ++j) {
+    output[j % num_tree_per_iteration_] += tree_outputs[j];
+  }
+  if (average_output_) {
+    for (int k = 0; k < num_tree_per_iteration_; ++k) {
+      output[k] /= num_iteration_for_pred_;
+    }
+  } else if (objective_function_ != nullptr) {
+    objective_function_->ConvertOutput(output, output);
+  }
+}
+
 void GBDT::PredictLeafIndex(const double* features, double* output) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict leaf index with a packed model");
+  }
   int total_tree = num_iteration_for_pred_ * num_tree_per_iteration_;
   for (int i = 0; i < total_tree; ++i) {
     output[i] = models_[i]->PredictLeafIndex(features);
   }
 }
 
+void GBDT::PredictLeafIndex(const double* features, int32_t* output) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict leaf index with a packed model");
+  }
+  int total_tree = num_iteration_for_pred_ * num_tree_per_iteration_;
+  for (int i = 0; i < total_tree; ++i) {
+    output[i] = models_[i]->PredictLeafIndex(features);
+  }
+}
+
+std::vector<int32_t> GBDT::LeafOffsets() const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict leaf index with a packed model");
+  }
+  int total_tree = num_iteration_for_pred_ * num_tree_per_iteration_;
+  std::vector<int32_t> offsets(total_tree + 1, 0);
+  for (int i = 0; i < total_tree; ++i) {
+    offsets[i + 1] = offsets[i] + models_[i]->num_leaves();
+  }
+  return offsets;
+}
+
 void GBDT::PredictLeafIndexByMap(const std::unordered_map<int, double>& features, double* output) const {
+  if (models_.empty() && packed_forest_) {
+    Log::Fatal("Cannot predict leaf index with a packed model");
+  }
   int total_tree = num_iteration_for_pred_ * num_tree_per_iteration_;
   for (int i = 0; i < total_tree; ++i) {
     output[i] = models_[i]->PredictLeafIndexByMap(features);
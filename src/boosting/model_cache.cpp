@@ -0,0 +1,173 @@
+#include "model_cache.h"
+
+#include <LightGBM/utils/log.h>
+#include <LightGBM/utils/openmp_wrapper.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace LightGBM {
+
+namespace {
+
+const char kModelCacheMagic[8] = { 'L', 'G', 'B', 'M', 'C', 'A', 'C', 'H' };
+const uint32_t kByteOrder = 0x01020304;
+/*! \brief Chunks of the model string hashed in parallel, fixed so that the hash does not depend on the threads */
+const size_t kHashChunkSize = 4 * 1024 * 1024;
+
+/*! \brief MurmurHash64A by Austin Appleby, public domain */
+uint64_t MurmurHash64(const char* data, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const size_t num_blocks = len / 8;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    uint64_t k;
+    std::memcpy(&k, data + i * 8, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  const unsigned char* tail = reinterpret_cast<const unsigned char*>(data + num_blocks * 8);
+  // every case falls through to mix in the remaining bytes of the tail
+  switch (len & 7) {
+  case 7:
+    h ^= static_cast<uint64_t>(tail[6]) << 48;
+    // fall through
+  case 6:
+    h ^= static_cast<uint64_t>(tail[5]) << 40;
+    // fall through
+  case 5:
+    h ^= static_cast<uint64_t>(tail[4]) << 32;
+    // fall through
+  case 4:
+    h ^= static_cast<uint64_t>(tail[3]) << 24;
+    // fall through
+  case 3:
+    h ^= static_cast<uint64_t>(tail[2]) << 16;
+    // fall through
+  case 2:
+    h ^= static_cast<uint64_t>(tail[1]) << 8;
+    // fall through
+  case 1:
+    h ^= static_cast<uint64_t>(tail[0]);
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+}  // namespace
+
+uint64_t ModelCache::Hash(const char* buffer, size_t len) {
+  const int num_chunks = static_cast<int>((len + kHashChunkSize - 1) / kHashChunkSize);
+  std::vector<uint64_t> chunk_hashes(num_chunks);
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < num_chunks; ++i) {
+    const size_t start = static_cast<size_t>(i) * kHashChunkSize;
+    const size_t chunk_len = std::min(kHashChunkSize, len - start);
+    chunk_hashes[i] = MurmurHash64(buffer + start, chunk_len, static_cast<uint64_t>(i));
+  }
+  return MurmurHash64(reinterpret_cast<const char*>(chunk_hashes.data()),
+                      chunk_hashes.size() * sizeof(uint64_t), static_cast<uint64_t>(len));
+}
+
+std::string ModelCache::FileName(const std::string& dir, uint64_t model_hash, uint64_t model_len) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "lightgbm-%016llx-%llu.pkf",
+                static_cast<unsigned long long>(model_hash), static_cast<unsigned long long>(model_len));
+  if (!dir.empty() && dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') {
+    return dir + "/" + name;
+  }
+  return dir + name;
+}
+
+void ModelCache::InitHeader(uint64_t model_hash, uint64_t model_len, uint64_t packed_size, ModelCacheHeader* header) {
+  std::memset(header, 0, sizeof(ModelCacheHeader));
+  std::memcpy(header->magic, kModelCacheMagic, sizeof(kModelCacheMagic));
+  header->byte_order = kByteOrder;
+  header->cache_version = kVersion;
+  header->packed_version = PackedForest::kVersion;
+  header->layout = static_cast<uint32_t>(sizeof(PackedNode) << 16 | sizeof(PackedForestHeader));
+  header->model_hash = model_hash;
+  header->model_len = model_len;
+  header->packed_size = packed_size;
+}
+
+std::unique_ptr<MappedFile> ModelCache::Open(const std::string& dir, uint64_t model_hash, uint64_t model_len,
+                                             const char** out_packed, size_t* out_packed_len) {
+  const std::string filename = FileName(dir, model_hash, model_len);
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  if (!file->Open(filename)) {
+    return std::unique_ptr<MappedFile>();
+  }
+  if (file->size() < sizeof(ModelCacheHeader)) {
+    Log::Warning("Ignoring truncated model cache file %s", filename.c_str());
+    return std::unique_ptr<MappedFile>();
+  }
+  // everything but the packed size has to match exactly, otherwise the file is stale
+  ModelCacheHeader expected;
+  const ModelCacheHeader* header = reinterpret_cast<const ModelCacheHeader*>(file->data());
+  InitHeader(model_hash, model_len, header->packed_size, &expected);
+  if (std::memcmp(header, &expected, sizeof(ModelCacheHeader)) != 0
+      || header->packed_size != file->size() - sizeof(ModelCacheHeader)
+      || !PackedForest::IsPackedForest(file->data() + sizeof(ModelCacheHeader), header->packed_size)) {
+    Log::Warning("Ignoring stale model cache file %s", filename.c_str());
+    return std::unique_ptr<MappedFile>();
+  }
+  // a damaged packed header would make loading the file fatal, rather than parsing the model again
+  const PackedForestHeader* packed_header =
+    reinterpret_cast<const PackedForestHeader*>(file->data() + sizeof(ModelCacheHeader));
+  if (packed_header->version != PackedForest::kVersion
+      || packed_header->total_size != static_cast<int64_t>(header->packed_size)) {
+    Log::Warning("Ignoring damaged model cache file %s", filename.c_str());
+    return std::unique_ptr<MappedFile>();
+  }
+  *out_packed = file->data() + sizeof(ModelCacheHeader);
+  *out_packed_len = static_cast<size_t>(header->packed_size);
+  return file;
+}
+
+void ModelCache::Save(const std::string& dir, uint64_t model_hash, uint64_t model_len, const PackedForest& packed) {
+  const std::string filename = FileName(dir, model_hash, model_len);
+  // written aside and renamed, so that concurrent loads never see a partial file
+  char suffix[32];
+  #if defined(_WIN32)
+  std::snprintf(suffix, sizeof(suffix), ".tmp");
+  #else
+  std::snprintf(suffix, sizeof(suffix), ".tmp.%d", static_cast<int>(getpid()));
+  #endif
+  const std::string tmp_filename = filename + suffix;
+  FILE* file = std::fopen(tmp_filename.c_str(), "wb");
+  if (file == 0) {
+    Log::Warning("Cannot write model cache file %s", tmp_filename.c_str());
+    return;
+  }
+  ModelCacheHeader header;
+  InitHeader(model_hash, model_len, packed.size(), &header);
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+    && std::fwrite(packed.data(), 1, packed.size(), file) == packed.size();
+  ok = std::fclose(file) == 0 && ok;
+  #if defined(_WIN32)
+  std::remove(filename.c_str());
+  #endif
+  if (!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp_filename.c_str());
+    Log::Warning("Cannot write model cache file %s", filename.c_str());
+    return;
+  }
+  Log::Debug("Saved model cache file %s", filename.c_str());
+}
+
+}  // namespace LightGBM
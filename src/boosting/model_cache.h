@@ -0,0 +1,72 @@
+#ifndef LIGHTGBM_BOOSTING_MODEL_CACHE_H_
+#define LIGHTGBM_BOOSTING_MODEL_CACHE_H_
+
+#include <LightGBM/packed_forest.h>
+#include <LightGBM/utils/mapped_file.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace LightGBM {
+
+/*!
+* \brief Header of a cached packed model file, the packed forest follows it
+*/
+struct ModelCacheHeader {
+  char magic[8];
+  /*! \brief 0x01020304 as written by the machine that made the file */
+  uint32_t byte_order;
+  int32_t cache_version;
+  int32_t packed_version;
+  /*! \brief sizeof(PackedNode) << 16 | sizeof(PackedForestHeader) */
+  uint32_t layout;
+  /*! \brief Hash of the model string */
+  uint64_t model_hash;
+  /*! \brief Length of the model string */
+  uint64_t model_len;
+  /*! \brief Size of the packed forest after this header */
+  uint64_t packed_size;
+  /*! \brief Pads the header to a cache line, so the packed forest keeps the alignment of its nodes */
+  uint64_t reserved[2];
+};
+
+/*!
+* \brief Directory of packed models, keyed by a hash of the model string.
+*        Files are written once and mapped read-only by later loads of the same model.
+*/
+class ModelCache {
+public:
+  /*! \brief Version of the cache files, bump when their meaning changes */
+  static const int32_t kVersion = 3;
+
+  /*!
+  * \brief Hash of a model string, chunks are hashed in parallel
+  */
+  static uint64_t Hash(const char* buffer, size_t len);
+
+  /*!
+  * \brief Map the cached packed model of a model string
+  * \param dir Cache directory
+  * \param model_hash Hash of the model string
+  * \param model_len Length of the model string
+  * \param out_packed Output, the packed forest inside the file
+  * \param out_packed_len Output, size of the packed forest
+  * \return The mapped file, nullptr if there is no valid cached file
+  */
+  static std::unique_ptr<MappedFile> Open(const std::string& dir, uint64_t model_hash, uint64_t model_len,
+                                          const char** out_packed, size_t* out_packed_len);
+
+  /*!
+  * \brief Write the packed model of a model string to the cache, failures are only reported
+  */
+  static void Save(const std::string& dir, uint64_t model_hash, uint64_t model_len, const PackedForest& packed);
+
+private:
+  static std::string FileName(const std::string& dir, uint64_t model_hash, uint64_t model_len);
+  static void InitHeader(uint64_t model_hash, uint64_t model_len, uint64_t packed_size, ModelCacheHeader* header);
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_BOOSTING_MODEL_CACHE_H_
@@ -0,0 +1,785 @@
+#include <LightGBM/packed_forest.h>
+
+#include <LightGBM/utils/log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace LightGBM {
+
+namespace {
+
+const char kPackedForestMagic[8] = { 'L', 'G', 'B', 'M', 'P', 'K', 'F', '\0' };
+
+/*! \brief Max number of distinct thresholds per feature, and of distinct bitsets */
+const size_t kMaxTableSize = 65536;
+
+/*! \brief Nodes in one cache line */
+const size_t kNodesPerCacheLine = 64 / sizeof(PackedNode);
+
+inline uint64_t DoubleBits(double val) {
+  uint64_t bits;
+  std::memcpy(&bits, &val, sizeof(bits));
+  return bits;
+}
+
+/*! \brief Key of a threshold in the table of its feature, the bits of the encoded threshold */
+inline uint64_t ThresholdKey(double threshold, PackedForest::ThresholdType type) {
+  if (type == PackedForest::kThresholdFloat32) {
+    const float val = static_cast<float>(threshold);
+    uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    return bits;
+  }
+  return DoubleBits(threshold);
+}
+
+/*! \brief Encoded leaf value, the bits of the value or its quantized code */
+inline uint64_t LeafCode(double val, double scale, PackedForest::LeafType type) {
+  if (type == PackedForest::kLeafFloat16) {
+    return Common::FloatToHalf(static_cast<float>(val / scale));
+  } else if (type == PackedForest::kLeafInt8) {
+    const double code = std::max(-127.0, std::min(127.0, std::floor(val / scale + 0.5)));
+    return static_cast<uint8_t>(static_cast<int8_t>(code));
+  }
+  return DoubleBits(val);
+}
+
+struct NodeKeyHash {
+  size_t operator()(const PackedNode& node) const {
+    size_t seed = static_cast<size_t>(static_cast<uint32_t>(node.left_child));
+    seed = seed * 1000003u ^ static_cast<uint32_t>(node.right_child);
+    seed = seed * 1000003u ^ static_cast<uint32_t>(node.split_feature);
+    seed = seed * 1000003u ^ node.threshold;
+    seed = seed * 1000003u ^ static_cast<uint8_t>(node.decision_type);
+    return seed;
+  }
+};
+
+struct NodeKeyEqual {
+  bool operator()(const PackedNode& a, const PackedNode& b) const {
+    return a.left_child == b.left_child && a.right_child == b.right_child
+      && a.split_feature == b.split_feature && a.threshold == b.threshold
+      && a.decision_type == b.decision_type;
+  }
+};
+
+/*!
+* \brief Turns trees into canonical nodes bottom-up, identical subtrees get the same id
+*/
+class ForestInterner {
+public:
+  ForestInterner(const std::vector<std::vector<uint64_t>>& feature_thresholds,
+                 const std::map<std::vector<uint32_t>, int>& bitset_ids,
+                 const std::vector<double>& tree_scales,
+                 PackedForest::LeafType leaf_type, PackedForest::ThresholdType threshold_type)
+    : feature_thresholds_(feature_thresholds), bitset_ids_(bitset_ids), tree_scales_(tree_scales),
+    leaf_type_(leaf_type), threshold_type_(threshold_type) {}
+
+  int Leaf(int tree_idx, double val) {
+    // quantized leaves are only shared by trees with the same scale
+    const uint64_t scale_bits = leaf_type_ == PackedForest::kLeafFloat64 ? 0 : DoubleBits(tree_scales_[tree_idx]);
+    const std::pair<uint64_t, uint64_t> key(scale_bits, LeafCode(val, tree_scales_[tree_idx], leaf_type_));
+    std::map<std::pair<uint64_t, uint64_t>, int>::iterator it = leaf_ids_.find(key);
+    if (it != leaf_ids_.end()) {
+      return ~(it->second);
+    }
+    const int id = static_cast<int>(leaf_codes_.size());
+    leaf_ids_[key] = id;
+    leaf_codes_.push_back(key.second);
+    return ~id;
+  }
+
+  int Node(int tree_idx, const Tree& tree, int node) {
+    if (node < 0) {
+      return Leaf(tree_idx, tree.LeafOutput(~node));
+    }
+    PackedNode packed;
+    packed.left_child = Node(tree_idx, tree, tree.left_child(node));
+    packed.right_child = Node(tree_idx, tree, tree.right_child(node));
+    packed.split_feature = tree.split_feature(node);
+    packed.decision_type = tree.decision_type(node);
+    packed.reserved = 0;
+    // Tree::GetLeaf only uses numerical decisions for trees without categorical splits
+    Tree::SetDecisionType(&packed.decision_type, tree.IsCategoricalSplit(node), kCategoricalMask);
+    if (tree.IsCategoricalSplit(node)) {
+      int num_words = 0;
+      const uint32_t* bits = tree.cat_threshold(node, &num_words);
+      packed.threshold = static_cast<uint16_t>(bitset_ids_.at(std::vector<uint32_t>(bits, bits + num_words)));
+    } else {
+      const std::vector<uint64_t>& table = feature_thresholds_[packed.split_feature];
+      packed.threshold = static_cast<uint16_t>(
+        std::lower_bound(table.begin(), table.end(), ThresholdKey(tree.threshold(node), threshold_type_)) - table.begin());
+    }
+    int id = 0;
+    std::unordered_map<PackedNode, int, NodeKeyHash, NodeKeyEqual>::iterator it = node_ids_.find(packed);
+    if (it != node_ids_.end()) {
+      id = it->second;
+    } else {
+      id = static_cast<int>(nodes_.size());
+      node_ids_[packed] = id;
+      nodes_.push_back(packed);
+      left_counts_.push_back(0);
+      right_counts_.push_back(0);
+    }
+    // training counts of every copy of a merged subtree add up
+    left_counts_[id] += tree.data_count(tree.left_child(node));
+    right_counts_[id] += tree.data_count(tree.right_child(node));
+    return id;
+  }
+
+  inline const std::vector<PackedNode>& nodes() const { return nodes_; }
+
+  /*! \brief Child of a node that saw more training data, left on ties */
+  inline int HotChild(int id) const {
+    return left_counts_[id] >= right_counts_[id] ? nodes_[id].left_child : nodes_[id].right_child;
+  }
+
+  inline int ColdChild(int id) const {
+    return left_counts_[id] >= right_counts_[id] ? nodes_[id].right_child : nodes_[id].left_child;
+  }
+  /*! \brief Leaf values as returned by LeafCode */
+  inline const std::vector<uint64_t>& leaf_codes() const { return leaf_codes_; }
+
+private:
+  const std::vector<std::vector<uint64_t>>& feature_thresholds_;
+  const std::map<std::vector<uint32_t>, int>& bitset_ids_;
+  const std::vector<double>& tree_scales_;
+  PackedForest::LeafType leaf_type_;
+  PackedForest::ThresholdType threshold_type_;
+  std::map<std::pair<uint64_t, uint64_t>, int> leaf_ids_;
+  std::vector<uint64_t> leaf_codes_;
+  std::unordered_map<PackedNode, int, NodeKeyHash, NodeKeyEqual> node_ids_;
+  std::vector<PackedNode> nodes_;
+  /*! \brief Number of training data that went to the left and right of every node */
+  std::vector<int64_t> left_counts_;
+  std::vector<int64_t> right_counts_;
+};
+
+/*! \brief Max ratio of the nodes of a complete tree to the nodes of the tree it stores */
+const int kMaxImplicitFill = 2;
+
+/*!
+* \brief Store a subtree into a complete binary tree. Leaves above the last level become splits that
+*        always go left, and their leaf value fills every slot below them.
+*/
+void FillImplicit(int tree_idx, const Tree& tree, int node, int slot, int depth, int max_depth,
+                  PackedForest::ThresholdType threshold_type, ForestInterner* interner,
+                  PackedImplicitNode* nodes, int32_t* leaves) {
+  if (depth == max_depth) {
+    leaves[slot - ((1 << max_depth) - 1)] = ~interner->Leaf(tree_idx, tree.LeafOutput(~node));
+    return;
+  }
+  PackedImplicitNode& out = nodes[slot];
+  std::memset(&out, 0, sizeof(out));
+  out.zero_right = -1;
+  if (node < 0) {
+    // everything goes left
+    out.threshold = std::numeric_limits<double>::infinity();
+    FillImplicit(tree_idx, tree, node, 2 * slot + 1, depth + 1, max_depth, threshold_type, interner, nodes, leaves);
+    FillImplicit(tree_idx, tree, node, 2 * slot + 2, depth + 1, max_depth, threshold_type, interner, nodes, leaves);
+  } else {
+    out.threshold = threshold_type == PackedForest::kThresholdFloat32
+      ? static_cast<double>(static_cast<float>(tree.threshold(node))) : tree.threshold(node);
+    out.split_feature = tree.split_feature(node);
+    const uint8_t missing_type = Tree::GetMissingType(tree.decision_type(node));
+    const int8_t default_right = Tree::GetDecisionType(tree.decision_type(node), kDefaultLeftMask) ? 0 : 1;
+    if (missing_type == 0) {
+      // NaN is compared as 0
+      out.nan_right = 0.0 <= out.threshold ? 0 : 1;
+    } else {
+      out.nan_right = default_right;
+    }
+    if (missing_type == 1) {
+      out.zero_right = default_right;
+    }
+    FillImplicit(tree_idx, tree, tree.left_child(node), 2 * slot + 1, depth + 1, max_depth, threshold_type,
+                 interner, nodes, leaves);
+    FillImplicit(tree_idx, tree, tree.right_child(node), 2 * slot + 2, depth + 1, max_depth, threshold_type,
+                 interner, nodes, leaves);
+  }
+}
+
+/*!
+* \brief Size above which a packed forest does not stay in cache while predicting. The shared last level
+*        cache is often reported for a whole package, the private L2 of a core is a steadier hint.
+*/
+size_t InterleaveThreshold() {
+  long size = 0;
+  #if defined(_SC_LEVEL2_CACHE_SIZE)
+  size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  #endif
+  return size > 0 ? 2 * static_cast<size_t>(size) : static_cast<size_t>(8) << 20;
+}
+
+/*!
+* \brief Whether the traversals of a packed forest of this size are interleaved.
+*        The environment variable LIGHTGBM_INTERLEAVE (always or never) overrides the size, e.g. to test small models
+*/
+bool UseInterleave(size_t size) {
+  static const size_t interleave_threshold = InterleaveThreshold();
+  const char* requested = std::getenv("LIGHTGBM_INTERLEAVE");
+  if (requested != 0 && requested[0] != '\0') {
+    if (std::strcmp(requested, "always") == 0) {
+      return true;
+    } else if (std::strcmp(requested, "never") == 0) {
+      return false;
+    }
+    Log::Warning("Unknown LIGHTGBM_INTERLEAVE %s, expected always or never", requested);
+  }
+  return size > interleave_threshold;
+}
+
+/*! \brief Carve one section of the buffer and record its offset */
+template<typename T>
+T* AllocateSection(Arena* arena, size_t n, int64_t* offset) {
+  *offset = static_cast<int64_t>(arena->used());
+  return arena->Allocate<T>(n);
+}
+
+/*! \brief Check that a section lies inside the buffer */
+template<typename T>
+void CheckSection(int64_t offset, int64_t n, size_t size) {
+  if (offset < 0 || n < 0 || offset % Arena::kAlignment != 0
+      || static_cast<uint64_t>(offset) + static_cast<uint64_t>(n) * sizeof(T) > size) {
+    Log::Fatal("Packed model is corrupted");
+  }
+}
+
+}  // namespace
+
+PackedForest::PackedForest()
+  : data_(0), size_(0), header_(0), leaf_type_(kLeafFloat64), threshold_type_(kThresholdFloat64), interleave_(false),
+  predict_in_groups_(false), roots_(0), nodes_(0), leaf_value_(0), leaf_value_half_(0), leaf_value_int8_(0), tree_scale_(0),
+  threshold_boundaries_(0), thresholds_(0), thresholds_float_(0), bitset_boundaries_(0), bitsets_(0),
+  implicit_trees_(0), implicit_nodes_(0), implicit_leaves_(0), kernels_(&GetPredictKernels()) {
+}
+
+bool PackedForest::Build(const std::vector<Tree*>& trees, int num_features, const std::string& model_header, bool huge_page,
+                         LeafType leaf_type, ThresholdType threshold_type) {
+  // intern the thresholds of every feature, and the categorical bitsets
+  std::vector<std::vector<uint64_t>> feature_thresholds(num_features);
+  std::map<std::vector<uint32_t>, int> bitset_ids;
+  std::vector<const std::vector<uint32_t>*> bitsets;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    const Tree& tree = *trees[i];
+    for (int node = 0; node < tree.num_leaves() - 1; ++node) {
+      if (tree.IsCategoricalSplit(node)) {
+        int num_words = 0;
+        const uint32_t* bits = tree.cat_threshold(node, &num_words);
+        std::vector<uint32_t> words(bits, bits + num_words);
+        std::map<std::vector<uint32_t>, int>::iterator it = bitset_ids.find(words);
+        if (it == bitset_ids.end()) {
+          it = bitset_ids.insert(std::make_pair(words, static_cast<int>(bitsets.size()))).first;
+          bitsets.push_back(&it->first);
+        }
+      } else {
+        feature_thresholds[tree.split_feature(node)].push_back(ThresholdKey(tree.threshold(node), threshold_type));
+      }
+    }
+  }
+  if (bitsets.size() > kMaxTableSize) {
+    Log::Warning("Cannot pack the model, it has %zu distinct categorical splits", bitsets.size());
+    return false;
+  }
+  size_t num_thresholds = 0;
+  for (int i = 0; i < num_features; ++i) {
+    std::vector<uint64_t>& table = feature_thresholds[i];
+    std::sort(table.begin(), table.end());
+    table.erase(std::unique(table.begin(), table.end()), table.end());
+    if (table.size() > kMaxTableSize) {
+      Log::Warning("Cannot pack the model, feature %d has %zu distinct thresholds", i, table.size());
+      return false;
+    }
+    num_thresholds += table.size();
+  }
+
+  // quantized leaf values are relative to the largest leaf value of their tree
+  std::vector<double> tree_scales(trees.size(), 1.0);
+  if (leaf_type != kLeafFloat64) {
+    for (size_t i = 0; i < trees.size(); ++i) {
+      double max_abs = 0.0;
+      for (int leaf = 0; leaf < trees[i]->num_leaves(); ++leaf) {
+        max_abs = std::max(max_abs, std::fabs(trees[i]->LeafOutput(leaf)));
+      }
+      if (leaf_type == kLeafInt8) {
+        max_abs /= 127.0;
+      }
+      if (max_abs > 0.0) {
+        tree_scales[i] = max_abs;
+      }
+    }
+  }
+
+  // merge identical subtrees
+  ForestInterner interner(feature_thresholds, bitset_ids, tree_scales, leaf_type, threshold_type);
+  std::vector<int> canonical_roots(trees.size());
+  for (size_t i = 0; i < trees.size(); ++i) {
+    if (trees[i]->num_leaves() <= 1) {
+      canonical_roots[i] = interner.Leaf(static_cast<int>(i), trees[i]->LeafOutput(0));
+    } else {
+      canonical_roots[i] = interner.Node(static_cast<int>(i), *trees[i], 0);
+    }
+  }
+  // shallow numerical trees are also stored as complete trees, as long as padding does not blow them up
+  std::vector<PackedImplicitTree> implicit_trees(trees.size());
+  std::vector<PackedImplicitNode> implicit_nodes;
+  std::vector<int32_t> implicit_leaves;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    std::memset(&implicit_trees[i], 0, sizeof(PackedImplicitTree));
+    Tree* tree = trees[i];
+    // quantized models are about size, complete trees would undo that
+    if (leaf_type != kLeafFloat64 || tree->num_leaves() <= 1 || tree->num_cat() > 0) {
+      continue;
+    }
+    if (tree->max_depth() < 0) {
+      tree->RecomputeMaxDepth();
+    }
+    const int depth = tree->max_depth();
+    if (depth > kMaxImplicitDepth || (1 << depth) - 1 > kMaxImplicitFill * (tree->num_leaves() - 1)) {
+      continue;
+    }
+    implicit_trees[i].depth = depth;
+    implicit_trees[i].node_offset = static_cast<int32_t>(implicit_nodes.size());
+    implicit_trees[i].leaf_offset = static_cast<int32_t>(implicit_leaves.size());
+    implicit_nodes.resize(implicit_nodes.size() + (1 << depth) - 1);
+    implicit_leaves.resize(implicit_leaves.size() + (1 << depth));
+    FillImplicit(static_cast<int>(i), *tree, 0, 0, 0, depth, threshold_type, &interner,
+                 implicit_nodes.data() + implicit_trees[i].node_offset,
+                 implicit_leaves.data() + implicit_trees[i].leaf_offset);
+  }
+
+  // the interner emits children first, lay the nodes out in pre-order of the trees instead.
+  // The child that saw more training data directly follows its parent, so the hot path of a tree is
+  // contiguous and the cold subtrees come after it. The hot path from a root, which every prediction
+  // walks, starts on a new cache line when it would straddle one more line otherwise.
+  // The gap is filled with copies of a node (-1 in order).
+  // The compare sense of a node is never flipped to make the hot child the fall-through: the threshold compare
+  // of PackedForest::NumericalDecision compiles to a conditional move, not a branch, so only the locality of the
+  // hot child matters here. The compiled engine, which branches, makes the hot child the fall-through itself.
+  const std::vector<PackedNode>& canonical_nodes = interner.nodes();
+  std::vector<int> new_index(canonical_nodes.size(), -1);
+  std::vector<int> order;
+  order.reserve(canonical_nodes.size());
+  std::vector<int> stack;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    if (canonical_roots[i] >= 0) {
+      stack.push_back(canonical_roots[i]);
+    }
+    while (!stack.empty()) {
+      const int node = stack.back();
+      stack.pop_back();
+      if (new_index[node] >= 0) { continue; }
+      size_t hot_path_len = 0;
+      for (int cur = node; cur >= 0 && new_index[cur] < 0; cur = interner.HotChild(cur)) {
+        ++hot_path_len;
+      }
+      const size_t line_pos = order.size() % kNodesPerCacheLine;
+      if (node == canonical_roots[i] && line_pos != 0
+          && (line_pos + hot_path_len + kNodesPerCacheLine - 1) / kNodesPerCacheLine
+             > (hot_path_len + kNodesPerCacheLine - 1) / kNodesPerCacheLine) {
+        order.resize(order.size() + kNodesPerCacheLine - line_pos, -1);
+      }
+      new_index[node] = static_cast<int>(order.size());
+      order.push_back(node);
+      if (interner.ColdChild(node) >= 0) {
+        stack.push_back(interner.ColdChild(node));
+      }
+      if (interner.HotChild(node) >= 0) {
+        stack.push_back(interner.HotChild(node));
+      }
+    }
+  }
+  // what the layout achieved, the tests read it from the debug log
+  int num_padding_nodes = 0;
+  int num_hot_children = 0;
+  int num_hot_children_next = 0;
+  for (size_t pos = 0; pos < order.size(); ++pos) {
+    if (order[pos] < 0) {
+      ++num_padding_nodes;
+    } else if (interner.HotChild(order[pos]) >= 0) {
+      ++num_hot_children;
+      if (new_index[interner.HotChild(order[pos])] == static_cast<int>(pos) + 1) {
+        ++num_hot_children_next;
+      }
+    }
+  }
+  int num_straddling_roots = 0;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    if (canonical_roots[i] < 0) { continue; }
+    size_t hot_path_len = 0;
+    for (int cur = canonical_roots[i]; cur >= 0; cur = interner.HotChild(cur)) {
+      ++hot_path_len;
+    }
+    const size_t line_pos = new_index[canonical_roots[i]] % kNodesPerCacheLine;
+    if ((line_pos + hot_path_len + kNodesPerCacheLine - 1) / kNodesPerCacheLine
+        > (hot_path_len + kNodesPerCacheLine - 1) / kNodesPerCacheLine) {
+      ++num_straddling_roots;
+    }
+  }
+
+  const std::vector<uint64_t>& leaf_codes = interner.leaf_codes();
+  const size_t num_tree_scales = leaf_type == kLeafFloat64 ? 0 : trees.size();
+  size_t num_bitset_words = 0;
+  for (size_t i = 0; i < bitsets.size(); ++i) {
+    num_bitset_words += bitsets[i]->size();
+  }
+  size_t leaf_section_size = Arena::AlignedSize<double>(leaf_codes.size());
+  if (leaf_type == kLeafFloat16) {
+    leaf_section_size = Arena::AlignedSize<uint16_t>(leaf_codes.size());
+  } else if (leaf_type == kLeafInt8) {
+    leaf_section_size = Arena::AlignedSize<int8_t>(leaf_codes.size());
+  }
+  const size_t roots_end = Arena::AlignedSize<PackedForestHeader>(1) + Arena::AlignedSize<int32_t>(trees.size());
+  // nodes start on a cache line, the buffer itself is allocated on one
+  const size_t node_padding = (64 - roots_end % 64) % 64;
+  size_t total_size = roots_end + node_padding
+    + Arena::AlignedSize<PackedNode>(order.size())
+    + leaf_section_size
+    + Arena::AlignedSize<double>(num_tree_scales)
+    + Arena::AlignedSize<int32_t>(num_features + 1)
+    + (threshold_type == kThresholdFloat64 ? Arena::AlignedSize<double>(num_thresholds)
+                                           : Arena::AlignedSize<float>(num_thresholds))
+    + Arena::AlignedSize<int32_t>(bitsets.size() + 1)
+    + Arena::AlignedSize<uint32_t>(num_bitset_words)
+    + Arena::AlignedSize<PackedImplicitTree>(trees.size())
+    + Arena::AlignedSize<PackedImplicitNode>(implicit_nodes.size())
+    + Arena::AlignedSize<int32_t>(implicit_leaves.size())
+    + Arena::AlignedSize<char>(model_header.size() + 1);
+  arena_.Reserve(total_size, huge_page);
+  // padding is zeroed so that the same model always serializes to the same bytes
+  std::memset(arena_.data(), 0, arena_.size());
+
+  PackedForestHeader* header = arena_.Allocate<PackedForestHeader>(1);
+  std::memcpy(header->magic, kPackedForestMagic, sizeof(kPackedForestMagic));
+  header->version = kVersion;
+  header->num_trees = static_cast<int32_t>(trees.size());
+  header->num_features = num_features;
+  header->num_nodes = static_cast<int32_t>(order.size());
+  header->num_leaves = static_cast<int32_t>(leaf_codes.size());
+  header->num_thresholds = static_cast<int32_t>(num_thresholds);
+  header->num_bitsets = static_cast<int32_t>(bitsets.size());
+  header->num_bitset_words = static_cast<int32_t>(num_bitset_words);
+  header->leaf_type = leaf_type;
+  header->threshold_type = threshold_type;
+  header->num_implicit_nodes = static_cast<int32_t>(implicit_nodes.size());
+  header->num_implicit_leaves = static_cast<int32_t>(implicit_leaves.size());
+  header->total_size = static_cast<int64_t>(total_size);
+
+  int32_t* roots = AllocateSection<int32_t>(&arena_, trees.size(), &header->root_offset);
+  for (size_t i = 0; i < trees.size(); ++i) {
+    roots[i] = canonical_roots[i] >= 0 ? new_index[canonical_roots[i]] : canonical_roots[i];
+  }
+  arena_.Allocate<char>(node_padding);
+  PackedNode* nodes = AllocateSection<PackedNode>(&arena_, order.size(), &header->node_offset);
+  for (size_t i = 0; i < order.size(); ++i) {
+    // padding is never reached, any valid node will do
+    nodes[i] = canonical_nodes[order[i] >= 0 ? order[i] : order[0]];
+    if (nodes[i].left_child >= 0) {
+      nodes[i].left_child = new_index[nodes[i].left_child];
+    }
+    if (nodes[i].right_child >= 0) {
+      nodes[i].right_child = new_index[nodes[i].right_child];
+    }
+  }
+  if (leaf_type == kLeafFloat16) {
+    uint16_t* leaf_value = AllocateSection<uint16_t>(&arena_, leaf_codes.size(), &header->leaf_value_offset);
+    for (size_t i = 0; i < leaf_codes.size(); ++i) {
+      leaf_value[i] = static_cast<uint16_t>(leaf_codes[i]);
+    }
+  } else if (leaf_type == kLeafInt8) {
+    int8_t* leaf_value = AllocateSection<int8_t>(&arena_, leaf_codes.size(), &header->leaf_value_offset);
+    for (size_t i = 0; i < leaf_codes.size(); ++i) {
+      leaf_value[i] = static_cast<int8_t>(static_cast<uint8_t>(leaf_codes[i]));
+    }
+  } else {
+    double* leaf_value = AllocateSection<double>(&arena_, leaf_codes.size(), &header->leaf_value_offset);
+    for (size_t i = 0; i < leaf_codes.size(); ++i) {
+      std::memcpy(leaf_value + i, &leaf_codes[i], sizeof(double));
+    }
+  }
+  double* tree_scale = AllocateSection<double>(&arena_, num_tree_scales, &header->tree_scale_offset);
+  for (size_t i = 0; i < num_tree_scales; ++i) {
+    tree_scale[i] = tree_scales[i];
+  }
+  int32_t* threshold_boundaries = AllocateSection<int32_t>(&arena_, num_features + 1,
+                                                           &header->threshold_boundaries_offset);
+  double* thresholds = 0;
+  float* thresholds_float = 0;
+  if (threshold_type == kThresholdFloat64) {
+    thresholds = AllocateSection<double>(&arena_, num_thresholds, &header->threshold_offset);
+  } else {
+    thresholds_float = AllocateSection<float>(&arena_, num_thresholds, &header->threshold_offset);
+  }
+  threshold_boundaries[0] = 0;
+  for (int i = 0; i < num_features; ++i) {
+    const std::vector<uint64_t>& table = feature_thresholds[i];
+    for (size_t j = 0; j < table.size(); ++j) {
+      if (threshold_type == kThresholdFloat64) {
+        std::memcpy(thresholds + threshold_boundaries[i] + j, &table[j], sizeof(double));
+      } else {
+        const uint32_t bits = static_cast<uint32_t>(table[j]);
+        std::memcpy(thresholds_float + threshold_boundaries[i] + j, &bits, sizeof(float));
+      }
+    }
+    threshold_boundaries[i + 1] = threshold_boundaries[i] + static_cast<int32_t>(table.size());
+  }
+  int32_t* bitset_boundaries = AllocateSection<int32_t>(&arena_, bitsets.size() + 1,
+                                                        &header->bitset_boundaries_offset);
+  uint32_t* bitset_words = AllocateSection<uint32_t>(&arena_, num_bitset_words, &header->bitset_offset);
+  bitset_boundaries[0] = 0;
+  for (size_t i = 0; i < bitsets.size(); ++i) {
+    std::copy(bitsets[i]->begin(), bitsets[i]->end(), bitset_words + bitset_boundaries[i]);
+    bitset_boundaries[i + 1] = bitset_boundaries[i] + static_cast<int32_t>(bitsets[i]->size());
+  }
+  PackedImplicitTree* implicit_tree_section = AllocateSection<PackedImplicitTree>(&arena_, trees.size(),
+                                                                                 &header->implicit_tree_offset);
+  std::copy(implicit_trees.begin(), implicit_trees.end(), implicit_tree_section);
+  PackedImplicitNode* implicit_node_section = AllocateSection<PackedImplicitNode>(&arena_, implicit_nodes.size(),
+                                                                                 &header->implicit_node_offset);
+  std::copy(implicit_nodes.begin(), implicit_nodes.end(), implicit_node_section);
+  int32_t* implicit_leaf_section = AllocateSection<int32_t>(&arena_, implicit_leaves.size(),
+                                                            &header->implicit_leaf_offset);
+  std::copy(implicit_leaves.begin(), implicit_leaves.end(), implicit_leaf_section);
+  char* text = AllocateSection<char>(&arena_, model_header.size() + 1, &header->model_header_offset);
+  std::memcpy(text, model_header.c_str(), model_header.size() + 1);
+  header->model_header_len = static_cast<int64_t>(model_header.size());
+
+  data_ = arena_.data();
+  size_ = total_size;
+  Attach();
+  int num_implicit_trees = 0;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    if (implicit_trees[i].depth > 0) { ++num_implicit_trees; }
+  }
+  Log::Debug("Packed %d trees into %d nodes and %d leaves, %d complete trees in %d implicit nodes, %zu bytes",
+             header->num_trees, header->num_nodes, header->num_leaves, num_implicit_trees, header->num_implicit_nodes,
+             total_size);
+  Log::Debug("%d of %d hot children follow their parent, %d padding nodes, %d root hot paths straddle a cache line",
+             num_hot_children_next, num_hot_children, num_padding_nodes, num_straddling_roots);
+  return true;
+}
+
+bool PackedForest::IsPackedForest(const char* buffer, size_t len) {
+  return len >= sizeof(PackedForestHeader)
+    && std::memcmp(buffer, kPackedForestMagic, sizeof(kPackedForestMagic)) == 0;
+}
+
+void PackedForest::LoadFromBuffer(const char* buffer, size_t len, bool copy) {
+  if (!IsPackedForest(buffer, len)) {
+    Log::Fatal("Buffer is not a packed model");
+  }
+  const PackedForestHeader* header = reinterpret_cast<const PackedForestHeader*>(buffer);
+  if (header->version != kVersion) {
+    Log::Fatal("Packed model version %d is not supported, expected %d", header->version, kVersion);
+  }
+  if (header->total_size != static_cast<int64_t>(len)) {
+    Log::Fatal("Packed model size mismatch, header says %lld bytes but got %zu",
+               static_cast<long long>(header->total_size), len);
+  }
+  if (copy || reinterpret_cast<uintptr_t>(buffer) % Arena::kAlignment != 0) {
+    arena_.Reserve(len, false);
+    std::memcpy(arena_.data(), buffer, len);
+    data_ = arena_.data();
+  } else {
+    arena_.Reserve(0, false);
+    data_ = buffer;
+  }
+  size_ = len;
+  Attach();
+}
+
+std::vector<int> PackedForest::SplitFeatures() const {
+  // every tree is in the node DAG, the implicit trees are copies
+  std::vector<bool> is_used(header_->num_features, false);
+  for (int i = 0; i < header_->num_nodes; ++i) {
+    is_used[nodes_[i].split_feature] = true;
+  }
+  std::vector<int> features;
+  for (int i = 0; i < header_->num_features; ++i) {
+    if (is_used[i]) {
+      features.push_back(i);
+    }
+  }
+  return features;
+}
+
+void PackedForest::TreeSplitFeatures(int tree, std::vector<int>* out_features) const {
+  out_features->clear();
+  std::vector<int> stack;
+  if (roots_[tree] >= 0) {
+    stack.push_back(roots_[tree]);
+  }
+  while (!stack.empty()) {
+    const PackedNode& node = nodes_[stack.back()];
+    stack.pop_back();
+    out_features->push_back(node.split_feature);
+    if (node.left_child >= 0) {
+      stack.push_back(node.left_child);
+    }
+    if (node.right_child >= 0) {
+      stack.push_back(node.right_child);
+    }
+  }
+  std::sort(out_features->begin(), out_features->end());
+  out_features->erase(std::unique(out_features->begin(), out_features->end()), out_features->end());
+}
+
+void PackedForest::Attach() {
+  header_ = reinterpret_cast<const PackedForestHeader*>(data_);
+  const PackedForestHeader& h = *header_;
+  if (h.num_trees < 0 || h.num_features < 0 || h.num_nodes < 0 || h.num_leaves < 0
+      || h.num_thresholds < 0 || h.num_bitsets < 0 || h.num_bitset_words < 0
+      || h.num_implicit_nodes < 0 || h.num_implicit_leaves < 0) {
+    Log::Fatal("Packed model is corrupted");
+  }
+  if (h.leaf_type < kLeafFloat64 || h.leaf_type > kLeafInt8
+      || h.threshold_type < kThresholdFloat64 || h.threshold_type > kThresholdFloat32) {
+    Log::Fatal("Packed model is corrupted");
+  }
+  leaf_type_ = static_cast<LeafType>(h.leaf_type);
+  threshold_type_ = static_cast<ThresholdType>(h.threshold_type);
+  // in cache the plain traversal is faster, out of it the cache misses dominate
+  interleave_ = UseInterleave(size_);
+  CheckSection<int32_t>(h.root_offset, h.num_trees, size_);
+  CheckSection<PackedNode>(h.node_offset, h.num_nodes, size_);
+  leaf_value_ = 0;
+  leaf_value_half_ = 0;
+  leaf_value_int8_ = 0;
+  tree_scale_ = 0;
+  if (leaf_type_ == kLeafFloat64) {
+    CheckSection<double>(h.leaf_value_offset, h.num_leaves, size_);
+    leaf_value_ = reinterpret_cast<const double*>(data_ + h.leaf_value_offset);
+  } else {
+    if (leaf_type_ == kLeafFloat16) {
+      CheckSection<uint16_t>(h.leaf_value_offset, h.num_leaves, size_);
+      leaf_value_half_ = reinterpret_cast<const uint16_t*>(data_ + h.leaf_value_offset);
+    } else {
+      CheckSection<int8_t>(h.leaf_value_offset, h.num_leaves, size_);
+      leaf_value_int8_ = reinterpret_cast<const int8_t*>(data_ + h.leaf_value_offset);
+    }
+    CheckSection<double>(h.tree_scale_offset, h.num_trees, size_);
+    tree_scale_ = reinterpret_cast<const double*>(data_ + h.tree_scale_offset);
+  }
+  CheckSection<int32_t>(h.threshold_boundaries_offset, h.num_features + 1, size_);
+  thresholds_ = 0;
+  thresholds_float_ = 0;
+  if (threshold_type_ == kThresholdFloat64) {
+    CheckSection<double>(h.threshold_offset, h.num_thresholds, size_);
+    thresholds_ = reinterpret_cast<const double*>(data_ + h.threshold_offset);
+  } else {
+    CheckSection<float>(h.threshold_offset, h.num_thresholds, size_);
+    thresholds_float_ = reinterpret_cast<const float*>(data_ + h.threshold_offset);
+  }
+  CheckSection<int32_t>(h.bitset_boundaries_offset, h.num_bitsets + 1, size_);
+  CheckSection<uint32_t>(h.bitset_offset, h.num_bitset_words, size_);
+  CheckSection<PackedImplicitTree>(h.implicit_tree_offset, h.num_trees, size_);
+  CheckSection<PackedImplicitNode>(h.implicit_node_offset, h.num_implicit_nodes, size_);
+  CheckSection<int32_t>(h.implicit_leaf_offset, h.num_implicit_leaves, size_);
+  CheckSection<char>(h.model_header_offset, h.model_header_len, size_);
+  roots_ = reinterpret_cast<const int32_t*>(data_ + h.root_offset);
+  nodes_ = reinterpret_cast<const PackedNode*>(data_ + h.node_offset);
+  threshold_boundaries_ = reinterpret_cast<const int32_t*>(data_ + h.threshold_boundaries_offset);
+  bitset_boundaries_ = reinterpret_cast<const int32_t*>(data_ + h.bitset_boundaries_offset);
+  bitsets_ = reinterpret_cast<const uint32_t*>(data_ + h.bitset_offset);
+  implicit_trees_ = reinterpret_cast<const PackedImplicitTree*>(data_ + h.implicit_tree_offset);
+  implicit_nodes_ = reinterpret_cast<const PackedImplicitNode*>(data_ + h.implicit_node_offset);
+  implicit_leaves_ = reinterpret_cast<const int32_t*>(data_ + h.implicit_leaf_offset);
+  // a mapped buffer is not trusted, every index is checked once here so traversal needs no checks
+  for (int i = 0; i < h.num_features; ++i) {
+    if (threshold_boundaries_[i] < 0 || threshold_boundaries_[i] > threshold_boundaries_[i + 1]
+        || threshold_boundaries_[i + 1] > h.num_thresholds) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  for (int i = 0; i < h.num_bitsets; ++i) {
+    if (bitset_boundaries_[i] < 0 || bitset_boundaries_[i] > bitset_boundaries_[i + 1]
+        || bitset_boundaries_[i + 1] > h.num_bitset_words) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  for (int i = 0; i < h.num_trees; ++i) {
+    if (roots_[i] >= h.num_nodes || ~roots_[i] >= h.num_leaves) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  for (int i = 0; i < h.num_nodes; ++i) {
+    const PackedNode& node = nodes_[i];
+    if (node.left_child >= h.num_nodes || ~node.left_child >= h.num_leaves
+        || node.right_child >= h.num_nodes || ~node.right_child >= h.num_leaves
+        || node.split_feature < 0 || node.split_feature >= h.num_features) {
+      Log::Fatal("Packed model is corrupted");
+    }
+    if (Tree::GetDecisionType(node.decision_type, kCategoricalMask)) {
+      if (node.threshold >= h.num_bitsets) {
+        Log::Fatal("Packed model is corrupted");
+      }
+    } else if (node.threshold >= threshold_boundaries_[node.split_feature + 1] - threshold_boundaries_[node.split_feature]) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  int num_implicit_trees = 0;
+  for (int i = 0; i < h.num_trees; ++i) {
+    const PackedImplicitTree& implicit = implicit_trees_[i];
+    if (implicit.depth == 0) { continue; }
+    if (implicit.depth < 0 || implicit.depth > kMaxImplicitDepth
+        || implicit.node_offset < 0 || implicit.node_offset > h.num_implicit_nodes - ((1 << implicit.depth) - 1)
+        || implicit.leaf_offset < 0 || implicit.leaf_offset > h.num_implicit_leaves - (1 << implicit.depth)) {
+      Log::Fatal("Packed model is corrupted");
+    }
+    ++num_implicit_trees;
+  }
+  // the kernels pay off once most groups have implicit trees
+  predict_in_groups_ = interleave_ || 2 * num_implicit_trees >= h.num_trees;
+  if (interleave_) {
+    Log::Debug("Interleaving the traversals of %d trees, %zu bytes", h.num_trees, size_);
+  }
+  for (int i = 0; i < h.num_implicit_nodes; ++i) {
+    if (implicit_nodes_[i].split_feature < 0 || implicit_nodes_[i].split_feature >= h.num_features) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  for (int i = 0; i < h.num_implicit_leaves; ++i) {
+    if (implicit_leaves_[i] < 0 || implicit_leaves_[i] >= h.num_leaves) {
+      Log::Fatal("Packed model is corrupted");
+    }
+  }
+  // traversal would never end on a cycle
+  std::vector<int8_t> state(h.num_nodes, 0);
+  std::vector<int> stack;
+  for (int i = 0; i < h.num_nodes; ++i) {
+    if (state[i] != 0) { continue; }
+    stack.push_back(i);
+    while (!stack.empty()) {
+      const int node = stack.back();
+      if (state[node] == 0) {
+        state[node] = 1;
+        const int children[2] = { nodes_[node].left_child, nodes_[node].right_child };
+        for (int j = 0; j < 2; ++j) {
+          if (children[j] < 0) { continue; }
+          if (state[children[j]] == 1) {
+            Log::Fatal("Packed model is corrupted");
+          } else if (state[children[j]] == 0) {
+            stack.push_back(children[j]);
+          }
+        }
+      } else {
+        state[node] = 2;
+        stack.pop_back();
+      }
+    }
+  }
+}
+
+}  // namespace LightGBM
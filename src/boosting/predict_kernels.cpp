@@ -0,0 +1,127 @@
+#include "predict_kernels.hpp"
+
+#include <LightGBM/utils/log.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define LIGHTGBM_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace LightGBM {
+
+/*! \brief Variants built in their own translation unit, null when the compiler could not target them */
+const PredictKernels* PredictKernelsSSE42();
+const PredictKernels* PredictKernelsAVX2();
+const PredictKernels* PredictKernelsAVX512();
+
+namespace {
+
+/*! \brief Instruction sets in increasing order */
+enum ISALevel {
+  kISAGeneric = 0,
+  kISASSE42 = 1,
+  kISAAVX2 = 2,
+  kISAAVX512 = 3
+};
+
+const char* const kISANames[] = { "generic", "sse4.2", "avx2", "avx512" };
+
+#if defined(LIGHTGBM_X86)
+void CpuId(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+  #if defined(_MSC_VER)
+  int info[4];
+  __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+  for (int i = 0; i < 4; ++i) {
+    regs[i] = static_cast<unsigned int>(info[i]);
+  }
+  #else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+  #endif
+}
+
+/*! \brief Register states the OS saves on context switches */
+uint64_t XGetBv() {
+  #if defined(_MSC_VER)
+  return _xgetbv(0);
+  #else
+  unsigned int eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return static_cast<uint64_t>(edx) << 32 | eax;
+  #endif
+}
+#endif
+
+/*! \brief Widest instruction set supported by both the CPU and the OS */
+ISALevel DetectISA() {
+  #if defined(LIGHTGBM_X86)
+  unsigned int regs[4];
+  CpuId(0, 0, regs);
+  const unsigned int max_leaf = regs[0];
+  CpuId(1, 0, regs);
+  const unsigned int features = regs[2];
+  if ((features & (1u << 20)) == 0) {
+    return kISAGeneric;
+  }
+  // AVX needs the OS to save the ymm registers, AVX-512 the opmask and zmm registers as well
+  const bool os_avx = (features & (1u << 27)) != 0 && (features & (1u << 28)) != 0 && (XGetBv() & 0x6) == 0x6;
+  if (!os_avx || max_leaf < 7) {
+    return kISASSE42;
+  }
+  CpuId(7, 0, regs);
+  const unsigned int extended_features = regs[1];
+  if ((extended_features & (1u << 5)) == 0) {
+    return kISASSE42;
+  }
+  if ((extended_features & (1u << 16)) == 0 || (XGetBv() & 0xe6) != 0xe6) {
+    return kISAAVX2;
+  }
+  return kISAAVX512;
+  #else
+  return kISAGeneric;
+  #endif
+}
+
+const PredictKernels* SelectKernels() {
+  static const PredictKernels generic = { kISANames[kISAGeneric], ImplicitLeaves, NonzeroFloat, NonzeroDouble,
+                                          FastExp };
+  int level = DetectISA();
+  const char* requested = std::getenv("LIGHTGBM_ISA");
+  if (requested != 0 && requested[0] != '\0') {
+    int requested_level = -1;
+    for (int i = kISAGeneric; i <= kISAAVX512; ++i) {
+      if (std::strcmp(requested, kISANames[i]) == 0) {
+        requested_level = i;
+      }
+    }
+    if (requested_level < 0) {
+      Log::Warning("Unknown LIGHTGBM_ISA %s, expected generic, sse4.2, avx2 or avx512", requested);
+    } else if (requested_level > level) {
+      Log::Warning("LIGHTGBM_ISA %s is not supported by this CPU, using %s", requested, kISANames[level]);
+    } else {
+      level = requested_level;
+    }
+  }
+  const PredictKernels* kernels = 0;
+  if (level >= kISAAVX512) { kernels = PredictKernelsAVX512(); }
+  if (kernels == 0 && level >= kISAAVX2) { kernels = PredictKernelsAVX2(); }
+  if (kernels == 0 && level >= kISASSE42) { kernels = PredictKernelsSSE42(); }
+  if (kernels == 0) { kernels = &generic; }
+  Log::Debug("Using %s prediction kernels", kernels->isa);
+  return kernels;
+}
+
+}  // namespace
+
+const PredictKernels& GetPredictKernels() {
+  static const PredictKernels* kernels = SelectKernels();
+  return *kernels;
+}
+
+}  // namespace LightGBM
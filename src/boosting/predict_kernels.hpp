@@ -0,0 +1,429 @@
+#ifndef LIGHTGBM_BOOSTING_PREDICT_KERNELS_HPP_
+#define LIGHTGBM_BOOSTING_PREDICT_KERNELS_HPP_
+
+/*
+* Kernels of PredictKernels, included by one translation unit per instruction set and compiled with its flags.
+* Keep to plain code and plain headers here: an inline function of another header that is not inlined
+* would be emitted with the instructions of the variant, and the linker could pick that copy for the whole library.
+*/
+
+#include <LightGBM/meta.h>
+#include <LightGBM/predict_kernels.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace LightGBM {
+
+namespace {
+
+/*! \brief Index of the lowest set bit of a non-zero mask */
+inline int LowestBit(unsigned int mask) {
+  #if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+  #else
+  return __builtin_ctz(mask);
+  #endif
+}
+
+/*! \brief Same as PackedForest::ImplicitGoRight */
+inline int ImplicitGoRight(double fval, const PackedImplicitNode& node) {
+  int go_right = fval <= node.threshold ? 0 : 1;
+  go_right = node.zero_right >= 0 && fval > -kZeroThreshold && fval <= kZeroThreshold ? node.zero_right : go_right;
+  return fval != fval ? node.nan_right : go_right;
+}
+
+#if defined(__AVX512F__)
+/*!
+* \brief One tree per 64 bits lane, the node is gathered as its threshold and as its second half,
+*        which holds the split feature, nan_right (bit 32) and zero_right (bits 40 to 47)
+*/
+void ImplicitLeaves(const PackedImplicitTree* trees, int num_trees, const PackedImplicitNode* nodes,
+                    const double* feature_values, int32_t* out_slots) {
+  int32_t depths[8] = { 0 };
+  int64_t offsets[8] = { 0 };
+  int max_depth = 0;
+  for (int i = 0; i < num_trees; ++i) {
+    depths[i] = trees[i].depth > 0 ? trees[i].depth : 0;
+    offsets[i] = 2 * static_cast<int64_t>(trees[i].node_offset);
+    max_depth = depths[i] > max_depth ? depths[i] : max_depth;
+  }
+  // the zero masking forms of the conversions, the plain ones start from an undefined vector that gcc warns about
+  const __m512i depth = _mm512_maskz_cvtepi32_epi64(0xff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(depths)));
+  const __m512i offset = _mm512_loadu_si512(offsets);
+  const __m512d zero_hi = _mm512_set1_pd(kZeroThreshold);
+  const __m512d zero_lo = _mm512_set1_pd(-kZeroThreshold);
+  const __m512i nan_right_bit = _mm512_set1_epi64(1LL << 32);
+  const __m512i zero_right_bit = _mm512_set1_epi64(1LL << 40);
+  const __m512i zero_missing_bit = _mm512_set1_epi64(1LL << 47);
+  const __m512i one = _mm512_set1_epi64(1);
+  const double* thresholds = reinterpret_cast<const double*>(nodes);
+  const long long* seconds = reinterpret_cast<const long long*>(nodes) + 1;
+  __m512i node = _mm512_setzero_si512();
+  for (int d = 0; d < max_depth; ++d) {
+    const __mmask8 active = _mm512_cmpgt_epi64_mask(depth, _mm512_set1_epi64(d));
+    // two 8 bytes words per node
+    const __m512i index = _mm512_add_epi64(offset, _mm512_add_epi64(node, node));
+    const __m512d threshold = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), active, index, thresholds, 8);
+    const __m512i second = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, index, seconds, 8);
+    const __m256i feature = _mm512_maskz_cvtepi64_epi32(0xff, second);
+    const __m512d fval = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), active, feature, feature_values, 8);
+    const __mmask8 left = _mm512_cmp_pd_mask(fval, threshold, _CMP_LE_OQ);
+    const __mmask8 is_nan = _mm512_cmp_pd_mask(fval, fval, _CMP_UNORD_Q);
+    const __mmask8 is_zero = _mm512_cmp_pd_mask(fval, zero_lo, _CMP_GT_OQ) & _mm512_cmp_pd_mask(fval, zero_hi, _CMP_LE_OQ);
+    const __mmask8 zero_rule = is_zero & ~_mm512_test_epi64_mask(second, zero_missing_bit);
+    __mmask8 right = (~left & ~zero_rule) | (_mm512_test_epi64_mask(second, zero_right_bit) & zero_rule);
+    right = (right & ~is_nan) | (_mm512_test_epi64_mask(second, nan_right_bit) & is_nan);
+    // node = 2 * node + 1 + right
+    node = _mm512_mask_add_epi64(node, active, _mm512_add_epi64(node, node), one);
+    node = _mm512_mask_add_epi64(node, active & right, node, one);
+  }
+  int64_t leaves[8];
+  _mm512_storeu_si512(leaves, node);
+  for (int i = 0; i < num_trees; ++i) {
+    if (depths[i] > 0) {
+      out_slots[i] = trees[i].leaf_offset + static_cast<int32_t>(leaves[i]) - ((1 << depths[i]) - 1);
+    }
+  }
+}
+#elif defined(__AVX2__)
+/*! \brief Same as the AVX-512 kernel, four trees at a time and masks as vectors */
+void ImplicitLeaves4(const PackedImplicitTree* trees, int num_trees, const PackedImplicitNode* nodes,
+                     const double* feature_values, int32_t* out_slots) {
+  int64_t depths[4] = { 0 };
+  int64_t offsets[4] = { 0 };
+  int max_depth = 0;
+  for (int i = 0; i < num_trees; ++i) {
+    depths[i] = trees[i].depth > 0 ? trees[i].depth : 0;
+    offsets[i] = 2 * static_cast<int64_t>(trees[i].node_offset);
+    max_depth = depths[i] > max_depth ? static_cast<int>(depths[i]) : max_depth;
+  }
+  const __m256i depth = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(depths));
+  const __m256i offset = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets));
+  const __m256d zero_hi = _mm256_set1_pd(kZeroThreshold);
+  const __m256d zero_lo = _mm256_set1_pd(-kZeroThreshold);
+  const __m256i nan_right_bit = _mm256_set1_epi64x(1LL << 32);
+  const __m256i zero_right_bit = _mm256_set1_epi64x(1LL << 40);
+  const __m256i zero_missing_bit = _mm256_set1_epi64x(1LL << 47);
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i feature_perm = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  const double* thresholds = reinterpret_cast<const double*>(nodes);
+  const long long* seconds = reinterpret_cast<const long long*>(nodes) + 1;
+  __m256i node = zero;
+  for (int d = 0; d < max_depth; ++d) {
+    const __m256i active = _mm256_cmpgt_epi64(depth, _mm256_set1_epi64x(d));
+    const __m256i index = _mm256_add_epi64(offset, _mm256_add_epi64(node, node));
+    const __m256d threshold = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), thresholds, index,
+                                                       _mm256_castsi256_pd(active), 8);
+    const __m256i second = _mm256_mask_i64gather_epi64(zero, seconds, index, active, 8);
+    const __m128i feature = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(second, feature_perm));
+    const __m256d fval = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), feature_values, feature,
+                                                  _mm256_castsi256_pd(active), 8);
+    const __m256i left = _mm256_castpd_si256(_mm256_cmp_pd(fval, threshold, _CMP_LE_OQ));
+    const __m256i is_nan = _mm256_castpd_si256(_mm256_cmp_pd(fval, fval, _CMP_UNORD_Q));
+    const __m256i is_zero = _mm256_castpd_si256(_mm256_and_pd(_mm256_cmp_pd(fval, zero_lo, _CMP_GT_OQ),
+                                                              _mm256_cmp_pd(fval, zero_hi, _CMP_LE_OQ)));
+    const __m256i zero_rule = _mm256_andnot_si256(
+      _mm256_cmpeq_epi64(_mm256_and_si256(second, zero_missing_bit), zero_missing_bit), is_zero);
+    const __m256i zero_right = _mm256_cmpeq_epi64(_mm256_and_si256(second, zero_right_bit), zero_right_bit);
+    const __m256i nan_right = _mm256_cmpeq_epi64(_mm256_and_si256(second, nan_right_bit), nan_right_bit);
+    __m256i right = _mm256_blendv_epi8(_mm256_xor_si256(left, _mm256_set1_epi64x(-1)), zero_right, zero_rule);
+    right = _mm256_blendv_epi8(right, nan_right, is_nan);
+    // node = 2 * node + 1 + right, right is -1 when set
+    const __m256i next = _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(node, node), one), right);
+    node = _mm256_blendv_epi8(node, next, active);
+  }
+  int64_t leaves[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(leaves), node);
+  for (int i = 0; i < num_trees; ++i) {
+    if (depths[i] > 0) {
+      out_slots[i] = trees[i].leaf_offset + static_cast<int32_t>(leaves[i]) - ((1 << depths[i]) - 1);
+    }
+  }
+}
+
+void ImplicitLeaves(const PackedImplicitTree* trees, int num_trees, const PackedImplicitNode* nodes,
+                    const double* feature_values, int32_t* out_slots) {
+  for (int i = 0; i < num_trees; i += 4) {
+    ImplicitLeaves4(trees + i, num_trees - i < 4 ? num_trees - i : 4, nodes, feature_values, out_slots + i);
+  }
+}
+#else
+/*! \brief No gather below AVX2, the trees are walked one by one */
+void ImplicitLeaves(const PackedImplicitTree* trees, int num_trees, const PackedImplicitNode* nodes,
+                    const double* feature_values, int32_t* out_slots) {
+  for (int i = 0; i < num_trees; ++i) {
+    const int depth = trees[i].depth;
+    if (depth <= 0) { continue; }
+    const PackedImplicitNode* tree_nodes = nodes + trees[i].node_offset;
+    int node = 0;
+    for (int d = 0; d < depth; ++d) {
+      node = 2 * node + 1 + ImplicitGoRight(feature_values[tree_nodes[node].split_feature], tree_nodes[node]);
+    }
+    out_slots[i] = trees[i].leaf_offset + node - ((1 << depth) - 1);
+  }
+}
+#endif
+
+/*! \brief FastExp is a normal number in this range, exp is used outside of it and for NaN */
+const double kFastExpMin = -708.0;
+const double kFastExpMax = 709.0;
+/*! \brief Adding it rounds a double below 2^51 to an integer, which is then in its low bits */
+const double kRoundMagic = 6755399441055744.0;
+const double kLog2E = 1.4426950408889634;
+/*! \brief ln(2) in two parts, the first one has trailing zeros so that n * kLn2Hi is exact */
+const double kLn2Hi = 6.93147180369123816490e-01;
+const double kLn2Lo = 1.90821492927058770002e-10;
+/*! \brief 1 / k! of the Taylor series of exp(r) for |r| <= ln(2) / 2, its remainder is below 0.03 ulp */
+const double kExpCoefs[14] = {
+  1.0, 1.0, 1.0 / 2.0, 1.0 / 6.0, 1.0 / 24.0, 1.0 / 120.0, 1.0 / 720.0, 1.0 / 5040.0, 1.0 / 40320.0,
+  1.0 / 362880.0, 1.0 / 3628800.0, 1.0 / 39916800.0, 1.0 / 479001600.0, 1.0 / 6227020800.0
+};
+
+/*!
+* \brief exp(x) = 2^n * exp(r) with x = n * ln(2) + r, the vector kernels take the same steps on every lane.
+*        The kernels are built without contraction into fused multiply-add, see CMakeLists.txt
+*/
+inline double FastExp1(double x) {
+  if (!(x >= kFastExpMin && x <= kFastExpMax)) {
+    return exp(x);
+  }
+  const double t = x * kLog2E + kRoundMagic;
+  const double n = t - kRoundMagic;
+  const double r = (x - n * kLn2Hi) - n * kLn2Lo;
+  double p = kExpCoefs[13];
+  for (int k = 12; k >= 0; --k) {
+    p = p * r + kExpCoefs[k];
+  }
+  int64_t bits;
+  memcpy(&bits, &t, sizeof(bits));
+  bits = (bits - 0x4338000000000000LL + 1023) << 52;
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+#if defined(__AVX512F__)
+void FastExp(const double* input, double* output, int len) {
+  const __m512d min_x = _mm512_set1_pd(kFastExpMin);
+  const __m512d max_x = _mm512_set1_pd(kFastExpMax);
+  const __m512d magic = _mm512_set1_pd(kRoundMagic);
+  const __m512i bias = _mm512_set1_epi64(1023 - 0x4338000000000000LL);
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m512d x = _mm512_loadu_pd(input + i);
+    // NaN is unordered, so it goes to exp along with the values out of range
+    const __mmask8 in_range = _mm512_cmp_pd_mask(x, min_x, _CMP_GE_OQ) & _mm512_cmp_pd_mask(x, max_x, _CMP_LE_OQ);
+    const __m512d t = _mm512_add_pd(_mm512_mul_pd(x, _mm512_set1_pd(kLog2E)), magic);
+    const __m512d n = _mm512_sub_pd(t, magic);
+    const __m512d r = _mm512_sub_pd(_mm512_sub_pd(x, _mm512_mul_pd(n, _mm512_set1_pd(kLn2Hi))),
+                                    _mm512_mul_pd(n, _mm512_set1_pd(kLn2Lo)));
+    __m512d p = _mm512_set1_pd(kExpCoefs[13]);
+    for (int k = 12; k >= 0; --k) {
+      p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(kExpCoefs[k]));
+    }
+    // zero masking, see ImplicitLeaves
+    const __m512i biased = _mm512_add_epi64(_mm512_castpd_si512(t), bias);
+    const __m512d scale = _mm512_castsi512_pd(_mm512_maskz_slli_epi64(0xff, biased, 52));
+    _mm512_storeu_pd(output + i, _mm512_mul_pd(p, scale));
+    if (in_range != 0xff) {
+      for (int j = 0; j < 8; ++j) {
+        if (!(in_range >> j & 1)) { output[i + j] = exp(input[i + j]); }
+      }
+    }
+  }
+  for (; i < len; ++i) {
+    output[i] = FastExp1(input[i]);
+  }
+}
+#elif defined(__AVX2__)
+void FastExp(const double* input, double* output, int len) {
+  const __m256d min_x = _mm256_set1_pd(kFastExpMin);
+  const __m256d max_x = _mm256_set1_pd(kFastExpMax);
+  const __m256d magic = _mm256_set1_pd(kRoundMagic);
+  const __m256i bias = _mm256_set1_epi64x(1023 - 0x4338000000000000LL);
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    const __m256d x = _mm256_loadu_pd(input + i);
+    // NaN is unordered, so it goes to exp along with the values out of range
+    const int in_range = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(x, min_x, _CMP_GE_OQ),
+                                                          _mm256_cmp_pd(x, max_x, _CMP_LE_OQ)));
+    const __m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(kLog2E)), magic);
+    const __m256d n = _mm256_sub_pd(t, magic);
+    const __m256d r = _mm256_sub_pd(_mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(kLn2Hi))),
+                                    _mm256_mul_pd(n, _mm256_set1_pd(kLn2Lo)));
+    __m256d p = _mm256_set1_pd(kExpCoefs[13]);
+    for (int k = 12; k >= 0; --k) {
+      p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(kExpCoefs[k]));
+    }
+    const __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(t), bias), 52));
+    _mm256_storeu_pd(output + i, _mm256_mul_pd(p, scale));
+    if (in_range != 0xf) {
+      for (int j = 0; j < 4; ++j) {
+        if (!(in_range >> j & 1)) { output[i + j] = exp(input[i + j]); }
+      }
+    }
+  }
+  for (; i < len; ++i) {
+    output[i] = FastExp1(input[i]);
+  }
+}
+#elif defined(__SSE2__)
+/*! \brief SSE2 is part of every x86-64 CPU, so the generic variant has two lanes as well */
+void FastExp(const double* input, double* output, int len) {
+  const __m128d min_x = _mm_set1_pd(kFastExpMin);
+  const __m128d max_x = _mm_set1_pd(kFastExpMax);
+  const __m128d magic = _mm_set1_pd(kRoundMagic);
+  const __m128i bias = _mm_set1_epi64x(1023 - 0x4338000000000000LL);
+  int i = 0;
+  for (; i + 2 <= len; i += 2) {
+    const __m128d x = _mm_loadu_pd(input + i);
+    // NaN is unordered, so it goes to exp along with the values out of range
+    const int in_range = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(x, min_x), _mm_cmple_pd(x, max_x)));
+    const __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(kLog2E)), magic);
+    const __m128d n = _mm_sub_pd(t, magic);
+    const __m128d r = _mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(kLn2Hi))), _mm_mul_pd(n, _mm_set1_pd(kLn2Lo)));
+    __m128d p = _mm_set1_pd(kExpCoefs[13]);
+    for (int k = 12; k >= 0; --k) {
+      p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(kExpCoefs[k]));
+    }
+    const __m128d scale = _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(_mm_castpd_si128(t), bias), 52));
+    _mm_storeu_pd(output + i, _mm_mul_pd(p, scale));
+    if (in_range != 0x3) {
+      for (int j = 0; j < 2; ++j) {
+        if (!(in_range >> j & 1)) { output[i + j] = exp(input[i + j]); }
+      }
+    }
+  }
+  for (; i < len; ++i) {
+    output[i] = FastExp1(input[i]);
+  }
+}
+#else
+/*! \brief Plain loop, the compiler may vectorize it */
+void FastExp(const double* input, double* output, int len) {
+  for (int i = 0; i < len; ++i) {
+    output[i] = FastExp1(input[i]);
+  }
+}
+#endif
+
+#if defined(__AVX512F__)
+int NonzeroDouble(const double* row, int len, int32_t* out_indices) {
+  const __m512d zero_threshold = _mm512_set1_pd(kZeroThreshold);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m512d val = _mm512_abs_pd(_mm512_loadu_pd(row + i));
+    // NaN is unordered, so it is kept along with |val| > kZeroThreshold
+    __mmask8 keep = _mm512_cmp_pd_mask(val, zero_threshold, _CMP_NLE_UQ);
+    while (keep != 0) {
+      out_indices[cnt++] = i + LowestBit(keep);
+      keep &= keep - 1;
+    }
+  }
+  for (; i < len; ++i) {
+    if (!(fabs(row[i]) <= kZeroThreshold)) { out_indices[cnt++] = i; }
+  }
+  return cnt;
+}
+
+int NonzeroFloat(const float* row, int len, int32_t* out_indices) {
+  const __m512d zero_threshold = _mm512_set1_pd(kZeroThreshold);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    // zero masking, see ImplicitLeaves
+    const __m512d val = _mm512_abs_pd(_mm512_maskz_cvtps_pd(0xff, _mm256_loadu_ps(row + i)));
+    __mmask8 keep = _mm512_cmp_pd_mask(val, zero_threshold, _CMP_NLE_UQ);
+    while (keep != 0) {
+      out_indices[cnt++] = i + LowestBit(keep);
+      keep &= keep - 1;
+    }
+  }
+  for (; i < len; ++i) {
+    if (!(fabs(static_cast<double>(row[i])) <= kZeroThreshold)) { out_indices[cnt++] = i; }
+  }
+  return cnt;
+}
+#elif defined(__AVX2__)
+int NonzeroDouble(const double* row, int len, int32_t* out_indices) {
+  const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+  const __m256d zero_threshold = _mm256_set1_pd(kZeroThreshold);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    const __m256d val = _mm256_and_pd(_mm256_loadu_pd(row + i), abs_mask);
+    // NaN is unordered, so it is kept along with |val| > kZeroThreshold
+    int keep = _mm256_movemask_pd(_mm256_cmp_pd(val, zero_threshold, _CMP_NLE_UQ));
+    while (keep != 0) {
+      out_indices[cnt++] = i + LowestBit(keep);
+      keep &= keep - 1;
+    }
+  }
+  for (; i < len; ++i) {
+    if (!(fabs(row[i]) <= kZeroThreshold)) { out_indices[cnt++] = i; }
+  }
+  return cnt;
+}
+
+int NonzeroFloat(const float* row, int len, int32_t* out_indices) {
+  const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+  const __m256d zero_threshold = _mm256_set1_pd(kZeroThreshold);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    const __m256d val = _mm256_and_pd(_mm256_cvtps_pd(_mm_loadu_ps(row + i)), abs_mask);
+    int keep = _mm256_movemask_pd(_mm256_cmp_pd(val, zero_threshold, _CMP_NLE_UQ));
+    while (keep != 0) {
+      out_indices[cnt++] = i + LowestBit(keep);
+      keep &= keep - 1;
+    }
+  }
+  for (; i < len; ++i) {
+    if (!(fabs(static_cast<double>(row[i])) <= kZeroThreshold)) { out_indices[cnt++] = i; }
+  }
+  return cnt;
+}
+#else
+/*! \brief Branch free, so that sparse and dense rows cost the same */
+int NonzeroDouble(const double* row, int len, int32_t* out_indices) {
+  int cnt = 0;
+  for (int i = 0; i < len; ++i) {
+    out_indices[cnt] = i;
+    cnt += !(fabs(row[i]) <= kZeroThreshold);
+  }
+  return cnt;
+}
+
+int NonzeroFloat(const float* row, int len, int32_t* out_indices) {
+  int cnt = 0;
+  for (int i = 0; i < len; ++i) {
+    out_indices[cnt] = i;
+    cnt += !(fabs(static_cast<double>(row[i])) <= kZeroThreshold);
+  }
+  return cnt;
+}
+#endif
+
+}  // namespace
+
+}  // namespace LightGBM
+
+#endif   // LIGHTGBM_BOOSTING_PREDICT_KERNELS_HPP_
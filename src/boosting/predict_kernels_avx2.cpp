@@ -0,0 +1,19 @@
+// compiled with the flags of avx2, see CMakeLists.txt
+#include <LightGBM/predict_kernels.h>
+
+#if defined(__AVX2__)
+#include "predict_kernels.hpp"
+#endif
+
+namespace LightGBM {
+
+const PredictKernels* PredictKernelsAVX2() {
+  #if defined(__AVX2__)
+  static const PredictKernels kernels = { "avx2", ImplicitLeaves, NonzeroFloat, NonzeroDouble, FastExp };
+  return &kernels;
+  #else
+  return 0;
+  #endif
+}
+
+}  // namespace LightGBM
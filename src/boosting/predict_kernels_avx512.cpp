@@ -0,0 +1,19 @@
+// compiled with the flags of avx512, see CMakeLists.txt
+#include <LightGBM/predict_kernels.h>
+
+#if defined(__AVX512F__)
+#include "predict_kernels.hpp"
+#endif
+
+namespace LightGBM {
+
+const PredictKernels* PredictKernelsAVX512() {
+  #if defined(__AVX512F__)
+  static const PredictKernels kernels = { "avx512", ImplicitLeaves, NonzeroFloat, NonzeroDouble, FastExp };
+  return &kernels;
+  #else
+  return 0;
+  #endif
+}
+
+}  // namespace LightGBM
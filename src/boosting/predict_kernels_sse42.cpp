@@ -0,0 +1,19 @@
+// compiled with the flags of sse4.2, see CMakeLists.txt
+#include <LightGBM/predict_kernels.h>
+
+#if defined(__SSE4_2__)
+#include "predict_kernels.hpp"
+#endif
+
+namespace LightGBM {
+
+const PredictKernels* PredictKernelsSSE42() {
+  #if defined(__SSE4_2__)
+  static const PredictKernels kernels = { "sse4.2", ImplicitLeaves, NonzeroFloat, NonzeroDouble, FastExp };
+  return &kernels;
+  #else
+  return 0;
+  #endif
+}
+
+}  // namespace LightGBM
@@ -0,0 +1,101 @@
+#include "score_cache.h"
+#include "model_cache.h"
+
+#include <LightGBM/utils/log.h>
+#include <LightGBM/utils/mapped_file.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace LightGBM {
+
+namespace {
+
+const char kScoreCacheMagic[8] = { 'L', 'G', 'B', 'M', 'S', 'C', 'O', 'R' };
+const uint32_t kByteOrder = 0x01020304;
+
+}  // namespace
+
+uint64_t ScoreCache::DataHash(const void* data, size_t len) {
+  return ModelCache::Hash(reinterpret_cast<const char*>(data), len);
+}
+
+std::unique_ptr<ScoreCache> ScoreCache::Load(const std::string& filename) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    Log::Fatal("Cannot open score cache file %s", filename.c_str());
+  }
+  const ScoreCacheHeader* header = reinterpret_cast<const ScoreCacheHeader*>(file.data());
+  if (file.size() < sizeof(ScoreCacheHeader)
+      || std::memcmp(header->magic, kScoreCacheMagic, sizeof(kScoreCacheMagic)) != 0) {
+    Log::Fatal("%s is not a score cache file", filename.c_str());
+  }
+  if (header->byte_order != kByteOrder || header->version != kVersion) {
+    Log::Fatal("Score cache file %s was written by another version or machine", filename.c_str());
+  }
+  const size_t num_scores = static_cast<size_t>(header->num_rows) * header->num_tree_per_iteration;
+  if (header->num_rows < 0 || header->num_tree_per_iteration < 0 || header->num_trees < 0
+      || file.size() != sizeof(ScoreCacheHeader) + num_scores * sizeof(double)) {
+    Log::Fatal("Score cache file %s is truncated", filename.c_str());
+  }
+  std::unique_ptr<ScoreCache> cache(new ScoreCache());
+  cache->num_rows = header->num_rows;
+  cache->num_cols = header->num_cols;
+  cache->data_type = header->data_type;
+  cache->is_row_major = header->is_row_major;
+  cache->data_hash = header->data_hash;
+  cache->num_tree_per_iteration = header->num_tree_per_iteration;
+  cache->num_trees = header->num_trees;
+  cache->lineage_hash = header->lineage_hash;
+  const double* scores = reinterpret_cast<const double*>(file.data() + sizeof(ScoreCacheHeader));
+  cache->raw_scores.assign(scores, scores + num_scores);
+  return cache;
+}
+
+void ScoreCache::Save(const std::string& filename) const {
+  // written aside and renamed, so that a failed save keeps the previous file
+  char suffix[32];
+  #if defined(_WIN32)
+  std::snprintf(suffix, sizeof(suffix), ".tmp");
+  #else
+  std::snprintf(suffix, sizeof(suffix), ".tmp.%d", static_cast<int>(getpid()));
+  #endif
+  const std::string tmp_filename = filename + suffix;
+  FILE* file = std::fopen(tmp_filename.c_str(), "wb");
+  if (file == 0) {
+    Log::Fatal("Cannot write score cache file %s", tmp_filename.c_str());
+  }
+  ScoreCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kScoreCacheMagic, sizeof(kScoreCacheMagic));
+  header.byte_order = kByteOrder;
+  header.version = kVersion;
+  header.num_rows = num_rows;
+  header.num_cols = num_cols;
+  header.data_type = data_type;
+  header.is_row_major = is_row_major;
+  header.data_hash = data_hash;
+  header.num_tree_per_iteration = num_tree_per_iteration;
+  header.num_trees = num_trees;
+  header.lineage_hash = lineage_hash;
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+    && std::fwrite(raw_scores.data(), sizeof(double), raw_scores.size(), file) == raw_scores.size();
+  ok = std::fclose(file) == 0 && ok;
+  #if defined(_WIN32)
+  if (ok) {
+    std::remove(filename.c_str());
+  }
+  #endif
+  if (!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp_filename.c_str());
+    Log::Fatal("Cannot write score cache file %s", filename.c_str());
+  }
+}
+
+}  // namespace LightGBM
@@ -0,0 +1,70 @@
+#ifndef LIGHTGBM_BOOSTING_SCORE_CACHE_H_
+#define LIGHTGBM_BOOSTING_SCORE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LightGBM {
+
+/*!
+* \brief Header of a saved score cache, the raw scores follow it
+*/
+struct ScoreCacheHeader {
+  char magic[8];
+  /*! \brief 0x01020304 as written by the machine that made the file */
+  uint32_t byte_order;
+  int32_t version;
+  int32_t num_rows;
+  int32_t num_cols;
+  int32_t data_type;
+  int32_t is_row_major;
+  uint64_t data_hash;
+  int32_t num_tree_per_iteration;
+  int32_t num_trees;
+  uint64_t lineage_hash;
+};
+
+/*!
+* \brief Raw scores of a fixed matrix of rows, with the trees they add up.
+*        When the model grows, only the trees it gained are evaluated on the rows.
+*/
+struct ScoreCache {
+  /*! \brief Version of the saved files, bump when their meaning changes */
+  static const int32_t kVersion = 1;
+
+  int32_t num_rows;
+  int32_t num_cols;
+  int32_t data_type;
+  int32_t is_row_major;
+  /*! \brief Hash of the values of the rows, a cache only takes the rows it was made for */
+  uint64_t data_hash;
+  /*! \brief Classes of the model, 0 until the scores cover a tree */
+  int32_t num_tree_per_iteration;
+  /*! \brief Number of first trees of the model the raw scores add up */
+  int32_t num_trees;
+  /*! \brief GBDTBase::LineageHash of these trees */
+  uint64_t lineage_hash;
+  /*! \brief Raw score of every row and class */
+  std::vector<double> raw_scores;
+
+  /*!
+  * \brief Hash of the values of the rows
+  */
+  static uint64_t DataHash(const void* data, size_t len);
+
+  /*!
+  * \brief Load a saved score cache, fatal if the file is not one
+  */
+  static std::unique_ptr<ScoreCache> Load(const std::string& filename);
+
+  /*!
+  * \brief Save the score cache, the file is replaced at once
+  */
+  void Save(const std::string& filename) const;
+};
+
+}  // namespace LightGBM
+
+#endif   // LightGBM_BOOSTING_SCORE_CACHE_H_
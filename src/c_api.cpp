@@ -1,29 +1,80 @@
 #include <LightGBM/utils/openmp_wrapper.h>
 
 #include <LightGBM/utils/common.h>
+#include <LightGBM/utils/shared_memory.h>
 //#include <LightGBM/utils/random.h>
 #include <LightGBM/utils/threading.h>
 #include <LightGBM/c_api.h>
 #include <LightGBM/boosting.h>
 #include <LightGBM/config.h>
 #include <LightGBM/prediction_early_stop.h>
+#include <LightGBM/predict_kernels.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 #include <string>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <stdexcept>
 #include <mutex>
 #include <functional>
 
 #include "./application/predictor.hpp"
+#include "./application/ensemble_predictor.hpp"
+#include "./boosting/score_cache.h"
+
+// some help functions used to convert data
+
+std::function<std::vector<double>(int row_idx)>
+RowFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major);
+
+std::function<std::vector<std::pair<int, double>>(int row_idx)>
+RowPairFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major);
+
+std::function<std::vector<std::pair<int, double>>(int row_idx)>
+RowPairFunctionFromDenseColumns(const void* data, int num_row, int num_col, int data_type, int is_row_major,
+                                const std::vector<int>& columns);
+
+std::function<std::vector<std::pair<int, double>>(int row_idx)>
+RowFunctionForPredict(const void* data, int num_row, int num_col, int data_type, int is_row_major,
+                      const std::vector<int>& used_features);
 
 namespace LightGBM {
 
+class Booster;
+
+/*! \brief Rows of a block whose raw scores Booster::Predict transforms together */
+const int kTransformBlockRows = 64;
+
+/*!
+* \brief One record scored by a booster. The output of every tree is kept,
+*        so that only the trees that split on a changed feature are evaluated again.
+*/
+struct RowRescorer {
+  /*! \brief Booster the record is scored by, Rescore is fatal once its trees change */
+  Booster* booster;
+  /*! \brief Version of the model of the booster the tree outputs were computed with */
+  int64_t model_version;
+  int num_iteration;
+  /*! \brief Number of trees of the booster, the size of tree_outputs depends on it */
+  int num_trees;
+  /*! \brief Size of features, the trees index it by feature slot */
+  int num_predict_features;
+  /*! \brief GBDTBase::LineageHash of the trees, 0 if the booster cannot hash them */
+  uint64_t lineage_hash;
+  /*! \brief Position of every feature in features, -1 if no tree splits on it */
+  std::vector<int> feature_slots;
+  /*! \brief Values of the record, as the prediction buffer holds them */
+  std::vector<double> features;
+  /*! \brief Output of every tree on the record */
+  std::vector<double> tree_outputs;
+};
+
 class Booster {
 public:
-  explicit Booster(const char* filename) {
+  explicit Booster(const char* filename) : model_version_(0) {
     boosting_.reset(Boosting::CreateBoosting("gbdt", filename));
   }
 
@@ -31,11 +82,13 @@ public:
 
   }
 
-  void Predict(int num_iteration, int predict_type, int nrow,
-               std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun,
+  void Predict(int num_iteration, int predict_type,
+               const void* data, int data_type, int nrow, int ncol, int is_row_major,
                const Config& config,
                double* out_result, int64_t* out_len) {
     std::lock_guard<std::mutex> lock(mutex_);
+    // the columns the trees use change with the trees, so they are read under the lock
+    auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major, boosting_->UsedFeatures());
     bool is_predict_leaf = false;
     bool is_raw_score = false;
     bool predict_contrib = false;
@@ -49,26 +102,379 @@ public:
       is_raw_score = false;
     }
 
-    Predictor predictor(boosting_.get(), num_iteration, is_raw_score, is_predict_leaf, predict_contrib,
+    const ContribMethod contrib_method = GetContribMethod(config);
+    Predictor predictor(boosting_.get(), num_iteration, is_raw_score, is_predict_leaf, predict_contrib, contrib_method,
                         config.pred_early_stop, config.pred_early_stop_freq, config.pred_early_stop_margin);
     int64_t num_pred_in_one_row = boosting_->NumPredictOneRow(num_iteration, is_predict_leaf, predict_contrib);
+    if (!config.pred_classes.empty()) {
+      if (predict_type != C_API_PREDICT_NORMAL) {
+        Log::Fatal("pred_classes can only be used with normal prediction");
+      }
+      if (config.pred_early_stop) {
+        Log::Fatal("pred_classes cannot be used with pred_early_stop");
+      }
+      predictor.SetClasses(config.pred_classes, config.pred_normalize_classes);
+      num_pred_in_one_row = static_cast<int64_t>(config.pred_classes.size());
+    }
+    GBDTBase* gbdt = dynamic_cast<GBDTBase*>(boosting_.get());
+    // the raw scores of a block of rows are transformed together
+    const bool batch_transform = gbdt != nullptr && predict_type == C_API_PREDICT_NORMAL && config.pred_classes.empty();
+    if (batch_transform) {
+      predictor.DeferTransform();
+    }
     auto pred_fun = predictor.GetPredictFunction();
+    // with fewer rows than threads the rows go one by one, and large models split their trees across threads
+    bool row_parallel = nrow >= omp_get_max_threads();
+    int num_threads = omp_get_max_threads();
+    if (predict_contrib) {
+      // SHAP values cost far more than the overhead of the threads
+      if (contrib_method != kContribSaabas) {
+        row_parallel = nrow > 1;
+      }
+    } else if (gbdt != nullptr && !is_predict_leaf) {
+      num_threads = gbdt->SelectPredictPlan(nrow, &row_parallel);
+    }
+    // blocks small enough for every thread to get one
+    const int block_rows = std::max(1, std::min(kTransformBlockRows, (nrow + num_threads - 1) / num_threads));
+    const int num_blocks = (nrow + block_rows - 1) / block_rows;
     OMP_INIT_EX();
-    #pragma omp parallel for schedule(static)
+    #pragma omp parallel for schedule(static) num_threads(num_threads) if (row_parallel)
+    for (int block = 0; block < num_blocks; ++block) {
+      OMP_LOOP_EX_BEGIN();
+      const int row_begin = block * block_rows;
+      const int row_end = std::min(nrow, row_begin + block_rows);
+      for (int i = row_begin; i < row_end; ++i) {
+        auto one_row = get_row_fun(i);
+        auto pred_wrt_ptr = out_result + static_cast<size_t>(num_pred_in_one_row) * i;
+        pred_fun(one_row, pred_wrt_ptr);
+      }
+      if (batch_transform) {
+        gbdt->ConvertRawScores(out_result + static_cast<size_t>(num_pred_in_one_row) * row_begin, row_end - row_begin,
+                               config.pred_fast_transform);
+      }
+      OMP_LOOP_EX_END();
+    }
+    OMP_THROW_EX();
+    *out_len = nrow * num_pred_in_one_row;
+  }
+
+  void PredictLeafIndex(int num_iteration, const void* data, int data_type, int nrow, int ncol, int is_row_major,
+                        int out_type, bool one_hot, void* out_result, int64_t* out_len, int64_t* out_num_col) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major, boosting_->UsedFeatures());
+    Predictor predictor(boosting_.get(), num_iteration, false, true, false, kContribTreeSHAP,
+                        false, 1, 0.0);
+    const int num_trees = boosting_->NumPredictOneRow(num_iteration, true, false);
+    const std::vector<int32_t> leaf_offsets = dynamic_cast<GBDTBase*>(boosting_.get())->LeafOffsets();
+    if (out_type == C_API_DTYPE_INT16) {
+      for (int i = 0; i < num_trees; ++i) {
+        if (leaf_offsets[i + 1] - leaf_offsets[i] > std::numeric_limits<int16_t>::max() + 1) {
+          Log::Fatal("Tree %d has %d leaves, too many for C_API_DTYPE_INT16", i, leaf_offsets[i + 1] - leaf_offsets[i]);
+        }
+      }
+    } else if (out_type != C_API_DTYPE_INT32) {
+      Log::Fatal("Unknown leaf index type %d, expected C_API_DTYPE_INT32 or C_API_DTYPE_INT16", out_type);
+    }
+    // int16 rows go through a buffer of every thread
+    std::vector<std::vector<int32_t>> leaf_bufs(out_type == C_API_DTYPE_INT16 ? omp_get_max_threads() : 0,
+                                                std::vector<int32_t>(num_trees));
+    OMP_INIT_EX();
+    #pragma omp parallel for schedule(static) if (nrow > 1)
     for (int i = 0; i < nrow; ++i) {
       OMP_LOOP_EX_BEGIN();
       auto one_row = get_row_fun(i);
-      auto pred_wrt_ptr = out_result + static_cast<size_t>(num_pred_in_one_row) * i;
-      pred_fun(one_row, pred_wrt_ptr);
+      const size_t row_begin = static_cast<size_t>(num_trees) * i;
+      if (out_type == C_API_DTYPE_INT32) {
+        int32_t* leaves = reinterpret_cast<int32_t*>(out_result) + row_begin;
+        predictor.PredictLeafIndex(one_row, leaves);
+        if (one_hot) {
+          for (int j = 0; j < num_trees; ++j) {
+            leaves[j] += leaf_offsets[j];
+          }
+        }
+      } else {
+        int32_t* leaves = leaf_bufs[omp_get_thread_num()].data();
+        predictor.PredictLeafIndex(one_row, leaves);
+        int16_t* row_output = reinterpret_cast<int16_t*>(out_result) + row_begin;
+        for (int j = 0; j < num_trees; ++j) {
+          row_output[j] = static_cast<int16_t>(leaves[j]);
+        }
+      }
       OMP_LOOP_EX_END();
     }
     OMP_THROW_EX();
-    *out_len = nrow * num_pred_in_one_row;
+    *out_len = static_cast<int64_t>(nrow) * num_trees;
+    if (out_num_col != nullptr) {
+      *out_num_col = leaf_offsets.back();
+    }
+  }
+
+  void PredictStaged(const std::vector<int>& checkpoints, int predict_type,
+                     const void* data, int data_type, int nrow, int ncol, int is_row_major,
+                     double* out_result, int64_t* out_len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major, boosting_->UsedFeatures());
+    if (predict_type != C_API_PREDICT_NORMAL && predict_type != C_API_PREDICT_RAW_SCORE) {
+      Log::Fatal("Staged prediction only supports C_API_PREDICT_NORMAL and C_API_PREDICT_RAW_SCORE");
+    }
+    if (checkpoints.empty()) {
+      Log::Fatal("No iteration to predict at");
+    }
+    for (size_t i = 0; i < checkpoints.size(); ++i) {
+      if (checkpoints[i] <= (i > 0 ? checkpoints[i - 1] : 0)) {
+        Log::Fatal("Iterations to predict at should be positive and increasing");
+      }
+    }
+    if (checkpoints.back() > boosting_->GetCurrentIteration()) {
+      Log::Fatal("Cannot predict at iteration %d, the model has %d iterations",
+                 checkpoints.back(), boosting_->GetCurrentIteration());
+    }
+    Predictor predictor(boosting_.get(), checkpoints.back(), false, false, false, kContribTreeSHAP,
+                        false, 1, 0.0);
+    const int64_t num_pred_in_one_row = static_cast<int64_t>(checkpoints.size()) * boosting_->NumModelPerIteration();
+    const bool is_raw_score = predict_type == C_API_PREDICT_RAW_SCORE;
+    OMP_INIT_EX();
+    #pragma omp parallel for schedule(static) if (nrow > 1)
+    for (int i = 0; i < nrow; ++i) {
+      OMP_LOOP_EX_BEGIN();
+      auto one_row = get_row_fun(i);
+      predictor.PredictStaged(one_row, checkpoints, is_raw_score, out_result + static_cast<size_t>(num_pred_in_one_row) * i);
+      OMP_LOOP_EX_END();
+    }
+    OMP_THROW_EX();
+    *out_len = num_pred_in_one_row * nrow;
+  }
+
+  int UpdateScoreCache(ScoreCache* cache, int predict_type,
+                       const void* data, int data_type, int nrow, int ncol, int is_row_major,
+                       double* out_result, int64_t* out_len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major, boosting_->UsedFeatures());
+    if (predict_type != C_API_PREDICT_NORMAL && predict_type != C_API_PREDICT_RAW_SCORE) {
+      Log::Fatal("Score caches only support C_API_PREDICT_NORMAL and C_API_PREDICT_RAW_SCORE");
+    }
+    GBDTBase* gbdt = dynamic_cast<GBDTBase*>(boosting_.get());
+    const int num_class = boosting_->NumModelPerIteration();
+    const int num_trees = boosting_->NumberOfTotalModel();
+    if (cache->num_trees > 0
+        && (cache->num_tree_per_iteration != num_class || cache->num_trees > num_trees
+            || gbdt->LineageHash(cache->num_trees) != cache->lineage_hash)) {
+      Log::Warning("The model did not grow from the model of the score cache, all its trees are evaluated");
+      cache->num_trees = 0;
+    }
+    if (cache->num_trees == 0) {
+      cache->num_tree_per_iteration = num_class;
+      cache->raw_scores.assign(static_cast<size_t>(nrow) * num_class, 0.0f);
+    }
+    const int first_tree = cache->num_trees;
+    if (first_tree < num_trees) {
+      Predictor predictor(boosting_.get(), -1, false, false, false, kContribTreeSHAP, false, 1, 0.0);
+      OMP_INIT_EX();
+      #pragma omp parallel for schedule(static) if (nrow > 1)
+      for (int i = 0; i < nrow; ++i) {
+        OMP_LOOP_EX_BEGIN();
+        auto one_row = get_row_fun(i);
+        predictor.AddTreesToRawScore(one_row, first_tree, num_trees,
+                                     cache->raw_scores.data() + static_cast<size_t>(num_class) * i);
+        OMP_LOOP_EX_END();
+      }
+      OMP_THROW_EX();
+      cache->num_trees = num_trees;
+      cache->lineage_hash = gbdt->LineageHash(num_trees);
+    }
+    if (out_result != nullptr) {
+      const int num_iteration = num_trees / num_class;
+      #pragma omp parallel for schedule(static) if (nrow > 1)
+      for (int i = 0; i < nrow; ++i) {
+        const size_t offset = static_cast<size_t>(num_class) * i;
+        if (predict_type == C_API_PREDICT_RAW_SCORE) {
+          std::memcpy(out_result + offset, cache->raw_scores.data() + offset, sizeof(double) * num_class);
+        } else {
+          gbdt->ConvertRawScore(cache->raw_scores.data() + offset, num_iteration, out_result + offset);
+        }
+      }
+    }
+    *out_len = static_cast<int64_t>(nrow) * num_class;
+    return num_trees - first_tree;
+  }
+
+  int64_t CalcNumPredict(int num_row, int predict_type, int num_iteration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int64_t>(num_row) * boosting_->NumPredictOneRow(num_iteration,
+                                                                        predict_type == C_API_PREDICT_LEAF_INDEX,
+                                                                        predict_type == C_API_PREDICT_CONTRIB);
+  }
+
+  void PredictContribSparse(int num_iteration, const void* data, int data_type, int nrow, int ncol, int is_row_major,
+                            const Config& config, int64_t* out_len, int64_t** out_indptr,
+                            int32_t** out_indices, double** out_data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major, boosting_->UsedFeatures());
+    const ContribMethod contrib_method = GetContribMethod(config);
+    Predictor predictor(boosting_.get(), num_iteration, false, false, true, contrib_method,
+                        false, config.pred_early_stop_freq, config.pred_early_stop_margin);
+    const int num_class = boosting_->NumModelPerIteration();
+    std::vector<std::vector<std::vector<std::pair<int, double>>>> contribs(nrow);
+    OMP_INIT_EX();
+    #pragma omp parallel for schedule(static) if (nrow > 1)
+    for (int i = 0; i < nrow; ++i) {
+      OMP_LOOP_EX_BEGIN();
+      auto one_row = get_row_fun(i);
+      predictor.PredictContribSparse(one_row, config.contrib_top_k, &contribs[i]);
+      OMP_LOOP_EX_END();
+    }
+    OMP_THROW_EX();
+    // one CSR row per record and class
+    std::unique_ptr<int64_t[]> indptr(new int64_t[static_cast<size_t>(nrow) * num_class + 1]);
+    indptr[0] = 0;
+    for (int i = 0; i < nrow; ++i) {
+      for (int k = 0; k < num_class; ++k) {
+        const size_t row = static_cast<size_t>(i) * num_class + k;
+        indptr[row + 1] = indptr[row] + static_cast<int64_t>(contribs[i][k].size());
+      }
+    }
+    const int64_t num_values = indptr[static_cast<size_t>(nrow) * num_class];
+    std::unique_ptr<int32_t[]> indices(new int32_t[num_values]);
+    std::unique_ptr<double[]> values(new double[num_values]);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < nrow; ++i) {
+      for (int k = 0; k < num_class; ++k) {
+        const std::vector<std::pair<int, double>>& class_contribs = contribs[i][k];
+        const int64_t begin = indptr[static_cast<size_t>(i) * num_class + k];
+        for (size_t j = 0; j < class_contribs.size(); ++j) {
+          indices[begin + j] = class_contribs[j].first;
+          values[begin + j] = class_contribs[j].second;
+        }
+      }
+    }
+    *out_len = num_values;
+    *out_indptr = indptr.release();
+    *out_indices = indices.release();
+    *out_data = values.release();
+  }
+
+  void LoadModelFromString(const char* model_str, const char* parameters) {
+    auto param = Config::Str2Map(parameters);
+    config_.Set(param);
+    boosting_->ResetConfig(&config_);
+    LoadModelFromString(model_str);
   }
 
   void LoadModelFromString(const char* model_str) {
     size_t len = std::strlen(model_str);
     boosting_->LoadModelFromString(model_str, len);
+    ++model_version_;
+  }
+
+  void LoadModelFromPacked(const char* buffer, size_t len) {
+    boosting_->LoadModelFromPacked(buffer, len, true);
+    ++model_version_;
+  }
+
+  void ModelDelta(const char* model_str, int base_num_trees, int64_t buffer_len, int64_t* out_len, char* out_str) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string delta = dynamic_cast<GBDTBase*>(boosting_.get())->ModelDelta(model_str, std::strlen(model_str),
+                                                                                     base_num_trees);
+    *out_len = static_cast<int64_t>(delta.size()) + 1;
+    if (*out_len <= buffer_len) {
+      std::memcpy(out_str, delta.c_str(), delta.size() + 1);
+    }
+  }
+
+  void ApplyModelDelta(const char* delta) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dynamic_cast<GBDTBase*>(boosting_.get())->ApplyModelDelta(delta, std::strlen(delta));
+    ++model_version_;
+  }
+
+  uint64_t LineageHash(int num_trees) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_trees < 0 || num_trees > boosting_->NumberOfTotalModel()) {
+      Log::Fatal("Cannot hash %d trees, the model has %d trees", num_trees, boosting_->NumberOfTotalModel());
+    }
+    return dynamic_cast<GBDTBase*>(boosting_.get())->LineageHash(num_trees);
+  }
+
+  void SavePackedModel(int64_t buffer_len, int64_t* out_len, char* out_buf) const {
+    size_t len = 0;
+    const char* packed = boosting_->PackedModel(&len);
+    if (packed == nullptr) {
+      Log::Fatal("Model is not packed, load it with pack_model=true");
+    }
+    *out_len = static_cast<int64_t>(len);
+    if (*out_len <= buffer_len) {
+      std::memcpy(out_buf, packed, len);
+    }
+  }
+
+  void ShareModel(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shared_model_) {
+      Log::Fatal("Model is already in shared memory");
+    }
+    size_t len = 0;
+    const char* packed = boosting_->PackedModel(&len);
+    if (packed == nullptr) {
+      Log::Fatal("Model is not packed, load it with pack_model=true");
+    }
+    std::unique_ptr<SharedMemory> shared_model(new SharedMemory());
+    shared_model->Create(name, packed, len);
+    // predict from the segment as well, so that the host keeps a single copy
+    boosting_->LoadModelFromPacked(shared_model->data(), shared_model->size(), false);
+    shared_model_.reset(shared_model.release());
+    ++model_version_;
+  }
+
+  void AttachSharedModel(const char* name) {
+    std::unique_ptr<SharedMemory> shared_model(new SharedMemory());
+    shared_model->Attach(name);
+    boosting_->LoadModelFromPacked(shared_model->data(), shared_model->size(), false);
+    shared_model_.reset(shared_model.release());
+    ++model_version_;
+  }
+
+  void QuantizeModel(int leaf_type, int threshold_type, int nrow,
+                     std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun,
+                     double* out_max_abs_deviation, double* out_mean_abs_deviation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::vector<double>> sample = DenseSample(nrow, get_row_fun);
+    dynamic_cast<GBDTBase*>(boosting_.get())->QuantizeModel(leaf_type, threshold_type, sample,
+                                                            out_max_abs_deviation, out_mean_abs_deviation);
+    ++model_version_;
+  }
+
+  void Autotune(int nrow, std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::vector<double>> sample = DenseSample(nrow, get_row_fun);
+    dynamic_cast<GBDTBase*>(boosting_.get())->Autotune(sample);
+    ++model_version_;
+  }
+
+  void SetContribBackground(int nrow, std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::vector<double>> background = DenseSample(nrow, get_row_fun);
+    dynamic_cast<GBDTBase*>(boosting_.get())->SetContribBackground(background);
+  }
+
+  void GetPredictPlan(int64_t buffer_len, int64_t* out_len, char* out_str) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string plan = dynamic_cast<GBDTBase*>(boosting_.get())->GetPredictPlan();
+    *out_len = static_cast<int64_t>(plan.size()) + 1;
+    if (*out_len <= buffer_len) {
+      std::memcpy(out_str, plan.c_str(), plan.size() + 1);
+    }
+  }
+
+  void SetPredictPlan(const char* plan) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dynamic_cast<GBDTBase*>(boosting_.get())->SetPredictPlan(plan);
+    ++model_version_;
+  }
+
+  void AcceptQuantizedModel(bool accept) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dynamic_cast<GBDTBase*>(boosting_.get())->AcceptQuantizedModel(accept);
+    ++model_version_;
   }
 
   double GetLeafValue(int tree_idx, int leaf_idx) const {
@@ -78,29 +484,150 @@ public:
   void SetLeafValue(int tree_idx, int leaf_idx, double val) {
     std::lock_guard<std::mutex> lock(mutex_);
     dynamic_cast<GBDTBase*>(boosting_.get())->SetLeafValue(tree_idx, leaf_idx, val);
+    ++model_version_;
+  }
+
+  void InitRescore(int num_iteration, std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun,
+                   RowRescorer* rescorer, double* out_result, int64_t* out_len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    GBDTBase* gbdt = dynamic_cast<GBDTBase*>(boosting_.get());
+    rescorer->booster = this;
+    rescorer->model_version = model_version_;
+    rescorer->num_iteration = num_iteration;
+    rescorer->num_trees = boosting_->NumberOfTotalModel();
+    rescorer->num_predict_features = boosting_->NumPredictFeatures();
+    rescorer->lineage_hash = gbdt->HasLineageHash() ? gbdt->LineageHash(rescorer->num_trees) : 0;
+    rescorer->feature_slots = FeatureSlots();
+    rescorer->features = DenseSample(1, get_row_fun)[0];
+    boosting_->InitPredict(num_iteration, false);
+    gbdt->PredictTreeOutputs(rescorer->features.data(), &rescorer->tree_outputs);
+    gbdt->PredictFromTreeOutputs(rescorer->tree_outputs.data(), out_result);
+    *out_len = boosting_->NumPredictOneRow(num_iteration, false, false);
+  }
+
+  void Rescore(RowRescorer* rescorer, const std::vector<std::pair<int, double>>& changes,
+               double* out_result, int64_t* out_len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    GBDTBase* gbdt = dynamic_cast<GBDTBase*>(boosting_.get());
+    // the tree outputs and the features of the record are laid out for the trees at InitRescore,
+    // hashing the trees costs more than rescoring, so it only runs once the booster changed
+    const bool is_changed = rescorer->model_version != model_version_;
+    if (is_changed && (boosting_->NumberOfTotalModel() != rescorer->num_trees
+                       || boosting_->NumPredictFeatures() != rescorer->num_predict_features
+                       || (gbdt->HasLineageHash() && rescorer->lineage_hash != 0
+                           && gbdt->LineageHash(rescorer->num_trees) != rescorer->lineage_hash))) {
+      Log::Fatal("The trees of the booster changed after LGBM_BoosterRescoreInit, initialize the record again");
+    }
+    std::vector<int> changed_features;
+    for (size_t i = 0; i < changes.size(); ++i) {
+      if (changes[i].first < 0 || changes[i].first >= static_cast<int>(rescorer->feature_slots.size())) {
+        Log::Fatal("Feature index %d is out of range", changes[i].first);
+      }
+      const int slot = rescorer->feature_slots[changes[i].first];
+      // the same values as the prediction buffer would get
+      const double value = std::fabs(changes[i].second) > kZeroThreshold || std::isnan(changes[i].second)
+                           ? changes[i].second : 0.0;
+      if (slot >= 0 && !(rescorer->features[slot] == value
+                         || (std::isnan(rescorer->features[slot]) && std::isnan(value)))) {
+        rescorer->features[slot] = value;
+        changed_features.push_back(slot);
+      }
+    }
+    boosting_->InitPredict(rescorer->num_iteration, false);
+    if (is_changed) {
+      // same trees, but they may be evaluated differently now, e.g. quantized
+      gbdt->PredictTreeOutputs(rescorer->features.data(), &rescorer->tree_outputs);
+      rescorer->model_version = model_version_;
+    } else {
+      gbdt->RepredictTreeOutputs(rescorer->features.data(), changed_features, rescorer->tree_outputs.data());
+    }
+    gbdt->PredictFromTreeOutputs(rescorer->tree_outputs.data(), out_result);
+    *out_len = boosting_->NumPredictOneRow(rescorer->num_iteration, false, false);
   }
 
   const Boosting* GetBoosting() const { return boosting_.get(); }
 
+  /*!
+  * \brief Lock the booster for a prediction together with other boosters, see Ensemble
+  * \param lock Lock of the booster
+  * \return Model of the booster, only to be used while lock is held
+  */
+  Boosting* Lock(std::unique_lock<std::mutex>* lock) {
+    *lock = std::unique_lock<std::mutex>(mutex_);
+    return boosting_.get();
+  }
+
 private:
+  static ContribMethod GetContribMethod(const Config& config) {
+    if (config.contrib_method == std::string("saabas")) {
+      return kContribSaabas;
+    } else if (config.contrib_method == std::string("interventional")) {
+      return kContribInterventional;
+    }
+    return kContribTreeSHAP;
+  }
+
+  /*! \brief Position of every feature in the prediction buffer, -1 if it is not there */
+  std::vector<int> FeatureSlots() const {
+    const int num_feature = boosting_->MaxFeatureIdx() + 1;
+    const int num_predict_feature = boosting_->NumPredictFeatures();
+    std::vector<int> feature_slots(num_feature, -1);
+    if (num_predict_feature < num_feature) {
+      const std::vector<int>& used_features = boosting_->UsedFeatures();
+      for (int i = 0; i < num_predict_feature; ++i) {
+        feature_slots[used_features[i]] = i;
+      }
+    } else {
+      for (int i = 0; i < num_feature; ++i) {
+        feature_slots[i] = i;
+      }
+    }
+    return feature_slots;
+  }
+
+  /*! \brief Dense rows, the same values as the prediction buffer would get */
+  std::vector<std::vector<double>> DenseSample(int nrow,
+                                               std::function<std::vector<std::pair<int, double>>(int row_idx)> get_row_fun) const {
+    const int num_feature = boosting_->MaxFeatureIdx() + 1;
+    const std::vector<int> feature_slots = FeatureSlots();
+    std::vector<std::vector<double>> sample(nrow, std::vector<double>(boosting_->NumPredictFeatures(), 0.0f));
+    for (int i = 0; i < nrow; ++i) {
+      auto one_row = get_row_fun(i);
+      for (size_t j = 0; j < one_row.size(); ++j) {
+        if (one_row[j].first < num_feature && feature_slots[one_row[j].first] >= 0) {
+          sample[i][feature_slots[one_row[j].first]] = one_row[j].second;
+        }
+      }
+    }
+    return sample;
+  }
+
+  /*! \brief Shared memory segment the packed trees of boosting_ live in, released after boosting_ */
+  std::unique_ptr<SharedMemory> shared_model_;
   std::unique_ptr<Boosting> boosting_;
   /*! \brief All configs */
   Config config_;
+  /*! \brief Bumped whenever the trees or the way they are evaluated change, see RowRescorer */
+  int64_t model_version_;
   /*! \brief mutex for threading safe call */
   std::mutex mutex_;
 };
 
+/*!
+* \brief Boosters predicted together on the same rows and blended
+*/
+struct Ensemble {
+  std::vector<Booster*> boosters;
+  std::vector<double> weights;
+  std::vector<bool> is_raw_score;
+  std::vector<int> num_iterations;
+};
+
 }
 
 using namespace LightGBM;
 
-// some help functions used to convert data
-
-std::function<std::vector<double>(int row_idx)>
-RowFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major);
-
-std::function<std::vector<std::pair<int, double>>(int row_idx)>
-RowPairFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major);
+Config PredictConfig(const char* parameter);
 
 // start of c_api functions
 
@@ -122,6 +649,160 @@ int LGBM_BoosterLoadModelFromString(
   API_END();
 }
 
+int LGBM_BoosterLoadModelFromStringWithParams(
+  const char* model_str,
+  const char* parameters,
+  int* out_num_iterations,
+  BoosterHandle* out) {
+  API_BEGIN();
+  auto ret = std::unique_ptr<Booster>(new Booster(0));
+  ret->LoadModelFromString(model_str, parameters);
+  *out_num_iterations = ret->GetBoosting()->GetCurrentIteration();
+  *out = ret.release();
+  API_END();
+}
+
+int LGBM_BoosterLoadPackedModel(
+  const void* buffer,
+  int64_t len,
+  int* out_num_iterations,
+  BoosterHandle* out) {
+  API_BEGIN();
+  auto ret = std::unique_ptr<Booster>(new Booster(0));
+  ret->LoadModelFromPacked(reinterpret_cast<const char*>(buffer), static_cast<size_t>(len));
+  *out_num_iterations = ret->GetBoosting()->GetCurrentIteration();
+  *out = ret.release();
+  API_END();
+}
+
+int LGBM_BoosterSavePackedModel(BoosterHandle handle,
+                                int64_t buffer_len,
+                                int64_t* out_len,
+                                void* out_buf) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->SavePackedModel(buffer_len, out_len, reinterpret_cast<char*>(out_buf));
+  API_END();
+}
+
+int LGBM_ModelDeltaCreate(const char* model_str,
+                          int base_num_trees,
+                          int64_t buffer_len,
+                          int64_t* out_len,
+                          char* out_str) {
+  API_BEGIN();
+  Booster booster(0);
+  booster.LoadModelFromString(model_str);
+  booster.ModelDelta(model_str, base_num_trees, buffer_len, out_len, out_str);
+  API_END();
+}
+
+int LGBM_BoosterApplyModelDelta(BoosterHandle handle,
+                                const char* delta_str,
+                                int* out_num_iterations) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->ApplyModelDelta(delta_str);
+  *out_num_iterations = ref_booster->GetBoosting()->GetCurrentIteration();
+  API_END();
+}
+
+int LGBM_BoosterGetLineageHash(BoosterHandle handle,
+                               int num_trees,
+                               uint64_t* out_hash) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  *out_hash = ref_booster->LineageHash(num_trees);
+  API_END();
+}
+
+int LGBM_BoosterShareModel(BoosterHandle handle, const char* name) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->ShareModel(name);
+  API_END();
+}
+
+int LGBM_BoosterAttachSharedModel(
+  const char* name,
+  int* out_num_iterations,
+  BoosterHandle* out) {
+  API_BEGIN();
+  auto ret = std::unique_ptr<Booster>(new Booster(0));
+  ret->AttachSharedModel(name);
+  *out_num_iterations = ret->GetBoosting()->GetCurrentIteration();
+  *out = ret.release();
+  API_END();
+}
+
+int LGBM_BoosterQuantizeModel(BoosterHandle handle,
+                              int leaf_type,
+                              int threshold_type,
+                              const void* data,
+                              int data_type,
+                              int32_t nrow,
+                              int32_t ncol,
+                              int is_row_major,
+                              double* out_max_abs_deviation,
+                              double* out_mean_abs_deviation) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  auto get_row_fun = RowPairFunctionFromDenseMatric(data, nrow, ncol, data_type, is_row_major);
+  ref_booster->QuantizeModel(leaf_type, threshold_type, nrow, get_row_fun,
+                             out_max_abs_deviation, out_mean_abs_deviation);
+  API_END();
+}
+
+int LGBM_BoosterAcceptQuantizedModel(BoosterHandle handle, int accept) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->AcceptQuantizedModel(accept != 0);
+  API_END();
+}
+
+int LGBM_BoosterAutotune(BoosterHandle handle,
+                         const void* data,
+                         int data_type,
+                         int32_t nrow,
+                         int32_t ncol,
+                         int is_row_major) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  auto get_row_fun = RowPairFunctionFromDenseMatric(data, nrow, ncol, data_type, is_row_major);
+  ref_booster->Autotune(nrow, get_row_fun);
+  API_END();
+}
+
+int LGBM_BoosterSetContribBackground(BoosterHandle handle,
+                                     const void* data,
+                                     int data_type,
+                                     int32_t nrow,
+                                     int32_t ncol,
+                                     int is_row_major) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  auto get_row_fun = RowPairFunctionFromDenseMatric(data, nrow, ncol, data_type, is_row_major);
+  ref_booster->SetContribBackground(nrow, get_row_fun);
+  API_END();
+}
+
+int LGBM_BoosterGetPredictPlan(BoosterHandle handle,
+                               int64_t buffer_len,
+                               int64_t* out_len,
+                               char* out_str) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->GetPredictPlan(buffer_len, out_len, out_str);
+  API_END();
+}
+
+int LGBM_BoosterSetPredictPlan(BoosterHandle handle, const char* plan) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->SetPredictPlan(plan);
+  API_END();
+}
+
 #pragma warning(disable : 4702)
 int LGBM_BoosterFree(BoosterHandle handle) {
   API_BEGIN();
@@ -143,6 +824,17 @@ int LGBM_BoosterGetNumFeature(BoosterHandle handle, int* out_len) {
   API_END();
 }
 
+int LGBM_BoosterGetUsedFeatures(BoosterHandle handle, int buffer_len, int* out_len, int* out_features) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  const std::vector<int>& used_features = ref_booster->GetBoosting()->UsedFeatures();
+  *out_len = static_cast<int>(used_features.size());
+  if (*out_len <= buffer_len) {
+    std::copy(used_features.begin(), used_features.end(), out_features);
+  }
+  API_END();
+}
+
 int LGBM_BoosterPredictForMat(BoosterHandle handle,
                               const void* data,
                               int data_type,
@@ -155,19 +847,335 @@ int LGBM_BoosterPredictForMat(BoosterHandle handle,
                               int64_t* out_len,
                               double* out_result) {
   API_BEGIN();
-  auto param = Config::Str2Map(parameter);
-  Config config;
-  config.Set(param);
-  if (config.num_threads > 0) {
-    omp_set_num_threads(config.num_threads);
-  }
+  Config config = PredictConfig(parameter);
   Booster* ref_booster = reinterpret_cast<Booster*>(handle);
-  auto get_row_fun = RowPairFunctionFromDenseMatric(data, nrow, ncol, data_type, is_row_major);
-  ref_booster->Predict(num_iteration, predict_type, nrow, get_row_fun,
+  ref_booster->Predict(num_iteration, predict_type, data, data_type, nrow, ncol, is_row_major,
                        config, out_result, out_len);
   API_END();
 }
 
+int LGBM_BoosterPredictSparseContribForMat(BoosterHandle handle,
+                                           const void* data,
+                                           int data_type,
+                                           int32_t nrow,
+                                           int32_t ncol,
+                                           int is_row_major,
+                                           int num_iteration,
+                                           const char* parameter,
+                                           int64_t* out_len,
+                                           int64_t** out_indptr,
+                                           int32_t** out_indices,
+                                           double** out_data) {
+  API_BEGIN();
+  Config config = PredictConfig(parameter);
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->PredictContribSparse(num_iteration, data, data_type, nrow, ncol, is_row_major, config,
+                                    out_len, out_indptr, out_indices, out_data);
+  API_END();
+}
+
+int LGBM_BoosterPredictStagedForMat(BoosterHandle handle,
+                                    const void* data,
+                                    int data_type,
+                                    int32_t nrow,
+                                    int32_t ncol,
+                                    int is_row_major,
+                                    int predict_type,
+                                    const int32_t* checkpoints,
+                                    int num_checkpoints,
+                                    const char* parameter,
+                                    int64_t* out_len,
+                                    double* out_result) {
+  API_BEGIN();
+  PredictConfig(parameter);
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  std::vector<int> iterations(checkpoints, checkpoints + num_checkpoints);
+  ref_booster->PredictStaged(iterations, predict_type, data, data_type, nrow, ncol, is_row_major,
+                             out_result, out_len);
+  API_END();
+}
+
+int LGBM_BoosterPredictStagedRangeForMat(BoosterHandle handle,
+                                         const void* data,
+                                         int data_type,
+                                         int32_t nrow,
+                                         int32_t ncol,
+                                         int is_row_major,
+                                         int predict_type,
+                                         int start_iteration,
+                                         int end_iteration,
+                                         const char* parameter,
+                                         int64_t* out_len,
+                                         double* out_result) {
+  API_BEGIN();
+  if (start_iteration <= 0 || end_iteration < start_iteration) {
+    Log::Fatal("Iteration range [%d, %d] is empty or not positive", start_iteration, end_iteration);
+  }
+  PredictConfig(parameter);
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  std::vector<int> iterations;
+  for (int i = start_iteration; i <= end_iteration; ++i) {
+    iterations.push_back(i);
+  }
+  ref_booster->PredictStaged(iterations, predict_type, data, data_type, nrow, ncol, is_row_major,
+                             out_result, out_len);
+  API_END();
+}
+
+int LGBM_ScoreCacheCreate(const void* data,
+                          int data_type,
+                          int32_t nrow,
+                          int32_t ncol,
+                          int is_row_major,
+                          ScoreCacheHandle* out) {
+  API_BEGIN();
+  if (data_type != C_API_DTYPE_FLOAT32 && data_type != C_API_DTYPE_FLOAT64) {
+    throw std::runtime_error("Unknown data type in LGBM_ScoreCacheCreate");
+  }
+  const size_t value_size = data_type == C_API_DTYPE_FLOAT32 ? sizeof(float) : sizeof(double);
+  std::unique_ptr<ScoreCache> cache(new ScoreCache());
+  cache->num_rows = nrow;
+  cache->num_cols = ncol;
+  cache->data_type = data_type;
+  cache->is_row_major = is_row_major;
+  cache->data_hash = ScoreCache::DataHash(data, static_cast<size_t>(nrow) * ncol * value_size);
+  cache->num_tree_per_iteration = 0;
+  cache->num_trees = 0;
+  cache->lineage_hash = 0;
+  *out = cache.release();
+  API_END();
+}
+
+int LGBM_ScoreCacheCreateFromFile(const char* filename,
+                                  ScoreCacheHandle* out) {
+  API_BEGIN();
+  *out = ScoreCache::Load(filename).release();
+  API_END();
+}
+
+int LGBM_ScoreCacheSaveToFile(ScoreCacheHandle handle,
+                              const char* filename) {
+  API_BEGIN();
+  reinterpret_cast<ScoreCache*>(handle)->Save(filename);
+  API_END();
+}
+
+int LGBM_ScoreCacheGetNumTrees(ScoreCacheHandle handle,
+                               int* out_num_trees) {
+  API_BEGIN();
+  *out_num_trees = reinterpret_cast<ScoreCache*>(handle)->num_trees;
+  API_END();
+}
+
+int LGBM_ScoreCacheFree(ScoreCacheHandle handle) {
+  API_BEGIN();
+  delete reinterpret_cast<ScoreCache*>(handle);
+  API_END();
+}
+
+int LGBM_BoosterUpdateScoreCache(BoosterHandle handle,
+                                 ScoreCacheHandle cache_handle,
+                                 const void* data,
+                                 int data_type,
+                                 int32_t nrow,
+                                 int32_t ncol,
+                                 int is_row_major,
+                                 int predict_type,
+                                 const char* parameter,
+                                 int* out_num_new_trees,
+                                 int64_t* out_len,
+                                 double* out_result) {
+  API_BEGIN();
+  PredictConfig(parameter);
+  ScoreCache* cache = reinterpret_cast<ScoreCache*>(cache_handle);
+  const size_t value_size = data_type == C_API_DTYPE_FLOAT32 ? sizeof(float) : sizeof(double);
+  if (cache->num_rows != nrow || cache->num_cols != ncol || cache->data_type != data_type
+      || cache->is_row_major != is_row_major
+      || cache->data_hash != ScoreCache::DataHash(data, static_cast<size_t>(nrow) * ncol * value_size)) {
+    Log::Fatal("The data differs from the data of the score cache");
+  }
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  *out_num_new_trees = ref_booster->UpdateScoreCache(cache, predict_type, data, data_type, nrow, ncol, is_row_major,
+                                                     out_result, out_len);
+  API_END();
+}
+
+int LGBM_EnsembleCreate(const BoosterHandle* boosters,
+                        int num_boosters,
+                        const double* weights,
+                        const int* predict_types,
+                        const int* num_iterations,
+                        EnsembleHandle* out) {
+  API_BEGIN();
+  if (num_boosters <= 0) {
+    Log::Fatal("An ensemble needs at least one booster");
+  }
+  std::unique_ptr<Ensemble> ensemble(new Ensemble());
+  for (int i = 0; i < num_boosters; ++i) {
+    Booster* booster = reinterpret_cast<Booster*>(boosters[i]);
+    if (std::find(ensemble->boosters.begin(), ensemble->boosters.end(), booster) != ensemble->boosters.end()) {
+      Log::Fatal("Booster %d is already in the ensemble", i);
+    }
+    const int predict_type = predict_types != nullptr ? predict_types[i] : C_API_PREDICT_NORMAL;
+    if (predict_type != C_API_PREDICT_NORMAL && predict_type != C_API_PREDICT_RAW_SCORE) {
+      Log::Fatal("Ensembles only support C_API_PREDICT_NORMAL and C_API_PREDICT_RAW_SCORE");
+    }
+    ensemble->boosters.push_back(booster);
+    ensemble->weights.push_back(weights != nullptr ? weights[i] : 1.0 / num_boosters);
+    ensemble->is_raw_score.push_back(predict_type == C_API_PREDICT_RAW_SCORE);
+    ensemble->num_iterations.push_back(num_iterations != nullptr ? num_iterations[i] : -1);
+  }
+  *out = ensemble.release();
+  API_END();
+}
+
+int LGBM_EnsemblePredictForMat(EnsembleHandle handle,
+                               const void* data,
+                               int data_type,
+                               int32_t nrow,
+                               int32_t ncol,
+                               int is_row_major,
+                               const char* parameter,
+                               int64_t* out_len,
+                               double* out_result) {
+  API_BEGIN();
+  PredictConfig(parameter);
+  Ensemble* ensemble = reinterpret_cast<Ensemble*>(handle);
+  // always locked in the same order, so that ensembles sharing boosters cannot deadlock
+  std::vector<std::pair<Booster*, int>> order;
+  for (size_t i = 0; i < ensemble->boosters.size(); ++i) {
+    order.push_back(std::make_pair(ensemble->boosters[i], static_cast<int>(i)));
+  }
+  std::sort(order.begin(), order.end());
+  std::vector<std::unique_lock<std::mutex>> locks(order.size());
+  std::vector<Boosting*> boostings(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    boostings[order[i].second] = order[i].first->Lock(&locks[i]);
+  }
+  EnsemblePredictor predictor(boostings, ensemble->num_iterations, ensemble->is_raw_score, ensemble->weights, nrow);
+  auto get_row_fun = RowFunctionForPredict(data, nrow, ncol, data_type, is_row_major,
+                                           predictor.UsedFeatures());
+  predictor.Predict(nrow, get_row_fun, out_result);
+  *out_len = static_cast<int64_t>(nrow) * predictor.NumPredictOneRow();
+  API_END();
+}
+
+int LGBM_EnsembleFree(EnsembleHandle handle) {
+  API_BEGIN();
+  delete reinterpret_cast<Ensemble*>(handle);
+  API_END();
+}
+
+int LGBM_BoosterCalcNumPredict(BoosterHandle handle,
+                               int num_row,
+                               int predict_type,
+                               int num_iteration,
+                               int64_t* out_len) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  *out_len = ref_booster->CalcNumPredict(num_row, predict_type, num_iteration);
+  API_END();
+}
+
+int LGBM_BoosterPredictLeafIndexForMat(BoosterHandle handle,
+                                       const void* data,
+                                       int data_type,
+                                       int32_t nrow,
+                                       int32_t ncol,
+                                       int is_row_major,
+                                       int num_iteration,
+                                       const char* parameter,
+                                       int out_type,
+                                       int64_t* out_len,
+                                       void* out_result) {
+  API_BEGIN();
+  PredictConfig(parameter);
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  ref_booster->PredictLeafIndex(num_iteration, data, data_type, nrow, ncol, is_row_major, out_type, false,
+                                out_result, out_len, 0);
+  API_END();
+}
+
+int LGBM_BoosterPredictLeafOneHotForMat(BoosterHandle handle,
+                                        const void* data,
+                                        int data_type,
+                                        int32_t nrow,
+                                        int32_t ncol,
+                                        int is_row_major,
+                                        int num_iteration,
+                                        const char* parameter,
+                                        int64_t* out_num_col,
+                                        int64_t* out_indptr,
+                                        int32_t* out_indices) {
+  API_BEGIN();
+  PredictConfig(parameter);
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  int64_t num_values = 0;
+  ref_booster->PredictLeafIndex(num_iteration, data, data_type, nrow, ncol, is_row_major, C_API_DTYPE_INT32, true,
+                                out_indices, &num_values, out_num_col);
+  // every row has one leaf per tree
+  const int64_t num_trees = nrow > 0 ? num_values / nrow : 0;
+  for (int32_t i = 0; i <= nrow; ++i) {
+    out_indptr[i] = num_trees * i;
+  }
+  API_END();
+}
+
+int LGBM_BoosterFreeSparseContrib(int64_t* indptr, int32_t* indices, double* data) {
+  API_BEGIN();
+  delete[] indptr;
+  delete[] indices;
+  delete[] data;
+  API_END();
+}
+
+int LGBM_BoosterRescoreInit(BoosterHandle handle,
+                            const void* data,
+                            int data_type,
+                            int32_t ncol,
+                            int num_iteration,
+                            RescoreHandle* out,
+                            int64_t* out_len,
+                            double* out_result) {
+  API_BEGIN();
+  Booster* ref_booster = reinterpret_cast<Booster*>(handle);
+  auto get_row_fun = RowPairFunctionFromDenseMatric(data, 1, ncol, data_type, 1);
+  std::unique_ptr<RowRescorer> rescorer(new RowRescorer());
+  ref_booster->InitRescore(num_iteration, get_row_fun, rescorer.get(), out_result, out_len);
+  *out = rescorer.release();
+  API_END();
+}
+
+int LGBM_BoosterRescore(RescoreHandle handle,
+                        const int32_t* feature_indices,
+                        const void* values,
+                        int data_type,
+                        int32_t num_changed,
+                        int64_t* out_len,
+                        double* out_result) {
+  API_BEGIN();
+  RowRescorer* rescorer = reinterpret_cast<RowRescorer*>(handle);
+  std::vector<std::pair<int, double>> changes(num_changed);
+  for (int i = 0; i < num_changed; ++i) {
+    changes[i].first = feature_indices[i];
+    if (data_type == C_API_DTYPE_FLOAT32) {
+      changes[i].second = static_cast<double>(reinterpret_cast<const float*>(values)[i]);
+    } else if (data_type == C_API_DTYPE_FLOAT64) {
+      changes[i].second = reinterpret_cast<const double*>(values)[i];
+    } else {
+      throw std::runtime_error("Unknown data type in LGBM_BoosterRescore");
+    }
+  }
+  rescorer->booster->Rescore(rescorer, changes, out_result, out_len);
+  API_END();
+}
+
+int LGBM_RescoreFree(RescoreHandle handle) {
+  API_BEGIN();
+  delete reinterpret_cast<RowRescorer*>(handle);
+  API_END();
+}
+
 // ---- start of some help functions
 
 template <typename PTR_T>
@@ -211,6 +1219,75 @@ public:
 	}
 };
 
+inline int NonzeroIndices(const float* row, int len, int32_t* out_indices) {
+  return GetPredictKernels().nonzero_float(row, len, out_indices);
+}
+
+inline int NonzeroIndices(const double* row, int len, int32_t* out_indices) {
+  return GetPredictKernels().nonzero_double(row, len, out_indices);
+}
+
+/*! \brief Non-zero values of a row of a row major matrix, found by the kernels without a copy of the row */
+template <typename PTR_T>
+class row_pair_functor_row_major {
+	const PTR_T *data_ptr_;
+	const int num_col_;
+	const int num_row_;
+public:
+	row_pair_functor_row_major(const PTR_T *data_ptr, const int num_col, const int num_row)
+			: data_ptr_(data_ptr), num_col_(num_col), num_row_(num_row)
+	{}
+
+	std::vector<std::pair<int, double>> operator() (const int row_idx)
+	{
+		auto tmp_ptr = data_ptr_ + static_cast<size_t>(num_col_) * row_idx;
+		std::vector<int32_t> indices(num_col_);
+		const int cnt = NonzeroIndices(tmp_ptr, num_col_, indices.data());
+		std::vector<std::pair<int, double>> ret;
+		ret.reserve(cnt);
+		for (int i = 0; i < cnt; ++i) {
+			ret.emplace_back(indices[i], static_cast<double>(tmp_ptr[indices[i]]));
+		}
+		return ret;
+	}
+};
+
+/*! \brief Non-zero values of some columns of a row, the other columns are not read */
+template <typename PTR_T>
+class row_pair_functor_columns {
+	const PTR_T *data_ptr_;
+	const int num_col_;
+	const int num_row_;
+	const int is_row_major_;
+	std::vector<int> columns_;
+public:
+	row_pair_functor_columns(const PTR_T *data_ptr, const int num_col, const int num_row, const int is_row_major,
+	                         const std::vector<int>& columns)
+			: data_ptr_(data_ptr), num_col_(num_col), num_row_(num_row), is_row_major_(is_row_major)
+	{
+		for (size_t i = 0; i < columns.size(); ++i) {
+			if (columns[i] < num_col) {
+				columns_.push_back(columns[i]);
+			}
+		}
+	}
+
+	std::vector<std::pair<int, double>> operator() (const int row_idx)
+	{
+		std::vector<std::pair<int, double>> ret;
+		ret.reserve(columns_.size());
+		for (size_t i = 0; i < columns_.size(); ++i) {
+			const int col = columns_[i];
+			const double val = static_cast<double>(is_row_major_ ? data_ptr_[static_cast<size_t>(num_col_) * row_idx + col]
+			                                                     : data_ptr_[static_cast<size_t>(num_row_) * col + row_idx]);
+			if (std::fabs(val) > kZeroThreshold || std::isnan(val)) {
+				ret.emplace_back(col, val);
+			}
+		}
+		return ret;
+	}
+};
+
 std::function<std::vector<double>(int row_idx)>
 RowFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major) {
   if (data_type == C_API_DTYPE_FLOAT32) {
@@ -255,9 +1332,45 @@ private:
 
 std::function<std::vector<std::pair<int, double>>(int row_idx)>
 RowPairFunctionFromDenseMatric(const void* data, int num_row, int num_col, int data_type, int is_row_major) {
+  if (is_row_major && data_type == C_API_DTYPE_FLOAT32) {
+    return row_pair_functor_row_major<float>(reinterpret_cast<const float*>(data), num_col, num_row);
+  } else if (is_row_major && data_type == C_API_DTYPE_FLOAT64) {
+    return row_pair_functor_row_major<double>(reinterpret_cast<const double*>(data), num_col, num_row);
+  }
   auto inner_function = RowFunctionFromDenseMatric(data, num_row, num_col, data_type, is_row_major);
   if (inner_function != 0) {
     return _outer_func_ftor(inner_function);
   }
   return NULL;
 }
+
+std::function<std::vector<std::pair<int, double>>(int row_idx)>
+RowPairFunctionFromDenseColumns(const void* data, int num_row, int num_col, int data_type, int is_row_major,
+                                const std::vector<int>& columns) {
+  if (data_type == C_API_DTYPE_FLOAT32) {
+    return row_pair_functor_columns<float>(reinterpret_cast<const float*>(data), num_col, num_row, is_row_major, columns);
+  } else if (data_type == C_API_DTYPE_FLOAT64) {
+    return row_pair_functor_columns<double>(reinterpret_cast<const double*>(data), num_col, num_row, is_row_major, columns);
+  }
+  throw std::runtime_error("Unknown data type in RowPairFunctionFromDenseColumns");
+}
+
+std::function<std::vector<std::pair<int, double>>(int row_idx)>
+RowFunctionForPredict(const void* data, int num_row, int num_col, int data_type, int is_row_major,
+                      const std::vector<int>& used_features) {
+  // only the columns the trees split on are read when most of them are not
+  if (static_cast<int>(used_features.size()) < num_col / 2) {
+    return RowPairFunctionFromDenseColumns(data, num_row, num_col, data_type, is_row_major, used_features);
+  }
+  return RowPairFunctionFromDenseMatric(data, num_row, num_col, data_type, is_row_major);
+}
+
+Config PredictConfig(const char* parameter) {
+  auto param = Config::Str2Map(parameter);
+  Config config;
+  config.Set(param);
+  if (config.num_threads > 0) {
+    omp_set_num_threads(config.num_threads);
+  }
+  return config;
+}
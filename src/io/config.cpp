@@ -153,6 +153,22 @@ void GetTreeLearnerType(const std::unordered_map<std::string, std::string>& para
   }
 }
 
+void GetContribMethod(const std::unordered_map<std::string, std::string>& params, std::string* contrib_method) {
+  std::string value;
+  if (Config::GetString(params, "contrib_method", &value)) {
+    std::transform(value.begin(), value.end(), value.begin(), Common::tolower);
+    if (value == std::string("tree_shap")) {
+      *contrib_method = "tree_shap";
+    } else if (value == std::string("saabas")) {
+      *contrib_method = "saabas";
+    } else if (value == std::string("interventional")) {
+      *contrib_method = "interventional";
+    } else {
+      Log::Fatal("Unknown contrib method %s", value.c_str());
+    }
+  }
+}
+
 void Config::Set(const std::unordered_map<std::string, std::string>& params) {
 
   // generate seeds by seed.
@@ -171,6 +187,7 @@ void Config::Set(const std::unordered_map<std::string, std::string>& params) {
   GetObjectiveType(params, &objective);
   GetDeviceType(params, &device_type);
   GetTreeLearnerType(params, &tree_learner);
+  GetContribMethod(params, &contrib_method);
 
   GetMembersFromString(params);
 
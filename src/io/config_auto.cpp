@@ -230,10 +230,23 @@ std::unordered_set<std::string> Config::parameter_set({
   "predict_raw_score",
   "predict_leaf_index",
   "predict_contrib",
+  "contrib_method",
+  "contrib_top_k",
   "num_iteration_predict",
   "pred_early_stop",
   "pred_early_stop_freq",
   "pred_early_stop_margin",
+  "pred_classes",
+  "pred_normalize_classes",
+  "pred_fast_transform",
+  "model_huge_pages",
+  "pack_model",
+  "model_cache_dir",
+  "compile_model",
+  "model_compiler",
+  "autotune",
+  "autotune_rows",
+  "predict_plan",
   "convert_model_language",
   "convert_model",
   "num_class",
@@ -439,6 +452,9 @@ void Config::GetMembersFromString(const std::unordered_map<std::string, std::str
 
   GetBool(params, "predict_contrib", &predict_contrib);
 
+  GetInt(params, "contrib_top_k", &contrib_top_k);
+  CHECK(contrib_top_k >=0);
+
   GetInt(params, "num_iteration_predict", &num_iteration_predict);
 
   GetBool(params, "pred_early_stop", &pred_early_stop);
@@ -447,6 +463,31 @@ void Config::GetMembersFromString(const std::unordered_map<std::string, std::str
 
   GetDouble(params, "pred_early_stop_margin", &pred_early_stop_margin);
 
+  if (GetString(params, "pred_classes", &tmp_str)) {
+    pred_classes = Common::StringToArray<int>(tmp_str, ',');
+  }
+
+  GetBool(params, "pred_normalize_classes", &pred_normalize_classes);
+
+  GetBool(params, "pred_fast_transform", &pred_fast_transform);
+
+  GetBool(params, "model_huge_pages", &model_huge_pages);
+
+  GetBool(params, "pack_model", &pack_model);
+
+  GetString(params, "model_cache_dir", &model_cache_dir);
+
+  GetBool(params, "compile_model", &compile_model);
+
+  GetString(params, "model_compiler", &model_compiler);
+
+  GetBool(params, "autotune", &autotune);
+
+  GetInt(params, "autotune_rows", &autotune_rows);
+  CHECK(autotune_rows >0);
+
+  GetString(params, "predict_plan", &predict_plan);
+
   GetString(params, "convert_model_language", &convert_model_language);
 
   GetString(params, "convert_model", &convert_model);
@@ -585,10 +626,23 @@ std::string Config::SaveMembersToString() const {
   str_buf << "[predict_raw_score: " << predict_raw_score << "]\n";
   str_buf << "[predict_leaf_index: " << predict_leaf_index << "]\n";
   str_buf << "[predict_contrib: " << predict_contrib << "]\n";
+  str_buf << "[contrib_method: " << contrib_method << "]\n";
+  str_buf << "[contrib_top_k: " << contrib_top_k << "]\n";
   str_buf << "[num_iteration_predict: " << num_iteration_predict << "]\n";
   str_buf << "[pred_early_stop: " << pred_early_stop << "]\n";
   str_buf << "[pred_early_stop_freq: " << pred_early_stop_freq << "]\n";
   str_buf << "[pred_early_stop_margin: " << pred_early_stop_margin << "]\n";
+  str_buf << "[pred_classes: " << Common::Join(pred_classes,",") << "]\n";
+  str_buf << "[pred_normalize_classes: " << pred_normalize_classes << "]\n";
+  str_buf << "[pred_fast_transform: " << pred_fast_transform << "]\n";
+  str_buf << "[model_huge_pages: " << model_huge_pages << "]\n";
+  str_buf << "[pack_model: " << pack_model << "]\n";
+  str_buf << "[model_cache_dir: " << model_cache_dir << "]\n";
+  str_buf << "[compile_model: " << compile_model << "]\n";
+  str_buf << "[model_compiler: " << model_compiler << "]\n";
+  str_buf << "[autotune: " << autotune << "]\n";
+  str_buf << "[autotune_rows: " << autotune_rows << "]\n";
+  str_buf << "[predict_plan: " << predict_plan << "]\n";
   str_buf << "[convert_model_language: " << convert_model_language << "]\n";
   str_buf << "[convert_model: " << convert_model << "]\n";
   str_buf << "[num_class: " << num_class << "]\n";
@@ -3,6 +3,7 @@
 #include <LightGBM/utils/threading.h>
 #include <LightGBM/utils/common.h>
 
+#include <algorithm>
 #include <sstream>
 #include <unordered_map>
 #include <functional>
@@ -10,26 +11,44 @@
 #include <string>
 #include <memory>
 #include <iomanip>
+#include <cstring>
 
 namespace LightGBM {
 
+namespace {
+
+/*! \brief Leaves whose path splits on more distinct features get no table in PredictContrib, 2 KB per leaf */
+const int kSHAPTableMaxFeatures = 8;
+
+/*! \brief Bits of the first num_path_features positions */
+inline uint64_t PathMask(int num_path_features) {
+  return num_path_features >= 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << num_path_features) - 1;
+}
+
+}  // namespace
+
 Tree::Tree(int max_leaves)
-  :max_leaves_(max_leaves) {
-
-  left_child_.resize(max_leaves_ - 1);
-  right_child_.resize(max_leaves_ - 1);
-  split_feature_inner_.resize(max_leaves_ - 1);
-  split_feature_.resize(max_leaves_ - 1);
-  threshold_in_bin_.resize(max_leaves_ - 1);
-  threshold_.resize(max_leaves_ - 1);
-  decision_type_.resize(max_leaves_ - 1, 0);
-  split_gain_.resize(max_leaves_ - 1);
-  leaf_parent_.resize(max_leaves_);
-  leaf_value_.resize(max_leaves_);
-  leaf_count_.resize(max_leaves_);
-  internal_value_.resize(max_leaves_ - 1);
-  internal_count_.resize(max_leaves_ - 1);
-  leaf_depth_.resize(max_leaves_);
+  :own_arena_(new Arena()), max_leaves_(max_leaves) {
+  const size_t num_nodes = max_leaves_ - 1;
+  own_arena_->Reserve(Arena::AlignedSize<int>(num_nodes) * 5 + Arena::AlignedSize<uint32_t>(num_nodes)
+                      + Arena::AlignedSize<double>(num_nodes) * 2 + Arena::AlignedSize<int8_t>(num_nodes)
+                      + Arena::AlignedSize<float>(num_nodes) + Arena::AlignedSize<int>(max_leaves_) * 3
+                      + Arena::AlignedSize<double>(max_leaves_) + Arena::AlignedSize<int>(1) * 2, false);
+  Arena* arena = own_arena_.get();
+  left_child_.Allocate(arena, num_nodes, 0);
+  right_child_.Allocate(arena, num_nodes, 0);
+  split_feature_inner_.Allocate(arena, num_nodes, 0);
+  split_feature_.Allocate(arena, num_nodes, 0);
+  threshold_in_bin_.Allocate(arena, num_nodes, 0);
+  threshold_.Allocate(arena, num_nodes, 0.0f);
+  decision_type_.Allocate(arena, num_nodes, 0);
+  split_gain_.Allocate(arena, num_nodes, 0.0f);
+  leaf_parent_.Allocate(arena, max_leaves_, 0);
+  leaf_value_.Allocate(arena, max_leaves_, 0.0f);
+  leaf_count_.Allocate(arena, max_leaves_, 0);
+  internal_value_.Allocate(arena, num_nodes, 0.0f);
+  internal_count_.Allocate(arena, num_nodes, 0);
+  leaf_depth_.Allocate(arena, max_leaves_, 0);
   // root is in the depth 0
   leaf_depth_[0] = 0;
   num_leaves_ = 1;
@@ -37,9 +56,13 @@ Tree::Tree(int max_leaves)
   leaf_parent_[0] = -1;
   shrinkage_ = 1.0f;
   num_cat_ = 0;
-  cat_boundaries_.push_back(0);
-  cat_boundaries_inner_.push_back(0);
+  cat_boundaries_.Allocate(arena, 1, 0);
+  cat_boundaries_inner_.Allocate(arena, 1, 0);
   max_depth_ = -1;
+  shap_paths_built_ = false;
+  shap_built_ = false;
+  shap_tabled_ = false;
+  saabas_built_ = false;
 }
 
 Tree::~Tree() {
@@ -66,30 +89,30 @@ std::string Tree::ToString() const {
   str_buf << "num_leaves=" << num_leaves_ << '\n';
   str_buf << "num_cat=" << num_cat_ << '\n';
   str_buf << "split_feature="
-    << Common::ArrayToStringFast(split_feature_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(split_feature_.data(), num_leaves_ - 1) << '\n';
   str_buf << "split_gain="
-    << Common::ArrayToStringFast(split_gain_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(split_gain_.data(), num_leaves_ - 1) << '\n';
   str_buf << "threshold="
-    << Common::ArrayToString(threshold_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToString(threshold_.data(), num_leaves_ - 1) << '\n';
   str_buf << "decision_type="
-    << Common::ArrayToStringFast(Common::ArrayCast<int8_t, int>(decision_type_), num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(decision_type_.data(), num_leaves_ - 1) << '\n';
   str_buf << "left_child="
-    << Common::ArrayToStringFast(left_child_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(left_child_.data(), num_leaves_ - 1) << '\n';
   str_buf << "right_child="
-    << Common::ArrayToStringFast(right_child_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(right_child_.data(), num_leaves_ - 1) << '\n';
   str_buf << "leaf_value="
-    << Common::ArrayToString(leaf_value_, num_leaves_) << '\n';
+    << Common::ArrayToString(leaf_value_.data(), num_leaves_) << '\n';
   str_buf << "leaf_count="
-    << Common::ArrayToStringFast(leaf_count_, num_leaves_) << '\n';
+    << Common::ArrayToStringFast(leaf_count_.data(), num_leaves_) << '\n';
   str_buf << "internal_value="
-    << Common::ArrayToStringFast(internal_value_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(internal_value_.data(), num_leaves_ - 1) << '\n';
   str_buf << "internal_count="
-    << Common::ArrayToStringFast(internal_count_, num_leaves_ - 1) << '\n';
+    << Common::ArrayToStringFast(internal_count_.data(), num_leaves_ - 1) << '\n';
   if (num_cat_ > 0) {
     str_buf << "cat_boundaries="
-      << Common::ArrayToStringFast(cat_boundaries_, num_cat_ + 1) << '\n';
+      << Common::ArrayToStringFast(cat_boundaries_.data(), num_cat_ + 1) << '\n';
     str_buf << "cat_threshold="
-      << Common::ArrayToStringFast(cat_threshold_, cat_threshold_.size()) << '\n';
+      << Common::ArrayToStringFast(cat_threshold_.data(), cat_threshold_.size()) << '\n';
   }
   str_buf << "shrinkage=" << shrinkage_ << '\n';
   str_buf << '\n';
@@ -312,120 +335,236 @@ std::string Tree::NodeToIfElseByMap(int index, bool predict_leaf_index) const {
   return str_buf.str();
 }
 
-Tree::Tree(const char* str, size_t* used_len) {
+namespace {
+
+/*! \brief Max number of lines of one tree in the model string */
+const int kMaxTreeLine = 15;
+
+/*!
+* \brief Key/value ranges of one tree in the model string, nothing is copied
+*/
+struct TreeFields {
+  int num_line;
+  const char* keys[kMaxTreeLine];
+  size_t key_lens[kMaxTreeLine];
+  const char* values[kMaxTreeLine];
+
+  /*! \brief Start of the value of key, 0 if the key is missing */
+  const char* Get(const char* key) const {
+    const size_t len = std::strlen(key);
+    for (int i = num_line - 1; i >= 0; --i) {
+      if (key_lens[i] == len && std::strncmp(keys[i], key, len) == 0) {
+        return values[i];
+      }
+    }
+    return 0;
+  }
+};
+
+/*! \brief Split one tree of the model string into key/value ranges, return the used length */
+size_t ParseTreeFields(const char* str, TreeFields* fields) {
   auto p = str;
-  std::unordered_map<std::string, std::string> key_vals;
-  const int max_num_line = 15;
-  int read_line = 0;
-  while (read_line < max_num_line) {
+  fields->num_line = 0;
+  while (fields->num_line < kMaxTreeLine) {
     if (*p == '\r' || *p == '\n') break;
-    auto start = p;
-    while (*p != '=') ++p; 
-    std::string key(start, p - start);
+    const int i = fields->num_line;
+    fields->keys[i] = p;
+    while (*p != '=') ++p;
+    fields->key_lens[i] = p - fields->keys[i];
     ++p;
-    start = p;
+    fields->values[i] = p;
     while (*p != '\r' && *p != '\n') ++p;
-    key_vals[key] = std::string(start, p - start);
-    ++read_line;
+    ++fields->num_line;
     if (*p == '\r') ++p;
     if (*p == '\n') ++p;
   }
-  *used_len = p - str;
+  return p - str;
+}
+
+}  // namespace
+
+Tree::Tree(const char* str, size_t* used_len)
+  :own_arena_(new Arena()) {
+  own_arena_->Reserve(ArenaSize(str, used_len), false);
+  LoadFromString(str, used_len, own_arena_.get());
+}
+
+Tree::Tree(const char* str, size_t* used_len, Arena* arena) {
+  LoadFromString(str, used_len, arena);
+}
 
-  if (key_vals.count("num_leaves") <= 0) {
+size_t Tree::ArenaSize(const char* str, size_t* used_len) {
+  TreeFields fields;
+  *used_len = ParseTreeFields(str, &fields);
+  int num_leaves = 0;
+  int num_cat = 0;
+  const char* val = fields.Get("num_leaves");
+  if (val != nullptr) {
+    Common::Atoi(val, &num_leaves);
+  }
+  val = fields.Get("num_cat");
+  if (val != nullptr) {
+    Common::Atoi(val, &num_cat);
+  }
+  // leaf_value_
+  size_t ret = Arena::AlignedSize<double>(num_leaves);
+  if (num_leaves <= 1) { return ret; }
+  const size_t num_nodes = num_leaves - 1;
+  // left_child_, right_child_, split_feature_, internal_count_
+  ret += Arena::AlignedSize<int>(num_nodes) * 4;
+  // threshold_, internal_value_
+  ret += Arena::AlignedSize<double>(num_nodes) * 2;
+  // split_gain_, decision_type_
+  ret += Arena::AlignedSize<float>(num_nodes) + Arena::AlignedSize<int8_t>(num_nodes);
+  // leaf_count_, leaf_depth_
+  ret += Arena::AlignedSize<int>(num_leaves) * 2;
+  if (num_cat > 0) {
+    int num_cat_threshold = 0;
+    val = fields.Get("cat_boundaries");
+    if (val != nullptr) {
+      for (int i = 0; i <= num_cat; ++i) {
+        val = Common::Atoi(val, &num_cat_threshold);
+      }
+    }
+    ret += Arena::AlignedSize<int>(num_cat + 1) + Arena::AlignedSize<uint32_t>(num_cat_threshold);
+  }
+  return ret;
+}
+
+void Tree::LoadFromString(const char* str, size_t* used_len, Arena* arena) {
+  TreeFields fields;
+  *used_len = ParseTreeFields(str, &fields);
+
+  const char* val = fields.Get("num_leaves");
+  if (val == nullptr) {
     Log::Fatal("Tree model should contain num_leaves field");
   }
 
-  Common::Atoi(key_vals["num_leaves"].c_str(), &num_leaves_);
+  Common::Atoi(val, &num_leaves_);
+  max_leaves_ = num_leaves_;
 
-  if (key_vals.count("num_cat") <= 0) {
+  val = fields.Get("num_cat");
+  if (val == nullptr) {
     Log::Fatal("Tree model should contain num_cat field");
   }
 
-  Common::Atoi(key_vals["num_cat"].c_str(), &num_cat_);
+  Common::Atoi(val, &num_cat_);
 
-  if (key_vals.count("leaf_value")) {
-    leaf_value_ = Common::StringToArray<double>(key_vals["leaf_value"], num_leaves_);
+  val = fields.Get("leaf_value");
+  if (val != nullptr) {
+    leaf_value_.Allocate(arena, num_leaves_);
+    Common::StringToArray(val, num_leaves_, leaf_value_.data());
   } else {
     Log::Fatal("Tree model string format error, should contain leaf_value field");
   }
 
+  val = fields.Get("shrinkage");
+  if (val != nullptr) {
+    Common::Atof(val, &shrinkage_);
+  } else {
+    shrinkage_ = 1.0f;
+  }
+  max_depth_ = -1;
+  shap_paths_built_ = false;
+  shap_built_ = false;
+  shap_tabled_ = false;
+  saabas_built_ = false;
+
   if (num_leaves_ <= 1) { return; }
+  const int num_nodes = num_leaves_ - 1;
 
-  if (key_vals.count("left_child")) {
-    left_child_ = Common::StringToArrayFast<int>(key_vals["left_child"], num_leaves_ - 1);
+  val = fields.Get("left_child");
+  if (val != nullptr) {
+    left_child_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, left_child_.data());
   } else {
     Log::Fatal("Tree model string format error, should contain left_child field");
   }
 
-  if (key_vals.count("right_child")) {
-    right_child_ = Common::StringToArrayFast<int>(key_vals["right_child"], num_leaves_ - 1);
+  val = fields.Get("right_child");
+  if (val != nullptr) {
+    right_child_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, right_child_.data());
   } else {
     Log::Fatal("Tree model string format error, should contain right_child field");
   }
 
-  if (key_vals.count("split_feature")) {
-    split_feature_ = Common::StringToArrayFast<int>(key_vals["split_feature"], num_leaves_ - 1);
+  val = fields.Get("split_feature");
+  if (val != nullptr) {
+    split_feature_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, split_feature_.data());
   } else {
     Log::Fatal("Tree model string format error, should contain split_feature field");
   }
 
-  if (key_vals.count("threshold")) {
-    threshold_ = Common::StringToArray<double>(key_vals["threshold"], num_leaves_ - 1);
+  val = fields.Get("threshold");
+  if (val != nullptr) {
+    threshold_.Allocate(arena, num_nodes);
+    Common::StringToArray(val, num_nodes, threshold_.data());
   } else {
     Log::Fatal("Tree model string format error, should contain threshold field");
   }
 
-  if (key_vals.count("split_gain")) {
-    split_gain_ = Common::StringToArrayFast<float>(key_vals["split_gain"], num_leaves_ - 1);
+  val = fields.Get("split_gain");
+  if (val != nullptr) {
+    split_gain_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, split_gain_.data());
   } else {
-    split_gain_.resize(num_leaves_ - 1);
+    split_gain_.Allocate(arena, num_nodes, 0.0f);
   }
 
-  if (key_vals.count("internal_count")) {
-    internal_count_ = Common::StringToArrayFast<int>(key_vals["internal_count"], num_leaves_ - 1);
+  val = fields.Get("internal_count");
+  if (val != nullptr) {
+    internal_count_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, internal_count_.data());
   } else {
-    internal_count_.resize(num_leaves_ - 1);
+    internal_count_.Allocate(arena, num_nodes, 0);
   }
 
-  if (key_vals.count("internal_value")) {
-    internal_value_ = Common::StringToArrayFast<double>(key_vals["internal_value"], num_leaves_ - 1);
+  val = fields.Get("internal_value");
+  if (val != nullptr) {
+    internal_value_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, internal_value_.data());
   } else {
-    internal_value_.resize(num_leaves_ - 1);
+    internal_value_.Allocate(arena, num_nodes, 0.0f);
   }
 
-  if (key_vals.count("leaf_count")) {
-    leaf_count_ = Common::StringToArrayFast<int>(key_vals["leaf_count"], num_leaves_);
+  val = fields.Get("leaf_count");
+  if (val != nullptr) {
+    leaf_count_.Allocate(arena, num_leaves_);
+    Common::StringToArrayFast(val, num_leaves_, leaf_count_.data());
   } else {
-    leaf_count_.resize(num_leaves_);
+    leaf_count_.Allocate(arena, num_leaves_, 0);
   }
 
-  if (key_vals.count("decision_type")) {
-    decision_type_ = Common::StringToArrayFast<int8_t>(key_vals["decision_type"], num_leaves_ - 1);
+  val = fields.Get("decision_type");
+  if (val != nullptr) {
+    decision_type_.Allocate(arena, num_nodes);
+    Common::StringToArrayFast(val, num_nodes, decision_type_.data());
   } else {
-    decision_type_ = std::vector<int8_t>(num_leaves_ - 1, 0);
+    decision_type_.Allocate(arena, num_nodes, 0);
   }
 
   if (num_cat_ > 0) {
-    if (key_vals.count("cat_boundaries")) {
-      cat_boundaries_ = Common::StringToArrayFast<int>(key_vals["cat_boundaries"], num_cat_ + 1);
+    val = fields.Get("cat_boundaries");
+    if (val != nullptr) {
+      cat_boundaries_.Allocate(arena, num_cat_ + 1);
+      Common::StringToArrayFast(val, num_cat_ + 1, cat_boundaries_.data());
     } else {
       Log::Fatal("Tree model should contain cat_boundaries field.");
     }
 
-    if (key_vals.count("cat_threshold")) {
-      cat_threshold_ = Common::StringToArrayFast<uint32_t>(key_vals["cat_threshold"], cat_boundaries_.back());
+    val = fields.Get("cat_threshold");
+    if (val != nullptr) {
+      cat_threshold_.Allocate(arena, cat_boundaries_.back());
+      Common::StringToArrayFast(val, cat_boundaries_.back(), cat_threshold_.data());
     } else {
       Log::Fatal("Tree model should contain cat_threshold field");
     }
   }
 
-  if (key_vals.count("shrinkage")) {
-    Common::Atof(key_vals["shrinkage"].c_str(), &shrinkage_);
-  } else {
-    shrinkage_ = 1.0f;
-  }
-  max_depth_ = -1;
+  // filled by RecomputeLeafDepths when needed
+  leaf_depth_.Allocate(arena, num_leaves_);
 }
 
 void Tree::ExtendPath(PathElement *unique_path, int unique_depth,
@@ -538,6 +677,420 @@ void Tree::TreeSHAP(const double *feature_values, double *phi,
   }
 }
 
+void Tree::BuildSHAPPaths() {
+  if (shap_paths_built_) {
+    return;
+  }
+  RecomputeMaxDepth();
+  shap_paths_built_ = true;
+  shap_max_path_features_ = 0;
+  shap_split_begin_.clear();
+  shap_splits_.clear();
+  shap_feature_begin_.clear();
+  shap_features_.clear();
+  shap_weights_.clear();
+  if (num_leaves_ <= 1) {
+    return;
+  }
+  const int num_nodes = num_leaves_ - 1;
+  std::vector<int> node_parent(num_nodes, -1);
+  std::vector<int> leaf_parent(num_leaves_, -1);
+  for (int node = 0; node < num_nodes; ++node) {
+    const int children[2] = { left_child_[node], right_child_[node] };
+    for (int k = 0; k < 2; ++k) {
+      if (children[k] >= 0) {
+        node_parent[children[k]] = node;
+      } else {
+        leaf_parent[~children[k]] = node;
+      }
+    }
+  }
+  // the SHAP values of a leaf only depend on the distinct features of its path and on which of them
+  // have all their splits followed by a record
+  shap_split_begin_.push_back(0);
+  shap_feature_begin_.push_back(0);
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const size_t first_split = shap_splits_.size();
+    int child = ~leaf;
+    for (int node = leaf_parent[leaf]; node >= 0; child = node, node = node_parent[node]) {
+      SHAPSplit split;
+      split.node = node;
+      split.left = left_child_[node] == child ? 1 : 0;
+      split.feature_pos = 0;
+      shap_splits_.push_back(split);
+    }
+    std::reverse(shap_splits_.begin() + first_split, shap_splits_.end());
+    const size_t first_feature = shap_features_.size();
+    for (size_t i = first_split; i < shap_splits_.size(); ++i) {
+      const int feature = split_feature_[shap_splits_[i].node];
+      size_t pos = first_feature;
+      while (pos < shap_features_.size() && shap_features_[pos] != feature) {
+        ++pos;
+      }
+      if (pos == shap_features_.size()) {
+        shap_features_.push_back(feature);
+      }
+      shap_splits_[i].feature_pos = pos - first_feature;
+    }
+    shap_max_path_features_ = std::max(shap_max_path_features_, static_cast<int>(shap_features_.size() - first_feature));
+    shap_split_begin_.push_back(static_cast<int>(shap_splits_.size()));
+    shap_feature_begin_.push_back(static_cast<int>(shap_features_.size()));
+  }
+  // Shapley weights s! (D - s - 1)! / D! of a subset of size s among D features, from D * (D - 1) / 2
+  for (int num_path_features = 1; num_path_features <= shap_max_path_features_; ++num_path_features) {
+    shap_weights_.push_back(1.0 / num_path_features);
+    for (int k = 1; k < num_path_features; ++k) {
+      shap_weights_.push_back(shap_weights_.back() * k / (num_path_features - k));
+    }
+  }
+}
+
+void Tree::BuildSHAPTables() {
+  if (shap_built_) {
+    return;
+  }
+  BuildSHAPPaths();
+  shap_built_ = true;
+  shap_tabled_ = false;
+  shap_zero_fractions_.clear();
+  shap_feature_ratios_.clear();
+  shap_zero_products_.clear();
+  shap_table_begin_.clear();
+  shap_tables_.clear();
+  // feature positions are int8_t
+  if (num_leaves_ <= 1 || shap_max_path_features_ > 127) {
+    return;
+  }
+  // the path-dependent TreeSHAP of a leaf depends on the fraction z of the data that follows the path
+  // at the splits of every distinct feature
+  shap_zero_fractions_.assign(shap_features_.size(), 1.0);
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const int feature_begin = shap_feature_begin_[leaf];
+    for (int i = shap_split_begin_[leaf]; i < shap_split_begin_[leaf + 1]; ++i) {
+      const int node = shap_splits_[i].node;
+      const int next = shap_splits_[i].left ? left_child_[node] : right_child_[node];
+      shap_zero_fractions_[feature_begin + shap_splits_[i].feature_pos] *= data_count(next) / static_cast<double>(data_count(node));
+    }
+    double zero_product = 1.0;
+    for (int pos = feature_begin; pos < shap_feature_begin_[leaf + 1]; ++pos) {
+      // the tables divide by z, a split that no data followed needs the recursive algorithm
+      if (!(shap_zero_fractions_[pos] > 0.0)) {
+        shap_zero_fractions_.clear();
+        shap_feature_ratios_.clear();
+        shap_zero_products_.clear();
+        return;
+      }
+      shap_feature_ratios_.push_back((1.0 - shap_zero_fractions_[pos]) / shap_zero_fractions_[pos]);
+      zero_product *= shap_zero_fractions_[pos];
+    }
+    shap_zero_products_.push_back(zero_product);
+  }
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const int feature_begin = shap_feature_begin_[leaf];
+    const int num_path_features = shap_feature_begin_[leaf + 1] - feature_begin;
+    if (num_path_features > kSHAPTableMaxFeatures) {
+      shap_table_begin_.push_back(-1);
+      continue;
+    }
+    const int num_subsets = 1 << num_path_features;
+    const double* weights = shap_weights_.data() + num_path_features * (num_path_features - 1) / 2;
+    shap_table_begin_.push_back(static_cast<int>(shap_tables_.size()));
+    const size_t table_begin = shap_tables_.size();
+    // G(A) is the sum over the subsets S of A of weight(|S|) times the product of z over the features not in S,
+    // the set of all features has no weight and is never looked up
+    for (int subset = 0; subset < num_subsets; ++subset) {
+      double val = 0.0;
+      int size = 0;
+      for (int j = 0; j < num_path_features; ++j) {
+        size += (subset >> j) & 1;
+      }
+      if (size < num_path_features) {
+        val = weights[size];
+        for (int j = 0; j < num_path_features; ++j) {
+          if (((subset >> j) & 1) == 0) {
+            val *= shap_zero_fractions_[feature_begin + j];
+          }
+        }
+      }
+      shap_tables_.push_back(val);
+    }
+    double* table = shap_tables_.data() + table_begin;
+    for (int j = 0; j < num_path_features; ++j) {
+      for (int subset = 0; subset < num_subsets; ++subset) {
+        if ((subset >> j) & 1) {
+          table[subset] += table[subset ^ (1 << j)];
+        }
+      }
+    }
+  }
+  shap_tabled_ = true;
+}
+
+void Tree::PredictContrib(const double* feature_values, int num_features, double* output, SHAPBuffer* buffer) const {
+  output[num_features] += ExpectedValue();
+  if (num_leaves_ <= 1) {
+    return;
+  }
+  if (!shap_tabled_) {
+    // run the recursion with preallocated space for the unique path data
+    const int max_path_len = max_depth_ + 1;
+    buffer->unique_path.resize(max_path_len * (max_path_len + 1) / 2);
+    TreeSHAP(feature_values, output, 0, 0, buffer->unique_path.data(), 1, 1, -1);
+    return;
+  }
+  const int num_nodes = num_leaves_ - 1;
+  buffer->goes_left.resize(num_nodes);
+  buffer->poly.resize(2 * (max_depth_ + 1));
+  int8_t* goes_left = buffer->goes_left.data();
+  for (int node = 0; node < num_nodes; ++node) {
+    goes_left[node] = Decision(feature_values[split_feature_[node]], node) == left_child_[node] ? 1 : 0;
+  }
+  // for a feature of the path in A its SHAP value is v (1 - z) / z G(A without it), otherwise it is -v G(A)
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const int feature_begin = shap_feature_begin_[leaf];
+    const int num_path_features = shap_feature_begin_[leaf + 1] - feature_begin;
+    const int* features = shap_features_.data() + feature_begin;
+    const double* ratios = shap_feature_ratios_.data() + feature_begin;
+    const double value = leaf_value_[leaf];
+    if (shap_table_begin_[leaf] >= 0) {
+      // whether the record follows a split is random, so there are no branches on it
+      int followed = (1 << num_path_features) - 1;
+      for (int i = shap_split_begin_[leaf]; i < shap_split_begin_[leaf + 1]; ++i) {
+        followed &= ~((goes_left[shap_splits_[i].node] != shap_splits_[i].left) << shap_splits_[i].feature_pos);
+      }
+      const double* table = shap_tables_.data() + shap_table_begin_[leaf];
+      const double not_followed = -value * table[followed];
+      for (int j = 0; j < num_path_features; ++j) {
+        const double in_followed = value * ratios[j] * table[followed ^ (1 << j)];
+        output[features[j]] += ((followed >> j) & 1) ? in_followed : not_followed;
+      }
+      continue;
+    }
+    // too many features for a table: G(A) is the product of z over the path
+    // times the sum of weight(s) e_s, e_s being the elementary symmetric polynomials of 1 / z over A
+    int8_t* is_followed = buffer->is_followed.data();
+    if (static_cast<int>(buffer->is_followed.size()) < num_path_features) {
+      buffer->is_followed.resize(num_path_features);
+      is_followed = buffer->is_followed.data();
+    }
+    std::fill(is_followed, is_followed + num_path_features, 1);
+    for (int i = shap_split_begin_[leaf]; i < shap_split_begin_[leaf + 1]; ++i) {
+      if (goes_left[shap_splits_[i].node] != shap_splits_[i].left) {
+        is_followed[shap_splits_[i].feature_pos] = 0;
+      }
+    }
+    const double* zero_fractions = shap_zero_fractions_.data() + feature_begin;
+    const double* weights = shap_weights_.data() + num_path_features * (num_path_features - 1) / 2;
+    double* poly = buffer->poly.data();
+    double* unwound = poly + max_depth_ + 1;
+    int num_followed = 0;
+    poly[0] = 1.0;
+    for (int j = 0; j < num_path_features; ++j) {
+      if (is_followed[j]) {
+        const double inv_zero_fraction = 1.0 / zero_fractions[j];
+        poly[++num_followed] = 0.0;
+        for (int k = num_followed; k > 0; --k) {
+          poly[k] += inv_zero_fraction * poly[k - 1];
+        }
+      }
+    }
+    const double scale = value * shap_zero_products_[leaf];
+    if (num_followed < num_path_features) {
+      double g = 0.0;
+      for (int k = 0; k <= num_followed; ++k) {
+        g += weights[k] * poly[k];
+      }
+      g *= scale;
+      for (int j = 0; j < num_path_features; ++j) {
+        if (!is_followed[j]) {
+          output[features[j]] -= g;
+        }
+      }
+    }
+    for (int j = 0; j < num_path_features; ++j) {
+      if (is_followed[j]) {
+        // divide the polynomial by (1 + x / z), from the highest degree down since 1 / z >= 1
+        unwound[num_followed - 1] = poly[num_followed] * zero_fractions[j];
+        for (int k = num_followed - 1; k > 0; --k) {
+          unwound[k - 1] = (poly[k] - unwound[k]) * zero_fractions[j];
+        }
+        double g = 0.0;
+        for (int k = 0; k < num_followed; ++k) {
+          g += weights[k] * unwound[k];
+        }
+        output[features[j]] += scale * ratios[j] * g;
+      }
+    }
+  }
+}
+
+void Tree::SetBackground(const double* rows, int num_rows, int num_features) {
+  BuildSHAPPaths();
+  background_begin_.clear();
+  background_masks_.clear();
+  background_fractions_.clear();
+  if (num_leaves_ <= 1 || num_rows <= 0) {
+    return;
+  }
+  if (shap_max_path_features_ > 64) {
+    Log::Fatal("Interventional SHAP values need at most 64 distinct features on the path of a leaf, a tree has %d",
+               shap_max_path_features_);
+  }
+  // a background row only matters to a leaf through the set of path features whose splits it follows,
+  // the rows are replaced by the distinct sets and their counts
+  const int num_nodes = num_leaves_ - 1;
+  std::vector<int8_t> goes_left(static_cast<size_t>(num_rows) * num_nodes);
+  for (int row = 0; row < num_rows; ++row) {
+    const double* feature_values = rows + static_cast<size_t>(row) * num_features;
+    int8_t* row_goes_left = goes_left.data() + static_cast<size_t>(row) * num_nodes;
+    for (int node = 0; node < num_nodes; ++node) {
+      row_goes_left[node] = Decision(feature_values[split_feature_[node]], node) == left_child_[node] ? 1 : 0;
+    }
+  }
+  std::vector<uint64_t> masks(num_rows);
+  background_begin_.push_back(0);
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const uint64_t all_features = PathMask(shap_feature_begin_[leaf + 1] - shap_feature_begin_[leaf]);
+    for (int row = 0; row < num_rows; ++row) {
+      const int8_t* row_goes_left = goes_left.data() + static_cast<size_t>(row) * num_nodes;
+      uint64_t followed = all_features;
+      for (int i = shap_split_begin_[leaf]; i < shap_split_begin_[leaf + 1]; ++i) {
+        followed &= ~(static_cast<uint64_t>(row_goes_left[shap_splits_[i].node] != shap_splits_[i].left)
+                      << shap_splits_[i].feature_pos);
+      }
+      masks[row] = followed;
+    }
+    std::sort(masks.begin(), masks.end());
+    for (int i = 0; i < num_rows;) {
+      int j = i + 1;
+      while (j < num_rows && masks[j] == masks[i]) {
+        ++j;
+      }
+      background_masks_.push_back(masks[i]);
+      background_fractions_.push_back((j - i) / static_cast<double>(num_rows));
+      i = j;
+    }
+    background_begin_.push_back(static_cast<int>(background_masks_.size()));
+  }
+}
+
+void Tree::PredictContribInterventional(const double* feature_values, int num_features, double* output,
+                                        SHAPBuffer* buffer) const {
+  if (num_leaves_ <= 1) {
+    output[num_features] += LeafOutput(0);
+    return;
+  }
+  const int num_nodes = num_leaves_ - 1;
+  buffer->goes_left.resize(num_nodes);
+  int8_t* goes_left = buffer->goes_left.data();
+  for (int node = 0; node < num_nodes; ++node) {
+    goes_left[node] = Decision(feature_values[split_feature_[node]], node) == left_child_[node] ? 1 : 0;
+  }
+  // the hybrid of the record and a background row reaches a leaf when every path feature is followed by one of them.
+  // Among the features only the record follows, a feature gets v weight(a - 1, a + b) for the permutations it comes
+  // last in and before the b features only the background row follows, which get -v weight(a, a + b) the same way
+  double expected_value = 0.0;
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    const int feature_begin = shap_feature_begin_[leaf];
+    const int num_path_features = shap_feature_begin_[leaf + 1] - feature_begin;
+    const uint64_t all_features = PathMask(num_path_features);
+    uint64_t followed = all_features;
+    for (int i = shap_split_begin_[leaf]; i < shap_split_begin_[leaf + 1]; ++i) {
+      followed &= ~(static_cast<uint64_t>(goes_left[shap_splits_[i].node] != shap_splits_[i].left)
+                    << shap_splits_[i].feature_pos);
+    }
+    const int* features = shap_features_.data() + feature_begin;
+    const double value = leaf_value_[leaf];
+    for (int k = background_begin_[leaf]; k < background_begin_[leaf + 1]; ++k) {
+      const uint64_t mask = background_masks_[k];
+      if ((mask | followed) != all_features) {
+        continue;
+      }
+      const double scaled_value = value * background_fractions_[k];
+      if (mask == all_features) {
+        expected_value += scaled_value;
+      }
+      const uint64_t only_record = followed & ~mask;
+      const uint64_t only_background = mask & ~followed;
+      int num_record = 0;
+      int num_background = 0;
+      for (int j = 0; j < num_path_features; ++j) {
+        num_record += static_cast<int>((only_record >> j) & 1);
+        num_background += static_cast<int>((only_background >> j) & 1);
+      }
+      const int num_players = num_record + num_background;
+      const double* weights = shap_weights_.data() + num_players * (num_players - 1) / 2;
+      if (num_record > 0) {
+        const double gain = scaled_value * weights[num_record - 1];
+        for (int j = 0; j < num_path_features; ++j) {
+          if ((only_record >> j) & 1) {
+            output[features[j]] += gain;
+          }
+        }
+      }
+      if (num_background > 0) {
+        const double loss = scaled_value * weights[num_record];
+        for (int j = 0; j < num_path_features; ++j) {
+          if ((only_background >> j) & 1) {
+            output[features[j]] -= loss;
+          }
+        }
+      }
+    }
+  }
+  output[num_features] += expected_value;
+}
+
+void Tree::BuildSaabasValues() {
+  if (saabas_built_) {
+    return;
+  }
+  // internal_value_ is the output of a split before shrinkage and bias, and models converted from
+  // other formats have none, so the node values are the means of the current leaf values
+  saabas_values_.assign(std::max(num_leaves_ - 1, 0), 0.0);
+  if (num_leaves_ > 1) {
+    int count = 0;
+    SaabasValue(0, &count);
+  }
+  saabas_built_ = true;
+}
+
+double Tree::SaabasValue(int node, int* count) {
+  if (node < 0) {
+    *count = leaf_count_[~node];
+    return leaf_value_[~node];
+  }
+  int left_count = 0;
+  int right_count = 0;
+  const double left_value = SaabasValue(left_child_[node], &left_count);
+  const double right_value = SaabasValue(right_child_[node], &right_count);
+  *count = left_count + right_count;
+  if (*count > 0) {
+    saabas_values_[node] = (left_count * left_value + right_count * right_value) / *count;
+  } else {
+    // models without counts, the internal values would not be the mean of the children's values
+    saabas_values_[node] = (left_value + right_value) / 2;
+  }
+  return saabas_values_[node];
+}
+
+void Tree::PredictContribSaabas(const double* feature_values, int num_features, double* output) const {
+  if (num_leaves_ <= 1) {
+    output[num_features] += LeafOutput(0);
+    return;
+  }
+  int node = 0;
+  double value = saabas_values_[0];
+  output[num_features] += value;
+  while (node >= 0) {
+    const int next = Decision(feature_values[split_feature_[node]], node);
+    const double next_value = next >= 0 ? saabas_values_[next] : leaf_value_[~next];
+    output[split_feature_[node]] += next_value - value;
+    node = next;
+    value = next_value;
+  }
+}
+
 double Tree::ExpectedValue() const {
   if (num_leaves_ == 1) return LeafOutput(0);
   const double total_count = internal_count_[0];
@@ -552,7 +1105,7 @@ void Tree::RecomputeMaxDepth() {
   if (num_leaves_ == 1) {
     max_depth_ = 0;
   } else {
-    if (leaf_depth_.size() == 0) {
+    if (max_depth_ < 0) {
       RecomputeLeafDepths(0, 0);
     }
     max_depth_ = leaf_depth_[0];
@@ -562,4 +1115,14 @@ void Tree::RecomputeMaxDepth() {
   }
 }
 
+void Tree::RemapSplitFeatures(const std::vector<int>& feature_slots) {
+  shap_paths_built_ = false;
+  shap_built_ = false;
+  for (int i = 0; i < num_leaves_ - 1; ++i) {
+    const int slot = feature_slots[split_feature_[i]];
+    CHECK(slot >= 0);
+    split_feature_[i] = slot;
+  }
+}
+
 }  // namespace LightGBM
@@ -2,6 +2,7 @@
 #define LIGHTGBM_OBJECTIVE_BINARY_OBJECTIVE_HPP_
 
 #include <LightGBM/objective_function.h>
+#include <LightGBM/predict_kernels.h>
 
 #include <cstring>
 #include <cmath>
@@ -150,6 +151,20 @@ public:
     output[0] = 1.0f / (1.0f + std::exp(-sigmoid_ * input[0]));
   }
 
+  void ConvertOutputBatch(const double* input, double* output, int num_rows, bool fast_exp) const override {
+    if (!fast_exp) {
+      ObjectiveFunction::ConvertOutputBatch(input, output, num_rows, false);
+      return;
+    }
+    for (int i = 0; i < num_rows; ++i) {
+      output[i] = -sigmoid_ * input[i];
+    }
+    GetPredictKernels().fast_exp(output, output, num_rows);
+    for (int i = 0; i < num_rows; ++i) {
+      output[i] = 1.0f / (1.0f + output[i]);
+    }
+  }
+
   std::string ToString() const override {
     std::stringstream str_buf;
     str_buf << GetName() << " ";
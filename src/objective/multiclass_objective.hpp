@@ -2,6 +2,7 @@
 #define LIGHTGBM_OBJECTIVE_MULTICLASS_OBJECTIVE_HPP_
 
 #include <LightGBM/objective_function.h>
+#include <LightGBM/predict_kernels.h>
 
 #include <cstring>
 #include <cmath>
@@ -100,6 +101,39 @@ public:
     Common::Softmax(input, output, num_class_);
   }
 
+  void ConvertOutputBatch(const double* input, double* output, int num_rows, bool fast_exp) const override {
+    if (!fast_exp) {
+      for (int i = 0; i < num_rows; ++i) {
+        Common::Softmax(input + static_cast<size_t>(i) * num_class_, output + static_cast<size_t>(i) * num_class_,
+                        num_class_);
+      }
+      return;
+    }
+    // the exp of the whole block at once, so that the vectors stay full with few classes
+    for (int i = 0; i < num_rows; ++i) {
+      const double* row_input = input + static_cast<size_t>(i) * num_class_;
+      double* row_output = output + static_cast<size_t>(i) * num_class_;
+      double wmax = row_input[0];
+      for (int k = 1; k < num_class_; ++k) {
+        wmax = row_input[k] < wmax ? wmax : row_input[k];
+      }
+      for (int k = 0; k < num_class_; ++k) {
+        row_output[k] = row_input[k] - wmax;
+      }
+    }
+    GetPredictKernels().fast_exp(output, output, num_rows * num_class_);
+    for (int i = 0; i < num_rows; ++i) {
+      double* row_output = output + static_cast<size_t>(i) * num_class_;
+      double wsum = 0.0f;
+      for (int k = 0; k < num_class_; ++k) {
+        wsum += row_output[k];
+      }
+      for (int k = 0; k < num_class_; ++k) {
+        row_output[k] /= wsum;
+      }
+    }
+  }
+
   const char* GetName() const override {
     return "multiclass";
   }
@@ -210,6 +244,21 @@ public:
     }
   }
 
+  void ConvertOutputBatch(const double* input, double* output, int num_rows, bool fast_exp) const override {
+    if (!fast_exp) {
+      ObjectiveFunction::ConvertOutputBatch(input, output, num_rows, false);
+      return;
+    }
+    const int len = num_rows * num_class_;
+    for (int i = 0; i < len; ++i) {
+      output[i] = -sigmoid_ * input[i];
+    }
+    GetPredictKernels().fast_exp(output, output, len);
+    for (int i = 0; i < len; ++i) {
+      output[i] = 1.0f / (1.0f + output[i]);
+    }
+  }
+
   std::string ToString() const override {
     std::stringstream str_buf;
     str_buf << GetName() << " ";
@@ -0,0 +1,1722 @@
+# coding: utf-8
+# pylint: skip-file
+"""Prediction through the C API, checked against an evaluation of the model text in Python.
+
+The models are generated, so that the tests do not depend on training.
+"""
+import ctypes
+import math
+import os
+import random
+import re
+import subprocess
+import sys
+
+from platform import system
+
+import numpy as np
+import pytest
+
+
+def find_lib_path():
+    curr_path = os.path.dirname(os.path.abspath(os.path.expanduser(__file__)))
+    dll_path = [curr_path, os.path.join(curr_path, '../../'), os.path.join(curr_path, '../../lib/')]
+    if system() in ('Windows', 'Microsoft'):
+        dll_path.append(os.path.join(curr_path, '../../Release/'))
+        dll_path.append(os.path.join(curr_path, '../../windows/x64/DLL/'))
+        names = ['lib_lightgbm.dll', 'liblightgbm.dll']
+    else:
+        names = ['lib_lightgbm.so', 'liblightgbm.so']
+    dll_path = [os.path.join(p, name) for p in dll_path for name in names]
+    lib_path = [p for p in dll_path if os.path.exists(p) and os.path.isfile(p)]
+    if not lib_path:
+        dll_path = [os.path.realpath(p) for p in dll_path]
+        raise Exception('Cannot find lightgbm library in following paths: ' + '\n'.join(dll_path))
+    return lib_path
+
+
+LIB = ctypes.cdll.LoadLibrary(find_lib_path()[0])
+LIB.LGBM_GetLastError.restype = ctypes.c_char_p
+
+C_API_DTYPE_FLOAT32 = 0
+C_API_DTYPE_FLOAT64 = 1
+C_API_DTYPE_INT32 = 2
+C_API_DTYPE_INT16 = 4
+
+C_API_PREDICT_NORMAL = 0
+C_API_PREDICT_RAW_SCORE = 1
+C_API_PREDICT_LEAF_INDEX = 2
+C_API_PREDICT_CONTRIB = 3
+
+K_ZERO_THRESHOLD = float(np.float32(1e-35))
+CAT_FEATURES = (2, 5)
+
+
+class LightGBMError(Exception):
+    pass
+
+
+def safe_call(ret):
+    if ret != 0:
+        raise LightGBMError(LIB.LGBM_GetLastError().decode())
+
+
+def c_str(string):
+    return ctypes.c_char_p(string.encode('ascii'))
+
+
+def double_ptr(array):
+    return array.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+
+
+def generate_model(seed, num_class=3, num_iteration=20, num_feature=12, max_leaves=15, with_sizes=True,
+                   objective=True):
+    """Random model text with numerical and categorical splits of every missing type.
+    Without objective the predictions are the raw scores."""
+    rnd = random.Random(seed)
+    blocks = []
+    for tree_idx in range(num_iteration * num_class):
+        num_leaves = rnd.randint(1, max_leaves)
+        left, right, feature, threshold, decision_type, gain, internal_value, internal_count = [], [], [], [], [], [], [], []
+        leaf_parent, leaf_value = [-1], [rnd.uniform(-1, 1)]
+        cat_boundaries, cat_threshold = [0], []
+        for node in range(num_leaves - 1):
+            leaf = rnd.randrange(len(leaf_value))
+            parent = leaf_parent[leaf]
+            if parent >= 0:
+                if left[parent] == ~leaf:
+                    left[parent] = node
+                else:
+                    right[parent] = node
+            split_feature = rnd.randrange(num_feature)
+            feature.append(split_feature)
+            gain.append(round(rnd.uniform(0, 10), 3))
+            if split_feature in CAT_FEATURES and rnd.random() < 0.8:
+                cats = sorted(rnd.sample(range(40), rnd.randint(1, 6)))
+                words = [0] * (max(cats) // 32 + 1)
+                for cat in cats:
+                    words[cat // 32] |= 1 << (cat % 32)
+                threshold.append(float(len(cat_boundaries) - 1))
+                cat_threshold.extend(words)
+                cat_boundaries.append(cat_boundaries[-1] + len(words))
+                decision_type.append(1 | (rnd.choice([0, 2]) << 2))
+            else:
+                threshold.append(rnd.choice([round(rnd.uniform(-2, 2), rnd.randint(1, 9)), 1e-35, 0.5, -0.25, 0.0]))
+                decision_type.append((rnd.choice([0, 1, 2]) << 2) | (2 if rnd.random() < 0.5 else 0))
+            left.append(~leaf)
+            right.append(~len(leaf_value))
+            leaf_parent[leaf] = node
+            leaf_parent.append(node)
+            internal_value.append(leaf_value[leaf])
+            internal_count.append(0)
+            leaf_value[leaf] = rnd.uniform(-1, 1)
+            leaf_value.append(rnd.uniform(-1, 1))
+        leaf_count = [rnd.randint(1, 100) for _ in leaf_value]
+
+        def count(node):
+            if node < 0:
+                return leaf_count[~node]
+            internal_count[node] = count(left[node]) + count(right[node])
+            return internal_count[node]
+
+        lines = ['num_leaves=%d' % num_leaves, 'num_cat=%d' % (len(cat_boundaries) - 1)]
+        if num_leaves > 1:
+            count(0)
+            lines.append('split_feature=' + ' '.join(map(str, feature)))
+            lines.append('split_gain=' + ' '.join(map(str, gain)))
+            lines.append('threshold=' + ' '.join(map(repr, threshold)))
+            lines.append('decision_type=' + ' '.join(map(str, decision_type)))
+            lines.append('left_child=' + ' '.join(map(str, left)))
+            lines.append('right_child=' + ' '.join(map(str, right)))
+        lines.append('leaf_value=' + ' '.join(map(repr, leaf_value)))
+        if num_leaves > 1:
+            lines.append('leaf_count=' + ' '.join(map(str, leaf_count)))
+            lines.append('internal_value=' + ' '.join(repr(round(x, 6)) for x in internal_value))
+            lines.append('internal_count=' + ' '.join(map(str, internal_count)))
+            if len(cat_boundaries) > 1:
+                lines.append('cat_boundaries=' + ' '.join(map(str, cat_boundaries)))
+                lines.append('cat_threshold=' + ' '.join(map(str, cat_threshold)))
+        lines.append('shrinkage=0.1')
+        blocks.append('Tree=%d\n' % tree_idx + '\n'.join(lines) + '\n\n')
+    header = ['tree', 'version=v2', 'num_class=%d' % num_class, 'num_tree_per_iteration=%d' % num_class,
+              'label_index=0', 'max_feature_idx=%d' % (num_feature - 1)]
+    if objective and num_class > 1:
+        header.append('objective=multiclass num_class:%d' % num_class)
+    header.append('feature_names=' + ' '.join('Column_%d' % i for i in range(num_feature)))
+    header.append('feature_infos=' + ' '.join('[-2:2]' for _ in range(num_feature)))
+    if with_sizes:
+        header.append('tree_sizes=' + ' '.join(str(len(block)) for block in blocks))
+    return ('\n'.join(header) + '\n\n' + ''.join(blocks)
+            + 'end of trees\n\nparameters:\n[boosting: gbdt]\nend of parameters\n')
+
+
+def generate_data(seed, num_row, num_feature=12):
+    """Rows with zeros, missing values, values on the thresholds and categories"""
+    rnd = np.random.RandomState(seed)
+    data = rnd.uniform(-2, 2, size=(num_row, num_feature))
+    special = np.array([0.0, np.nan, 0.5, -0.25, 1e-35, -1e-36])
+    mask = rnd.uniform(size=data.shape) < 0.2
+    data[mask] = rnd.choice(special, size=mask.sum())
+    for feature in CAT_FEATURES:
+        if feature < num_feature:
+            data[:, feature] = rnd.randint(-1, 40, size=num_row)
+    return data
+
+
+def parse_trees(model_str):
+    """Arrays of every tree of a model text"""
+    trees = []
+    for block in model_str.split('Tree=')[1:]:
+        fields = dict(line.split('=', 1) for line in block.split('end of trees')[0].splitlines()[1:] if '=' in line)
+        tree = {'num_leaves': int(fields['num_leaves']),
+                'leaf_value': [float(x) for x in fields['leaf_value'].split()]}
+        if tree['num_leaves'] > 1:
+            for key in ('split_feature', 'decision_type', 'left_child', 'right_child', 'leaf_count',
+                        'internal_count'):
+                tree[key] = [int(x) for x in fields[key].split()]
+            tree['threshold'] = [float(x) for x in fields['threshold'].split()]
+            tree['cat_boundaries'] = [int(x) for x in fields.get('cat_boundaries', '').split()]
+            tree['cat_threshold'] = [int(x) for x in fields.get('cat_threshold', '').split()]
+        trees.append(tree)
+    return trees
+
+
+def next_node(tree, node, fval):
+    """Child a value goes to, same decisions as Tree::Decision on a prediction buffer"""
+    # the prediction buffer leaves tiny values out
+    if not math.isnan(fval) and abs(fval) <= K_ZERO_THRESHOLD:
+        fval = 0.0
+    decision_type = tree['decision_type'][node]
+    missing_type = (decision_type >> 2) & 3
+    go_left = False
+    if decision_type & 1:
+        if not math.isnan(fval) and int(fval) >= 0:
+            cat_idx = int(tree['threshold'][node])
+            begin, end = tree['cat_boundaries'][cat_idx], tree['cat_boundaries'][cat_idx + 1]
+            cat = int(fval)
+            go_left = cat // 32 < end - begin and (tree['cat_threshold'][begin + cat // 32] >> (cat % 32)) & 1 == 1
+    else:
+        if math.isnan(fval) and missing_type != 2:
+            fval = 0.0
+        if (missing_type == 1 and -K_ZERO_THRESHOLD < fval <= K_ZERO_THRESHOLD) \
+                or (missing_type == 2 and math.isnan(fval)):
+            go_left = decision_type & 2 != 0
+        else:
+            go_left = fval <= tree['threshold'][node]
+    return tree['left_child'][node] if go_left else tree['right_child'][node]
+
+
+def tree_leaf(tree, row):
+    """Leaf of a row"""
+    if tree['num_leaves'] == 1:
+        return 0
+    node = 0
+    while node >= 0:
+        node = next_node(tree, node, row[tree['split_feature'][node]])
+    return ~node
+
+
+def reference_raw_score(model_str, data, num_class, num_iteration=None):
+    """Raw scores, summed in the same order as GBDT::PredictRaw"""
+    trees = parse_trees(model_str)
+    if num_iteration is not None:
+        trees = trees[:num_iteration * num_class]
+    out = np.zeros((data.shape[0], num_class))
+    for i in range(data.shape[0]):
+        for j, tree in enumerate(trees):
+            out[i, j % num_class] += tree['leaf_value'][tree_leaf(tree, data[i])]
+    return out
+
+
+def softmax(raw):
+    exp = np.vectorize(math.exp)(raw - raw.max(axis=1, keepdims=True))
+    return exp / exp.sum(axis=1, keepdims=True)
+
+
+class Booster(object):
+    def __init__(self, model_str, params=''):
+        self.handle = ctypes.c_void_p()
+        num_iteration = ctypes.c_int(0)
+        safe_call(LIB.LGBM_BoosterLoadModelFromStringWithParams(c_str(model_str), c_str(params),
+                                                                ctypes.byref(num_iteration),
+                                                                ctypes.byref(self.handle)))
+        self.num_iteration = num_iteration.value
+        self._init_num_class()
+
+    @classmethod
+    def from_handle(cls, handle):
+        booster = cls.__new__(cls)
+        booster.handle = handle
+        booster.num_iteration = None
+        booster._init_num_class()
+        return booster
+
+    def _init_num_class(self):
+        num_class = ctypes.c_int(0)
+        safe_call(LIB.LGBM_BoosterGetNumClasses(self.handle, ctypes.byref(num_class)))
+        self.num_class = num_class.value
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.free()
+
+    def free(self):
+        if self.handle:
+            safe_call(LIB.LGBM_BoosterFree(self.handle))
+            self.handle = ctypes.c_void_p()
+
+    def predict(self, data, predict_type=C_API_PREDICT_NORMAL, num_iteration=-1, params='', data_type=C_API_DTYPE_FLOAT64):
+        data = np.ascontiguousarray(data, dtype=np.float32 if data_type == C_API_DTYPE_FLOAT32 else np.float64)
+        num_predict = ctypes.c_int64(0)
+        safe_call(LIB.LGBM_BoosterCalcNumPredict(self.handle, data.shape[0], predict_type, num_iteration,
+                                                 ctypes.byref(num_predict)))
+        out = np.zeros(max(num_predict.value, 1), dtype=np.float64)
+        out_len = ctypes.c_int64(0)
+        safe_call(LIB.LGBM_BoosterPredictForMat(self.handle, data.ctypes.data_as(ctypes.c_void_p), data_type,
+                                                data.shape[0], data.shape[1], 1, predict_type, num_iteration,
+                                                c_str(params), ctypes.byref(out_len), double_ptr(out)))
+        return out[:out_len.value].reshape(data.shape[0], -1)
+
+
+@pytest.fixture(scope='module')
+def model_str():
+    return generate_model(7)
+
+
+@pytest.fixture(scope='module')
+def raw_model_str():
+    return generate_model(7, objective=False)
+
+
+@pytest.fixture(scope='module')
+def data():
+    return generate_data(11, 300)
+
+
+# ---- arena model storage
+
+def test_predict_matches_reference(model_str, raw_model_str, data):
+    expected = reference_raw_score(model_str, data, 3)
+    with Booster(raw_model_str) as booster:
+        np.testing.assert_array_equal(booster.predict(data), expected)
+    with Booster(model_str) as booster:
+        np.testing.assert_allclose(booster.predict(data), softmax(expected), rtol=1e-12, atol=0)
+
+
+def test_load_without_tree_sizes(model_str, data):
+    with Booster(model_str) as booster, Booster(generate_model(7, with_sizes=False)) as sequential:
+        np.testing.assert_array_equal(booster.predict(data), sequential.predict(data))
+
+
+def test_float32_data(raw_model_str, data):
+    with Booster(raw_model_str) as booster:
+        np.testing.assert_array_equal(booster.predict(data, data_type=C_API_DTYPE_FLOAT32),
+                                      reference_raw_score(raw_model_str, data.astype(np.float32).astype(np.float64), 3))
+
+
+def test_reload_and_free(model_str, data):
+    expected = None
+    for _ in range(5):
+        with Booster(model_str, 'model_huge_pages=true') as booster:
+            pred = booster.predict(data)
+        if expected is not None:
+            np.testing.assert_array_equal(pred, expected)
+        expected = pred
+
+
+@pytest.mark.parametrize('with_sizes', [True, False])
+def test_load_malformed_tree(model_str, with_sizes):
+    bad = generate_model(7, with_sizes=with_sizes)
+    pos = bad.index('right_child=', bad.index('Tree=5'))
+    bad = bad[:pos] + 'rigth_child=' + bad[pos + len('right_child='):]
+    with pytest.raises(LightGBMError, match='right_child'):
+        Booster(bad)
+    # the failed load leaves nothing behind
+    with Booster(model_str) as booster:
+        assert booster.num_iteration == 20
+
+
+def test_load_truncated_model(model_str):
+    for _ in range(20):
+        with pytest.raises(LightGBMError, match='bytes left'):
+            Booster(model_str[:len(model_str) // 2] + '\nend of trees\n')
+
+
+# ---- packed forest
+
+def save_packed(booster):
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterSavePackedModel(booster.handle, ctypes.c_int64(0), ctypes.byref(out_len), None))
+    buf = ctypes.create_string_buffer(out_len.value)
+    safe_call(LIB.LGBM_BoosterSavePackedModel(booster.handle, ctypes.c_int64(out_len.value), ctypes.byref(out_len),
+                                              buf))
+    return buf.raw[:out_len.value]
+
+
+def load_packed(buf):
+    handle = ctypes.c_void_p()
+    num_iteration = ctypes.c_int(0)
+    safe_call(LIB.LGBM_BoosterLoadPackedModel(buf, ctypes.c_int64(len(buf)), ctypes.byref(num_iteration),
+                                              ctypes.byref(handle)))
+    return Booster.from_handle(handle)
+
+
+@pytest.mark.parametrize('data_type', [C_API_DTYPE_FLOAT64, C_API_DTYPE_FLOAT32])
+def test_packed_bit_identical(model_str, raw_model_str, data, data_type):
+    for model in (model_str, raw_model_str):
+        with Booster(model) as booster, Booster(model, 'pack_model=true') as packed:
+            np.testing.assert_array_equal(packed.predict(data, data_type=data_type),
+                                          booster.predict(data, data_type=data_type))
+            for num_iteration in (1, 7):
+                np.testing.assert_array_equal(packed.predict(data, num_iteration=num_iteration),
+                                              booster.predict(data, num_iteration=num_iteration))
+
+
+def test_packed_single_rows(model_str, data):
+    with Booster(model_str) as booster, Booster(model_str, 'pack_model=true') as packed:
+        for row in data[:20]:
+            np.testing.assert_array_equal(packed.predict(row[np.newaxis, :]), booster.predict(row[np.newaxis, :]))
+
+
+def test_packed_save_and_load(model_str, data):
+    with Booster(model_str, 'pack_model=true') as packed:
+        buf = save_packed(packed)
+        expected = packed.predict(data)
+    with load_packed(buf) as loaded:
+        assert loaded.num_class == 3
+        np.testing.assert_array_equal(loaded.predict(data), expected)
+        # saving the loaded packed model gives the same bytes
+        assert save_packed(loaded) == buf
+
+
+def test_save_packed_needs_pack_model(model_str):
+    with Booster(model_str) as booster:
+        with pytest.raises(LightGBMError, match='pack_model=true'):
+            save_packed(booster)
+
+
+def test_load_corrupted_packed(model_str):
+    with Booster(model_str, 'pack_model=true') as packed:
+        buf = save_packed(packed)
+    with pytest.raises(LightGBMError, match='not a packed model'):
+        load_packed(b'\0' * len(buf))
+    with pytest.raises(LightGBMError, match='size mismatch'):
+        load_packed(buf[:len(buf) // 2])
+
+
+# ---- quantized models
+
+C_API_LEAF_FLOAT64 = 0
+C_API_LEAF_FLOAT16 = 1
+C_API_LEAF_INT8 = 2
+C_API_THRESHOLD_FLOAT64 = 0
+C_API_THRESHOLD_FLOAT32 = 1
+
+
+def quantize(booster, leaf_type, threshold_type, sample):
+    """Max and mean absolute deviation of the raw scores on the sample"""
+    sample = np.ascontiguousarray(sample, dtype=np.float64)
+    max_deviation = ctypes.c_double(0)
+    mean_deviation = ctypes.c_double(0)
+    safe_call(LIB.LGBM_BoosterQuantizeModel(booster.handle, leaf_type, threshold_type,
+                                            sample.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64,
+                                            sample.shape[0], sample.shape[1], 1, ctypes.byref(max_deviation),
+                                            ctypes.byref(mean_deviation)))
+    return max_deviation.value, mean_deviation.value
+
+
+def accept_quantized(booster, accept):
+    safe_call(LIB.LGBM_BoosterAcceptQuantizedModel(booster.handle, 1 if accept else 0))
+
+
+def test_quantize_lossless(raw_model_str, data):
+    with Booster(raw_model_str) as booster:
+        expected = booster.predict(data)
+        assert quantize(booster, C_API_LEAF_FLOAT64, C_API_THRESHOLD_FLOAT64, data) == (0.0, 0.0)
+        accept_quantized(booster, True)
+        np.testing.assert_array_equal(booster.predict(data), expected)
+
+
+@pytest.mark.parametrize('leaf_type,threshold_type', [(C_API_LEAF_FLOAT16, C_API_THRESHOLD_FLOAT64),
+                                                      (C_API_LEAF_INT8, C_API_THRESHOLD_FLOAT64),
+                                                      (C_API_LEAF_FLOAT16, C_API_THRESHOLD_FLOAT32)])
+def test_quantize_deviation_report(raw_model_str, data, leaf_type, threshold_type):
+    with Booster(raw_model_str) as booster:
+        expected = booster.predict(data)
+        max_deviation, mean_deviation = quantize(booster, leaf_type, threshold_type, data)
+        assert 0 < mean_deviation <= max_deviation < 0.5
+        # the booster predicts with its trees until the quantized model is accepted
+        np.testing.assert_array_equal(booster.predict(data), expected)
+        accept_quantized(booster, True)
+        deviation = np.abs(booster.predict(data) - expected)
+    assert deviation.max() == pytest.approx(max_deviation, rel=1e-9)
+    assert deviation.mean() == pytest.approx(mean_deviation, rel=1e-9)
+
+
+def test_quantize_reject_and_errors(model_str, raw_model_str, data):
+    with Booster(raw_model_str) as booster:
+        expected = booster.predict(data)
+        with pytest.raises(LightGBMError, match='no quantized model'):
+            accept_quantized(booster, True)
+        quantize(booster, C_API_LEAF_INT8, C_API_THRESHOLD_FLOAT32, data)
+        accept_quantized(booster, False)
+        np.testing.assert_array_equal(booster.predict(data), expected)
+        with pytest.raises(LightGBMError, match='no quantized model'):
+            accept_quantized(booster, True)
+        with pytest.raises(LightGBMError, match='Unknown leaf type'):
+            quantize(booster, 3, C_API_THRESHOLD_FLOAT64, data)
+        with pytest.raises(LightGBMError, match='Unknown threshold type'):
+            quantize(booster, C_API_LEAF_FLOAT16, 2, data)
+    with Booster(model_str, 'pack_model=true') as packed:
+        buf = save_packed(packed)
+    with load_packed(buf) as loaded:
+        with pytest.raises(LightGBMError, match='without its trees'):
+            quantize(loaded, C_API_LEAF_FLOAT16, C_API_THRESHOLD_FLOAT64, data)
+
+
+# ---- model cache
+
+def test_model_cache(model_str, data, tmp_path):
+    params = 'pack_model=true model_cache_dir=%s' % tmp_path
+    with Booster(model_str) as booster:
+        expected = booster.predict(data)
+    with Booster(model_str, params) as first:
+        np.testing.assert_array_equal(first.predict(data), expected)
+    cache_files = list(tmp_path.iterdir())
+    assert len(cache_files) == 1
+    with Booster(model_str, params) as cached:
+        np.testing.assert_array_equal(cached.predict(data), expected)
+    # another model gets its own file
+    with Booster(generate_model(8), params):
+        pass
+    assert len(list(tmp_path.iterdir())) == 2
+
+
+@pytest.mark.parametrize('damage', ['truncate', 'header', 'packed_header'])
+def test_model_cache_damaged_file(model_str, data, tmp_path, damage):
+    params = 'pack_model=true model_cache_dir=%s' % tmp_path
+    with Booster(model_str, params) as booster:
+        expected = booster.predict(data)
+    cache_file, = list(tmp_path.iterdir())
+    content = cache_file.read_bytes()
+    if damage == 'truncate':
+        cache_file.write_bytes(content[:len(content) // 2])
+    elif damage == 'header':
+        # the byte order and the versions
+        cache_file.write_bytes(content[:8] + b'\xff' * 16 + content[24:])
+    else:
+        # the packed forest starts on the first cache line after the header, everything past its magic
+        cache_file.write_bytes(content[:72] + b'\xff' * (len(content) - 72))
+    # the damaged file is ignored, the model is parsed and the file written again
+    with Booster(model_str, params) as booster:
+        np.testing.assert_array_equal(booster.predict(data), expected)
+    assert cache_file.read_bytes() == content
+
+
+def test_model_cache_unwritable_dir(model_str, data, tmp_path):
+    with Booster(model_str) as booster, \
+            Booster(model_str, 'pack_model=true model_cache_dir=%s' % (tmp_path / 'missing')) as packed:
+        np.testing.assert_array_equal(packed.predict(data), booster.predict(data))
+
+
+# ---- shared memory models
+
+def share_model(booster, name):
+    safe_call(LIB.LGBM_BoosterShareModel(booster.handle, c_str(name)))
+
+
+def attach_shared_model(name):
+    handle = ctypes.c_void_p()
+    num_iteration = ctypes.c_int(0)
+    safe_call(LIB.LGBM_BoosterAttachSharedModel(c_str(name), ctypes.byref(num_iteration), ctypes.byref(handle)))
+    return Booster.from_handle(handle)
+
+
+@pytest.mark.skipif(system() in ('Windows', 'Microsoft'), reason='shared memory models are POSIX only')
+def test_shared_model(model_str, data):
+    name = '/lightgbm_test_%d' % os.getpid()
+    with Booster(model_str) as booster:
+        expected = booster.predict(data)
+    with Booster(model_str, 'pack_model=true') as host:
+        share_model(host, name)
+        np.testing.assert_array_equal(host.predict(data), expected)
+        with pytest.raises(LightGBMError, match='already in shared memory'):
+            share_model(host, name + '_again')
+        with Booster(model_str, 'pack_model=true') as other:
+            with pytest.raises(LightGBMError, match='Cannot create shared memory segment'):
+                share_model(other, name)
+        with attach_shared_model(name) as attached:
+            assert attached.num_class == 3
+            np.testing.assert_array_equal(attached.predict(data), expected)
+    # the segment is gone with the last booster using it
+    with pytest.raises(LightGBMError, match='Cannot open shared memory segment'):
+        attach_shared_model(name)
+
+
+@pytest.mark.skipif(system() in ('Windows', 'Microsoft'), reason='shared memory models are POSIX only')
+def test_shared_model_errors(model_str):
+    with Booster(model_str) as booster:
+        with pytest.raises(LightGBMError, match='not packed'):
+            share_model(booster, '/lightgbm_test_unpacked_%d' % os.getpid())
+    with pytest.raises(LightGBMError, match='Cannot open shared memory segment'):
+        attach_shared_model('/lightgbm_test_missing_%d' % os.getpid())
+    shared_memory = pytest.importorskip('multiprocessing.shared_memory')
+    foreign = shared_memory.SharedMemory(name='lightgbm_test_foreign_%d' % os.getpid(), create=True, size=4096)
+    try:
+        with pytest.raises(LightGBMError, match='LightGBM segment'):
+            attach_shared_model('/' + foreign.name)
+    finally:
+        foreign.close()
+        foreign.unlink()
+
+
+# ---- compiled models
+
+def test_compiled_bit_identical(model_str, raw_model_str, data):
+    for model in (model_str, raw_model_str):
+        with Booster(model) as booster, Booster(model, 'compile_model=true') as compiled:
+            np.testing.assert_array_equal(compiled.predict(data), booster.predict(data))
+            np.testing.assert_array_equal(compiled.predict(data, data_type=C_API_DTYPE_FLOAT32),
+                                          booster.predict(data, data_type=C_API_DTYPE_FLOAT32))
+            np.testing.assert_array_equal(compiled.predict(data, num_iteration=5),
+                                          booster.predict(data, num_iteration=5))
+
+
+def test_compile_failure_interprets_trees(model_str, data):
+    with Booster(model_str) as booster, \
+            Booster(model_str, 'compile_model=true model_compiler=no_such_compiler_xyz') as fallback:
+        np.testing.assert_array_equal(fallback.predict(data), booster.predict(data))
+
+
+def test_model_compiler_is_not_run_by_a_shell(model_str, tmp_path):
+    marker = tmp_path / 'marker'
+    with Booster(model_str, 'compile_model=true model_compiler=cc;touch%s' % marker):
+        pass
+    assert not marker.exists()
+
+
+# ---- packed node layout
+
+def packed_layout(model_str, capfd):
+    """Counts the packing reports in the debug log"""
+    capfd.readouterr()
+    with Booster(model_str, 'pack_model=true verbosity=2'):
+        pass
+    out = capfd.readouterr().out
+    match = re.search(r'(\d+) of (\d+) hot children follow their parent, (\d+) padding nodes, '
+                      r'(\d+) root hot paths straddle a cache line', out)
+    assert match, out
+    return [int(x) for x in match.groups()]
+
+
+def test_hot_path_layout(model_str, raw_model_str, capfd):
+    total_padding = 0
+    for model in (model_str, raw_model_str, generate_model(3, num_class=1, num_iteration=50, max_leaves=31)):
+        follow, hot, padding, straddling = packed_layout(model, capfd)
+        # no subtree is shared in these models, so every hot child directly follows its parent
+        assert hot > 0
+        assert follow == hot
+        assert straddling == 0
+        total_padding += padding
+    assert total_padding > 0
+
+
+def tree_depth(tree, node=0):
+    if node < 0:
+        return 0
+    return 1 + max(tree_depth(tree, tree['left_child'][node]), tree_depth(tree, tree['right_child'][node]))
+
+
+def implicit_layout(model_str, capfd, quantize_leaves=None):
+    """Number of complete trees and implicit nodes the packing reports in the debug log"""
+    capfd.readouterr()
+    with Booster(model_str, 'pack_model=true verbosity=2') as packed:
+        if quantize_leaves is not None:
+            quantize(packed, quantize_leaves, 0, generate_data(3, 20))
+    out = capfd.readouterr().out
+    matches = re.findall(r'(\d+) complete trees in (\d+) implicit nodes', out)
+    assert matches, out
+    return [int(x) for x in matches[-1]]
+
+
+def test_implicit_tree_layout(model_str, capfd):
+    # numerical trees no deeper than 8 whose complete tree is at most twice their size, as PackedForest::Build
+    shallow_str = generate_model(5, num_feature=2, max_leaves=8)
+    for model in (model_str, shallow_str):
+        num_trees = 0
+        num_nodes = 0
+        for tree in parse_trees(model):
+            if tree['num_leaves'] <= 1 or any(d & 1 for d in tree['decision_type']):
+                continue
+            depth = tree_depth(tree)
+            if depth <= 8 and (1 << depth) - 1 <= 2 * (tree['num_leaves'] - 1):
+                num_trees += 1
+                num_nodes += (1 << depth) - 1
+        assert num_trees > 0
+        assert implicit_layout(model, capfd) == [num_trees, num_nodes]
+    # quantized models stay small
+    assert implicit_layout(model_str, capfd, quantize_leaves=1) == [0, 0]
+
+
+# ---- interleaved traversals
+
+@pytest.mark.parametrize('interleave', ['always', 'never'])
+def test_interleave_bit_identical(model_str, raw_model_str, data, interleave, monkeypatch, capfd):
+    # the models stay in cache, the environment forces the interleaved traversal on them
+    monkeypatch.setenv('LIGHTGBM_INTERLEAVE', interleave)
+    for model in (model_str, raw_model_str, generate_model(11, num_class=1)):
+        with Booster(model) as booster:
+            expected = booster.predict(data)
+            expected_7 = booster.predict(data, num_iteration=7)
+        capfd.readouterr()
+        with Booster(model, 'pack_model=true verbosity=2') as packed:
+            assert ('Interleaving the traversals' in capfd.readouterr().out) == (interleave == 'always')
+            np.testing.assert_array_equal(packed.predict(data), expected)
+            np.testing.assert_array_equal(packed.predict(data, num_iteration=7), expected_7)
+            for i in range(10):
+                np.testing.assert_array_equal(packed.predict(data[i:i + 1]), expected[i:i + 1])
+            buf = save_packed(packed)
+        with load_packed(buf) as loaded:
+            np.testing.assert_array_equal(loaded.predict(data), expected)
+
+
+# ---- trees split across threads
+
+@pytest.fixture(scope='module')
+def large_model_str():
+    # enough trees for the trees of a few rows to be split across the threads by default
+    return generate_model(23, num_iteration=350, max_leaves=6)
+
+
+def test_large_model_splits_trees(large_model_str, data):
+    with Booster(large_model_str, 'num_threads=4') as booster:
+        # as many rows as threads go one per thread, fewer rows split the trees
+        expected = booster.predict(data[:16])
+        for nrow in (1, 3):
+            np.testing.assert_array_equal(booster.predict(data[:nrow]), expected[:nrow])
+
+
+# ---- predict plans and autotuning
+
+def predict_plan(booster):
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterGetPredictPlan(booster.handle, ctypes.c_int64(0), ctypes.byref(out_len), None))
+    buf = ctypes.create_string_buffer(out_len.value)
+    safe_call(LIB.LGBM_BoosterGetPredictPlan(booster.handle, ctypes.c_int64(out_len.value), ctypes.byref(out_len),
+                                             buf))
+    return buf.value.decode()
+
+
+def set_predict_plan(booster, plan):
+    safe_call(LIB.LGBM_BoosterSetPredictPlan(booster.handle, c_str(plan)))
+
+
+def autotune(booster, rows):
+    rows = np.ascontiguousarray(rows, dtype=np.float64)
+    safe_call(LIB.LGBM_BoosterAutotune(booster.handle, double_ptr(rows), ctypes.c_int(C_API_DTYPE_FLOAT64),
+                                       ctypes.c_int32(rows.shape[0]), ctypes.c_int32(rows.shape[1]),
+                                       ctypes.c_int(1)))
+
+
+def test_autotune_bit_identical(model_str, raw_model_str, data):
+    for model in (model_str, raw_model_str):
+        with Booster(model) as booster:
+            expected = booster.predict(data)
+            expected_one = booster.predict(data[:1])
+        with Booster(model, 'autotune=true autotune_rows=64') as tuned:
+            np.testing.assert_array_equal(tuned.predict(data), expected)
+            np.testing.assert_array_equal(tuned.predict(data[:1]), expected_one)
+        with Booster(model, 'pack_model=true') as tuned:
+            autotune(tuned, data[:50])
+            np.testing.assert_array_equal(tuned.predict(data), expected)
+            np.testing.assert_array_equal(tuned.predict(data[:1]), expected_one)
+            plan = predict_plan(tuned)
+            # the plan found by autotuning is kept when loading with it
+            with Booster(model, 'pack_model=true predict_plan=%s' % plan) as pinned:
+                assert predict_plan(pinned) == plan
+                np.testing.assert_array_equal(pinned.predict(data), expected)
+
+
+def test_set_predict_plan(model_str, data):
+    with Booster(model_str, 'pack_model=true') as booster:
+        expected = booster.predict(data)
+        set_predict_plan(booster, '256:packed:0:1')
+        buckets = predict_plan(booster).split(',')
+        assert [bucket.split(':')[0] for bucket in buckets] == ['1', '16', '256', 'max']
+        assert buckets[2] == '256:packed:0:1'
+        np.testing.assert_array_equal(booster.predict(data[:200]), expected[:200])
+
+
+def test_predict_plan_errors(model_str, data):
+    with Booster(model_str) as booster:
+        plan = predict_plan(booster)
+        for bad_plan, message in (('1:trees:0', 'should be bucket:engine:tree_block:num_threads'),
+                                  ('2:trees:0:1', 'Unknown batch size'),
+                                  ('1:forest:0:1', 'Unknown engine'),
+                                  ('1:trees:-1:1', 'non negative tree_block'),
+                                  ('1:trees:0:x', 'non negative tree_block'),
+                                  ('1:trees:0:1,max:trees:0', 'should be bucket:engine:tree_block:num_threads')):
+            with pytest.raises(LightGBMError, match=message):
+                set_predict_plan(booster, bad_plan)
+            # a malformed plan leaves the plan as it was
+            assert predict_plan(booster) == plan
+        # an empty sample is replaced by synthetic rows
+        autotune(booster, np.zeros((0, 12)))
+        assert predict_plan(booster) != ''
+        # missing features are zero, as when predicting
+        autotune(booster, data[:10, :5])
+        with Booster(model_str) as untuned:
+            np.testing.assert_array_equal(booster.predict(data), untuned.predict(data))
+
+
+def test_plan_reports_compiled_model(model_str):
+    with Booster(model_str, 'compile_model=true') as compiled:
+        assert 'compiled' in predict_plan(compiled)
+    with Booster(model_str, 'compile_model=true model_compiler=no_such_compiler_xyz') as fallback:
+        assert 'compiled' not in predict_plan(fallback)
+
+
+def test_large_model_plan_splits_trees(large_model_str, data):
+    with Booster(large_model_str, 'num_threads=4') as booster:
+        for bucket in predict_plan(booster).split(','):
+            assert int(bucket.split(':')[2]) > 0
+        pred = {nrow: booster.predict(data[:nrow]) for nrow in (1, 3, 16)}
+        set_predict_plan(booster, '1:trees:0:1,16:trees:0:1')
+        for nrow, expected in pred.items():
+            np.testing.assert_array_equal(booster.predict(data[:nrow]), expected)
+
+
+def test_tree_blocks_bit_identical(model_str, raw_model_str, data):
+    rows = data[:3]
+    for model in (model_str, raw_model_str):
+        with Booster(model, 'num_threads=4 pack_model=true') as booster:
+            set_predict_plan(booster, '1:trees:0:1,16:trees:0:1')
+            expected = booster.predict(rows)
+            expected_one = booster.predict(rows[:1])
+            expected_five = booster.predict(rows, num_iteration=5)
+            for engine in ('trees', 'packed', 'packed_groups'):
+                for tree_block in (1, 5, 64):
+                    for num_threads in (0, 2, 4):
+                        set_predict_plan(booster, '1:%s:%d:%d,16:%s:%d:%d'
+                                         % (engine, tree_block, num_threads, engine, tree_block, num_threads))
+                        np.testing.assert_array_equal(booster.predict(rows), expected)
+                        np.testing.assert_array_equal(booster.predict(rows[:1]), expected_one)
+                        np.testing.assert_array_equal(booster.predict(rows, num_iteration=5), expected_five)
+
+
+# ---- compacted features
+
+WIDE_NUM_FEATURE = 500
+# fewer than half of the columns are used, so PredictForMat gathers them
+WIDE_FEATURES = [41 * i + 7 for i in range(12)]
+
+
+def widen_model(model_str):
+    """The same trees on WIDE_FEATURES of WIDE_NUM_FEATURE declared features, the others are unused"""
+    lines = []
+    for line in model_str.splitlines():
+        key = line.split('=', 1)[0]
+        if key == 'tree_sizes':
+            continue
+        elif key == 'max_feature_idx':
+            line = 'max_feature_idx=%d' % (WIDE_NUM_FEATURE - 1)
+        elif key == 'feature_names':
+            line = 'feature_names=' + ' '.join('Column_%d' % i for i in range(WIDE_NUM_FEATURE))
+        elif key == 'feature_infos':
+            line = 'feature_infos=' + ' '.join('[-2:2]' for _ in range(WIDE_NUM_FEATURE))
+        elif key == 'split_feature':
+            line = 'split_feature=' + ' '.join(str(WIDE_FEATURES[int(f)]) for f in line.split('=', 1)[1].split())
+        lines.append(line)
+    return '\n'.join(lines) + '\n'
+
+
+def widen_data(data):
+    # the unused columns hold values the trees would split differently on, were they read
+    wide = np.full((data.shape[0], WIDE_NUM_FEATURE), 1e30)
+    wide[:, WIDE_FEATURES] = data
+    return wide
+
+
+def used_features(booster):
+    out_len = ctypes.c_int(0)
+    safe_call(LIB.LGBM_BoosterGetUsedFeatures(booster.handle, 0, ctypes.byref(out_len), None))
+    out = (ctypes.c_int * out_len.value)()
+    safe_call(LIB.LGBM_BoosterGetUsedFeatures(booster.handle, out_len.value, ctypes.byref(out_len), out))
+    return list(out)
+
+
+def predict_col_major(booster, data):
+    data = np.asfortranarray(data, dtype=np.float64)
+    num_predict = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterCalcNumPredict(booster.handle, data.shape[0], C_API_PREDICT_NORMAL, -1,
+                                             ctypes.byref(num_predict)))
+    out = np.zeros(num_predict.value, dtype=np.float64)
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterPredictForMat(booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64,
+                                            data.shape[0], data.shape[1], 0, C_API_PREDICT_NORMAL, -1, c_str(''),
+                                            ctypes.byref(out_len), double_ptr(out)))
+    return out[:out_len.value].reshape(data.shape[0], -1)
+
+
+def widen_contrib(contrib, num_class):
+    contrib = contrib.reshape(contrib.shape[0], num_class, -1)
+    wide = np.zeros((contrib.shape[0], num_class, WIDE_NUM_FEATURE + 1))
+    wide[:, :, WIDE_FEATURES] = contrib[:, :, :-1]
+    wide[:, :, -1] = contrib[:, :, -1]
+    return wide.reshape(contrib.shape[0], -1)
+
+
+def test_used_features(model_str):
+    with Booster(model_str) as narrow, Booster(widen_model(model_str)) as wide:
+        assert used_features(narrow) == list(range(12))
+        assert used_features(wide) == WIDE_FEATURES
+    with Booster(widen_model(model_str), 'pack_model=true') as packed:
+        assert used_features(packed) == WIDE_FEATURES
+        buf = save_packed(packed)
+    with load_packed(buf) as loaded:
+        assert used_features(loaded) == WIDE_FEATURES
+    # a buffer too small is left untouched, the number of features is still returned
+    out_len = ctypes.c_int(0)
+    out = (ctypes.c_int * 12)(*([-1] * 12))
+    with Booster(widen_model(model_str)) as wide:
+        safe_call(LIB.LGBM_BoosterGetUsedFeatures(wide.handle, 11, ctypes.byref(out_len), out))
+    assert out_len.value == 12
+    assert list(out) == [-1] * 12
+
+
+@pytest.mark.parametrize('params', ['', 'pack_model=true', 'compile_model=true'])
+def test_compacted_predictions(model_str, data, params):
+    wide_data = widen_data(data)
+    # the narrow model uses all its features, it is the uncompacted reference
+    with Booster(model_str) as narrow, Booster(widen_model(model_str), params) as wide:
+        for data_type in (C_API_DTYPE_FLOAT64, C_API_DTYPE_FLOAT32):
+            np.testing.assert_array_equal(wide.predict(wide_data, data_type=data_type),
+                                          narrow.predict(data, data_type=data_type))
+        np.testing.assert_array_equal(predict_col_major(wide, wide_data), narrow.predict(data))
+        np.testing.assert_array_equal(wide.predict(wide_data, num_iteration=7), narrow.predict(data, num_iteration=7))
+        for i in range(10):
+            np.testing.assert_array_equal(wide.predict(wide_data[i:i + 1]), narrow.predict(data[i:i + 1]))
+
+
+def test_compacted_contributions(model_str, data):
+    wide_data = widen_data(data)
+    with Booster(model_str) as narrow, Booster(widen_model(model_str)) as wide:
+        for method in ('tree_shap', 'saabas'):
+            params = 'contrib_method=%s' % method
+            np.testing.assert_array_equal(wide.predict(wide_data, C_API_PREDICT_CONTRIB, params=params),
+                                          widen_contrib(narrow.predict(data, C_API_PREDICT_CONTRIB, params=params), 3))
+        np.testing.assert_array_equal(wide.predict(wide_data, C_API_PREDICT_LEAF_INDEX),
+                                      narrow.predict(data, C_API_PREDICT_LEAF_INDEX))
+
+
+# ---- rescoring records
+
+class Record(object):
+    def __init__(self, booster, row, num_iteration=-1):
+        self.handle = ctypes.c_void_p()
+        self.num_class = booster.num_class
+        row = np.ascontiguousarray(row, dtype=np.float64)
+        out = np.zeros(self.num_class)
+        out_len = ctypes.c_int64(0)
+        safe_call(LIB.LGBM_BoosterRescoreInit(booster.handle, row.ctypes.data_as(ctypes.c_void_p),
+                                              C_API_DTYPE_FLOAT64, len(row), num_iteration, ctypes.byref(self.handle),
+                                              ctypes.byref(out_len), double_ptr(out)))
+        self.prediction = out[:out_len.value]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        safe_call(LIB.LGBM_RescoreFree(self.handle))
+
+    def rescore(self, changes, data_type=C_API_DTYPE_FLOAT64):
+        indices = np.array(sorted(changes), dtype=np.int32)
+        values = np.array([changes[i] for i in sorted(changes)],
+                          dtype=np.float32 if data_type == C_API_DTYPE_FLOAT32 else np.float64)
+        out = np.zeros(self.num_class)
+        out_len = ctypes.c_int64(0)
+        safe_call(LIB.LGBM_BoosterRescore(self.handle, indices.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)),
+                                          values.ctypes.data_as(ctypes.c_void_p), data_type, len(indices),
+                                          ctypes.byref(out_len), double_ptr(out)))
+        return out[:out_len.value]
+
+
+def test_rescore_matches_prediction(model_str, data):
+    rnd = np.random.RandomState(23)
+    with Booster(model_str) as booster:
+        for row in data[:20]:
+            row = row.copy()
+            with Record(booster, row) as record:
+                np.testing.assert_array_equal(record.prediction, booster.predict(row[np.newaxis, :])[0])
+                for _ in range(5):
+                    changes = {int(feature): data[rnd.randint(len(data)), feature]
+                               for feature in rnd.choice(12, size=rnd.randint(1, 4), replace=False)}
+                    for feature, value in changes.items():
+                        row[feature] = value
+                    np.testing.assert_array_equal(record.rescore(changes), booster.predict(row[np.newaxis, :])[0])
+
+
+def test_rescore_float32_and_iterations(model_str, data):
+    with Booster(model_str) as booster:
+        row = data[0].copy()
+        with Record(booster, row, num_iteration=6) as record:
+            np.testing.assert_array_equal(record.prediction, booster.predict(row[np.newaxis, :], num_iteration=6)[0])
+            row[3] = np.float32(0.3)
+            np.testing.assert_array_equal(record.rescore({3: 0.3}, C_API_DTYPE_FLOAT32),
+                                          booster.predict(row[np.newaxis, :], num_iteration=6)[0])
+
+
+def test_rescore_errors(model_str, data):
+    with Booster(model_str) as booster:
+        with Record(booster, data[0]) as record:
+            with pytest.raises(LightGBMError, match='out of range'):
+                record.rescore({12: 1.0})
+
+
+# ---- class subsets
+
+def test_class_subset_raw_scores(model_str, raw_model_str, data):
+    expected = reference_raw_score(model_str, data, 3)
+    for model in (model_str, raw_model_str):
+        with Booster(model) as booster:
+            np.testing.assert_array_equal(booster.predict(data, params='pred_classes=2,0'), expected[:, [2, 0]])
+            np.testing.assert_array_equal(booster.predict(data, params='pred_classes=1'), expected[:, [1]])
+
+
+def test_class_subset_normalized(model_str, data):
+    expected = softmax(reference_raw_score(model_str, data, 3)[:, [2, 0]])
+    with Booster(model_str) as booster:
+        pred = booster.predict(data, params='pred_classes=2,0 pred_normalize_classes=true')
+    np.testing.assert_allclose(pred, expected, rtol=1e-12, atol=0)
+    np.testing.assert_allclose(pred.sum(axis=1), 1.0, rtol=1e-12)
+
+
+def test_class_subset_errors(model_str, raw_model_str, data):
+    with Booster(model_str) as booster:
+        with pytest.raises(LightGBMError, match='out of range'):
+            booster.predict(data, params='pred_classes=0,3')
+        with pytest.raises(LightGBMError, match='pred_early_stop'):
+            booster.predict(data, params='pred_classes=0 pred_early_stop=true')
+        with pytest.raises(LightGBMError, match='normal prediction'):
+            booster.predict(data, predict_type=C_API_PREDICT_LEAF_INDEX, params='pred_classes=0')
+    custom_model_str = model_str.replace('objective=multiclass num_class:3', 'objective=custom')
+    for model in (custom_model_str, raw_model_str):
+        with Booster(model) as booster:
+            with pytest.raises(LightGBMError, match='multiclass objective'):
+                booster.predict(data, params='pred_classes=0,1 pred_normalize_classes=true')
+
+
+# ---- TreeSHAP contributions
+
+def shapley_values(value_function, num_feature):
+    """Shapley values of every feature and the value of the empty set, by enumerating the subsets"""
+    values = {}
+    for mask in range(1 << num_feature):
+        values[mask] = value_function(mask)
+    phi = np.zeros(num_feature + 1)
+    for feature in range(num_feature):
+        for mask in range(1 << num_feature):
+            if mask >> feature & 1:
+                continue
+            size = bin(mask).count('1')
+            weight = math.factorial(size) * math.factorial(num_feature - size - 1) / float(math.factorial(num_feature))
+            phi[feature] += weight * (values[mask | 1 << feature] - values[mask])
+    phi[num_feature] = values[0]
+    return phi
+
+
+def data_count(tree, node):
+    return tree['leaf_count'][~node] if node < 0 else tree['internal_count'][node]
+
+
+def path_dependent_value(tree, row, mask, node=0):
+    """Expected output of a tree when the features in mask are known, the others follow the training counts"""
+    if node < 0:
+        return tree['leaf_value'][~node]
+    feature = tree['split_feature'][node]
+    if mask >> feature & 1:
+        return path_dependent_value(tree, row, mask, next_node(tree, node, row[feature]))
+    left, right = tree['left_child'][node], tree['right_child'][node]
+    return (data_count(tree, left) * path_dependent_value(tree, row, mask, left)
+            + data_count(tree, right) * path_dependent_value(tree, row, mask, right)) / float(data_count(tree, node))
+
+
+def reference_contrib(model_str, data, num_class, value):
+    """Contributions of every row and class, value(tree, row, mask) is the value of a coalition in a tree"""
+    trees = parse_trees(model_str)
+    num_feature = data.shape[1]
+    out = np.zeros((data.shape[0], num_class, num_feature + 1))
+    for i in range(data.shape[0]):
+        for j, tree in enumerate(trees):
+            if tree['num_leaves'] == 1:
+                out[i, j % num_class, num_feature] += tree['leaf_value'][0]
+            else:
+                out[i, j % num_class] += shapley_values(lambda mask: value(tree, data[i], mask), num_feature)
+    return out.reshape(data.shape[0], -1)
+
+
+@pytest.fixture(scope='module')
+def small_model_str():
+    # few features, so that the Shapley values can be enumerated
+    return generate_model(13, num_iteration=3, num_feature=6, max_leaves=10, objective=False)
+
+
+@pytest.fixture(scope='module')
+def small_data():
+    return generate_data(17, 25, num_feature=6)
+
+
+def test_tree_shap_matches_shapley_values(small_model_str, small_data):
+    expected = reference_contrib(small_model_str, small_data, 3, path_dependent_value)
+    with Booster(small_model_str) as booster:
+        for params in ('', 'contrib_method=tree_shap'):
+            contrib = booster.predict(small_data, C_API_PREDICT_CONTRIB, params=params)
+            np.testing.assert_allclose(contrib, expected, rtol=1e-9, atol=1e-12)
+
+
+def test_contrib_sums_to_raw_score(raw_model_str, data):
+    raw = reference_raw_score(raw_model_str, data, 3)
+    with Booster(raw_model_str) as booster:
+        contrib = booster.predict(data, C_API_PREDICT_CONTRIB)
+        np.testing.assert_allclose(contrib.reshape(data.shape[0], 3, -1).sum(axis=2), raw, rtol=1e-9, atol=1e-12)
+
+
+def test_contrib_of_packed_models(model_str, data):
+    with Booster(model_str, 'pack_model=true') as packed:
+        # the booster keeps its trees for contributions
+        with Booster(model_str) as booster:
+            np.testing.assert_array_equal(packed.predict(data, C_API_PREDICT_CONTRIB),
+                                          booster.predict(data, C_API_PREDICT_CONTRIB))
+        buf = save_packed(packed)
+    with load_packed(buf) as loaded:
+        with pytest.raises(LightGBMError, match='packed model'):
+            loaded.predict(data, C_API_PREDICT_CONTRIB)
+
+
+def test_contrib_of_cached_models(model_str, data, tmp_path):
+    params = 'pack_model=true model_cache_dir=%s' % tmp_path
+    # the booster that writes the file holds only the packed model, as the boosters that map it
+    with Booster(model_str, params) as first:
+        with pytest.raises(LightGBMError, match='packed model'):
+            first.predict(data, C_API_PREDICT_CONTRIB)
+    with Booster(model_str, 'pack_model=true model_cache_dir=%s' % (tmp_path / 'missing')) as unwritten:
+        with pytest.raises(LightGBMError, match='packed model'):
+            unwritten.predict(data, C_API_PREDICT_CONTRIB)
+    with Booster(model_str, params) as cached:
+        with pytest.raises(LightGBMError, match='packed model'):
+            cached.predict(data, C_API_PREDICT_CONTRIB)
+
+
+# ---- Saabas contributions
+
+def saabas_node_value(tree, node):
+    if node < 0:
+        return tree['leaf_value'][~node], tree['leaf_count'][~node]
+    left_value, left_count = saabas_node_value(tree, tree['left_child'][node])
+    right_value, right_count = saabas_node_value(tree, tree['right_child'][node])
+    if left_count + right_count == 0:
+        return (left_value + right_value) / 2.0, 0
+    return (left_count * left_value + right_count * right_value) / float(left_count + right_count), \
+        left_count + right_count
+
+
+def reference_saabas(model_str, data, num_class):
+    trees = parse_trees(model_str)
+    num_feature = data.shape[1]
+    out = np.zeros((data.shape[0], num_class, num_feature + 1))
+    for i in range(data.shape[0]):
+        for j, tree in enumerate(trees):
+            if tree['num_leaves'] == 1:
+                out[i, j % num_class, num_feature] += tree['leaf_value'][0]
+                continue
+            node = 0
+            value = saabas_node_value(tree, node)[0]
+            out[i, j % num_class, num_feature] += value
+            while node >= 0:
+                feature = tree['split_feature'][node]
+                node = next_node(tree, node, data[i, feature])
+                next_value = saabas_node_value(tree, node)[0]
+                out[i, j % num_class, feature] += next_value - value
+                value = next_value
+    return out.reshape(data.shape[0], -1)
+
+
+def test_saabas(small_model_str, small_data):
+    with Booster(small_model_str) as booster:
+        contrib = booster.predict(small_data, C_API_PREDICT_CONTRIB, params='contrib_method=saabas')
+    np.testing.assert_allclose(contrib, reference_saabas(small_model_str, small_data, 3), rtol=1e-12, atol=1e-12)
+
+
+def test_saabas_sums_to_raw_score(raw_model_str, data):
+    raw = reference_raw_score(raw_model_str, data, 3)
+    with Booster(raw_model_str) as booster:
+        contrib = booster.predict(data, C_API_PREDICT_CONTRIB, params='contrib_method=saabas')
+    np.testing.assert_allclose(contrib.reshape(data.shape[0], 3, -1).sum(axis=2), raw, rtol=1e-9, atol=1e-12)
+
+
+def test_saabas_without_counts(small_model_str, small_data):
+    # models written without counts weigh both children of a node the same, the edited trees change their sizes
+    model_str = re.sub(r'^tree_sizes=.*\n', '', small_model_str, flags=re.M)
+    zero_counts = re.sub(r'^(leaf_count|internal_count)=.*$',
+                         lambda m: m.group(1) + '=' + ' '.join('0' for _ in m.group(0).split('=')[1].split()),
+                         model_str, flags=re.M)
+    no_counts = re.sub(r'^(leaf_count|internal_count)=.*\n', '', model_str, flags=re.M)
+    expected = reference_saabas(zero_counts, small_data, 3)
+    for model in (zero_counts, no_counts):
+        with Booster(model) as booster:
+            contrib = booster.predict(small_data, C_API_PREDICT_CONTRIB, params='contrib_method=saabas')
+        np.testing.assert_allclose(contrib, expected, rtol=1e-12, atol=1e-12)
+    with Booster(small_model_str) as booster:
+        weighted = booster.predict(small_data, C_API_PREDICT_CONTRIB, params='contrib_method=saabas')
+    assert not np.allclose(weighted, expected)
+
+
+def test_contrib_method_errors(model_str, data):
+    with Booster(model_str) as booster:
+        with pytest.raises(LightGBMError, match='Unknown contrib method'):
+            booster.predict(data, C_API_PREDICT_CONTRIB, params='contrib_method=lime')
+
+
+# ---- interventional contributions
+
+def set_contrib_background(booster, background):
+    background = np.ascontiguousarray(background, dtype=np.float64)
+    safe_call(LIB.LGBM_BoosterSetContribBackground(booster.handle, background.ctypes.data_as(ctypes.c_void_p),
+                                                   C_API_DTYPE_FLOAT64, background.shape[0], background.shape[1], 1))
+
+
+def test_interventional_matches_shapley_values(small_model_str, small_data):
+    background = generate_data(19, 30, num_feature=6)
+
+    def value(tree, row, mask):
+        hybrid = np.where([mask >> feature & 1 for feature in range(len(row))], row, background)
+        return np.mean([tree['leaf_value'][tree_leaf(tree, hybrid_row)] for hybrid_row in hybrid])
+
+    expected = reference_contrib(small_model_str, small_data, 3, value)
+    with Booster(small_model_str) as booster:
+        with pytest.raises(LightGBMError, match='need a background'):
+            booster.predict(small_data, C_API_PREDICT_CONTRIB, params='contrib_method=interventional')
+        set_contrib_background(booster, background)
+        contrib = booster.predict(small_data, C_API_PREDICT_CONTRIB, params='contrib_method=interventional')
+    np.testing.assert_allclose(contrib, expected, rtol=1e-9, atol=1e-12)
+
+
+# ---- sparse contributions
+
+def predict_sparse_contrib(booster, data, params=''):
+    data = np.ascontiguousarray(data, dtype=np.float64)
+    out_len = ctypes.c_int64(0)
+    indptr = ctypes.POINTER(ctypes.c_int64)()
+    indices = ctypes.POINTER(ctypes.c_int32)()
+    values = ctypes.POINTER(ctypes.c_double)()
+    safe_call(LIB.LGBM_BoosterPredictSparseContribForMat(
+        booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1], 1,
+        -1, c_str(params), ctypes.byref(out_len), ctypes.byref(indptr), ctypes.byref(indices), ctypes.byref(values)))
+    num_rows = data.shape[0] * booster.num_class
+    result = (np.ctypeslib.as_array(indptr, shape=(num_rows + 1,)).copy(),
+              np.ctypeslib.as_array(indices, shape=(out_len.value,)).copy(),
+              np.ctypeslib.as_array(values, shape=(out_len.value,)).copy())
+    safe_call(LIB.LGBM_BoosterFreeSparseContrib(indptr, indices, values))
+    return result
+
+
+def test_sparse_contrib(raw_model_str, data):
+    with Booster(raw_model_str) as booster:
+        dense = booster.predict(data, C_API_PREDICT_CONTRIB).reshape(data.shape[0] * 3, -1)
+        indptr, indices, values = predict_sparse_contrib(booster, data)
+        for row in range(dense.shape[0]):
+            cols = indices[indptr[row]:indptr[row + 1]]
+            expected_cols = np.flatnonzero(dense[row])
+            if dense[row, -1] == 0:
+                expected_cols = np.append(expected_cols, dense.shape[1] - 1)
+            np.testing.assert_array_equal(cols, expected_cols)
+            np.testing.assert_array_equal(values[indptr[row]:indptr[row + 1]], dense[row, cols])
+        indptr, indices, values = predict_sparse_contrib(booster, data, 'contrib_top_k=2')
+        for row in range(dense.shape[0]):
+            cols = indices[indptr[row]:indptr[row + 1]]
+            assert cols[-1] == dense.shape[1] - 1
+            magnitude = np.abs(dense[row, :-1])
+            assert len(cols) == 1 + min(2, np.count_nonzero(magnitude))
+            assert np.all(np.diff(cols) > 0)
+            if len(cols) > 1:
+                assert magnitude[cols[:-1]].min() >= np.sort(magnitude)[-2]
+
+
+# ---- leaf indices
+
+def predict_leaf_index(booster, data, out_type, num_iteration=-1):
+    data = np.ascontiguousarray(data, dtype=np.float64)
+    num_predict = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterCalcNumPredict(booster.handle, data.shape[0], C_API_PREDICT_LEAF_INDEX, num_iteration,
+                                             ctypes.byref(num_predict)))
+    out = np.zeros(num_predict.value, dtype=np.int16 if out_type == C_API_DTYPE_INT16 else np.int32)
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterPredictLeafIndexForMat(
+        booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1], 1,
+        num_iteration, c_str(''), out_type, ctypes.byref(out_len), out.ctypes.data_as(ctypes.c_void_p)))
+    return out[:out_len.value].reshape(data.shape[0], -1)
+
+
+def test_leaf_index(model_str, data):
+    trees = parse_trees(model_str)
+    expected = np.array([[tree_leaf(tree, row) for tree in trees] for row in data])
+    with Booster(model_str) as booster:
+        for out_type in (C_API_DTYPE_INT32, C_API_DTYPE_INT16):
+            np.testing.assert_array_equal(predict_leaf_index(booster, data, out_type), expected)
+        np.testing.assert_array_equal(predict_leaf_index(booster, data, C_API_DTYPE_INT32, num_iteration=4),
+                                      expected[:, :12])
+        np.testing.assert_array_equal(booster.predict(data, C_API_PREDICT_LEAF_INDEX), expected)
+        with pytest.raises(LightGBMError, match='Unknown leaf index type'):
+            predict_leaf_index(booster, data, C_API_DTYPE_FLOAT64)
+
+
+def test_leaf_one_hot(model_str, data):
+    trees = parse_trees(model_str)
+    offsets = np.cumsum([0] + [tree['num_leaves'] for tree in trees])
+    expected = np.array([[offsets[j] + tree_leaf(tree, row) for j, tree in enumerate(trees)] for row in data])
+    with Booster(model_str) as booster:
+        num_col = ctypes.c_int64(0)
+        indptr = np.zeros(data.shape[0] + 1, dtype=np.int64)
+        indices = np.zeros(expected.size, dtype=np.int32)
+        safe_call(LIB.LGBM_BoosterPredictLeafOneHotForMat(
+            booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1],
+            1, -1, c_str(''), ctypes.byref(num_col), indptr.ctypes.data_as(ctypes.POINTER(ctypes.c_int64)),
+            indices.ctypes.data_as(ctypes.POINTER(ctypes.c_int32))))
+    assert num_col.value == offsets[-1]
+    np.testing.assert_array_equal(indptr, np.arange(data.shape[0] + 1) * len(trees))
+    np.testing.assert_array_equal(indices, expected.ravel())
+
+
+# ---- staged prediction
+
+def predict_staged(booster, data, checkpoints, predict_type=C_API_PREDICT_NORMAL, params=''):
+    data = np.ascontiguousarray(data, dtype=np.float64)
+    checkpoints = np.ascontiguousarray(checkpoints, dtype=np.int32)
+    out = np.zeros(data.shape[0] * max(len(checkpoints), 1) * booster.num_class)
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterPredictStagedForMat(
+        booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1], 1,
+        predict_type, checkpoints.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)), len(checkpoints), c_str(params),
+        ctypes.byref(out_len), double_ptr(out)))
+    return out[:out_len.value].reshape(data.shape[0], len(checkpoints), booster.num_class)
+
+
+def predict_staged_range(booster, data, start_iteration, end_iteration, predict_type=C_API_PREDICT_NORMAL):
+    data = np.ascontiguousarray(data, dtype=np.float64)
+    num_stages = max(end_iteration - start_iteration + 1, 1)
+    out = np.zeros(data.shape[0] * num_stages * booster.num_class)
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_BoosterPredictStagedRangeForMat(
+        booster.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1], 1,
+        predict_type, start_iteration, end_iteration, c_str(''), ctypes.byref(out_len), double_ptr(out)))
+    return out[:out_len.value].reshape(data.shape[0], num_stages, booster.num_class)
+
+
+def test_staged_bit_identical(model_str, raw_model_str, data):
+    checkpoints = [1, 2, 7, 20]
+    with Booster(model_str) as booster:
+        staged = predict_staged(booster, data, checkpoints)
+        raw_staged = predict_staged(booster, data, checkpoints, C_API_PREDICT_RAW_SCORE)
+        for i, num_iteration in enumerate(checkpoints):
+            np.testing.assert_array_equal(staged[:, i], booster.predict(data, num_iteration=num_iteration))
+            np.testing.assert_array_equal(raw_staged[:, i], reference_raw_score(model_str, data, 3, num_iteration))
+    with Booster(raw_model_str) as booster:
+        staged = predict_staged(booster, data, checkpoints)
+        for i, num_iteration in enumerate(checkpoints):
+            np.testing.assert_array_equal(staged[:, i], booster.predict(data, num_iteration=num_iteration))
+
+
+def test_staged_range(model_str, data):
+    with Booster(model_str) as booster:
+        np.testing.assert_array_equal(predict_staged_range(booster, data, 3, 6),
+                                      predict_staged(booster, data, [3, 4, 5, 6]))
+        np.testing.assert_array_equal(predict_staged_range(booster, data, 20, 20, C_API_PREDICT_RAW_SCORE),
+                                      predict_staged(booster, data, [20], C_API_PREDICT_RAW_SCORE))
+        with pytest.raises(LightGBMError, match='empty or not positive'):
+            predict_staged_range(booster, data, 5, 4)
+        with pytest.raises(LightGBMError, match='empty or not positive'):
+            predict_staged_range(booster, data, 0, 4)
+        with pytest.raises(LightGBMError, match='the model has 20 iterations'):
+            predict_staged_range(booster, data, 18, 21)
+
+
+def test_staged_errors(model_str, data):
+    with Booster(model_str) as booster:
+        with pytest.raises(LightGBMError, match='positive and increasing'):
+            predict_staged(booster, data, [3, 3])
+        with pytest.raises(LightGBMError, match='positive and increasing'):
+            predict_staged(booster, data, [0, 3])
+        with pytest.raises(LightGBMError, match='No iteration'):
+            predict_staged(booster, data, [])
+        with pytest.raises(LightGBMError, match='the model has 20 iterations'):
+            predict_staged(booster, data, [5, 21])
+        with pytest.raises(LightGBMError, match='only supports'):
+            predict_staged(booster, data, [5], C_API_PREDICT_LEAF_INDEX)
+
+
+# ---- score caches
+
+class ScoreCache(object):
+    def __init__(self, data=None, filename=None):
+        self.handle = ctypes.c_void_p()
+        if filename is not None:
+            safe_call(LIB.LGBM_ScoreCacheCreateFromFile(c_str(filename), ctypes.byref(self.handle)))
+        else:
+            data = np.ascontiguousarray(data, dtype=np.float64)
+            safe_call(LIB.LGBM_ScoreCacheCreate(data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64,
+                                                data.shape[0], data.shape[1], 1, ctypes.byref(self.handle)))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        safe_call(LIB.LGBM_ScoreCacheFree(self.handle))
+
+    @property
+    def num_trees(self):
+        num_trees = ctypes.c_int(0)
+        safe_call(LIB.LGBM_ScoreCacheGetNumTrees(self.handle, ctypes.byref(num_trees)))
+        return num_trees.value
+
+    def save(self, filename):
+        safe_call(LIB.LGBM_ScoreCacheSaveToFile(self.handle, c_str(filename)))
+
+    def update(self, booster, data, predict_type=C_API_PREDICT_NORMAL):
+        """Predictions of the rows and the number of trees evaluated"""
+        data = np.ascontiguousarray(data, dtype=np.float64)
+        out = np.zeros(data.shape[0] * booster.num_class)
+        out_len = ctypes.c_int64(0)
+        num_new_trees = ctypes.c_int(0)
+        safe_call(LIB.LGBM_BoosterUpdateScoreCache(
+            booster.handle, self.handle, data.ctypes.data_as(ctypes.c_void_p), C_API_DTYPE_FLOAT64, data.shape[0],
+            data.shape[1], 1, predict_type, c_str(''), ctypes.byref(num_new_trees), ctypes.byref(out_len),
+            double_ptr(out)))
+        return out[:out_len.value].reshape(data.shape[0], -1), num_new_trees.value
+
+
+def test_score_cache_grown_model(model_str, data):
+    # the generator makes the trees one after the other, the first 10 iterations of both models are the same
+    with Booster(generate_model(7, num_iteration=10)) as small, Booster(model_str) as full, ScoreCache(data) as cache:
+        assert cache.num_trees == 0
+        pred, num_new_trees = cache.update(small, data)
+        assert num_new_trees == 30
+        np.testing.assert_array_equal(pred, small.predict(data))
+        pred, num_new_trees = cache.update(full, data)
+        assert num_new_trees == 30
+        assert cache.num_trees == 60
+        np.testing.assert_array_equal(pred, full.predict(data))
+        pred, num_new_trees = cache.update(full, data, C_API_PREDICT_RAW_SCORE)
+        assert num_new_trees == 0
+        np.testing.assert_array_equal(pred, reference_raw_score(model_str, data, 3))
+
+
+def test_score_cache_other_model(model_str, data):
+    with Booster(model_str) as booster, Booster(generate_model(8)) as other, ScoreCache(data) as cache:
+        cache.update(booster, data)
+        pred, num_new_trees = cache.update(other, data)
+        assert num_new_trees == 60
+        np.testing.assert_array_equal(pred, other.predict(data))
+        # a model with fewer trees is evaluated again as well
+        with Booster(generate_model(8, num_iteration=5)) as shrunk:
+            pred, num_new_trees = cache.update(shrunk, data)
+            assert num_new_trees == 15
+            np.testing.assert_array_equal(pred, shrunk.predict(data))
+
+
+def test_score_cache_file(model_str, data, tmp_path):
+    filename = str(tmp_path / 'scores.bin')
+    with Booster(generate_model(7, num_iteration=10)) as small, ScoreCache(data) as cache:
+        cache.update(small, data)
+        cache.save(filename)
+    with Booster(model_str) as full, ScoreCache(filename=filename) as cache:
+        assert cache.num_trees == 30
+        pred, num_new_trees = cache.update(full, data)
+        assert num_new_trees == 30
+        np.testing.assert_array_equal(pred, full.predict(data))
+
+
+def test_score_cache_errors(model_str, data, tmp_path):
+    with Booster(model_str) as booster, ScoreCache(data) as cache:
+        with pytest.raises(LightGBMError, match='data differs'):
+            cache.update(booster, data[:-1])
+        changed = data.copy()
+        changed[5, 3] += 1.0
+        with pytest.raises(LightGBMError, match='data differs'):
+            cache.update(booster, changed)
+        with pytest.raises(LightGBMError, match='only support'):
+            cache.update(booster, data, C_API_PREDICT_LEAF_INDEX)
+    with pytest.raises(LightGBMError):
+        ScoreCache(filename=str(tmp_path / 'missing.bin'))
+    junk = tmp_path / 'junk.bin'
+    junk.write_bytes(b'not a score cache' * 10)
+    with pytest.raises(LightGBMError):
+        ScoreCache(filename=str(junk))
+
+
+def test_score_cache_packed_models(model_str, data, tmp_path):
+    # packed models keep the hashes of their trees, so a cache goes on from the trees it covers
+    with Booster(generate_model(7, num_iteration=10)) as small, ScoreCache(data) as cache:
+        cache.update(small, data)
+        with Booster(model_str, 'model_cache_dir=%s' % tmp_path) as cached:
+            pred, num_new_trees = cache.update(cached, data)
+            assert num_new_trees == 30
+            with Booster(model_str) as full:
+                np.testing.assert_array_equal(pred, full.predict(data))
+            buf = save_packed(cached)
+        with load_packed(buf) as loaded:
+            pred, num_new_trees = cache.update(loaded, data)
+            assert num_new_trees == 0
+
+
+# ---- model deltas
+
+def model_delta(model_str, base_num_trees):
+    out_len = ctypes.c_int64(0)
+    safe_call(LIB.LGBM_ModelDeltaCreate(c_str(model_str), base_num_trees, ctypes.c_int64(0), ctypes.byref(out_len),
+                                        None))
+    buf = ctypes.create_string_buffer(out_len.value)
+    safe_call(LIB.LGBM_ModelDeltaCreate(c_str(model_str), base_num_trees, ctypes.c_int64(out_len.value),
+                                        ctypes.byref(out_len), buf))
+    return buf.value.decode()
+
+
+def apply_delta(booster, delta):
+    num_iteration = ctypes.c_int(0)
+    safe_call(LIB.LGBM_BoosterApplyModelDelta(booster.handle, c_str(delta), ctypes.byref(num_iteration)))
+    return num_iteration.value
+
+
+def lineage_hash(booster, num_trees):
+    out = ctypes.c_uint64(0)
+    safe_call(LIB.LGBM_BoosterGetLineageHash(booster.handle, num_trees, ctypes.byref(out)))
+    return out.value
+
+
+@pytest.fixture(scope='module')
+def small_model_str7():
+    # the generator makes the trees one after the other, these are the first 10 iterations of model_str
+    return generate_model(7, num_iteration=10)
+
+
+def test_delta_append_and_truncate(model_str, small_model_str7, data):
+    with Booster(model_str) as full, Booster(small_model_str7) as booster:
+        small_pred = booster.predict(data)
+        assert lineage_hash(booster, 30) == lineage_hash(full, 30)
+        assert apply_delta(booster, model_delta(model_str, 30)) == 20
+        np.testing.assert_array_equal(booster.predict(data), full.predict(data))
+        assert lineage_hash(booster, 60) == lineage_hash(full, 60)
+        assert apply_delta(booster, model_delta(small_model_str7, 30)) == 10
+        np.testing.assert_array_equal(booster.predict(data), small_pred)
+
+
+def test_delta_from_no_trees(model_str, data):
+    with Booster(model_str) as full, Booster(generate_model(8)) as booster:
+        assert apply_delta(booster, model_delta(model_str, 0)) == 20
+        np.testing.assert_array_equal(booster.predict(data), full.predict(data))
+
+
+def test_delta_rejected_without_change(model_str, small_model_str7, data):
+    delta = model_delta(model_str, 30)
+    bad_tree = delta.index('right_child=', delta.index('Tree=35'))
+    corrupted = delta[:bad_tree] + 'rigth_child=' + delta[bad_tree + len('right_child='):]
+    with Booster(small_model_str7) as booster:
+        expected = booster.predict(data)
+        with pytest.raises(LightGBMError, match='not made for the first 30 trees'):
+            apply_delta(booster, model_delta(generate_model(8), 30))
+        with pytest.raises(LightGBMError, match='right_child'):
+            apply_delta(booster, corrupted)
+        with pytest.raises(LightGBMError, match="doesn't start with model_delta"):
+            apply_delta(booster, delta[delta.index('\n') + 1:])
+        with pytest.raises(LightGBMError, match='goes on from 60 trees'):
+            apply_delta(booster, model_delta(model_str, 60))
+        assert booster.predict(data).tobytes() == expected.tobytes()
+        # the booster takes a good delta after the failed ones
+        assert apply_delta(booster, delta) == 20
+
+
+def test_delta_errors(model_str):
+    with pytest.raises(LightGBMError, match='Cannot make a model delta from 31 trees'):
+        model_delta(model_str, 31)
+    with pytest.raises(LightGBMError, match='Cannot make a model delta from 63 trees'):
+        model_delta(model_str, 63)
+    with Booster(model_str, 'pack_model=true') as packed:
+        buf = save_packed(packed)
+    with load_packed(buf) as loaded:
+        with pytest.raises(LightGBMError, match='packed model'):
+            apply_delta(loaded, model_delta(model_str, 30))
+
+
+def test_delta_on_compacted_model(model_str, data):
+    # the first iteration splits on fewer features than the whole model, the delta adds the others
+    base_str = generate_model(7, num_iteration=1)
+    wide_data = widen_data(data)
+    with Booster(widen_model(base_str)) as wide, Booster(base_str) as narrow_base, Booster(model_str) as narrow:
+        base_features = used_features(wide)
+        assert len(base_features) < len(WIDE_FEATURES)
+        expected_base = narrow_base.predict(data)
+        np.testing.assert_array_equal(wide.predict(wide_data), expected_base)
+        apply_delta(wide, model_delta(widen_model(model_str), 3))
+        assert used_features(wide) == WIDE_FEATURES
+        np.testing.assert_array_equal(wide.predict(wide_data), narrow.predict(data))
+        np.testing.assert_array_equal(wide.predict(wide_data, C_API_PREDICT_CONTRIB),
+                                      widen_contrib(narrow.predict(data, C_API_PREDICT_CONTRIB), 3))
+        # and back to the first iteration
+        apply_delta(wide, model_delta(widen_model(base_str), 3))
+        assert used_features(wide) == base_features
+        np.testing.assert_array_equal(wide.predict(wide_data), expected_base)
+
+
+def test_delta_on_cached_model(model_str, small_model_str7, data, tmp_path):
+    # the booster of a cached model holds no trees to keep, also on the load that writes the file
+    with Booster(small_model_str7) as booster:
+        expected = booster.predict(data)
+    for _ in range(2):
+        with Booster(small_model_str7, 'model_cache_dir=%s' % tmp_path) as cached:
+            with pytest.raises(LightGBMError, match='Cannot apply a model delta to a packed model'):
+                apply_delta(cached, model_delta(model_str, 30))
+            np.testing.assert_array_equal(cached.predict(data), expected)
+
+
+def test_lineage_hash_of_packed_models(model_str, tmp_path):
+    with Booster(model_str) as booster, Booster(model_str, 'pack_model=true') as packed:
+        buf = save_packed(packed)
+        with load_packed(buf) as loaded, Booster(model_str, 'model_cache_dir=%s' % tmp_path) as cached:
+            for num_trees in (0, 30, 60):
+                assert lineage_hash(loaded, num_trees) == lineage_hash(booster, num_trees)
+                assert lineage_hash(cached, num_trees) == lineage_hash(booster, num_trees)
+
+
+def test_rescore_after_delta(model_str, small_model_str7, data):
+    with Booster(small_model_str7) as booster:
+        with Record(booster, data[0]) as record:
+            apply_delta(booster, model_delta(model_str, 30))
+            with pytest.raises(LightGBMError, match='initialize the record again'):
+                record.rescore({3: 1.0})
+        with Record(booster, data[0]) as record:
+            row = data[0].copy()
+            row[3] = 1.0
+            np.testing.assert_array_equal(record.rescore({3: 1.0}), booster.predict(row[np.newaxis, :])[0])
+
+
+# ---- ensembles
+
+class Ensemble(object):
+    def __init__(self, boosters, weights=None, predict_types=None, num_iterations=None):
+        self.handle = ctypes.c_void_p()
+        self.num_class = boosters[0].num_class
+        self.num_boosters = len(boosters)
+        handles = (ctypes.c_void_p * len(boosters))(*[booster.handle.value for booster in boosters])
+        safe_call(LIB.LGBM_EnsembleCreate(
+            handles, len(boosters),
+            None if weights is None else (ctypes.c_double * len(weights))(*weights),
+            None if predict_types is None else (ctypes.c_int * len(predict_types))(*predict_types),
+            None if num_iterations is None else (ctypes.c_int * len(num_iterations))(*num_iterations),
+            ctypes.byref(self.handle)))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        safe_call(LIB.LGBM_EnsembleFree(self.handle))
+
+    def predict(self, data):
+        """Predictions of every booster and the blend, one after the other for every row"""
+        data = np.ascontiguousarray(data, dtype=np.float64)
+        out = np.zeros(data.shape[0] * (self.num_boosters + 1) * self.num_class)
+        out_len = ctypes.c_int64(0)
+        safe_call(LIB.LGBM_EnsemblePredictForMat(self.handle, data.ctypes.data_as(ctypes.c_void_p),
+                                                 C_API_DTYPE_FLOAT64, data.shape[0], data.shape[1], 1, c_str(''),
+                                                 ctypes.byref(out_len), double_ptr(out)))
+        return out[:out_len.value].reshape(data.shape[0], self.num_boosters + 1, self.num_class)
+
+
+def test_ensemble_bit_identical(model_str, data):
+    other_str = generate_model(8, num_iteration=30)
+    with Booster(model_str) as first, Booster(other_str) as second:
+        with Ensemble([first, second], weights=[0.25, 0.75],
+                      predict_types=[C_API_PREDICT_NORMAL, C_API_PREDICT_RAW_SCORE],
+                      num_iterations=[-1, 12]) as ensemble:
+            pred = ensemble.predict(data)
+        np.testing.assert_array_equal(pred[:, 0], first.predict(data))
+        np.testing.assert_array_equal(pred[:, 1], reference_raw_score(other_str, data, 3, 12))
+        np.testing.assert_allclose(pred[:, 2], 0.25 * pred[:, 0] + 0.75 * pred[:, 1], rtol=1e-15, atol=1e-15)
+        # the same weight for every booster by default
+        with Ensemble([first, second]) as ensemble:
+            pred = ensemble.predict(data)
+        np.testing.assert_array_equal(pred[:, 1], second.predict(data))
+        np.testing.assert_allclose(pred[:, 2], 0.5 * pred[:, 0] + 0.5 * pred[:, 1], rtol=1e-15, atol=1e-15)
+
+
+def test_ensemble_packed_and_compiled(model_str, data):
+    with Booster(model_str) as booster, Booster(model_str, 'pack_model=true') as packed, \
+            Booster(model_str, 'compile_model=true') as compiled:
+        expected = booster.predict(data)
+        with Ensemble([booster, packed, compiled]) as ensemble:
+            pred = ensemble.predict(data)
+        for i in range(3):
+            np.testing.assert_array_equal(pred[:, i], expected)
+
+
+def test_ensemble_errors(model_str, data):
+    with Booster(model_str) as booster, Booster(generate_model(9, num_class=2)) as two_classes:
+        with pytest.raises(LightGBMError, match='already in the ensemble'):
+            Ensemble([booster, booster])
+        with pytest.raises(LightGBMError, match='only support'):
+            Ensemble([booster], predict_types=[C_API_PREDICT_LEAF_INDEX])
+        with pytest.raises(LightGBMError, match='at least one booster'):
+            safe_call(LIB.LGBM_EnsembleCreate(None, 0, None, None, None, ctypes.byref(ctypes.c_void_p())))
+        with Ensemble([booster, two_classes]) as ensemble:
+            with pytest.raises(LightGBMError, match='same number of classes'):
+                ensemble.predict(data)
+
+
+# ---- vectorized output transform
+
+def ulp_distance(a, b):
+    return np.abs(np.ascontiguousarray(a).view(np.int64) - np.ascontiguousarray(b).view(np.int64))
+
+
+def test_fast_transform_within_few_ulp(model_str, data):
+    raw = reference_raw_score(model_str, data, 3)
+    # the default transform is the softmax of the C library exp, summed in class order
+    exp = np.vectorize(math.exp)(raw - raw.max(axis=1, keepdims=True))
+    total = exp[:, 0] + exp[:, 1] + exp[:, 2]
+    with Booster(model_str) as booster:
+        default = booster.predict(data)
+        fast = booster.predict(data, params='pred_fast_transform=true')
+    np.testing.assert_array_equal(default, exp / total[:, np.newaxis])
+    # exp within 1 ulp moves the probabilities by at most 3 ulp through the sum and the division
+    assert ulp_distance(fast, default).max() <= 3
+    np.testing.assert_allclose(fast.sum(axis=1), 1.0, rtol=1e-15)
+
+
+def test_fast_transform_blocks(model_str, data):
+    with Booster(model_str) as booster:
+        fast = booster.predict(data, params='pred_fast_transform=true')
+        # rows transformed in a partial block or alone come out the same
+        for begin, end in ((0, 1), (3, 10), (17, 300)):
+            np.testing.assert_array_equal(booster.predict(data[begin:end], params='pred_fast_transform=true'),
+                                          fast[begin:end])
+        # raw scores and other prediction types are not transformed
+        with Booster(generate_model(7, objective=False)) as raw_booster:
+            np.testing.assert_array_equal(raw_booster.predict(data, params='pred_fast_transform=true'),
+                                          raw_booster.predict(data))
+        np.testing.assert_array_equal(booster.predict(data, C_API_PREDICT_LEAF_INDEX,
+                                                      params='pred_fast_transform=true'),
+                                      booster.predict(data, C_API_PREDICT_LEAF_INDEX))
+
+
+def test_fast_transform_same_on_every_isa(model_str, data, tmp_path):
+    script = ('import sys, numpy as np, test_predict as t\n'
+              'with t.Booster(t.generate_model(7)) as booster:\n'
+              '    np.save(sys.argv[1], booster.predict(t.generate_data(11, 300), params="pred_fast_transform=true"))\n')
+    with Booster(model_str) as booster:
+        expected = booster.predict(data, params='pred_fast_transform=true')
+    env = dict(os.environ, PYTHONPATH=os.path.dirname(os.path.abspath(__file__)))
+    for isa in ('generic', 'sse4.2', 'avx2', 'avx512'):
+        env['LIGHTGBM_ISA'] = isa
+        out = str(tmp_path / ('%s.npy' % isa))
+        subprocess.check_call([sys.executable, '-c', script, out], env=env)
+        np.testing.assert_array_equal(np.load(out), expected)
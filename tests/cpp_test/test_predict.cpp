@@ -0,0 +1,659 @@
+/*!
+* Tests of prediction through the C API, built with -DBUILD_CPP_TEST=ON and run by ctest.
+* The models are generated, every engine and mode is checked against the plain prediction of the trees.
+*/
+#include <LightGBM/c_api.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int num_failures = 0;
+
+#define EXPECT(cond) \
+  do { \
+    if (!(cond)) { \
+      std::fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+      ++num_failures; \
+    } \
+  } while (0)
+
+#define EXPECT_OK(call) \
+  do { \
+    if ((call) != 0) { \
+      std::fprintf(stderr, "%s:%d: %s failed: %s\n", __FILE__, __LINE__, #call, LGBM_GetLastError()); \
+      ++num_failures; \
+    } \
+  } while (0)
+
+#define EXPECT_ERROR(call, message) \
+  do { \
+    if ((call) == 0) { \
+      std::fprintf(stderr, "%s:%d: %s should fail\n", __FILE__, __LINE__, #call); \
+      ++num_failures; \
+    } else if (std::strstr(LGBM_GetLastError(), message) == 0) { \
+      std::fprintf(stderr, "%s:%d: unexpected error of %s: %s\n", __FILE__, __LINE__, #call, LGBM_GetLastError()); \
+      ++num_failures; \
+    } \
+  } while (0)
+
+const int kNumFeature = 12;
+const int kCatFeature = 2;
+
+/*! \brief Random model text with numerical splits of every missing type and categorical splits on kCatFeature */
+std::string GenerateModel(unsigned int seed, int num_class, int num_iteration, bool objective) {
+  std::mt19937 rnd(seed);
+  std::uniform_real_distribution<double> value(-1.0, 1.0);
+  std::stringstream trees;
+  trees.precision(17);
+  std::vector<size_t> tree_sizes;
+  for (int t = 0; t < num_class * num_iteration; ++t) {
+    const int num_leaves = 1 + static_cast<int>(rnd() % 12);
+    std::vector<int> left, right, feature, decision_type, leaf_parent(1, -1);
+    std::vector<double> threshold, leaf_value(1, value(rnd));
+    std::vector<int> cat_boundaries(1, 0);
+    std::vector<unsigned int> cat_threshold;
+    for (int node = 0; node < num_leaves - 1; ++node) {
+      const int leaf = static_cast<int>(rnd() % leaf_value.size());
+      const int parent = leaf_parent[leaf];
+      if (parent >= 0) {
+        (left[parent] == ~leaf ? left[parent] : right[parent]) = node;
+      }
+      feature.push_back(static_cast<int>(rnd() % kNumFeature));
+      if (feature.back() == kCatFeature) {
+        threshold.push_back(static_cast<double>(cat_boundaries.size() - 1));
+        cat_threshold.push_back(static_cast<unsigned int>(rnd()));
+        cat_boundaries.push_back(cat_boundaries.back() + 1);
+        decision_type.push_back(1);
+      } else {
+        const double thresholds[] = { value(rnd) * 2, 1e-35, 0.5, 0.0 };
+        threshold.push_back(thresholds[rnd() % 4]);
+        decision_type.push_back(static_cast<int>((rnd() % 3) << 2 | (rnd() % 2) << 1));
+      }
+      left.push_back(~leaf);
+      right.push_back(~static_cast<int>(leaf_value.size()));
+      leaf_parent[leaf] = node;
+      leaf_parent.push_back(node);
+      leaf_value[leaf] = value(rnd);
+      leaf_value.push_back(value(rnd));
+    }
+    std::stringstream tree;
+    tree.precision(17);
+    tree << "Tree=" << t << "\nnum_leaves=" << num_leaves << "\nnum_cat=" << cat_boundaries.size() - 1 << "\n";
+    if (num_leaves > 1) {
+      tree << "split_feature=";
+      for (size_t i = 0; i < feature.size(); ++i) { tree << (i ? " " : "") << feature[i]; }
+      tree << "\nthreshold=";
+      for (size_t i = 0; i < threshold.size(); ++i) { tree << (i ? " " : "") << threshold[i]; }
+      tree << "\ndecision_type=";
+      for (size_t i = 0; i < decision_type.size(); ++i) { tree << (i ? " " : "") << decision_type[i]; }
+      tree << "\nleft_child=";
+      for (size_t i = 0; i < left.size(); ++i) { tree << (i ? " " : "") << left[i]; }
+      tree << "\nright_child=";
+      for (size_t i = 0; i < right.size(); ++i) { tree << (i ? " " : "") << right[i]; }
+      tree << "\n";
+    }
+    tree << "leaf_value=";
+    for (size_t i = 0; i < leaf_value.size(); ++i) { tree << (i ? " " : "") << leaf_value[i]; }
+    tree << "\n";
+    if (num_leaves > 1) {
+      // every leaf saw the same data, the children of a node come after it
+      std::vector<int> internal_count(left.size());
+      for (int node = static_cast<int>(left.size()) - 1; node >= 0; --node) {
+        internal_count[node] = (left[node] < 0 ? 10 : internal_count[left[node]])
+                               + (right[node] < 0 ? 10 : internal_count[right[node]]);
+      }
+      tree << "leaf_count=";
+      for (size_t i = 0; i < leaf_value.size(); ++i) { tree << (i ? " " : "") << 10; }
+      tree << "\ninternal_count=";
+      for (size_t i = 0; i < internal_count.size(); ++i) { tree << (i ? " " : "") << internal_count[i]; }
+      tree << "\n";
+      if (cat_boundaries.size() > 1) {
+        tree << "cat_boundaries=";
+        for (size_t i = 0; i < cat_boundaries.size(); ++i) { tree << (i ? " " : "") << cat_boundaries[i]; }
+        tree << "\ncat_threshold=";
+        for (size_t i = 0; i < cat_threshold.size(); ++i) { tree << (i ? " " : "") << cat_threshold[i]; }
+        tree << "\n";
+      }
+    }
+    tree << "shrinkage=0.1\n\n";
+    tree_sizes.push_back(tree.str().size());
+    trees << tree.str();
+  }
+  std::stringstream model;
+  model << "tree\nversion=v2\nnum_class=" << num_class << "\nnum_tree_per_iteration=" << num_class
+        << "\nlabel_index=0\nmax_feature_idx=" << kNumFeature - 1 << "\n";
+  if (objective) {
+    model << "objective=multiclass num_class:" << num_class << "\n";
+  }
+  model << "feature_names=";
+  for (int i = 0; i < kNumFeature; ++i) { model << (i ? " " : "") << "Column_" << i; }
+  model << "\nfeature_infos=";
+  for (int i = 0; i < kNumFeature; ++i) { model << (i ? " " : "") << "[-2:2]"; }
+  model << "\n";
+  model << "tree_sizes=";
+  for (size_t i = 0; i < tree_sizes.size(); ++i) { model << (i ? " " : "") << tree_sizes[i]; }
+  model << "\n\n" << trees.str() << "end of trees\n";
+  return model.str();
+}
+
+/*! \brief Row major rows with zeros, missing values and categories */
+std::vector<double> GenerateData(unsigned int seed, int num_row) {
+  std::mt19937 rnd(seed);
+  std::uniform_real_distribution<double> value(-2.0, 2.0);
+  std::vector<double> data(static_cast<size_t>(num_row) * kNumFeature);
+  for (size_t i = 0; i < data.size(); ++i) {
+    const unsigned int kind = rnd() % 10;
+    data[i] = kind == 0 ? 0.0 : (kind == 1 ? NAN : value(rnd));
+    if (i % kNumFeature == kCatFeature) {
+      data[i] = static_cast<double>(rnd() % 32);
+    }
+  }
+  return data;
+}
+
+BoosterHandle Load(const std::string& model, const char* parameters) {
+  BoosterHandle handle = 0;
+  int num_iteration = 0;
+  EXPECT_OK(LGBM_BoosterLoadModelFromStringWithParams(model.c_str(), parameters, &num_iteration, &handle));
+  return handle;
+}
+
+std::vector<double> Predict(BoosterHandle handle, const std::vector<double>& data, const char* parameters) {
+  const int num_row = static_cast<int>(data.size() / kNumFeature);
+  int64_t num_predict = 0;
+  EXPECT_OK(LGBM_BoosterCalcNumPredict(handle, num_row, C_API_PREDICT_NORMAL, -1, &num_predict));
+  std::vector<double> out(static_cast<size_t>(num_predict));
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterPredictForMat(handle, data.data(), C_API_DTYPE_FLOAT64, num_row, kNumFeature, 1,
+                                      C_API_PREDICT_NORMAL, -1, parameters, &out_len, out.data()));
+  EXPECT(out_len == num_predict);
+  return out;
+}
+
+/*! \brief True if both have the same bits, NaN included */
+bool Identical(const std::vector<double>& a, const std::vector<double>& b) {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0;
+}
+
+void TestArenaLoad() {
+  const std::string model = GenerateModel(1, 3, 10, true);
+  const std::vector<double> data = GenerateData(2, 200);
+  BoosterHandle booster = Load(model, "");
+  BoosterHandle huge_pages = Load(model, "model_huge_pages=true");
+  if (booster == 0 || huge_pages == 0) {
+    return;
+  }
+  EXPECT(Identical(Predict(booster, data, ""), Predict(huge_pages, data, "")));
+  EXPECT_OK(LGBM_BoosterFree(huge_pages));
+  // a malformed tree fails the load, the process goes on
+  std::string bad = model;
+  bad.replace(bad.find("right_child=", bad.find("Tree=4")), 12, "rigth_child=");
+  BoosterHandle bad_booster = 0;
+  int num_iteration = 0;
+  EXPECT_ERROR(LGBM_BoosterLoadModelFromStringWithParams(bad.c_str(), "", &num_iteration, &bad_booster),
+               "right_child");
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestPacked() {
+  const std::string model = GenerateModel(3, 3, 10, true);
+  const std::vector<double> data = GenerateData(4, 200);
+  BoosterHandle booster = Load(model, "");
+  BoosterHandle packed = Load(model, "pack_model=true");
+  if (booster == 0 || packed == 0) {
+    return;
+  }
+  const std::vector<double> expected = Predict(booster, data, "");
+  EXPECT(Identical(Predict(packed, data, ""), expected));
+  int64_t len = 0;
+  EXPECT_OK(LGBM_BoosterSavePackedModel(packed, 0, &len, 0));
+  std::vector<char> buffer(static_cast<size_t>(len));
+  EXPECT_OK(LGBM_BoosterSavePackedModel(packed, len, &len, buffer.data()));
+  BoosterHandle loaded = 0;
+  int num_iteration = 0;
+  EXPECT_OK(LGBM_BoosterLoadPackedModel(buffer.data(), len, &num_iteration, &loaded));
+  if (loaded != 0) {
+    EXPECT(Identical(Predict(loaded, data, ""), expected));
+    EXPECT_OK(LGBM_BoosterFree(loaded));
+  }
+  EXPECT_ERROR(LGBM_BoosterLoadPackedModel(buffer.data(), len / 2, &num_iteration, &loaded), "size mismatch");
+  EXPECT_ERROR(LGBM_BoosterSavePackedModel(booster, 0, &len, 0), "pack_model=true");
+  EXPECT_OK(LGBM_BoosterFree(packed));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestCompiled() {
+  const std::string model = GenerateModel(5, 3, 10, true);
+  const std::vector<double> data = GenerateData(6, 200);
+  BoosterHandle booster = Load(model, "");
+  BoosterHandle compiled = Load(model, "compile_model=true");
+  BoosterHandle fallback = Load(model, "compile_model=true model_compiler=no_such_compiler_xyz");
+  if (booster == 0 || compiled == 0 || fallback == 0) {
+    return;
+  }
+  const std::vector<double> expected = Predict(booster, data, "");
+  EXPECT(Identical(Predict(compiled, data, ""), expected));
+  EXPECT(Identical(Predict(fallback, data, ""), expected));
+  EXPECT_OK(LGBM_BoosterFree(fallback));
+  EXPECT_OK(LGBM_BoosterFree(compiled));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+std::string PredictPlan(BoosterHandle handle) {
+  int64_t len = 0;
+  EXPECT_OK(LGBM_BoosterGetPredictPlan(handle, 0, &len, 0));
+  std::vector<char> plan(static_cast<size_t>(len) + 1);
+  EXPECT_OK(LGBM_BoosterGetPredictPlan(handle, len, &len, plan.data()));
+  return std::string(plan.data());
+}
+
+void TestPredictPlan() {
+  const std::string model = GenerateModel(5, 3, 10, true);
+  BoosterHandle compiled = Load(model, "compile_model=true");
+  BoosterHandle fallback = Load(model, "compile_model=true model_compiler=no_such_compiler_xyz");
+  if (compiled == 0 || fallback == 0) {
+    return;
+  }
+  EXPECT(PredictPlan(compiled).find("compiled") != std::string::npos);
+  EXPECT(PredictPlan(fallback).find("compiled") == std::string::npos);
+  EXPECT_ERROR(LGBM_BoosterSetPredictPlan(compiled, "1:forest:0:1"), "Unknown engine");
+  EXPECT_OK(LGBM_BoosterSetPredictPlan(compiled, "1:trees:0:1"));
+  EXPECT(PredictPlan(compiled).find("1:trees:0:1") == 0);
+  EXPECT_OK(LGBM_BoosterFree(fallback));
+  EXPECT_OK(LGBM_BoosterFree(compiled));
+}
+
+void TestRescore() {
+  std::vector<double> row = GenerateData(24, 1);
+  BoosterHandle booster = Load(GenerateModel(23, 3, 5, true), "");
+  if (booster == 0) {
+    return;
+  }
+  RescoreHandle record = 0;
+  std::vector<double> out(3);
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterRescoreInit(booster, row.data(), C_API_DTYPE_FLOAT64, kNumFeature, -1, &record, &out_len,
+                                    out.data()));
+  EXPECT(Identical(out, Predict(booster, row, "")));
+  const int32_t features[] = { 0, 7 };
+  const double values[] = { 0.25, -1.5 };
+  row[0] = values[0];
+  row[7] = values[1];
+  EXPECT_OK(LGBM_BoosterRescore(record, features, values, C_API_DTYPE_FLOAT64, 2, &out_len, out.data()));
+  EXPECT(Identical(out, Predict(booster, row, "")));
+  EXPECT_OK(LGBM_RescoreFree(record));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestClassSubset() {
+  const std::string model = GenerateModel(7, 3, 10, false);
+  const std::vector<double> data = GenerateData(8, 200);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  const std::vector<double> all = Predict(booster, data, "");
+  std::vector<double> expected;
+  for (size_t i = 0; i < all.size(); i += 3) {
+    expected.push_back(all[i + 2]);
+    expected.push_back(all[i]);
+  }
+  std::vector<double> out(all.size());
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterPredictForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 200, kNumFeature, 1,
+                                      C_API_PREDICT_NORMAL, -1, "pred_classes=2,0", &out_len, out.data()));
+  out.resize(static_cast<size_t>(out_len));
+  EXPECT(Identical(out, expected));
+  EXPECT_ERROR(LGBM_BoosterPredictForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 200, kNumFeature, 1,
+                                         C_API_PREDICT_NORMAL, -1, "pred_classes=3", &out_len, out.data()),
+               "out of range");
+  // the model has no objective, its raw scores are not meant for softmax
+  EXPECT_ERROR(LGBM_BoosterPredictForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 200, kNumFeature, 1,
+                                         C_API_PREDICT_NORMAL, -1, "pred_classes=0,1 pred_normalize_classes=true",
+                                         &out_len, out.data()),
+               "multiclass objective");
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+/*! \brief Contributions of every row and class, summed per row and class */
+std::vector<double> ContribSums(BoosterHandle handle, const std::vector<double>& data, const char* parameters) {
+  const int num_row = static_cast<int>(data.size() / kNumFeature);
+  int64_t num_predict = 0;
+  EXPECT_OK(LGBM_BoosterCalcNumPredict(handle, num_row, C_API_PREDICT_CONTRIB, -1, &num_predict));
+  std::vector<double> contrib(static_cast<size_t>(num_predict));
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterPredictForMat(handle, data.data(), C_API_DTYPE_FLOAT64, num_row, kNumFeature, 1,
+                                      C_API_PREDICT_CONTRIB, -1, parameters, &out_len, contrib.data()));
+  std::vector<double> sums;
+  for (size_t i = 0; i < contrib.size(); i += kNumFeature + 1) {
+    double sum = 0.0;
+    for (int j = 0; j <= kNumFeature; ++j) {
+      sum += contrib[i + j];
+    }
+    sums.push_back(sum);
+  }
+  return sums;
+}
+
+bool Close(const std::vector<double>& a, const std::vector<double>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (!(std::fabs(a[i] - b[i]) <= 1e-9 * std::fabs(b[i]) + 1e-12)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TestTreeSHAP() {
+  const std::string model = GenerateModel(9, 3, 10, false);
+  const std::vector<double> data = GenerateData(10, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  // the contributions add up to the raw score
+  EXPECT(Close(ContribSums(booster, data, ""), Predict(booster, data, "")));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestSaabas() {
+  const std::string model = GenerateModel(9, 3, 10, false);
+  const std::vector<double> data = GenerateData(10, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  const std::vector<double> raw = Predict(booster, data, "");
+  EXPECT(Close(ContribSums(booster, data, "contrib_method=tree_shap"), raw));
+  EXPECT(Close(ContribSums(booster, data, "contrib_method=saabas"), raw));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestInterventional() {
+  const std::string model = GenerateModel(9, 3, 10, false);
+  const std::vector<double> data = GenerateData(10, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  const std::vector<double> raw = Predict(booster, data, "");
+  int64_t out_len = 0;
+  std::vector<double> contrib(data.size() / kNumFeature * 3 * (kNumFeature + 1));
+  EXPECT_ERROR(LGBM_BoosterPredictForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                         C_API_PREDICT_CONTRIB, -1, "contrib_method=interventional", &out_len,
+                                         contrib.data()),
+               "need a background");
+  const std::vector<double> background = GenerateData(11, 50);
+  EXPECT_OK(LGBM_BoosterSetContribBackground(booster, background.data(), C_API_DTYPE_FLOAT64, 50, kNumFeature, 1));
+  EXPECT(Close(ContribSums(booster, data, "contrib_method=interventional"), raw));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestSparseContrib() {
+  const std::string model = GenerateModel(9, 3, 10, false);
+  const std::vector<double> data = GenerateData(10, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  // the top contributions of every record and class, and the expected value
+  int64_t out_len = 0;
+  int64_t* indptr = 0;
+  int32_t* indices = 0;
+  double* values = 0;
+  EXPECT_OK(LGBM_BoosterPredictSparseContribForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                                   -1, "contrib_top_k=3", &out_len, &indptr, &indices, &values));
+  if (indptr != 0) {
+    for (int row = 0; row < 100 * 3; ++row) {
+      EXPECT(indptr[row + 1] - indptr[row] <= 4);
+      EXPECT(indices[indptr[row + 1] - 1] == kNumFeature);
+    }
+    EXPECT(indptr[100 * 3] == out_len);
+    EXPECT_OK(LGBM_BoosterFreeSparseContrib(indptr, indices, values));
+  }
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestLeafIndex() {
+  const std::string model = GenerateModel(13, 3, 10, true);
+  const std::vector<double> data = GenerateData(14, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  int64_t num_predict = 0;
+  EXPECT_OK(LGBM_BoosterCalcNumPredict(booster, 100, C_API_PREDICT_LEAF_INDEX, -1, &num_predict));
+  std::vector<int32_t> leaves32(static_cast<size_t>(num_predict));
+  std::vector<int16_t> leaves16(static_cast<size_t>(num_predict));
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterPredictLeafIndexForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1, -1, "",
+                                               C_API_DTYPE_INT32, &out_len, leaves32.data()));
+  EXPECT(out_len == num_predict);
+  EXPECT_OK(LGBM_BoosterPredictLeafIndexForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1, -1, "",
+                                               C_API_DTYPE_INT16, &out_len, leaves16.data()));
+  EXPECT(std::equal(leaves32.begin(), leaves32.end(), leaves16.begin()));
+  EXPECT_ERROR(LGBM_BoosterPredictLeafIndexForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1, -1,
+                                                  "", C_API_DTYPE_FLOAT64, &out_len, leaves32.data()),
+               "Unknown leaf index type");
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestStaged() {
+  const std::string model = GenerateModel(15, 3, 10, true);
+  const std::vector<double> data = GenerateData(16, 100);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  const int32_t checkpoints[] = { 2, 5, 10 };
+  std::vector<double> staged(100 * 3 * 3);
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterPredictStagedForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                            C_API_PREDICT_NORMAL, checkpoints, 3, "", &out_len, staged.data()));
+  EXPECT(out_len == static_cast<int64_t>(staged.size()));
+  std::vector<double> range(staged.size());
+  EXPECT_OK(LGBM_BoosterPredictStagedRangeForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                                 C_API_PREDICT_NORMAL, 4, 6, "", &out_len, range.data()));
+  for (int k = 0; k < 3; ++k) {
+    std::vector<double> expected(100 * 3);
+    EXPECT_OK(LGBM_BoosterPredictForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                        C_API_PREDICT_NORMAL, checkpoints[k], "", &out_len, expected.data()));
+    std::vector<double> stage, range_stage;
+    for (int row = 0; row < 100; ++row) {
+      stage.insert(stage.end(), staged.begin() + (row * 3 + k) * 3, staged.begin() + (row * 3 + k + 1) * 3);
+      // the range predicts at iterations 4, 5 and 6, the second is the checkpoint at 5
+      if (k == 1) {
+        range_stage.insert(range_stage.end(), range.begin() + (row * 3 + 1) * 3, range.begin() + (row * 3 + 2) * 3);
+      }
+    }
+    EXPECT(Identical(stage, expected));
+    if (k == 1) {
+      EXPECT(Identical(range_stage, expected));
+    }
+  }
+  const int32_t decreasing[] = { 5, 2 };
+  EXPECT_ERROR(LGBM_BoosterPredictStagedForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                               C_API_PREDICT_NORMAL, decreasing, 2, "", &out_len, staged.data()),
+               "positive and increasing");
+  EXPECT_ERROR(LGBM_BoosterPredictStagedRangeForMat(booster, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                                    C_API_PREDICT_NORMAL, 9, 11, "", &out_len, range.data()),
+               "the model has 10 iterations");
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestScoreCache() {
+  // the trees are generated one after the other, the first 5 iterations of both models are the same
+  const std::vector<double> data = GenerateData(18, 100);
+  BoosterHandle small = Load(GenerateModel(17, 3, 5, true), "");
+  BoosterHandle full = Load(GenerateModel(17, 3, 10, true), "");
+  if (small == 0 || full == 0) {
+    return;
+  }
+  ScoreCacheHandle cache = 0;
+  EXPECT_OK(LGBM_ScoreCacheCreate(data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1, &cache));
+  std::vector<double> out(100 * 3);
+  int64_t out_len = 0;
+  int num_new_trees = 0;
+  EXPECT_OK(LGBM_BoosterUpdateScoreCache(small, cache, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                         C_API_PREDICT_NORMAL, "", &num_new_trees, &out_len, out.data()));
+  EXPECT(num_new_trees == 15);
+  EXPECT(Identical(out, Predict(small, data, "")));
+  EXPECT_OK(LGBM_BoosterUpdateScoreCache(full, cache, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1,
+                                         C_API_PREDICT_NORMAL, "", &num_new_trees, &out_len, out.data()));
+  EXPECT(num_new_trees == 15);
+  EXPECT(Identical(out, Predict(full, data, "")));
+  EXPECT_ERROR(LGBM_BoosterUpdateScoreCache(full, cache, data.data(), C_API_DTYPE_FLOAT64, 99, kNumFeature, 1,
+                                            C_API_PREDICT_NORMAL, "", &num_new_trees, &out_len, out.data()),
+               "data differs");
+  EXPECT_OK(LGBM_ScoreCacheFree(cache));
+  EXPECT_OK(LGBM_BoosterFree(full));
+  EXPECT_OK(LGBM_BoosterFree(small));
+}
+
+std::string ModelDelta(const std::string& model, int base_num_trees) {
+  int64_t len = 0;
+  EXPECT_OK(LGBM_ModelDeltaCreate(model.c_str(), base_num_trees, 0, &len, 0));
+  std::vector<char> delta(static_cast<size_t>(len) + 1);
+  EXPECT_OK(LGBM_ModelDeltaCreate(model.c_str(), base_num_trees, len, &len, delta.data()));
+  return std::string(delta.data());
+}
+
+void TestModelDelta() {
+  // the trees are generated one after the other, the first 5 iterations of both models are the same
+  const std::string full_model = GenerateModel(19, 3, 10, true);
+  const std::vector<double> data = GenerateData(20, 100);
+  BoosterHandle booster = Load(GenerateModel(19, 3, 5, true), "");
+  BoosterHandle full = Load(full_model, "");
+  if (booster == 0 || full == 0) {
+    return;
+  }
+  const std::vector<double> small_pred = Predict(booster, data, "");
+  int num_iteration = 0;
+  const std::string other_delta = ModelDelta(GenerateModel(21, 3, 10, true), 15);
+  EXPECT_ERROR(LGBM_BoosterApplyModelDelta(booster, other_delta.c_str(), &num_iteration), "not made for");
+  EXPECT(Identical(Predict(booster, data, ""), small_pred));
+  EXPECT_OK(LGBM_BoosterApplyModelDelta(booster, ModelDelta(full_model, 15).c_str(), &num_iteration));
+  EXPECT(num_iteration == 10);
+  EXPECT(Identical(Predict(booster, data, ""), Predict(full, data, "")));
+  EXPECT_OK(LGBM_BoosterFree(full));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestRescoreAfterDelta() {
+  const std::string full_model = GenerateModel(23, 3, 10, true);
+  const std::vector<double> row = GenerateData(24, 1);
+  BoosterHandle booster = Load(GenerateModel(23, 3, 5, true), "");
+  if (booster == 0) {
+    return;
+  }
+  RescoreHandle record = 0;
+  std::vector<double> out(3);
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_BoosterRescoreInit(booster, row.data(), C_API_DTYPE_FLOAT64, kNumFeature, -1, &record, &out_len,
+                                    out.data()));
+  const int32_t features[] = { 0, 7 };
+  const double values[] = { 0.25, -1.5 };
+  int num_iteration = 0;
+  EXPECT_OK(LGBM_BoosterApplyModelDelta(booster, ModelDelta(full_model, 15).c_str(), &num_iteration));
+  EXPECT_ERROR(LGBM_BoosterRescore(record, features, values, C_API_DTYPE_FLOAT64, 2, &out_len, out.data()),
+               "initialize the record again");
+  EXPECT_OK(LGBM_RescoreFree(record));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+void TestEnsemble() {
+  const std::vector<double> data = GenerateData(26, 100);
+  BoosterHandle boosters[2] = { Load(GenerateModel(25, 3, 10, true), ""),
+                                Load(GenerateModel(27, 3, 8, true), "pack_model=true") };
+  if (boosters[0] == 0 || boosters[1] == 0) {
+    return;
+  }
+  const double weights[] = { 0.25, 0.75 };
+  EnsembleHandle ensemble = 0;
+  EXPECT_OK(LGBM_EnsembleCreate(boosters, 2, weights, 0, 0, &ensemble));
+  std::vector<double> out(100 * 3 * 3);
+  int64_t out_len = 0;
+  EXPECT_OK(LGBM_EnsemblePredictForMat(ensemble, data.data(), C_API_DTYPE_FLOAT64, 100, kNumFeature, 1, "", &out_len,
+                                       out.data()));
+  EXPECT(out_len == static_cast<int64_t>(out.size()));
+  for (int m = 0; m < 2; ++m) {
+    std::vector<double> part;
+    for (int row = 0; row < 100; ++row) {
+      part.insert(part.end(), out.begin() + (row * 3 + m) * 3, out.begin() + (row * 3 + m + 1) * 3);
+    }
+    EXPECT(Identical(part, Predict(boosters[m], data, "")));
+  }
+  EXPECT_OK(LGBM_EnsembleFree(ensemble));
+  const BoosterHandle twice[] = { boosters[0], boosters[0] };
+  EXPECT_ERROR(LGBM_EnsembleCreate(twice, 2, 0, 0, 0, &ensemble), "already in the ensemble");
+  EXPECT_OK(LGBM_BoosterFree(boosters[1]));
+  EXPECT_OK(LGBM_BoosterFree(boosters[0]));
+}
+
+/*! \brief Largest distance of two vectors of the same size in units in the last place */
+int64_t MaxUlpDistance(const std::vector<double>& a, const std::vector<double>& b) {
+  int64_t max_distance = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    int64_t x = 0;
+    int64_t y = 0;
+    std::memcpy(&x, &a[i], sizeof(x));
+    std::memcpy(&y, &b[i], sizeof(y));
+    max_distance = std::max(max_distance, x > y ? x - y : y - x);
+  }
+  return max_distance;
+}
+
+void TestFastTransform() {
+  const std::string model = GenerateModel(29, 3, 10, true);
+  const std::vector<double> data = GenerateData(30, 1000);
+  BoosterHandle booster = Load(model, "");
+  if (booster == 0) {
+    return;
+  }
+  const std::vector<double> fast = Predict(booster, data, "pred_fast_transform=true");
+  EXPECT(MaxUlpDistance(fast, Predict(booster, data, "")) <= 3);
+  // a single row is transformed alone, the last rows in a partial block
+  const std::vector<double> first_row(data.begin(), data.begin() + kNumFeature);
+  EXPECT(Identical(Predict(booster, first_row, "pred_fast_transform=true"),
+                   std::vector<double>(fast.begin(), fast.begin() + 3)));
+  EXPECT_OK(LGBM_BoosterFree(booster));
+}
+
+}  // namespace
+
+int main() {
+  TestArenaLoad();
+  TestPacked();
+  TestCompiled();
+  TestPredictPlan();
+  TestRescore();
+  TestClassSubset();
+  TestTreeSHAP();
+  TestSaabas();
+  TestInterventional();
+  TestSparseContrib();
+  TestLeafIndex();
+  TestStaged();
+  TestScoreCache();
+  TestModelDelta();
+  TestRescoreAfterDelta();
+  TestEnsemble();
+  TestFastTransform();
+  if (num_failures > 0) {
+    std::fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  std::printf("All checks passed\n");
+  return 0;
+}